@@ -0,0 +1,1067 @@
+/********************************************************
+ * Description : open loop load generator of redis db
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <list>
+#include <thread>
+#include <iostream>
+#include "hiredis.h"
+#include "hircluster.h"
+#include "hihistogram.h"
+#include "libredis.h"
+
+#define KEY_PREFIX  "libredis:loadgen:"
+
+enum LoadOp
+{
+    load_op_read = 0,                                               /* GET */
+    load_op_write,                                                  /* SET */
+    load_op_queue,                                                  /* RPUSH and LPOP taking turns */
+    load_op_count
+};
+
+static const char * s_op_names[load_op_count] = { "read", "write", "queue" };
+
+enum KeyDistributionKind
+{
+    key_distribution_uniform = 0,
+    key_distribution_zipf,
+    key_distribution_hotspot
+};
+
+struct ValueSize
+{
+    uint32_t                            size;
+    uint32_t                            weight;
+};
+
+struct LoadConfig
+{
+    std::string                         address;
+    std::string                         username;
+    std::string                         password;
+    uint32_t                            threads;
+    uint32_t                            duration;                   /* seconds */
+    uint32_t                            rate;                       /* target ops per second of all threads, 0 for closed loop */
+    bool                                poisson;                    /* exponential gaps between requests instead of fixed ones */
+    uint32_t                            depth;                      /* requests of a pipeline round */
+    uint32_t                            keys;                       /* size of the key space */
+    KeyDistributionKind                 distribution;
+    double                              zipf_theta;                 /* skew of zipf, between 0 and 1 */
+    double                              hot_keys;                   /* fraction of the key space that is hot */
+    double                              hot_share;                  /* fraction of the requests that hit hot keys */
+    uint32_t                            mix[load_op_count];         /* weights of the operations */
+    std::vector<ValueSize>              value_sizes;                /* weighted sizes, or one range picked from uniformly */
+    bool                                value_range;
+    bool                                fill;                       /* write the key space before the run */
+    bool                                clean;                      /* erase keys and queues after the run */
+};
+
+/*
+ * zipf over the ranks of the key space after gray et al., "quickly
+ * generating billion-record synthetic databases", as used by ycsb,
+ * zeta is computed once and shared by the threads
+ */
+struct KeyDistribution
+{
+    KeyDistributionKind                 kind;
+    uint32_t                            keys;
+    uint32_t                            hot_count;
+    double                              hot_share;
+    double                              theta;
+    double                              alpha;
+    double                              zeta_n;
+    double                              eta;
+};
+
+struct LoadRequest
+{
+    LoadOp                              op;
+    uint32_t                            key;
+    uint32_t                            value_size;
+    uint64_t                            intended_ns;                /* when the schedule wanted it sent */
+    uint64_t                            done_ns;
+    bool                                ok;
+};
+
+struct LoadWorker
+{
+    RedisDB                             redis_db;
+    redisContext                      * context;                    /* pipelines against a standalone server */
+    redisClusterContext               * cluster_context;            /* pipelines against a cluster */
+    uint32_t                            index;
+    std::mt19937_64                     random;
+    bool                                queue_push;                 /* next queue operation pushes */
+    uint64_t                            ops[load_op_count];
+    uint64_t                            errors[load_op_count];
+    hihistogram                       * latency[load_op_count];     /* nanoseconds from the intended start, waiting in the client included */
+    hihistogram                       * service[load_op_count];     /* nanoseconds from the actual send */
+    uint64_t                            max_lag_ns;                 /* worst delay of a send behind its schedule */
+};
+
+static uint64_t get_time_ns()
+{
+    return (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+static void split_string(const std::string & str, char separator, std::vector<std::string> & items)
+{
+    items.clear();
+    std::string::size_type beg = 0;
+    while (beg <= str.size())
+    {
+        std::string::size_type end = str.find(separator, beg);
+        if (std::string::npos == end)
+        {
+            end = str.size();
+        }
+        if (end > beg)
+        {
+            items.push_back(str.substr(beg, end - beg));
+        }
+        beg = end + 1;
+    }
+}
+
+static void usage(const char * program)
+{
+    printf("usage: %s --address host:port[,host:port...] [options]\n", program);
+    printf("  --username name --password pass      credentials of --address\n");
+    printf("  --threads n                          (default 4)\n");
+    printf("  --duration seconds                   (default 10)\n");
+    printf("  --rate n                             target ops/s of all threads, 0 for closed loop (default 10000)\n");
+    printf("  --arrival poisson|fixed              gaps between scheduled requests (default poisson)\n");
+    printf("  --depth n                            requests of a pipeline round, 1 sends through redis db (default 1)\n");
+    printf("  --keys n                             key space (default 100000)\n");
+    printf("  --distribution zipf|uniform|hotspot  (default zipf)\n");
+    printf("  --zipf-theta x                       skew of zipf, 0 < x < 1 (default 0.99)\n");
+    printf("  --hot-keys x --hot-share x           hotspot: fraction x of the keys gets fraction x of the requests (default 0.2 0.8)\n");
+    printf("  --mix read,write,queue               weights of the operations (default 80,15,5)\n");
+    printf("  --value-sizes spec                   n, min-max or n:weight[,n:weight...] bytes (default 64)\n");
+    printf("  --fill 0|1                           write the key space before the run (default 1)\n");
+    printf("  --clean 0|1                          erase keys and queues after the run (default 1)\n");
+}
+
+static bool parse_value_sizes(const std::string & spec, LoadConfig & config)
+{
+    config.value_sizes.clear();
+    config.value_range = false;
+
+    std::string::size_type dash = spec.find('-');
+    if (std::string::npos != dash)
+    {
+        ValueSize min_size = { static_cast<uint32_t>(strtoul(spec.substr(0, dash).c_str(), nullptr, 10)), 1 };
+        ValueSize max_size = { static_cast<uint32_t>(strtoul(spec.substr(dash + 1).c_str(), nullptr, 10)), 1 };
+        config.value_sizes.push_back(min_size);
+        config.value_sizes.push_back(max_size);
+        config.value_range = true;
+        return (min_size.size <= max_size.size);
+    }
+
+    std::vector<std::string> items;
+    split_string(spec, ',', items);
+    for (std::vector<std::string>::const_iterator iter = items.begin(); items.end() != iter; ++iter)
+    {
+        std::string::size_type colon = iter->find(':');
+        ValueSize value_size = { static_cast<uint32_t>(strtoul(iter->substr(0, colon).c_str(), nullptr, 10)), 1 };
+        if (std::string::npos != colon)
+        {
+            value_size.weight = static_cast<uint32_t>(strtoul(iter->substr(colon + 1).c_str(), nullptr, 10));
+        }
+        if (0 == value_size.weight)
+        {
+            return (false);
+        }
+        config.value_sizes.push_back(value_size);
+    }
+    return (!config.value_sizes.empty());
+}
+
+static bool parse_config(int argc, char * argv[], LoadConfig & config)
+{
+    config.threads = 4;
+    config.duration = 10;
+    config.rate = 10000;
+    config.poisson = true;
+    config.depth = 1;
+    config.keys = 100000;
+    config.distribution = key_distribution_zipf;
+    config.zipf_theta = 0.99;
+    config.hot_keys = 0.2;
+    config.hot_share = 0.8;
+    config.mix[load_op_read] = 80;
+    config.mix[load_op_write] = 15;
+    config.mix[load_op_queue] = 5;
+    config.fill = true;
+    config.clean = true;
+
+    std::string value_sizes("64");
+
+    for (int index = 1; index < argc; ++index)
+    {
+        const std::string name(argv[index]);
+        if (index + 1 >= argc)
+        {
+            return (false);
+        }
+        const std::string value(argv[++index]);
+
+        if ("--address" == name)
+        {
+            config.address = value;
+        }
+        else if ("--username" == name)
+        {
+            config.username = value;
+        }
+        else if ("--password" == name)
+        {
+            config.password = value;
+        }
+        else if ("--threads" == name)
+        {
+            config.threads = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--duration" == name)
+        {
+            config.duration = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--rate" == name)
+        {
+            config.rate = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--arrival" == name)
+        {
+            if ("poisson" != value && "fixed" != value)
+            {
+                return (false);
+            }
+            config.poisson = ("poisson" == value);
+        }
+        else if ("--depth" == name)
+        {
+            config.depth = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--keys" == name)
+        {
+            config.keys = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--distribution" == name)
+        {
+            if ("zipf" == value)
+            {
+                config.distribution = key_distribution_zipf;
+            }
+            else if ("uniform" == value)
+            {
+                config.distribution = key_distribution_uniform;
+            }
+            else if ("hotspot" == value)
+            {
+                config.distribution = key_distribution_hotspot;
+            }
+            else
+            {
+                return (false);
+            }
+        }
+        else if ("--zipf-theta" == name)
+        {
+            config.zipf_theta = atof(value.c_str());
+        }
+        else if ("--hot-keys" == name)
+        {
+            config.hot_keys = atof(value.c_str());
+        }
+        else if ("--hot-share" == name)
+        {
+            config.hot_share = atof(value.c_str());
+        }
+        else if ("--mix" == name)
+        {
+            std::vector<std::string> items;
+            split_string(value, ',', items);
+            if (load_op_count != items.size())
+            {
+                return (false);
+            }
+            for (uint32_t op = 0; op < load_op_count; ++op)
+            {
+                config.mix[op] = static_cast<uint32_t>(strtoul(items[op].c_str(), nullptr, 10));
+            }
+        }
+        else if ("--value-sizes" == name)
+        {
+            value_sizes = value;
+        }
+        else if ("--fill" == name)
+        {
+            config.fill = ("0" != value);
+        }
+        else if ("--clean" == name)
+        {
+            config.clean = ("0" != value);
+        }
+        else
+        {
+            return (false);
+        }
+    }
+
+    if (config.address.empty() || 0 == config.threads || 0 == config.duration || 0 == config.depth || 0 == config.keys)
+    {
+        return (false);
+    }
+    if (0 == config.mix[load_op_read] + config.mix[load_op_write] + config.mix[load_op_queue])
+    {
+        return (false);
+    }
+    if (config.zipf_theta <= 0.0 || config.zipf_theta >= 1.0)
+    {
+        return (false);
+    }
+    if (config.hot_keys <= 0.0 || config.hot_keys >= 1.0 || config.hot_share < 0.0 || config.hot_share > 1.0)
+    {
+        return (false);
+    }
+    if (!parse_value_sizes(value_sizes, config))
+    {
+        return (false);
+    }
+
+    return (true);
+}
+
+static void init_key_distribution(const LoadConfig & config, KeyDistribution & distribution)
+{
+    distribution.kind = config.distribution;
+    distribution.keys = config.keys;
+    distribution.hot_count = std::max(static_cast<uint32_t>(config.keys * config.hot_keys), static_cast<uint32_t>(1));
+    distribution.hot_share = config.hot_share;
+    distribution.theta = config.zipf_theta;
+    distribution.alpha = 1.0 / (1.0 - config.zipf_theta);
+    distribution.zeta_n = 0.0;
+    distribution.eta = 0.0;
+
+    if (key_distribution_zipf != config.distribution)
+    {
+        return;
+    }
+
+    for (uint32_t rank = 1; rank <= config.keys; ++rank)
+    {
+        distribution.zeta_n += 1.0 / pow(static_cast<double>(rank), config.zipf_theta);
+    }
+    const double zeta_2 = 1.0 + 1.0 / pow(2.0, config.zipf_theta);
+    distribution.eta = (1.0 - pow(2.0 / config.keys, 1.0 - config.zipf_theta)) / (1.0 - zeta_2 / distribution.zeta_n);
+}
+
+static uint32_t choose_key(const KeyDistribution & distribution, std::mt19937_64 & random)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    if (key_distribution_zipf == distribution.kind)
+    {
+        const double u = unit(random);
+        const double uz = u * distribution.zeta_n;
+        if (uz < 1.0)
+        {
+            return (0);
+        }
+        if (uz < 1.0 + pow(0.5, distribution.theta))
+        {
+            return (std::min(static_cast<uint32_t>(1), distribution.keys - 1));
+        }
+        const uint64_t rank = static_cast<uint64_t>(distribution.keys * pow(distribution.eta * u - distribution.eta + 1.0, distribution.alpha));
+        return (static_cast<uint32_t>(std::min(rank, static_cast<uint64_t>(distribution.keys - 1))));
+    }
+
+    if (key_distribution_hotspot == distribution.kind && distribution.hot_count < distribution.keys)
+    {
+        if (unit(random) < distribution.hot_share)
+        {
+            return (static_cast<uint32_t>(random() % distribution.hot_count));
+        }
+        return (distribution.hot_count + static_cast<uint32_t>(random() % (distribution.keys - distribution.hot_count)));
+    }
+
+    return (static_cast<uint32_t>(random() % distribution.keys));
+}
+
+static LoadOp choose_op(const LoadConfig & config, std::mt19937_64 & random)
+{
+    uint64_t pick = random() % (config.mix[load_op_read] + config.mix[load_op_write] + config.mix[load_op_queue]);
+    for (uint32_t op = 0; op < load_op_count; ++op)
+    {
+        if (pick < config.mix[op])
+        {
+            return (static_cast<LoadOp>(op));
+        }
+        pick -= config.mix[op];
+    }
+    return (load_op_read);
+}
+
+static uint32_t choose_value_size(const LoadConfig & config, std::mt19937_64 & random)
+{
+    if (config.value_range)
+    {
+        const uint32_t min_size = config.value_sizes[0].size;
+        const uint32_t max_size = config.value_sizes[1].size;
+        return (min_size + static_cast<uint32_t>(random() % (max_size - min_size + 1)));
+    }
+
+    uint64_t total = 0;
+    for (std::vector<ValueSize>::const_iterator iter = config.value_sizes.begin(); config.value_sizes.end() != iter; ++iter)
+    {
+        total += iter->weight;
+    }
+    uint64_t pick = random() % total;
+    for (std::vector<ValueSize>::const_iterator iter = config.value_sizes.begin(); config.value_sizes.end() != iter; ++iter)
+    {
+        if (pick < iter->weight)
+        {
+            return (iter->size);
+        }
+        pick -= iter->weight;
+    }
+    return (config.value_sizes.back().size);
+}
+
+static uint32_t max_value_size(const LoadConfig & config)
+{
+    uint32_t size = 0;
+    for (std::vector<ValueSize>::const_iterator iter = config.value_sizes.begin(); config.value_sizes.end() != iter; ++iter)
+    {
+        size = std::max(size, iter->size);
+    }
+    return (size);
+}
+
+static std::string key_name(uint32_t index)
+{
+    return (KEY_PREFIX "key:" + std::to_string(index));
+}
+
+static std::string queue_name(uint32_t thread_index)
+{
+    return (KEY_PREFIX "queue:" + std::to_string(thread_index));
+}
+
+static redisContext * connect_server(const LoadConfig & config)
+{
+    std::string host = config.address;
+    int port = 6379;
+    std::string::size_type pos = config.address.rfind(':');
+    if (std::string::npos != pos)
+    {
+        host = config.address.substr(0, pos);
+        port = atoi(config.address.substr(pos + 1).c_str());
+    }
+
+    const struct timeval timeout = { 5, 0 };
+    redisContext * context = redisConnectWithTimeout(host.c_str(), port, timeout);
+    if (nullptr == context || 0 != context->err)
+    {
+        std::cerr << "connect [" << config.address << "] failure: " << (nullptr != context ? context->errstr : "unknown") << std::endl;
+        redisFree(context);
+        return (nullptr);
+    }
+
+    if (!config.password.empty())
+    {
+        redisReply * reply = nullptr;
+        if (config.username.empty())
+        {
+            reply = reinterpret_cast<redisReply *>(redisCommand(context, "AUTH %s", config.password.c_str()));
+        }
+        else
+        {
+            reply = reinterpret_cast<redisReply *>(redisCommand(context, "AUTH %s %s", config.username.c_str(), config.password.c_str()));
+        }
+        bool authorized = (nullptr != reply && REDIS_REPLY_ERROR != reply->type);
+        freeReplyObject(reply);
+        if (!authorized)
+        {
+            std::cerr << "auth [" << config.address << "] failure" << std::endl;
+            redisFree(context);
+            return (nullptr);
+        }
+    }
+
+    return (context);
+}
+
+static redisClusterContext * connect_cluster(const LoadConfig & config)
+{
+    redisClusterContext * cc = redisClusterContextInit();
+    if (nullptr == cc)
+    {
+        return (nullptr);
+    }
+
+    do
+    {
+        if (REDIS_OK != redisClusterSetOptionAddNodes(cc, config.address.c_str()))
+        {
+            break;
+        }
+
+        if (!config.username.empty() && REDIS_OK != redisClusterSetOptionUsername(cc, config.username.c_str()))
+        {
+            break;
+        }
+
+        if (!config.password.empty() && REDIS_OK != redisClusterSetOptionPassword(cc, config.password.c_str()))
+        {
+            break;
+        }
+
+        if (REDIS_OK != redisClusterSetOptionRouteUseSlots(cc))
+        {
+            break;
+        }
+
+        if (REDIS_OK != redisClusterConnect2(cc))
+        {
+            break;
+        }
+
+        return (cc);
+    } while (false);
+
+    std::cerr << "connect [" << config.address << "] failure: " << cc->errstr << std::endl;
+    redisClusterFree(cc);
+    return (nullptr);
+}
+
+/*
+ * sleeps most of the gap, then yields until the due time
+ */
+static void wait_until(uint64_t due_ns)
+{
+    uint64_t now_ns = get_time_ns();
+    while (now_ns < due_ns)
+    {
+        if (due_ns - now_ns > 1000000)
+        {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(due_ns - now_ns - 500000));
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+        now_ns = get_time_ns();
+    }
+}
+
+static bool execute_request(LoadWorker & worker, const LoadRequest & request, const std::string & values, std::string & result)
+{
+    switch (request.op)
+    {
+        case load_op_read:
+        {
+            return (worker.redis_db.get(key_name(request.key), result));
+        }
+        case load_op_write:
+        {
+            return (worker.redis_db.set(key_name(request.key), values.substr(0, request.value_size)));
+        }
+        default:
+        {
+            worker.queue_push = !worker.queue_push;
+            if (worker.queue_push)
+            {
+                return (worker.redis_db.push_back(queue_name(worker.index), values.substr(0, request.value_size)));
+            }
+            return (worker.redis_db.pop_front(queue_name(worker.index), result));
+        }
+    }
+}
+
+/*
+ * one pipeline round of the requests, each request is done when its own
+ * reply has been read
+ */
+static void run_pipeline_round(LoadWorker & worker, std::vector<LoadRequest> & requests, const std::string & values)
+{
+    const std::string queue = queue_name(worker.index);
+    std::vector<std::string> keys(requests.size());
+
+    size_t appended = 0;
+    for (; appended < requests.size(); ++appended)
+    {
+        LoadRequest & request = requests[appended];
+        const char * argv[3] = { nullptr, nullptr, values.c_str() };
+        size_t argvlen[3] = { 0, 0, request.value_size };
+        int argc = 3;
+
+        if (load_op_queue == request.op)
+        {
+            worker.queue_push = !worker.queue_push;
+            argv[0] = (worker.queue_push ? "RPUSH" : "LPOP");
+            argv[1] = queue.c_str();
+            argvlen[1] = queue.size();
+            argc = (worker.queue_push ? 3 : 2);
+        }
+        else
+        {
+            keys[appended] = key_name(request.key);
+            argv[0] = (load_op_read == request.op ? "GET" : "SET");
+            argv[1] = keys[appended].c_str();
+            argvlen[1] = keys[appended].size();
+            argc = (load_op_read == request.op ? 2 : 3);
+        }
+        argvlen[0] = strlen(argv[0]);
+
+        int ret = (nullptr != worker.cluster_context ? redisClusterAppendCommandArgv(worker.cluster_context, argc, argv, argvlen) : redisAppendCommandArgv(worker.context, argc, argv, argvlen));
+        if (REDIS_OK != ret)
+        {
+            break;
+        }
+    }
+
+    size_t index = 0;
+    for (; index < appended; ++index)
+    {
+        void * reply = nullptr;
+        int status = (nullptr != worker.cluster_context ? redisClusterGetReply(worker.cluster_context, &reply) : redisGetReply(worker.context, &reply));
+        if (REDIS_OK != status || nullptr == reply)
+        {
+            break;
+        }
+        requests[index].ok = (REDIS_REPLY_ERROR != reinterpret_cast<redisReply *>(reply)->type);
+        requests[index].done_ns = get_time_ns();
+        freeReplyObject(reply);
+    }
+
+    if (index < requests.size())
+    {
+        if (nullptr != worker.cluster_context)
+        {
+            redisClusterReset(worker.cluster_context);
+        }
+        const uint64_t now_ns = get_time_ns();
+        for (; index < requests.size(); ++index)
+        {
+            requests[index].ok = false;
+            requests[index].done_ns = now_ns;
+        }
+    }
+}
+
+/*
+ * open loop: requests are scheduled at the target rate whatever the
+ * replies do, and a request that has to wait for an earlier one is
+ * timed from when it was due, so stalls are not hidden by the client
+ * sending less while it waits (coordinated omission)
+ */
+static void run_worker(LoadWorker & worker, const LoadConfig & config, const KeyDistribution & distribution, const std::string & values, uint64_t start_ns, uint64_t end_ns)
+{
+    const double interval_ns = (0 == config.rate ? 0.0 : 1000000000.0 * config.threads / config.rate);
+    std::exponential_distribution<double> arrival(1.0);
+    double next_ns = static_cast<double>(start_ns) + interval_ns * worker.index / config.threads;
+    std::vector<LoadRequest> requests;
+    requests.reserve(config.depth);
+    std::string result;
+
+    while (true)
+    {
+        uint64_t now_ns = get_time_ns();
+        if (0 != config.rate)
+        {
+            if (next_ns >= static_cast<double>(end_ns))
+            {
+                break;
+            }
+            if (next_ns > static_cast<double>(now_ns))
+            {
+                wait_until(static_cast<uint64_t>(next_ns));
+                now_ns = get_time_ns();
+            }
+        }
+        else if (now_ns >= end_ns)
+        {
+            break;
+        }
+
+        /* requests already due go out in one round, up to depth */
+        requests.clear();
+        do
+        {
+            LoadRequest request;
+            request.op = choose_op(config, worker.random);
+            request.key = choose_key(distribution, worker.random);
+            request.value_size = choose_value_size(config, worker.random);
+            request.intended_ns = (0 != config.rate ? static_cast<uint64_t>(next_ns) : now_ns);
+            request.done_ns = 0;
+            request.ok = false;
+            requests.push_back(request);
+
+            if (0 != config.rate)
+            {
+                next_ns += (config.poisson ? interval_ns * arrival(worker.random) : interval_ns);
+            }
+        } while (requests.size() < config.depth && (0 == config.rate || (next_ns <= static_cast<double>(now_ns) && next_ns < static_cast<double>(end_ns))));
+
+        const uint64_t send_ns = get_time_ns();
+        if (send_ns > requests.front().intended_ns)
+        {
+            worker.max_lag_ns = std::max(worker.max_lag_ns, send_ns - requests.front().intended_ns);
+        }
+
+        if (1 == config.depth)
+        {
+            LoadRequest & request = requests.front();
+            request.ok = execute_request(worker, request, values, result);
+            request.done_ns = get_time_ns();
+        }
+        else
+        {
+            run_pipeline_round(worker, requests, values);
+        }
+
+        for (std::vector<LoadRequest>::const_iterator iter = requests.begin(); requests.end() != iter; ++iter)
+        {
+            hihistogram_record(worker.latency[iter->op], iter->done_ns - std::min(iter->intended_ns, iter->done_ns));
+            hihistogram_record(worker.service[iter->op], iter->done_ns - send_ns);
+            worker.ops[iter->op] += 1;
+            if (!iter->ok)
+            {
+                worker.errors[iter->op] += 1;
+            }
+        }
+    }
+}
+
+static bool fill_worker(LoadWorker & worker, const LoadConfig & config, const std::string & values)
+{
+    const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(config.keys) * worker.index / config.threads);
+    const uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(config.keys) * (worker.index + 1) / config.threads);
+    for (uint32_t key = first; key < last; ++key)
+    {
+        if (!worker.redis_db.set(key_name(key), values.substr(0, choose_value_size(config, worker.random))))
+        {
+            std::cerr << "fill keys failure: " << worker.redis_db.error_message() << std::endl;
+            return (false);
+        }
+    }
+    return (true);
+}
+
+/*
+ * writes every key of the key space so that reads hit, the threads
+ * take a share each
+ */
+static bool fill_keys(std::vector<LoadWorker *> & workers, const LoadConfig & config, const std::string & values)
+{
+    std::vector<char> results(workers.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t index = 0; index < workers.size(); ++index)
+    {
+        threads.push_back(std::thread([&workers, &config, &values, &results, index]()
+        {
+            results[index] = (fill_worker(*workers[index], config, values) ? 1 : 0);
+        }));
+    }
+    for (std::vector<std::thread>::iterator iter = threads.begin(); threads.end() != iter; ++iter)
+    {
+        iter->join();
+    }
+    return (results.end() == std::find(results.begin(), results.end(), 0));
+}
+
+static void clean_keys(RedisDB & redis_db, const LoadConfig & config)
+{
+    std::list<std::string> keys;
+    for (uint32_t index = 0; index < config.keys; ++index)
+    {
+        keys.push_back(key_name(index));
+        if (keys.size() >= 1000)
+        {
+            redis_db.erase(keys);
+            keys.clear();
+        }
+    }
+    for (uint32_t index = 0; index < config.threads; ++index)
+    {
+        keys.push_back(queue_name(index));
+    }
+    redis_db.erase(keys);
+}
+
+static void merge_histogram(hihistogram * target, const hihistogram * source)
+{
+    target->count += source->count;
+    if (target->max < source->max)
+    {
+        target->max = source->max;
+    }
+    for (size_t index = 0; index < HIHISTOGRAM_BUCKETS; ++index)
+    {
+        target->buckets[index] += source->buckets[index];
+    }
+}
+
+static double latency_us(const hihistogram * histogram, double percentile)
+{
+    return (static_cast<double>(hihistogram_percentile(histogram, percentile)) / 1000.0);
+}
+
+/*
+ * counts per power of two of nanoseconds, with a bar scaled to the
+ * fullest row
+ */
+static void print_histogram(const char * title, const hihistogram * histogram)
+{
+    printf("\n%s\n", title);
+    if (0 == histogram->count)
+    {
+        printf("  (no requests)\n");
+        return;
+    }
+
+    std::vector<uint64_t> rows((HIHISTOGRAM_BUCKETS >> HIHISTOGRAM_SUB_BITS), 0);
+    for (size_t index = 0; index < HIHISTOGRAM_BUCKETS; ++index)
+    {
+        rows[index >> HIHISTOGRAM_SUB_BITS] += histogram->buckets[index];
+    }
+
+    size_t first = 0;
+    size_t last = rows.size();
+    while (0 == rows[first])
+    {
+        ++first;
+    }
+    while (0 == rows[last - 1])
+    {
+        --last;
+    }
+
+    const uint64_t fullest = *std::max_element(rows.begin(), rows.end());
+    uint64_t seen = 0;
+    for (size_t row = first; row < last; ++row)
+    {
+        /* the first row holds the values below 1 << HIHISTOGRAM_SUB_BITS, each other one a power of two */
+        const uint64_t end_ns = (static_cast<uint64_t>(1) << (HIHISTOGRAM_SUB_BITS + row));
+        seen += rows[row];
+        printf("  < %12.1f us %12llu %9.4f%% |%s\n", static_cast<double>(end_ns) / 1000.0, static_cast<unsigned long long>(rows[row]),
+            100.0 * seen / histogram->count, std::string(static_cast<size_t>(50 * rows[row] / fullest), '#').c_str());
+    }
+}
+
+static void print_report(const LoadConfig & config, const std::vector<LoadWorker *> & workers, uint64_t elapsed_ns)
+{
+    hihistogram * latency[load_op_count + 1] = { nullptr };
+    hihistogram * service[load_op_count + 1] = { nullptr };
+    uint64_t ops[load_op_count + 1] = { 0 };
+    uint64_t errors[load_op_count + 1] = { 0 };
+    uint64_t max_lag_ns = 0;
+
+    for (uint32_t op = 0; op <= load_op_count; ++op)
+    {
+        latency[op] = hihistogram_create();
+        service[op] = hihistogram_create();
+        if (nullptr == latency[op] || nullptr == service[op])
+        {
+            for (uint32_t index = 0; index <= op; ++index)
+            {
+                hihistogram_destroy(latency[index]);
+                hihistogram_destroy(service[index]);
+            }
+            return;
+        }
+    }
+
+    for (std::vector<LoadWorker *>::const_iterator iter = workers.begin(); workers.end() != iter; ++iter)
+    {
+        const LoadWorker * worker = *iter;
+        for (uint32_t op = 0; op < load_op_count; ++op)
+        {
+            merge_histogram(latency[op], worker->latency[op]);
+            merge_histogram(service[op], worker->service[op]);
+            merge_histogram(latency[load_op_count], worker->latency[op]);
+            merge_histogram(service[load_op_count], worker->service[op]);
+            ops[op] += worker->ops[op];
+            errors[op] += worker->errors[op];
+            ops[load_op_count] += worker->ops[op];
+            errors[load_op_count] += worker->errors[op];
+        }
+        max_lag_ns = std::max(max_lag_ns, worker->max_lag_ns);
+    }
+
+    const double seconds = static_cast<double>(elapsed_ns) / 1000000000.0;
+    printf("address %s, threads %u, depth %u, keys %u, %s keys, mix %u/%u/%u\n", config.address.c_str(), config.threads, config.depth, config.keys,
+        (key_distribution_zipf == config.distribution ? "zipf" : key_distribution_hotspot == config.distribution ? "hotspot" : "uniform"),
+        config.mix[load_op_read], config.mix[load_op_write], config.mix[load_op_queue]);
+    if (0 != config.rate)
+    {
+        printf("target %u ops/s (%s), achieved %.0f ops/s, worst send behind schedule %.1f ms\n", config.rate, (config.poisson ? "poisson" : "fixed"),
+            (seconds > 0.0 ? ops[load_op_count] / seconds : 0.0), static_cast<double>(max_lag_ns) / 1000000.0);
+    }
+    else
+    {
+        printf("closed loop, achieved %.0f ops/s, latencies suffer from coordinated omission\n", (seconds > 0.0 ? ops[load_op_count] / seconds : 0.0));
+    }
+
+    printf("\n%-8s %10s %8s %12s %10s %10s %10s %10s %10s %12s %12s\n", "op", "ops", "errors", "ops/s", "p50 us", "p90 us", "p99 us", "p999 us", "max us", "svc p50 us", "svc p99 us");
+    for (uint32_t op = 0; op <= load_op_count; ++op)
+    {
+        printf("%-8s %10llu %8llu %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f %12.1f\n", (load_op_count == op ? "all" : s_op_names[op]),
+            static_cast<unsigned long long>(ops[op]), static_cast<unsigned long long>(errors[op]), (seconds > 0.0 ? ops[op] / seconds : 0.0),
+            latency_us(latency[op], 50.0), latency_us(latency[op], 90.0), latency_us(latency[op], 99.0), latency_us(latency[op], 99.9),
+            static_cast<double>(latency[op]->max) / 1000.0, latency_us(service[op], 50.0), latency_us(service[op], 99.0));
+    }
+
+    print_histogram("latency of all requests, from their intended start", latency[load_op_count]);
+    print_histogram("service time of all requests, from their send", service[load_op_count]);
+
+    for (uint32_t op = 0; op <= load_op_count; ++op)
+    {
+        hihistogram_destroy(latency[op]);
+        hihistogram_destroy(service[op]);
+    }
+}
+
+static void close_workers(std::vector<LoadWorker *> & workers)
+{
+    for (std::vector<LoadWorker *>::iterator iter = workers.begin(); workers.end() != iter; ++iter)
+    {
+        LoadWorker * worker = *iter;
+        worker->redis_db.close();
+        redisFree(worker->context);
+        redisClusterFree(worker->cluster_context);
+        for (uint32_t op = 0; op < load_op_count; ++op)
+        {
+            hihistogram_destroy(worker->latency[op]);
+            hihistogram_destroy(worker->service[op]);
+        }
+        delete worker;
+    }
+    workers.clear();
+}
+
+static bool open_workers(std::vector<LoadWorker *> & workers, const LoadConfig & config)
+{
+    const bool cluster = (std::string::npos != config.address.find(','));
+
+    for (uint32_t index = 0; index < config.threads; ++index)
+    {
+        LoadWorker * worker = new LoadWorker;
+        worker->context = nullptr;
+        worker->cluster_context = nullptr;
+        worker->index = index;
+        worker->random.seed(index + 1);
+        worker->queue_push = false;
+        worker->max_lag_ns = 0;
+        bool created = true;
+        for (uint32_t op = 0; op < load_op_count; ++op)
+        {
+            worker->ops[op] = 0;
+            worker->errors[op] = 0;
+            worker->latency[op] = hihistogram_create();
+            worker->service[op] = hihistogram_create();
+            created = (created && nullptr != worker->latency[op] && nullptr != worker->service[op]);
+        }
+        workers.push_back(worker);
+
+        if (!created)
+        {
+            return (false);
+        }
+
+        if (!worker->redis_db.open(config.address, config.username, config.password))
+        {
+            std::cerr << "open redis db [" << config.address << "] failure: " << worker->redis_db.error_message() << std::endl;
+            return (false);
+        }
+
+        if (1 == config.depth)
+        {
+            continue;
+        }
+
+        if (cluster)
+        {
+            worker->cluster_context = connect_cluster(config);
+        }
+        else
+        {
+            worker->context = connect_server(config);
+        }
+        if (nullptr == worker->context && nullptr == worker->cluster_context)
+        {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+int main(int argc, char * argv[])
+{
+    LoadConfig config;
+    if (!parse_config(argc, argv, config))
+    {
+        usage(argv[0]);
+        return (1);
+    }
+
+    KeyDistribution distribution;
+    init_key_distribution(config, distribution);
+
+    const std::string values(max_value_size(config), 'x');
+
+    std::vector<LoadWorker *> workers;
+    if (!open_workers(workers, config))
+    {
+        close_workers(workers);
+        return (2);
+    }
+
+    if (config.fill && (0 != config.mix[load_op_read]) && !fill_keys(workers, config, values))
+    {
+        close_workers(workers);
+        return (3);
+    }
+
+    const uint64_t start_ns = get_time_ns();
+    const uint64_t end_ns = start_ns + static_cast<uint64_t>(config.duration) * 1000000000;
+
+    std::vector<std::thread> threads;
+    for (uint32_t index = 0; index < workers.size(); ++index)
+    {
+        threads.push_back(std::thread(run_worker, std::ref(*workers[index]), std::cref(config), std::cref(distribution), std::cref(values), start_ns, end_ns));
+    }
+    for (std::vector<std::thread>::iterator iter = threads.begin(); threads.end() != iter; ++iter)
+    {
+        iter->join();
+    }
+
+    const uint64_t elapsed_ns = get_time_ns() - start_ns;
+
+    print_report(config, workers, elapsed_ns);
+
+    if (config.clean)
+    {
+        clean_keys(workers.front()->redis_db, config);
+    }
+    close_workers(workers);
+
+    return (0);
+}
@@ -0,0 +1,614 @@
+/********************************************************
+ * Description : microbenchmarks of the cpu hot paths of redis db
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include <list>
+#include <functional>
+#include "hiredis.h"
+#include "alloc.h"
+
+extern "C"
+{
+    #include "dict.h"
+    #include "adlist.h"
+    #include "hiarray.h"
+    #include "command.h"
+    #include "hiutil.h"
+}
+
+#include "hircluster.h"
+#include "hifragment.h"
+#include "redis_utility.h"
+
+#define DEFAULT_MIN_MS  200
+
+/*
+ * allocations of hiredis and hiredis-cluster go through the hiredis
+ * allocators, those of the c++ layer through the global operator new,
+ * both are counted while a case runs, the benchmark is single threaded
+ */
+static uint64_t s_c_allocs = 0;
+static uint64_t s_cpp_allocs = 0;
+static volatile uint64_t s_sink = 0;
+
+static void * count_malloc(size_t size)
+{
+    ++s_c_allocs;
+    return (malloc(size));
+}
+
+static void * count_calloc(size_t nmemb, size_t size)
+{
+    ++s_c_allocs;
+    return (calloc(nmemb, size));
+}
+
+static void * count_realloc(void * ptr, size_t size)
+{
+    ++s_c_allocs;
+    return (realloc(ptr, size));
+}
+
+static char * count_strdup(const char * str)
+{
+    ++s_c_allocs;
+    size_t size = strlen(str) + 1;
+    char * dup = static_cast<char *>(malloc(size));
+    if (nullptr != dup)
+    {
+        memcpy(dup, str, size);
+    }
+    return (dup);
+}
+
+static void count_free(void * ptr)
+{
+    free(ptr);
+}
+
+void * operator new (std::size_t size)
+{
+    ++s_cpp_allocs;
+    void * ptr = malloc(0 == size ? 1 : size);
+    if (nullptr == ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return (ptr);
+}
+
+void * operator new [] (std::size_t size)
+{
+    return (operator new (size));
+}
+
+void operator delete (void * ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete [] (void * ptr) noexcept
+{
+    free(ptr);
+}
+
+static uint64_t get_time_ns()
+{
+    return (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+struct MicroCase
+{
+    std::string                         name;
+    std::function<void (uint64_t)>      run;                        /* runs the given iterations */
+};
+
+/*
+ * grow the iterations until one run takes min_ns, report the last run
+ */
+static void run_case(const MicroCase & micro_case, uint64_t min_ns)
+{
+    micro_case.run(1);
+
+    uint64_t iterations = 1;
+    uint64_t elapsed_ns = 0;
+    uint64_t c_allocs = 0;
+    uint64_t cpp_allocs = 0;
+    while (true)
+    {
+        s_c_allocs = 0;
+        s_cpp_allocs = 0;
+        const uint64_t start_ns = get_time_ns();
+        micro_case.run(iterations);
+        elapsed_ns = get_time_ns() - start_ns;
+        c_allocs = s_c_allocs;
+        cpp_allocs = s_cpp_allocs;
+
+        if (elapsed_ns >= min_ns || iterations >= (static_cast<uint64_t>(1) << 32))
+        {
+            break;
+        }
+
+        uint64_t next = (0 == elapsed_ns ? iterations * 100 : static_cast<uint64_t>(static_cast<double>(iterations) * min_ns * 1.2 / elapsed_ns));
+        if (next < iterations * 2)
+        {
+            next = iterations * 2;
+        }
+        if (next > iterations * 100)
+        {
+            next = iterations * 100;
+        }
+        iterations = next;
+    }
+
+    printf("%-36s %12llu %12.1f %14.2f %14.2f\n", micro_case.name.c_str(), static_cast<unsigned long long>(iterations), static_cast<double>(elapsed_ns) / iterations, static_cast<double>(c_allocs) / iterations, static_cast<double>(cpp_allocs) / iterations);
+}
+
+static std::string format_command(const std::vector<std::string> & args)
+{
+    std::string text = "*" + std::to_string(args.size()) + "\r\n";
+    for (std::vector<std::string>::const_iterator iter = args.begin(); args.end() != iter; ++iter)
+    {
+        text += "$" + std::to_string(iter->size()) + "\r\n" + *iter + "\r\n";
+    }
+    return (text);
+}
+
+static std::vector<std::string> key_command(const char * name, uint32_t keys)
+{
+    std::vector<std::string> args(1, name);
+    for (uint32_t index = 0; index < keys; ++index)
+    {
+        args.push_back("libredis:bench:micro:" + std::to_string(index));
+    }
+    return (args);
+}
+
+static std::string node_name(uint32_t index)
+{
+    char name[48] = { 0x0 };
+    snprintf(name, sizeof(name), "%040x", index + 1);
+    return (name);
+}
+
+static std::string node_host(uint32_t index)
+{
+    return ("10.0." + std::to_string(index / 250) + "." + std::to_string(index % 250 + 1));
+}
+
+/*
+ * masters owning two interleaved slot ranges each, one replica per master
+ */
+static std::string cluster_slots_text(uint32_t masters)
+{
+    const uint32_t ranges = masters * 2;
+    std::string text = "*" + std::to_string(ranges) + "\r\n";
+    for (uint32_t range = 0; range < ranges; ++range)
+    {
+        const uint32_t master = range % masters;
+        const uint32_t first = range * REDIS_CLUSTER_SLOTS / ranges;
+        const uint32_t last = (range + 1) * REDIS_CLUSTER_SLOTS / ranges - 1;
+        text += "*4\r\n:" + std::to_string(first) + "\r\n:" + std::to_string(last) + "\r\n";
+        for (uint32_t role = 0; role < 2; ++role)
+        {
+            const std::string host = node_host(master);
+            const std::string name = node_name(master * 2 + role);
+            text += "*3\r\n$" + std::to_string(host.size()) + "\r\n" + host + "\r\n:" + std::to_string(7000 + role) + "\r\n";
+            text += "$" + std::to_string(name.size()) + "\r\n" + name + "\r\n";
+        }
+    }
+    return (text);
+}
+
+static std::string cluster_nodes_text(uint32_t masters)
+{
+    const uint32_t ranges = masters * 2;
+    std::string text;
+    for (uint32_t master = 0; master < masters; ++master)
+    {
+        const std::string host = node_host(master);
+        text += node_name(master * 2) + " " + host + ":7000@17000 master - 0 0 " + std::to_string(master + 1) + " connected";
+        for (uint32_t range = master; range < ranges; range += masters)
+        {
+            text += " " + std::to_string(range * REDIS_CLUSTER_SLOTS / ranges) + "-" + std::to_string((range + 1) * REDIS_CLUSTER_SLOTS / ranges - 1);
+        }
+        text += "\n";
+        text += node_name(master * 2 + 1) + " " + host + ":7001@17001 slave " + node_name(master * 2) + " 0 0 " + std::to_string(master + 1) + " connected\n";
+    }
+    return (text);
+}
+
+static redisReply * read_reply(const std::string & text)
+{
+    redisReader * reader = redisReaderCreate();
+    if (nullptr == reader)
+    {
+        return (nullptr);
+    }
+
+    void * reply = nullptr;
+    if (REDIS_OK != redisReaderFeed(reader, text.data(), text.size()) || REDIS_OK != redisReaderGetReply(reader, &reply))
+    {
+        reply = nullptr;
+    }
+    redisReaderFree(reader);
+    return (static_cast<redisReply *>(reply));
+}
+
+static void release_command(void * command)
+{
+    command_destroy(static_cast<struct cmd *>(command));
+}
+
+static struct cmd * parse_command(redisClusterContext * cc, std::string & text)
+{
+    struct cmd * command = command_pool_get(cc->command_pool);
+    command->cmd = &text[0];
+    command->clen = static_cast<uint32_t>(text.size());
+    redis_parse_cmd(command);
+    return (command);
+}
+
+static void destroy_command(struct cmd * command)
+{
+    command->cmd = nullptr;
+    command_destroy(command);
+}
+
+/*
+ * the sub-replies a node would send for a fragment, fed through one
+ * reader as the connections of the cluster would
+ */
+static bool replay_replies(redisReader * reader, hilist * commands, bool mget)
+{
+    listIter iter;
+    listRewind(commands, &iter);
+    listNode * node = nullptr;
+    while (nullptr != (node = listNext(&iter)))
+    {
+        struct cmd * sub_command = static_cast<struct cmd *>(listNodeValue(node));
+        const uint32_t keys = hiarray_n(sub_command->keys);
+        std::string text;
+        if (mget)
+        {
+            text = "*" + std::to_string(keys) + "\r\n";
+            for (uint32_t index = 0; index < keys; ++index)
+            {
+                text += "$5\r\nvalue\r\n";
+            }
+        }
+        else
+        {
+            text = ":" + std::to_string(keys) + "\r\n";
+        }
+
+        void * reply = nullptr;
+        if (REDIS_OK != redisReaderFeed(reader, text.data(), text.size()) || REDIS_OK != redisReaderGetReply(reader, &reply) || nullptr == reply)
+        {
+            return (false);
+        }
+        sub_command->reply = static_cast<redisReply *>(reply);
+    }
+    return (true);
+}
+
+static void add_fragment_cases(std::vector<MicroCase> & cases, redisClusterContext * cc, redisReader * reader, std::list<std::string> & texts, const char * name, uint32_t keys)
+{
+    texts.push_back(format_command(key_command(name, keys)));
+    std::string & text = texts.back();
+    const bool mget = (0 == strcmp(name, "MGET"));
+
+    MicroCase pre_case;
+    pre_case.name = std::string("pre_fragment ") + name + " " + std::to_string(keys);
+    pre_case.run = [cc, &text](uint64_t iterations)
+    {
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            struct cmd * command = parse_command(cc, text);
+            hilist * commands = listCreate();
+            commands->free = release_command;
+            s_sink += command_pre_fragment(cc, command, commands);
+            listRelease(commands);
+            destroy_command(command);
+        }
+    };
+    cases.push_back(pre_case);
+
+    MicroCase post_case;
+    post_case.name = std::string("pre+post_fragment ") + name + " " + std::to_string(keys);
+    post_case.run = [cc, reader, mget, &text](uint64_t iterations)
+    {
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            struct cmd * command = parse_command(cc, text);
+            hilist * commands = listCreate();
+            commands->free = release_command;
+            command_pre_fragment(cc, command, commands);
+            if (replay_replies(reader, commands, mget))
+            {
+                redisReply * reply = static_cast<redisReply *>(command_post_fragment(cc, command, commands));
+                if (nullptr != reply)
+                {
+                    s_sink += reply->type;
+                    freeReplyObject(reply);
+                }
+            }
+            listRelease(commands);
+            destroy_command(command);
+        }
+    };
+    cases.push_back(post_case);
+}
+
+template <typename T>
+static void add_conversion_cases(std::vector<MicroCase> & cases, const char * type_name, T value)
+{
+    MicroCase to_string_case;
+    to_string_case.name = std::string("type_to_string ") + type_name;
+    to_string_case.run = [value](uint64_t iterations)
+    {
+        std::string str;
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            type_to_string(value, str);
+            s_sink += str.size();
+        }
+    };
+    cases.push_back(to_string_case);
+
+    std::string value_string;
+    type_to_string(value, value_string);
+
+    MicroCase to_type_case;
+    to_type_case.name = std::string("string_to_type ") + type_name;
+    to_type_case.run = [value_string](uint64_t iterations)
+    {
+        T val = T();
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            s_sink += string_to_type(value_string, val);
+        }
+    };
+    cases.push_back(to_type_case);
+}
+
+static void add_argument_cases(std::vector<MicroCase> & cases, std::list<std::list<std::string>> & arg_lists, uint32_t count)
+{
+    arg_lists.push_back(std::list<std::string>(1, "SET"));
+    std::list<std::string> & args = arg_lists.back();
+    for (uint32_t index = 1; index < count; ++index)
+    {
+        args.push_back("libredis:bench:micro:" + std::to_string(index));
+    }
+
+    MicroCase argv_case;
+    argv_case.name = "build_command_argv " + std::to_string(count);
+    argv_case.run = [&args](uint64_t iterations)
+    {
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            std::vector<const char *> arg_ptr;
+            std::vector<size_t> arg_len;
+            build_command_argv(args, arg_ptr, arg_len);
+            s_sink += arg_len.size();
+        }
+    };
+    cases.push_back(argv_case);
+
+    MicroCase text_case;
+    text_case.name = "build_command_text " + std::to_string(count);
+    text_case.run = [&args](uint64_t iterations)
+    {
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            s_sink += build_command_text(args).size();
+        }
+    };
+    cases.push_back(text_case);
+}
+
+static void add_topology_cases(std::vector<MicroCase> & cases, redisClusterContext * cc, std::list<redisReply *> & replies, std::list<std::string> & texts, uint32_t masters)
+{
+    redisReply * slots_reply = read_reply(cluster_slots_text(masters));
+    if (nullptr != slots_reply)
+    {
+        replies.push_back(slots_reply);
+
+        MicroCase slots_case;
+        slots_case.name = "parse_cluster_slots " + std::to_string(masters);
+        slots_case.run = [cc, slots_reply](uint64_t iterations)
+        {
+            for (uint64_t index = 0; index < iterations; ++index)
+            {
+                dict * nodes = parse_cluster_slots(cc, slots_reply, HIRCLUSTER_FLAG_ADD_SLAVE);
+                if (nullptr != nodes)
+                {
+                    s_sink += dictSize(nodes);
+                    dictRelease(nodes);
+                }
+            }
+        };
+        cases.push_back(slots_case);
+    }
+
+    texts.push_back(cluster_nodes_text(masters));
+    std::string & nodes_text = texts.back();
+
+    MicroCase nodes_case;
+    nodes_case.name = "parse_cluster_nodes " + std::to_string(masters);
+    nodes_case.run = [cc, &nodes_text](uint64_t iterations)
+    {
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            dict * nodes = parse_cluster_nodes(cc, &nodes_text[0], static_cast<int>(nodes_text.size()), HIRCLUSTER_FLAG_ADD_SLAVE);
+            if (nullptr != nodes)
+            {
+                s_sink += dictSize(nodes);
+                dictRelease(nodes);
+            }
+        }
+    };
+    cases.push_back(nodes_case);
+}
+
+int main(int argc, char * argv[])
+{
+    const char * filter = (argc > 1 ? argv[1] : "");
+    const uint64_t min_ns = static_cast<uint64_t>(argc > 2 ? atoi(argv[2]) : DEFAULT_MIN_MS) * 1000000;
+    if ((argc > 1 && (0 == strcmp(filter, "-h") || 0 == strcmp(filter, "--help"))) || 0 == min_ns)
+    {
+        printf("usage: %s [case filter] [min ms per case]\n", argv[0]);
+        return (1);
+    }
+
+    redisClusterContext * cc = redisClusterContextInit();
+    redisReader * reader = redisReaderCreate();
+    if (nullptr == cc || nullptr == reader)
+    {
+        printf("create cluster context failure\n");
+        return (2);
+    }
+
+    std::list<std::string> texts;
+    std::list<std::list<std::string>> arg_lists;
+    std::list<redisReply *> replies;
+    std::vector<MicroCase> cases;
+
+    const char * slot_keys[] = { "libredis:bench:micro:0", "{user:1000}.following", "a-key-long-enough-to-make-the-crc-loop-dominate-the-hash-slot" };
+    for (size_t key_index = 0; key_index < sizeof(slot_keys) / sizeof(slot_keys[0]); ++key_index)
+    {
+        const std::string key(slot_keys[key_index]);
+
+        MicroCase crc_case;
+        crc_case.name = "crc16 " + std::to_string(key.size()) + "B";
+        crc_case.run = [key](uint64_t iterations)
+        {
+            for (uint64_t index = 0; index < iterations; ++index)
+            {
+                s_sink += crc16(key.data(), static_cast<int>(key.size()));
+            }
+        };
+        cases.push_back(crc_case);
+
+        MicroCase slot_case;
+        slot_case.name = "key_hash_slot " + std::to_string(key.size()) + "B";
+        slot_case.run = [key](uint64_t iterations)
+        {
+            std::string slot_key(key);
+            for (uint64_t index = 0; index < iterations; ++index)
+            {
+                s_sink += redisClusterGetSlotByKey(&slot_key[0]);
+            }
+        };
+        cases.push_back(slot_case);
+    }
+
+    const char * lookups[][2] = { { "GET", "" }, { "zrangebyscore", "" }, { "XINFO", "STREAM" } };
+    for (size_t lookup_index = 0; lookup_index < sizeof(lookups) / sizeof(lookups[0]); ++lookup_index)
+    {
+        const std::string arg0(lookups[lookup_index][0]);
+        const std::string arg1(lookups[lookup_index][1]);
+
+        MicroCase lookup_case;
+        lookup_case.name = "lookup_cmd " + arg0 + (arg1.empty() ? "" : " " + arg1);
+        lookup_case.run = [arg0, arg1](uint64_t iterations)
+        {
+            for (uint64_t index = 0; index < iterations; ++index)
+            {
+                s_sink += redis_command_type(arg0.data(), static_cast<uint32_t>(arg0.size()), arg1.data(), static_cast<uint32_t>(arg1.size()));
+            }
+        };
+        cases.push_back(lookup_case);
+    }
+
+    MicroCase command_case;
+    command_case.name = "command_get+destroy";
+    command_case.run = [cc](uint64_t iterations)
+    {
+        for (uint64_t index = 0; index < iterations; ++index)
+        {
+            struct cmd * command = command_pool_get(cc->command_pool);
+            s_sink += command->slot_num;
+            command_destroy(command);
+        }
+    };
+    cases.push_back(command_case);
+
+    std::vector<std::vector<std::string>> parse_commands;
+    parse_commands.push_back(key_command("GET", 1));
+    parse_commands.push_back(std::vector<std::string>{ "SET", "libredis:bench:micro:0", std::string(64, 'v'), "EX", "60" });
+    parse_commands.push_back(key_command("MGET", 10));
+    parse_commands.push_back(key_command("MGET", 100));
+    for (std::vector<std::vector<std::string>>::const_iterator iter = parse_commands.begin(); parse_commands.end() != iter; ++iter)
+    {
+        texts.push_back(format_command(*iter));
+        std::string & text = texts.back();
+
+        MicroCase parse_case;
+        parse_case.name = "parse_cmd " + iter->front() + " " + std::to_string(iter->size() - 1);
+        parse_case.run = [cc, &text](uint64_t iterations)
+        {
+            for (uint64_t index = 0; index < iterations; ++index)
+            {
+                struct cmd * command = parse_command(cc, text);
+                s_sink += command->result;
+                destroy_command(command);
+            }
+        };
+        cases.push_back(parse_case);
+    }
+
+    const uint32_t fragment_keys[] = { 2, 10, 100, 1000 };
+    for (size_t keys_index = 0; keys_index < sizeof(fragment_keys) / sizeof(fragment_keys[0]); ++keys_index)
+    {
+        add_fragment_cases(cases, cc, reader, texts, "MGET", fragment_keys[keys_index]);
+        add_fragment_cases(cases, cc, reader, texts, "DEL", fragment_keys[keys_index]);
+    }
+
+    add_conversion_cases<int32_t>(cases, "int32", -123456789);
+    add_conversion_cases<uint64_t>(cases, "uint64", 18446744073709551557ULL);
+    add_conversion_cases<double>(cases, "double", 3.14159265358979);
+    add_conversion_cases<bool>(cases, "bool", true);
+
+    add_argument_cases(cases, arg_lists, 3);
+    add_argument_cases(cases, arg_lists, 100);
+
+    add_topology_cases(cases, cc, replies, texts, 10);
+    add_topology_cases(cases, cc, replies, texts, 500);
+
+    hiredisAllocFuncs count_allocators = { count_malloc, count_calloc, count_realloc, count_strdup, count_free };
+    hiredisSetAllocators(&count_allocators);
+
+    printf("%-36s %12s %12s %14s %14s\n", "case", "iterations", "ns/op", "c allocs/op", "c++ allocs/op");
+    for (std::vector<MicroCase>::const_iterator iter = cases.begin(); cases.end() != iter; ++iter)
+    {
+        if (std::string::npos != iter->name.find(filter))
+        {
+            run_case(*iter, min_ns);
+        }
+    }
+
+    hiredisResetAllocators();
+
+    for (std::list<redisReply *>::iterator iter = replies.begin(); replies.end() != iter; ++iter)
+    {
+        freeReplyObject(*iter);
+    }
+    redisReaderFree(reader);
+    redisClusterFree(cc);
+
+    return (0);
+}
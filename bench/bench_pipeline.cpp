@@ -0,0 +1,172 @@
+/********************************************************
+ * Description : pipeline depth benchmark of redis cluster
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "hircluster.h"
+
+#define SERVER      "127.0.0.1:7000,127.0.0.1:7001,127.0.0.1:7002"
+#define PASSWORD    ""
+
+static uint64_t get_time_ns()
+{
+    return (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+static redisClusterContext * connect_cluster(const char * address, const char * password)
+{
+    redisClusterContext * cc = redisClusterContextInit();
+    if (nullptr == cc)
+    {
+        return (nullptr);
+    }
+
+    do
+    {
+        if (REDIS_OK != redisClusterSetOptionAddNodes(cc, address))
+        {
+            break;
+        }
+
+        if (nullptr != password && '\0' != password[0] && REDIS_OK != redisClusterSetOptionPassword(cc, password))
+        {
+            break;
+        }
+
+        if (REDIS_OK != redisClusterSetOptionRouteUseSlots(cc))
+        {
+            break;
+        }
+
+        if (REDIS_OK != redisClusterConnect2(cc))
+        {
+            break;
+        }
+
+        return (cc);
+    } while (false);
+
+    std::cout << "connect [" << address << "] failure: " << cc->errstr << std::endl;
+    redisClusterFree(cc);
+    return (nullptr);
+}
+
+/*
+ * appends depth commands, then reads all replies back,
+ * returns false when any command fails
+ */
+static bool run_pipeline(redisClusterContext * cc, const char * command, uint32_t depth, uint64_t & append_ns, uint64_t & total_ns)
+{
+    char key[32] = { 0x0 };
+    const char * argv[3] = { command, key, "value" };
+    size_t argvlen[3] = { strlen(command), 0, 5 };
+    int argc = (0 == strcmp(command, "SET") ? 3 : 2);
+
+    uint64_t time_beg = get_time_ns();
+
+    for (uint32_t index = 0; index < depth; ++index)
+    {
+        argvlen[1] = static_cast<size_t>(snprintf(key, sizeof(key), "bench:pipeline:%u", index));
+        if (REDIS_OK != redisClusterAppendCommandArgv(cc, argc, argv, argvlen))
+        {
+            std::cout << "append " << command << " failure: " << cc->errstr << std::endl;
+            redisClusterReset(cc);
+            return (false);
+        }
+    }
+
+    uint64_t time_mid = get_time_ns();
+
+    for (uint32_t index = 0; index < depth; ++index)
+    {
+        void * reply = nullptr;
+        if (REDIS_OK != redisClusterGetReply(cc, &reply) || nullptr == reply)
+        {
+            std::cout << "get reply of " << command << " failure: " << cc->errstr << std::endl;
+            redisClusterReset(cc);
+            return (false);
+        }
+        freeReplyObject(reply);
+    }
+
+    uint64_t time_end = get_time_ns();
+
+    append_ns = time_mid - time_beg;
+    total_ns = time_end - time_beg;
+
+    return (true);
+}
+
+int main(int argc, char * argv[])
+{
+    const char * address = (argc > 1 ? argv[1] : SERVER);
+    const char * password = (argc > 2 ? argv[2] : PASSWORD);
+    uint32_t max_depth = (argc > 3 ? static_cast<uint32_t>(strtoul(argv[3], nullptr, 10)) : 100000);
+
+    redisClusterContext * cc = connect_cluster(address, password);
+    if (nullptr == cc)
+    {
+        return (1);
+    }
+
+    const char * commands[] = { "SET", "GET" };
+
+    printf("%-8s %10s %14s %14s %14s\n", "command", "depth", "ops/s", "ns/op", "append ns/op");
+
+    for (size_t cmd_index = 0; cmd_index < sizeof(commands) / sizeof(commands[0]); ++cmd_index)
+    {
+        for (uint32_t depth = 1; depth <= max_depth; depth *= 10)
+        {
+            /* warm the connections, the command pool and the request ring up */
+            uint64_t append_ns = 0;
+            uint64_t total_ns = 0;
+            if (!run_pipeline(cc, commands[cmd_index], depth, append_ns, total_ns))
+            {
+                redisClusterFree(cc);
+                return (2);
+            }
+
+            /* repeat small depths so that every row measures a similar amount of work */
+            uint32_t rounds = (depth < max_depth ? max_depth / depth : 1);
+            if (rounds > 1000)
+            {
+                rounds = 1000;
+            }
+
+            uint64_t sum_append_ns = 0;
+            uint64_t sum_total_ns = 0;
+            for (uint32_t round = 0; round < rounds; ++round)
+            {
+                if (!run_pipeline(cc, commands[cmd_index], depth, append_ns, total_ns))
+                {
+                    redisClusterFree(cc);
+                    return (2);
+                }
+                sum_append_ns += append_ns;
+                sum_total_ns += total_ns;
+            }
+
+            double ops = static_cast<double>(depth) * rounds;
+            double total_ns_per_op = static_cast<double>(sum_total_ns) / ops;
+            double append_ns_per_op = static_cast<double>(sum_append_ns) / ops;
+            double ops_per_second = (sum_total_ns > 0 ? ops * 1000000000.0 / static_cast<double>(sum_total_ns) : 0.0);
+
+            printf("%-8s %10u %14.0f %14.1f %14.1f\n", commands[cmd_index], depth, ops_per_second, total_ns_per_op, append_ns_per_op);
+        }
+    }
+
+    redisClusterFree(cc);
+
+    return (0);
+}
@@ -0,0 +1,1060 @@
+/********************************************************
+ * Description : benchmark suite of redis db against a local server
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef _MSC_VER
+    #include <signal.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+#endif // _MSC_VER
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <list>
+#include <thread>
+#include <iostream>
+#include "hiredis.h"
+#include "hircluster.h"
+#include "hialloc.h"
+#include "hihistogram.h"
+#include "libredis.h"
+
+#define KEY_PREFIX  "libredis:bench:"
+
+struct BenchConfig
+{
+    std::string                         address;                    /* server to use, empty to spawn one */
+    std::string                         username;
+    std::string                         password;
+    std::string                         spawn;                      /* standalone or cluster */
+    uint16_t                            port;                       /* first port of spawned servers */
+    uint32_t                            nodes;                      /* masters of a spawned cluster */
+    std::string                         redis_server;
+    std::string                         redis_cli;
+    uint32_t                            threads;
+    uint32_t                            requests;                   /* per workload, spread over the threads */
+    uint32_t                            keys;                       /* size of the key space */
+    uint32_t                            batch;                      /* keys of a batch call */
+    uint32_t                            depth;                      /* commands of a pipeline round */
+    std::vector<uint32_t>               value_sizes;
+    std::vector<std::string>            workloads;
+    std::string                         format;                     /* json or text */
+    bool                                allocs;                     /* count allocations per operation */
+    std::vector<std::pair<std::string, double>> max_allocs;         /* allocations per operation a workload may make */
+};
+
+struct BenchResult
+{
+    std::string                         workload;
+    uint32_t                            value_size;
+    uint64_t                            ops;
+    uint64_t                            errors;
+    uint64_t                            elapsed_ns;
+    hihistogram                       * latency;                    /* nanoseconds of a call, a batch or a pipeline round */
+    uint64_t                            allocs;                     /* made by the calls, with allocs */
+    uint64_t                            alloc_bytes;
+};
+
+struct BenchWorker
+{
+    RedisDB                             redis_db;
+    redisContext                      * context;                    /* pipelines against a standalone server */
+    redisClusterContext               * cluster_context;            /* pipelines against a cluster */
+    std::mt19937                        random;
+    uint64_t                            ops;
+    uint64_t                            errors;
+    hihistogram                       * latency;
+    hialloc_counters                    allocs;
+};
+
+static uint64_t get_time_ns()
+{
+    return (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+static void split_string(const std::string & str, std::vector<std::string> & items)
+{
+    items.clear();
+    std::string::size_type beg = 0;
+    while (beg <= str.size())
+    {
+        std::string::size_type end = str.find(',', beg);
+        if (std::string::npos == end)
+        {
+            end = str.size();
+        }
+        if (end > beg)
+        {
+            items.push_back(str.substr(beg, end - beg));
+        }
+        beg = end + 1;
+    }
+}
+
+static void usage(const char * program)
+{
+    printf("usage: %s [options]\n", program);
+    printf("  --address host:port[,host:port...]   use a running server or cluster\n");
+    printf("  --username name --password pass      credentials of --address\n");
+    printf("  --spawn standalone|cluster           start redis-server instead (default standalone)\n");
+    printf("  --port port                          first port of spawned servers (default 16379)\n");
+    printf("  --nodes n                            masters of a spawned cluster (default 3)\n");
+    printf("  --redis-server path --redis-cli path binaries used to spawn (default from PATH)\n");
+    printf("  --threads n                          (default 1)\n");
+    printf("  --requests n                         per workload and value size (default 100000)\n");
+    printf("  --keys n                             key space (default 10000)\n");
+    printf("  --batch n                            keys of a batch call (default 100)\n");
+    printf("  --depth n                            commands of a pipeline round (default 100)\n");
+    printf("  --value-sizes n[,n...]               bytes (default 64,1024)\n");
+    printf("  --workloads name[,name...]           set,get,push,pop,batch,pipeline (default all)\n");
+    printf("  --format json|text                   (default json)\n");
+    printf("  --allocs 0|1                         count allocations per operation (default 0)\n");
+    printf("  --max-allocs name:n[,name:n...]      fail when a workload makes more allocations per operation, implies --allocs 1\n");
+}
+
+static bool parse_config(int argc, char * argv[], BenchConfig & config)
+{
+    config.port = 16379;
+    config.nodes = 3;
+    config.redis_server = "redis-server";
+    config.redis_cli = "redis-cli";
+    config.threads = 1;
+    config.requests = 100000;
+    config.keys = 10000;
+    config.batch = 100;
+    config.depth = 100;
+    config.format = "json";
+
+    std::string value_sizes("64,1024");
+    std::string workloads("set,get,push,pop,batch,pipeline");
+    std::string max_allocs;
+    config.allocs = false;
+
+    for (int index = 1; index < argc; ++index)
+    {
+        const std::string name(argv[index]);
+        if (index + 1 >= argc)
+        {
+            return (false);
+        }
+        const std::string value(argv[++index]);
+
+        if ("--address" == name)
+        {
+            config.address = value;
+        }
+        else if ("--username" == name)
+        {
+            config.username = value;
+        }
+        else if ("--password" == name)
+        {
+            config.password = value;
+        }
+        else if ("--spawn" == name)
+        {
+            config.spawn = value;
+        }
+        else if ("--port" == name)
+        {
+            config.port = static_cast<uint16_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--nodes" == name)
+        {
+            config.nodes = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--redis-server" == name)
+        {
+            config.redis_server = value;
+        }
+        else if ("--redis-cli" == name)
+        {
+            config.redis_cli = value;
+        }
+        else if ("--threads" == name)
+        {
+            config.threads = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--requests" == name)
+        {
+            config.requests = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--keys" == name)
+        {
+            config.keys = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--batch" == name)
+        {
+            config.batch = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--depth" == name)
+        {
+            config.depth = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 10));
+        }
+        else if ("--value-sizes" == name)
+        {
+            value_sizes = value;
+        }
+        else if ("--workloads" == name)
+        {
+            workloads = value;
+        }
+        else if ("--format" == name)
+        {
+            config.format = value;
+        }
+        else if ("--allocs" == name)
+        {
+            config.allocs = ("0" != value);
+        }
+        else if ("--max-allocs" == name)
+        {
+            max_allocs = value;
+        }
+        else
+        {
+            return (false);
+        }
+    }
+
+    if (config.address.empty() && config.spawn.empty())
+    {
+        config.spawn = "standalone";
+    }
+
+    std::vector<std::string> items;
+    split_string(value_sizes, items);
+    for (std::vector<std::string>::const_iterator iter = items.begin(); items.end() != iter; ++iter)
+    {
+        config.value_sizes.push_back(static_cast<uint32_t>(strtoul(iter->c_str(), nullptr, 10)));
+    }
+    split_string(workloads, config.workloads);
+    items.clear();
+    split_string(max_allocs, items);
+    for (std::vector<std::string>::const_iterator iter = items.begin(); items.end() != iter; ++iter)
+    {
+        std::string::size_type colon = iter->find(':');
+        if (std::string::npos == colon)
+        {
+            return (false);
+        }
+        config.max_allocs.push_back(std::make_pair(iter->substr(0, colon), atof(iter->substr(colon + 1).c_str())));
+        config.allocs = true;
+    }
+
+    if (0 == config.threads || 0 == config.requests || 0 == config.keys || 0 == config.batch || 0 == config.depth || 0 == config.nodes)
+    {
+        return (false);
+    }
+    if (config.value_sizes.empty() || config.workloads.empty())
+    {
+        return (false);
+    }
+    if (config.address.empty() && "standalone" != config.spawn && "cluster" != config.spawn)
+    {
+        return (false);
+    }
+    if ("json" != config.format && "text" != config.format)
+    {
+        return (false);
+    }
+
+    return (true);
+}
+
+#ifndef _MSC_VER
+
+/*
+ * local redis-server processes, stopped and cleaned up when destroyed
+ */
+class LocalServer
+{
+public:
+    LocalServer();
+    ~LocalServer();
+
+public:
+    bool start(const BenchConfig & config, std::string & address);
+
+private:
+    LocalServer(const LocalServer &);
+    LocalServer & operator = (const LocalServer &);
+
+private:
+    bool spawn(const BenchConfig & config, uint16_t port, bool cluster);
+    bool wait_ready(uint16_t port);
+    bool wait_cluster(uint16_t port);
+    void stop();
+
+private:
+    std::string                         m_dir;
+    std::vector<uint16_t>               m_ports;
+    std::vector<pid_t>                  m_pids;
+};
+
+LocalServer::LocalServer()
+    : m_dir()
+    , m_ports()
+    , m_pids()
+{
+
+}
+
+LocalServer::~LocalServer()
+{
+    stop();
+}
+
+bool LocalServer::start(const BenchConfig & config, std::string & address)
+{
+    char dir[] = "/tmp/libredis-bench-XXXXXX";
+    if (nullptr == mkdtemp(dir))
+    {
+        std::cerr << "create working directory failure" << std::endl;
+        return (false);
+    }
+    m_dir = dir;
+
+    const bool cluster = ("cluster" == config.spawn);
+    const uint32_t count = (cluster ? config.nodes : 1);
+
+    address.clear();
+    for (uint32_t index = 0; index < count; ++index)
+    {
+        uint16_t port = static_cast<uint16_t>(config.port + index);
+        if (!spawn(config, port, cluster) || !wait_ready(port))
+        {
+            std::cerr << "start redis-server on port " << port << " failure" << std::endl;
+            return (false);
+        }
+        address += (address.empty() ? "" : ",") + std::string("127.0.0.1:") + std::to_string(port);
+    }
+
+    if (!cluster)
+    {
+        return (true);
+    }
+
+    std::string command = config.redis_cli + " --cluster create";
+    for (std::vector<uint16_t>::const_iterator iter = m_ports.begin(); m_ports.end() != iter; ++iter)
+    {
+        command += " 127.0.0.1:" + std::to_string(*iter);
+    }
+    command += " --cluster-replicas 0 --cluster-yes > /dev/null 2>&1";
+    if (0 != system(command.c_str()))
+    {
+        std::cerr << "create cluster failure: " << command << std::endl;
+        return (false);
+    }
+
+    for (std::vector<uint16_t>::const_iterator iter = m_ports.begin(); m_ports.end() != iter; ++iter)
+    {
+        if (!wait_cluster(*iter))
+        {
+            std::cerr << "cluster state of port " << *iter << " is not ok" << std::endl;
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+bool LocalServer::spawn(const BenchConfig & config, uint16_t port, bool cluster)
+{
+    const std::string port_string = std::to_string(port);
+    const std::string nodes_file = "nodes-" + port_string + ".conf";
+
+    std::vector<const char *> argv;
+    argv.push_back(config.redis_server.c_str());
+    argv.push_back("--port");
+    argv.push_back(port_string.c_str());
+    argv.push_back("--bind");
+    argv.push_back("127.0.0.1");
+    argv.push_back("--dir");
+    argv.push_back(m_dir.c_str());
+    argv.push_back("--save");
+    argv.push_back("");
+    argv.push_back("--appendonly");
+    argv.push_back("no");
+    if (cluster)
+    {
+        argv.push_back("--cluster-enabled");
+        argv.push_back("yes");
+        argv.push_back("--cluster-config-file");
+        argv.push_back(nodes_file.c_str());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        return (false);
+    }
+
+    if (0 == pid)
+    {
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execvp(argv[0], const_cast<char * const *>(&argv[0]));
+        _exit(127);
+    }
+
+    m_ports.push_back(port);
+    m_pids.push_back(pid);
+
+    return (true);
+}
+
+bool LocalServer::wait_ready(uint16_t port)
+{
+    const struct timeval timeout = { 1, 0 };
+    for (int retry = 0; retry < 200; ++retry)
+    {
+        int status = 0;
+        if (m_pids.back() == waitpid(m_pids.back(), &status, WNOHANG))
+        {
+            m_pids.back() = -1;
+            return (false);
+        }
+
+        redisContext * context = redisConnectWithTimeout("127.0.0.1", port, timeout);
+        if (nullptr != context && 0 == context->err)
+        {
+            redisReply * reply = reinterpret_cast<redisReply *>(redisCommand(context, "PING"));
+            bool ready = (nullptr != reply && REDIS_REPLY_STATUS == reply->type);
+            freeReplyObject(reply);
+            redisFree(context);
+            if (ready)
+            {
+                return (true);
+            }
+        }
+        else
+        {
+            redisFree(context);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return (false);
+}
+
+bool LocalServer::wait_cluster(uint16_t port)
+{
+    const struct timeval timeout = { 1, 0 };
+    for (int retry = 0; retry < 600; ++retry)
+    {
+        bool ok = false;
+        redisContext * context = redisConnectWithTimeout("127.0.0.1", port, timeout);
+        if (nullptr != context && 0 == context->err)
+        {
+            redisReply * reply = reinterpret_cast<redisReply *>(redisCommand(context, "CLUSTER INFO"));
+            ok = (nullptr != reply && REDIS_REPLY_STRING == reply->type && nullptr != strstr(reply->str, "cluster_state:ok"));
+            freeReplyObject(reply);
+        }
+        redisFree(context);
+        if (ok)
+        {
+            return (true);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return (false);
+}
+
+void LocalServer::stop()
+{
+    for (std::vector<pid_t>::const_iterator iter = m_pids.begin(); m_pids.end() != iter; ++iter)
+    {
+        if (*iter > 0)
+        {
+            kill(*iter, SIGTERM);
+        }
+    }
+    for (std::vector<pid_t>::const_iterator iter = m_pids.begin(); m_pids.end() != iter; ++iter)
+    {
+        if (*iter > 0)
+        {
+            int status = 0;
+            waitpid(*iter, &status, 0);
+        }
+    }
+    m_pids.clear();
+
+    if (!m_dir.empty())
+    {
+        for (std::vector<uint16_t>::const_iterator iter = m_ports.begin(); m_ports.end() != iter; ++iter)
+        {
+            unlink((m_dir + "/nodes-" + std::to_string(*iter) + ".conf").c_str());
+        }
+        unlink((m_dir + "/dump.rdb").c_str());
+        rmdir(m_dir.c_str());
+        m_dir.clear();
+    }
+    m_ports.clear();
+}
+
+#endif // _MSC_VER
+
+static redisContext * connect_server(const std::string & address, const BenchConfig & config)
+{
+    std::string host = address;
+    int port = 6379;
+    std::string::size_type pos = address.rfind(':');
+    if (std::string::npos != pos)
+    {
+        host = address.substr(0, pos);
+        port = atoi(address.substr(pos + 1).c_str());
+    }
+
+    const struct timeval timeout = { 5, 0 };
+    redisContext * context = redisConnectWithTimeout(host.c_str(), port, timeout);
+    if (nullptr == context || 0 != context->err)
+    {
+        std::cerr << "connect [" << address << "] failure: " << (nullptr != context ? context->errstr : "unknown") << std::endl;
+        redisFree(context);
+        return (nullptr);
+    }
+
+    if (!config.password.empty())
+    {
+        redisReply * reply = nullptr;
+        if (config.username.empty())
+        {
+            reply = reinterpret_cast<redisReply *>(redisCommand(context, "AUTH %s", config.password.c_str()));
+        }
+        else
+        {
+            reply = reinterpret_cast<redisReply *>(redisCommand(context, "AUTH %s %s", config.username.c_str(), config.password.c_str()));
+        }
+        bool authorized = (nullptr != reply && REDIS_REPLY_ERROR != reply->type);
+        freeReplyObject(reply);
+        if (!authorized)
+        {
+            std::cerr << "auth [" << address << "] failure" << std::endl;
+            redisFree(context);
+            return (nullptr);
+        }
+    }
+
+    return (context);
+}
+
+static redisClusterContext * connect_cluster(const std::string & address, const BenchConfig & config)
+{
+    redisClusterContext * cc = redisClusterContextInit();
+    if (nullptr == cc)
+    {
+        return (nullptr);
+    }
+
+    do
+    {
+        if (REDIS_OK != redisClusterSetOptionAddNodes(cc, address.c_str()))
+        {
+            break;
+        }
+
+        if (!config.username.empty() && REDIS_OK != redisClusterSetOptionUsername(cc, config.username.c_str()))
+        {
+            break;
+        }
+
+        if (!config.password.empty() && REDIS_OK != redisClusterSetOptionPassword(cc, config.password.c_str()))
+        {
+            break;
+        }
+
+        if (REDIS_OK != redisClusterSetOptionRouteUseSlots(cc))
+        {
+            break;
+        }
+
+        if (REDIS_OK != redisClusterConnect2(cc))
+        {
+            break;
+        }
+
+        return (cc);
+    } while (false);
+
+    std::cerr << "connect [" << address << "] failure: " << cc->errstr << std::endl;
+    redisClusterFree(cc);
+    return (nullptr);
+}
+
+static std::string key_name(uint32_t index)
+{
+    return (KEY_PREFIX "key:" + std::to_string(index));
+}
+
+static std::string queue_name(uint32_t thread_index)
+{
+    return (KEY_PREFIX "queue:" + std::to_string(thread_index));
+}
+
+/*
+ * one pipeline round of depth SETs, read back before the next round starts
+ */
+static bool run_pipeline_round(BenchWorker & worker, const BenchConfig & config, const std::string & value)
+{
+    std::vector<std::string> keys(config.depth);
+    for (uint32_t index = 0; index < config.depth; ++index)
+    {
+        keys[index] = key_name(worker.random() % config.keys);
+        const char * argv[3] = { "SET", keys[index].c_str(), value.c_str() };
+        size_t argvlen[3] = { 3, keys[index].size(), value.size() };
+        int ret = (nullptr != worker.cluster_context ? redisClusterAppendCommandArgv(worker.cluster_context, 3, argv, argvlen) : redisAppendCommandArgv(worker.context, 3, argv, argvlen));
+        if (REDIS_OK != ret)
+        {
+            if (nullptr != worker.cluster_context)
+            {
+                redisClusterReset(worker.cluster_context);
+            }
+            return (false);
+        }
+    }
+
+    bool ret = true;
+    for (uint32_t index = 0; index < config.depth; ++index)
+    {
+        void * reply = nullptr;
+        int status = (nullptr != worker.cluster_context ? redisClusterGetReply(worker.cluster_context, &reply) : redisGetReply(worker.context, &reply));
+        if (REDIS_OK != status || nullptr == reply)
+        {
+            if (nullptr != worker.cluster_context)
+            {
+                redisClusterReset(worker.cluster_context);
+            }
+            return (false);
+        }
+        if (REDIS_REPLY_ERROR == reinterpret_cast<redisReply *>(reply)->type)
+        {
+            ret = false;
+        }
+        freeReplyObject(reply);
+    }
+
+    return (ret);
+}
+
+static void run_worker(BenchWorker & worker, const BenchConfig & config, const std::string & workload, const std::string & value, uint32_t thread_index)
+{
+    uint32_t requests = config.requests / config.threads + (thread_index < config.requests % config.threads ? 1 : 0);
+    const std::string queue = queue_name(thread_index);
+    std::string result;
+    std::list<std::string> batch_keys;
+
+    uint32_t done = 0;
+    while (done < requests)
+    {
+        uint32_t count = 1;
+        bool ok = false;
+        hialloc_counters alloc_beg = { 0, 0, 0 };
+        hialloc_thread_counters(&alloc_beg);
+        uint64_t time_beg = get_time_ns();
+
+        if ("set" == workload)
+        {
+            ok = worker.redis_db.set(key_name(worker.random() % config.keys), value);
+        }
+        else if ("get" == workload)
+        {
+            ok = worker.redis_db.get(key_name(worker.random() % config.keys), result);
+        }
+        else if ("push" == workload)
+        {
+            ok = worker.redis_db.push_back(queue, value);
+        }
+        else if ("pop" == workload)
+        {
+            ok = worker.redis_db.pop_front(queue, result);
+        }
+        else if ("batch" == workload)
+        {
+            count = std::min(config.batch, requests - done);
+            batch_keys.clear();
+            for (uint32_t index = 0; index < count; ++index)
+            {
+                batch_keys.push_back(key_name(worker.random() % config.keys));
+            }
+            hialloc_thread_counters(&alloc_beg);
+            time_beg = get_time_ns();
+            ok = worker.redis_db.expire(batch_keys, 3600);
+        }
+        else if ("pipeline" == workload)
+        {
+            count = config.depth;
+            ok = run_pipeline_round(worker, config, value);
+        }
+
+        hihistogram_record(worker.latency, get_time_ns() - time_beg);
+        hialloc_add_since(&worker.allocs, &alloc_beg);
+        worker.ops += count;
+        if (!ok)
+        {
+            worker.errors += count;
+        }
+        done += count;
+    }
+}
+
+static void merge_histogram(hihistogram * target, const hihistogram * source)
+{
+    target->count += source->count;
+    if (target->max < source->max)
+    {
+        target->max = source->max;
+    }
+    for (size_t index = 0; index < HIHISTOGRAM_BUCKETS; ++index)
+    {
+        target->buckets[index] += source->buckets[index];
+    }
+}
+
+static bool run_workload(std::vector<BenchWorker *> & workers, const BenchConfig & config, const std::string & workload, uint32_t value_size, BenchResult & result)
+{
+    const std::string value(value_size, 'x');
+
+    for (std::vector<BenchWorker *>::iterator iter = workers.begin(); workers.end() != iter; ++iter)
+    {
+        (*iter)->ops = 0;
+        (*iter)->errors = 0;
+        hihistogram_reset((*iter)->latency);
+        memset(&(*iter)->allocs, 0, sizeof((*iter)->allocs));
+    }
+
+    uint64_t time_beg = get_time_ns();
+
+    std::vector<std::thread> threads;
+    for (uint32_t index = 0; index < workers.size(); ++index)
+    {
+        threads.push_back(std::thread(run_worker, std::ref(*workers[index]), std::cref(config), std::cref(workload), std::cref(value), index));
+    }
+    for (std::vector<std::thread>::iterator iter = threads.begin(); threads.end() != iter; ++iter)
+    {
+        iter->join();
+    }
+
+    uint64_t time_end = get_time_ns();
+
+    result.workload = workload;
+    result.value_size = value_size;
+    result.ops = 0;
+    result.errors = 0;
+    result.elapsed_ns = time_end - time_beg;
+    result.allocs = 0;
+    result.alloc_bytes = 0;
+    result.latency = hihistogram_create();
+    if (nullptr == result.latency)
+    {
+        return (false);
+    }
+
+    for (std::vector<BenchWorker *>::const_iterator iter = workers.begin(); workers.end() != iter; ++iter)
+    {
+        result.ops += (*iter)->ops;
+        result.errors += (*iter)->errors;
+        result.allocs += (*iter)->allocs.allocs;
+        result.alloc_bytes += (*iter)->allocs.bytes;
+        merge_histogram(result.latency, (*iter)->latency);
+    }
+
+    return (true);
+}
+
+/*
+ * writes every key of the key space so that reads and batches hit
+ */
+static bool fill_keys(RedisDB & redis_db, const BenchConfig & config, uint32_t value_size)
+{
+    const std::string value(value_size, 'x');
+    for (uint32_t index = 0; index < config.keys; ++index)
+    {
+        if (!redis_db.set(key_name(index), value))
+        {
+            std::cerr << "fill keys failure: " << redis_db.error_message() << std::endl;
+            return (false);
+        }
+    }
+    return (true);
+}
+
+static void clean_keys(RedisDB & redis_db, const BenchConfig & config)
+{
+    std::list<std::string> keys;
+    for (uint32_t index = 0; index < config.keys; ++index)
+    {
+        keys.push_back(key_name(index));
+    }
+    for (uint32_t index = 0; index < config.threads; ++index)
+    {
+        keys.push_back(queue_name(index));
+    }
+    redis_db.erase(keys);
+}
+
+static double latency_us(const hihistogram * histogram, double percentile)
+{
+    return (static_cast<double>(hihistogram_percentile(histogram, percentile)) / 1000.0);
+}
+
+static double per_op(uint64_t value, const BenchResult & result)
+{
+    return (0 == result.ops ? 0.0 : static_cast<double>(value) / static_cast<double>(result.ops));
+}
+
+static void print_json(const BenchConfig & config, const std::string & address, const std::vector<BenchResult> & results)
+{
+    printf("{\n");
+    printf("  \"config\": {\"address\": \"%s\", \"mode\": \"%s\", \"spawned\": %s, \"threads\": %u, \"requests\": %u, \"keys\": %u, \"batch\": %u, \"depth\": %u},\n",
+        address.c_str(), (std::string::npos == address.find(',') ? "standalone" : "cluster"), (config.address.empty() ? "true" : "false"),
+        config.threads, config.requests, config.keys, config.batch, config.depth);
+    printf("  \"results\": [");
+    for (size_t index = 0; index < results.size(); ++index)
+    {
+        const BenchResult & result = results[index];
+        double seconds = static_cast<double>(result.elapsed_ns) / 1000000000.0;
+        printf("%s\n    {\"workload\": \"%s\", \"value_size\": %u, \"ops\": %llu, \"errors\": %llu, \"seconds\": %.6f, \"ops_per_second\": %.1f, "
+            "\"latency_us\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+            (0 == index ? "" : ","), result.workload.c_str(), result.value_size,
+            static_cast<unsigned long long>(result.ops), static_cast<unsigned long long>(result.errors),
+            seconds, (seconds > 0.0 ? static_cast<double>(result.ops) / seconds : 0.0),
+            latency_us(result.latency, 50.0), latency_us(result.latency, 90.0), latency_us(result.latency, 99.0), latency_us(result.latency, 99.9),
+            static_cast<double>(result.latency->max) / 1000.0);
+        if (config.allocs)
+        {
+            printf(", \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}", per_op(result.allocs, result), per_op(result.alloc_bytes, result));
+        }
+        else
+        {
+            printf("}");
+        }
+    }
+    printf("\n  ]\n}\n");
+}
+
+static void print_text(const BenchConfig & config, const std::vector<BenchResult> & results)
+{
+    printf("%-10s %8s %10s %8s %14s %10s %10s %10s %10s", "workload", "value", "ops", "errors", "ops/s", "p50 us", "p99 us", "p999 us", "max us");
+    printf(config.allocs ? " %10s %10s\n" : "\n", "allocs/op", "bytes/op");
+    for (std::vector<BenchResult>::const_iterator iter = results.begin(); results.end() != iter; ++iter)
+    {
+        double seconds = static_cast<double>(iter->elapsed_ns) / 1000000000.0;
+        printf("%-10s %8u %10llu %8llu %14.0f %10.1f %10.1f %10.1f %10.1f", iter->workload.c_str(), iter->value_size,
+            static_cast<unsigned long long>(iter->ops), static_cast<unsigned long long>(iter->errors),
+            (seconds > 0.0 ? static_cast<double>(iter->ops) / seconds : 0.0),
+            latency_us(iter->latency, 50.0), latency_us(iter->latency, 99.0), latency_us(iter->latency, 99.9),
+            static_cast<double>(iter->latency->max) / 1000.0);
+        if (config.allocs)
+        {
+            printf(" %10.2f %10.1f", per_op(iter->allocs, *iter), per_op(iter->alloc_bytes, *iter));
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * a workload over its allocation limit fails the run, so a change that adds allocations to a hot path is caught
+ */
+static bool check_allocs(const BenchConfig & config, const std::vector<BenchResult> & results)
+{
+    bool ret = true;
+    for (std::vector<BenchResult>::const_iterator iter = results.begin(); results.end() != iter; ++iter)
+    {
+        for (std::vector<std::pair<std::string, double>>::const_iterator limit = config.max_allocs.begin(); config.max_allocs.end() != limit; ++limit)
+        {
+            if (limit->first == iter->workload && per_op(iter->allocs, *iter) > limit->second)
+            {
+                std::cerr << "workload " << iter->workload << " value size " << iter->value_size << " makes " << per_op(iter->allocs, *iter)
+                          << " allocations per operation, more than " << limit->second << std::endl;
+                ret = false;
+            }
+        }
+    }
+    return (ret);
+}
+
+static void close_workers(std::vector<BenchWorker *> & workers)
+{
+    for (std::vector<BenchWorker *>::iterator iter = workers.begin(); workers.end() != iter; ++iter)
+    {
+        BenchWorker * worker = *iter;
+        worker->redis_db.close();
+        redisFree(worker->context);
+        redisClusterFree(worker->cluster_context);
+        hihistogram_destroy(worker->latency);
+        delete worker;
+    }
+    workers.clear();
+}
+
+static bool open_workers(std::vector<BenchWorker *> & workers, const BenchConfig & config, const std::string & address)
+{
+    const bool cluster = (std::string::npos != address.find(','));
+
+    for (uint32_t index = 0; index < config.threads; ++index)
+    {
+        BenchWorker * worker = new BenchWorker;
+        worker->context = nullptr;
+        worker->cluster_context = nullptr;
+        worker->random.seed(index + 1);
+        worker->ops = 0;
+        worker->errors = 0;
+        worker->latency = hihistogram_create();
+        memset(&worker->allocs, 0, sizeof(worker->allocs));
+        workers.push_back(worker);
+
+        if (nullptr == worker->latency)
+        {
+            return (false);
+        }
+
+        if (!worker->redis_db.open(address, config.username, config.password))
+        {
+            std::cerr << "open redis db [" << address << "] failure: " << worker->redis_db.error_message() << std::endl;
+            return (false);
+        }
+
+        if (cluster)
+        {
+            worker->cluster_context = connect_cluster(address, config);
+        }
+        else
+        {
+            worker->context = connect_server(address, config);
+        }
+        if (nullptr == worker->context && nullptr == worker->cluster_context)
+        {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+static bool has_workload(const BenchConfig & config, const char * name)
+{
+    for (std::vector<std::string>::const_iterator iter = config.workloads.begin(); config.workloads.end() != iter; ++iter)
+    {
+        if (name == *iter)
+        {
+            return (true);
+        }
+    }
+    return (false);
+}
+
+int main(int argc, char * argv[])
+{
+    BenchConfig config;
+    if (!parse_config(argc, argv, config))
+    {
+        usage(argv[0]);
+        return (1);
+    }
+
+    for (std::vector<std::string>::const_iterator iter = config.workloads.begin(); config.workloads.end() != iter; ++iter)
+    {
+        if ("set" != *iter && "get" != *iter && "push" != *iter && "pop" != *iter && "batch" != *iter && "pipeline" != *iter)
+        {
+            std::cerr << "unknown workload " << *iter << std::endl;
+            return (1);
+        }
+    }
+
+    std::string address = config.address;
+
+#ifndef _MSC_VER
+    LocalServer local_server;
+    if (address.empty() && !local_server.start(config, address))
+    {
+        return (2);
+    }
+#else
+    if (address.empty())
+    {
+        std::cerr << "spawning redis-server is not supported on windows, pass --address" << std::endl;
+        return (2);
+    }
+#endif // _MSC_VER
+
+    if (config.allocs && 0 != hialloc_install())
+    {
+        std::cerr << "allocation counting needs to be installed before any client is open" << std::endl;
+        return (2);
+    }
+
+    std::vector<BenchWorker *> workers;
+    if (!open_workers(workers, config, address))
+    {
+        close_workers(workers);
+        return (2);
+    }
+
+    int ret = 0;
+    std::vector<BenchResult> results;
+
+    for (std::vector<uint32_t>::const_iterator size_iter = config.value_sizes.begin(); config.value_sizes.end() != size_iter && 0 == ret; ++size_iter)
+    {
+        if ((has_workload(config, "get") || has_workload(config, "batch")) && !fill_keys(workers.front()->redis_db, config, *size_iter))
+        {
+            ret = 3;
+            break;
+        }
+
+        for (std::vector<std::string>::const_iterator iter = config.workloads.begin(); config.workloads.end() != iter; ++iter)
+        {
+            BenchResult result;
+            if (!run_workload(workers, config, *iter, *size_iter, result))
+            {
+                ret = 3;
+                break;
+            }
+            results.push_back(result);
+        }
+    }
+
+    clean_keys(workers.front()->redis_db, config);
+    close_workers(workers);
+
+    if ("json" == config.format)
+    {
+        print_json(config, address, results);
+    }
+    else
+    {
+        print_text(config, results);
+    }
+
+    if (0 == ret && !check_allocs(config, results))
+    {
+        ret = 4;
+    }
+
+    for (std::vector<BenchResult>::iterator iter = results.begin(); results.end() != iter; ++iter)
+    {
+        hihistogram_destroy(iter->latency);
+    }
+
+    return (ret);
+}
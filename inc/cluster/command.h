@@ -35,6 +35,7 @@
 #include <stdint.h>
 
 #include "adlist.h"
+#include "hiarray.h"
 #include <hiredis.h>
 
 typedef enum cmd_parse_result {
@@ -68,6 +69,13 @@ struct keypos {
                             pairs in command, like mset */
 };
 
+/* Number of keypos stored inside struct cmd before the keys array
+ * moves to the heap. Most commands have a single key. */
+#define CMD_INLINE_KEYS 1
+
+struct cmd_pool;
+struct hiarena;
+
 struct cmd {
 
     uint64_t id; /* command id */
@@ -94,6 +102,7 @@ struct cmd {
                       * or if its a multi-key command cross different
                       * nodes (cross slot) */
     char *node_addr; /* Command sent to this node address */
+    int64_t started; /* Appended at (usec), when tracing */
 
     struct cmd *
         *frag_seq; /* sequence of fragment command, map from keys to fragments*/
@@ -101,11 +110,35 @@ struct cmd {
     redisReply *reply;
 
     hilist *sub_commands; /* just for pipeline and multi-key commands */
+
+    struct cmd_pool *pool; /* pool the command returns to, or NULL */
+    struct cmd *next_free; /* next command in the pool free list */
+
+    struct hiarray keys_array;                  /* storage of keys */
+    struct keypos keys_inline[CMD_INLINE_KEYS]; /* inline keypos storage */
+};
+
+/* Free list of recycled commands, one per cluster context. A recycled
+ * command keeps its keypos storage, so the steady state of a pipeline
+ * or a multi-key command does not touch the allocator for commands. */
+struct cmd_pool {
+    struct cmd *free_list; /* recycled commands */
+    uint32_t nfree;        /* # commands in free_list */
+    uint32_t max_free;     /* max # commands kept in free_list */
+    struct hiarena *reply_arena; /* replies the commands must not free */
 };
 
 void redis_parse_cmd(struct cmd *r);
+cmd_type_t redis_command_type(const char *arg0, uint32_t arg0_len,
+                              const char *arg1, uint32_t arg1_len);
+const char *redis_command_name(cmd_type_t type, const char **subname);
 
 struct cmd *command_get(void);
 void command_destroy(struct cmd *command);
+struct keypos *command_push_key(struct cmd *command);
+
+struct cmd_pool *command_pool_create(uint32_t max_free);
+void command_pool_destroy(struct cmd_pool *pool);
+struct cmd *command_pool_get(struct cmd_pool *pool);
 
 #endif
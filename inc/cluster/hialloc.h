@@ -0,0 +1,56 @@
+/********************************************************
+ * Description : allocation counting of hiredis and hircluster
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef __HIALLOC_H_
+#define __HIALLOC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Allocations of one thread, or of the calls of one command. */
+struct hialloc_counters {
+    uint64_t calls;  /* # calls the allocations were made by, 0 for a thread */
+    uint64_t allocs; /* malloc, calloc, realloc and strdup */
+    uint64_t bytes;  /* bytes asked for */
+};
+
+/* Installs counting allocators with hiredisSetAllocators(), in front of the
+ * ones installed before. Counting starts with the first call and is never
+ * turned off again, later calls do nothing. Allocators installed after this
+ * one replace it.
+ * hiredisSetAllocators() swaps the process-wide table without a lock, so
+ * the first call has to come before any client is open: it returns -1 and
+ * installs nothing while one is, 0 otherwise. */
+int hialloc_install(void);
+int hialloc_installed(void);
+
+/* A client, which may allocate from any thread until closed. Every cluster
+ * context is one, from redisClusterContextInit() to redisClusterFree(),
+ * hiredis contexts made outside of it have to be counted by their owner. */
+void hialloc_client_open(void);
+void hialloc_client_close(void);
+
+/* Counts an allocation made outside of hiredis, e.g. by operator new. */
+void hialloc_record(size_t size);
+
+/* Allocations of the calling thread since counting started. A command is
+ * measured by the difference of two snapshots around it. */
+void hialloc_thread_counters(struct hialloc_counters *counters);
+void hialloc_add_since(struct hialloc_counters *total,
+                       const struct hialloc_counters *start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
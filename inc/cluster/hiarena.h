@@ -0,0 +1,55 @@
+/********************************************************
+ * Description : arena allocator for redis replies
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef __HIARENA_H_
+#define __HIARENA_H_
+
+#include <stddef.h>
+
+#include <hiredis.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HIARENA_DEFAULT_BLOCK_SIZE (16 * 1024)
+
+struct hiarena_block;
+
+/* A bump allocator. Memory is only handed back to the system by
+ * hiarena_reset() and hiarena_destroy(), all at once. */
+struct hiarena {
+    struct hiarena_block *blocks; /* blocks in use, the retained one last */
+    struct hiarena_block *first;  /* block kept across resets */
+    size_t block_size;            /* size of regular blocks */
+    size_t allocated;             /* bytes handed out since the last reset */
+};
+
+struct hiarena *hiarena_create(size_t block_size);
+void hiarena_destroy(struct hiarena *a);
+void hiarena_reset(struct hiarena *a);
+
+void *hiarena_alloc(struct hiarena *a, size_t size);
+void *hiarena_calloc(struct hiarena *a, size_t nmemb, size_t size);
+int hiarena_owns(const struct hiarena *a, const void *ptr);
+
+/* Reply object functions building redisReply trees inside the arena passed
+ * as reader privdata. freeObject does nothing, the tree goes away with the
+ * next hiarena_reset(). */
+extern redisReplyObjectFunctions hiarenaReplyFunctions;
+
+/* Replaces the reader of a context without pending input by one that builds
+ * its replies in the arena. */
+int hiarena_attach(redisContext *c, struct hiarena *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/********************************************************
+ * Description : latency histogram with logarithmic buckets
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef __HIHISTOGRAM_H_
+#define __HIHISTOGRAM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Every power of two is split into 1 << HIHISTOGRAM_SUB_BITS buckets, which
+ * keeps the error of a percentile below 1 / 16. Values of 2^MAX_BITS and
+ * above are counted in the last bucket. */
+#define HIHISTOGRAM_SUB_BITS 4
+#define HIHISTOGRAM_MAX_BITS 36
+#define HIHISTOGRAM_BUCKETS                                                    \
+    ((HIHISTOGRAM_MAX_BITS - HIHISTOGRAM_SUB_BITS + 1) << HIHISTOGRAM_SUB_BITS)
+
+/* Counts of values, in the style of HdrHistogram. Recording is a few
+ * instructions without any allocation. There is no locking, a histogram
+ * belongs to the thread that records into it. */
+struct hihistogram {
+    uint64_t count;                        /* # recorded values */
+    uint64_t max;                          /* highest recorded value */
+    uint64_t buckets[HIHISTOGRAM_BUCKETS]; /* # values of each bucket */
+};
+
+struct hihistogram *hihistogram_create(void);
+void hihistogram_destroy(struct hihistogram *h);
+void hihistogram_reset(struct hihistogram *h);
+
+void hihistogram_record(struct hihistogram *h, uint64_t value);
+
+/* The value below which percentile percent (0 to 100) of the recorded values
+ * are, rounded up to the end of its bucket. 0 for an empty histogram. */
+uint64_t hihistogram_percentile(const struct hihistogram *h,
+                                double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -39,6 +39,11 @@
 
 #define UNUSED(x) (void)(x)
 
+struct hialloc_counters;
+struct hihistogram;
+struct hislowlog;
+struct hislowlog_entry;
+
 #define HIREDIS_CLUSTER_MAJOR 0
 #define HIREDIS_CLUSTER_MINOR 11
 #define HIREDIS_CLUSTER_PATCH 0
@@ -50,6 +55,10 @@
 #define REDIS_ROLE_MASTER 1
 #define REDIS_ROLE_SLAVE 2
 
+// Cluster errors are offset by 100 to be sufficiently out of range of
+// standard Redis errors
+#define REDIS_ERR_CLUSTER_TOO_MANY_RETRIES 100
+
 /* Configuration flags */
 #define HIRCLUSTER_FLAG_NULL 0x0
 /* Flag to enable parsing of slave nodes. Currently not used, but the
@@ -66,6 +75,13 @@
 #define HIRCLUSTER_EVENT_SLOTMAP_UPDATED 1
 #define HIRCLUSTER_EVENT_READY 2
 #define HIRCLUSTER_EVENT_FREE_CONTEXT 3
+#define HIRCLUSTER_EVENT_CONNECT 4        /* New connection to a node */
+#define HIRCLUSTER_EVENT_RECONNECT 5      /* Broken connection re-established */
+#define HIRCLUSTER_EVENT_CONNECT_FAILED 6 /* Connect or handshake failed */
+#define HIRCLUSTER_EVENT_MOVED 7          /* MOVED redirect received */
+#define HIRCLUSTER_EVENT_ASK 8            /* ASK redirect received */
+#define HIRCLUSTER_EVENT_RETRY 9          /* TRYAGAIN or CLUSTERDOWN retried */
+#define HIRCLUSTER_EVENT_SLOTMAP_UPDATE_FAILED 10
 
 #ifdef __cplusplus
 extern "C" {
@@ -73,8 +89,16 @@ extern "C" {
 
 struct dict;
 struct hilist;
+struct hiring;
+struct cmd_pool;
+struct hiarena;
+struct pollfd;
+struct askcache;
+struct slotmapRefresher;
+struct slotmapSnapshot;
 struct redisClusterAsyncContext;
 
+typedef struct redisClusterSlotmapGroup redisClusterSlotmapGroup;
 typedef int(adapterAttachFn)(redisAsyncContext *, void *);
 typedef int(sslInitFn)(redisContext *, void *);
 typedef void(redisClusterCallbackFn)(struct redisClusterAsyncContext *, void *,
@@ -85,8 +109,9 @@ typedef struct redisClusterNode {
     sds host;
     uint16_t port;
     uint8_t role;
-    uint8_t pad;
+    uint8_t shared;    /* name, addr, host and slot lists are borrowed */
     int failure_count; /* consecutive failing attempts in async */
+    uint32_t index;    /* Position in a shared route, see slotmap groups */
     redisContext *con;
     redisAsyncContext *acon;
     int64_t lastConnectionAttempt; /* Timestamp */
@@ -94,8 +119,55 @@ typedef struct redisClusterNode {
     struct hilist *slaves;
     struct hiarray *migrating; /* copen_slot[] */
     struct hiarray *importing; /* copen_slot[] */
+    struct hiring *replies;    /* Replies read ahead of their turn (Pipel.) */
+    uint32_t pending;          /* Replies still expected on con (Pipel.) */
+    struct hihistogram *latency; /* Owned by the context, NULL until used */
 } redisClusterNode;
 
+/* Operational counters, see redisClusterGetStats(). */
+typedef struct redisClusterStats {
+    uint64_t connects;                /* Connections established */
+    uint64_t reconnects;              /* Broken connections re-established */
+    uint64_t connect_failures;        /* Failed connects and handshakes */
+    uint64_t commands;                /* Commands executed (blocking API) */
+    uint64_t command_errors;          /* Commands without a reply */
+    uint64_t moved;                   /* MOVED redirects */
+    uint64_t ask;                     /* ASK redirects */
+    uint64_t tryagain;                /* TRYAGAIN replies retried */
+    uint64_t clusterdown;             /* CLUSTERDOWN replies retried */
+    uint64_t slotmap_updates;         /* Slotmaps installed */
+    uint64_t slotmap_update_failures; /* Failed slotmap refreshes */
+    uint64_t bytes_out;               /* Written to the sockets, before TLS */
+    uint64_t bytes_in;                /* Read from the sockets, after TLS */
+    int64_t in_flight;                /* Commands waiting for their reply */
+} redisClusterStats;
+
+/* Tracing, see redisClusterSetTraceCallback() */
+#define HIRCLUSTER_TRACE_BEGIN 1 /* The command is about to be sent */
+#define HIRCLUSTER_TRACE_END 2   /* Its reply arrived or it failed */
+#define HIRCLUSTER_TRACE_MAX_HOPS 4
+#define HIRCLUSTER_TRACE_ADDR_LEN 64
+
+typedef struct redisClusterTrace {
+    int type;             /* Command type, see redisClusterCommandName() */
+    int slot;             /* Key slot, -1 when not routed by key */
+    int pipelined;        /* Appended, the reply is read by GetReply */
+    int status;           /* REDIS_OK when a reply arrived (END) */
+    int64_t start_us;     /* hi_usec_now() when the command was issued */
+    int64_t duration_us;  /* Until the reply (END) */
+    uint64_t bytes_out;   /* Request bytes, resends included */
+    uint64_t bytes_in;    /* Read from the sockets meanwhile (END) */
+    int redirects;        /* MOVED and ASK redirects followed */
+    int retries;          /* TRYAGAIN and CLUSTERDOWN retries */
+    int nhops;            /* Entries in hops */
+    /* Nodes the command went to in order, the one that answered last. A
+     * longer chain keeps its first entries and the last one. */
+    char hops[HIRCLUSTER_TRACE_MAX_HOPS][HIRCLUSTER_TRACE_ADDR_LEN];
+} redisClusterTrace;
+
+typedef void(redisClusterTraceFn)(const redisClusterTrace *trace, int phase,
+                                  void *privdata);
+
 typedef struct cluster_slot {
     uint32_t start;
     uint32_t end;
@@ -119,18 +191,62 @@ typedef struct redisClusterContext {
     struct timeval *connect_timeout; /* TCP connect timeout */
     struct timeval *command_timeout; /* Receive and send timeout */
     int max_retry_count;             /* Allowed retry attempts */
+    int retry_base_delay_ms;         /* Backoff before the first retry */
+    int retry_max_delay_ms;          /* Backoff cap */
+    int retry_deadline_ms;           /* Retry window of a command, 0: none */
+    int retry_budget;                /* Retries per second, 0: no limit */
     char *username;                  /* Authenticate using user */
     char *password;                  /* Authentication password */
+    char *client_name;               /* CLIENT SETNAME on new connections */
 
     struct dict *nodes;       /* Known redisClusterNode's */
     uint64_t route_version;   /* Increased when the node lookup table changes */
     redisClusterNode **table; /* redisClusterNode lookup table */
 
-    struct hilist *requests; /* Outstanding commands (Pipelining) */
+    struct hiring *requests; /* Outstanding commands (Pipelining) */
+    struct cmd_pool *command_pool; /* Recycled commands */
+    struct hiarena *reply_arena;   /* Reply storage when enabled */
+
+    struct pollfd *poll_fds;         /* Scratch space for pipeline polling */
+    redisClusterNode **poll_nodes;   /* Node of each entry in poll_fds */
+    uint32_t poll_nalloc;            /* # allocated entries of both */
+
+    struct askcache *ask_cache; /* Keys moved by a slot migration (ASK) */
+    uint64_t ask_cache_hits;    /* Commands sent by the cache with ASKING */
+    uint64_t ask_cache_misses;  /* ASK redirects that had to be followed */
+
+    struct hihistogram **command_latency; /* Per command type, or NULL */
+    struct dict *node_latency;            /* Per node address, or NULL */
+    struct hialloc_counters *command_allocs; /* Per command type, or NULL */
+
+    struct slotmapRefresher *refresher; /* Background slotmap updates */
+
+    char *slotmap_file;              /* Snapshot of the slotmap, or NULL */
+    uint64_t slotmap_file_signature; /* Topology saved in the snapshot */
+
+    struct redisClusterSlotmapGroup *slotmap_group; /* Shared route, or NULL */
+    uint64_t slotmap_group_version; /* Route of the group installed last */
+    struct slotmapSnapshot *slotmap_snapshot; /* Route table belongs to */
+    redisClusterNode **slotmap_links; /* Node of cc per node of the route */
 
     int retry_count;       /* Current number of failing attempts */
     int need_update_route; /* Indicator for redisClusterReset() (Pipel.) */
 
+    double retry_tokens;       /* Retries left in the budget */
+    int64_t retry_tokens_time; /* Last refill of retry_tokens (usec) */
+    uint64_t retry_seed;       /* State of the backoff jitter */
+    int64_t deadline;          /* Operation deadline (usec), 0: none */
+
+    struct hislowlog *slowlog;    /* Slow commands, or NULL */
+    int64_t slowlog_threshold_us; /* Commands taking longer are logged */
+
+    redisClusterTraceFn *trace_fn; /* Called around each command, or NULL */
+    void *trace_privdata;
+
+    redisClusterStats stats; /* Written by the owning thread only */
+    const redisContextFuncs *transport; /* Functions wrapped by stat_funcs */
+    redisContextFuncs stat_funcs;       /* Count the bytes of a connection */
+
     void *ssl; /* Pointer to a redisSSLContext when using SSL/TLS. */
     sslInitFn *ssl_init_fn; /* Func ptr for SSL context initiation */
 
@@ -160,6 +276,10 @@ typedef struct redisClusterAsyncContext {
     /* Called when the first write event was received. */
     redisConnectCallback *onConnect;
 
+    /* Commands waiting out a TRYAGAIN or CLUSTERDOWN backoff, oldest due
+     * first. See redisClusterAsyncHandleRetries(). */
+    struct hilist *retries;
+
 } redisClusterAsyncContext;
 
 typedef struct redisClusterNodeIterator {
@@ -193,6 +313,19 @@ int redisClusterSetOptionUsername(redisClusterContext *cc,
                                   const char *username);
 int redisClusterSetOptionPassword(redisClusterContext *cc,
                                   const char *password);
+/* Name new connections with CLIENT SETNAME, in the same round trip as AUTH. */
+int redisClusterSetOptionClientName(redisClusterContext *cc,
+                                    const char *name);
+/* Keep a snapshot of the slotmap in a file. redisClusterConnect2() starts
+ * from the snapshot instead of querying the cluster, the first command then
+ * validates it with a refresh pipelined on its connection. MOVED redirects
+ * correct stale entries until that refresh lands. */
+int redisClusterSetOptionSlotmapFile(redisClusterContext *cc,
+                                     const char *path);
+/* Share the route with the other contexts of a group, see
+ * redisClusterSlotmapGroupCreate(). Set before redisClusterConnect2(). */
+int redisClusterSetOptionSlotmapGroup(redisClusterContext *cc,
+                                      redisClusterSlotmapGroup *group);
 int redisClusterSetOptionParseSlaves(redisClusterContext *cc);
 int redisClusterSetOptionParseOpenSlots(redisClusterContext *cc);
 int redisClusterSetOptionRouteUseSlots(redisClusterContext *cc);
@@ -201,6 +334,78 @@ int redisClusterSetOptionConnectTimeout(redisClusterContext *cc,
 int redisClusterSetOptionTimeout(redisClusterContext *cc,
                                  const struct timeval tv);
 int redisClusterSetOptionMaxRetry(redisClusterContext *cc, int max_retry_count);
+/* Wait between retries of a command failing with TRYAGAIN or CLUSTERDOWN,
+ * starting at base_delay_ms and doubling up to max_delay_ms, of which a
+ * random half. The default is 10 ms up to 1000 ms, 0 disables the wait.
+ * Asynchronous commands wait in a list which is sent when due, see
+ * redisClusterAsyncHandleRetries(). */
+int redisClusterSetOptionRetryBackoff(redisClusterContext *cc,
+                                      int base_delay_ms, int max_delay_ms);
+/* Stop retrying a command deadline_ms after it was sent first, 0 (default)
+ * for no limit besides the retry count. */
+int redisClusterSetOptionRetryDeadline(redisClusterContext *cc,
+                                       int deadline_ms);
+/* Allow no more than retries_per_second TRYAGAIN or CLUSTERDOWN retries over
+ * all commands of the context, with bursts of as many. 0 (default) for no
+ * limit. */
+int redisClusterSetOptionRetryBudget(redisClusterContext *cc,
+                                     int retries_per_second);
+/* Synchronous commands issued from now on have to complete within
+ * timeout_ms, connects, redirects and retries included, or fail with
+ * REDIS_ERR_TIMEOUT. Socket timeouts are shortened to what is left. 0 clears
+ * the deadline. */
+int redisClusterSetDeadline(redisClusterContext *cc, int timeout_ms);
+
+/* Latency statistics, see redisClusterSetOptionLatencyStats() */
+typedef void(redisClusterLatencyFn)(const char *name,
+                                    const struct hihistogram *h,
+                                    void *privdata);
+/* Calls command_fn for every command type ("GET", "CLUSTER SLOTS", ...) and
+ * node_fn for every node address that recorded latencies. Either may be
+ * NULL. */
+void redisClusterLatencyForEach(redisClusterContext *cc,
+                                redisClusterLatencyFn *command_fn,
+                                redisClusterLatencyFn *node_fn,
+                                void *privdata);
+void redisClusterLatencyReset(redisClusterContext *cc);
+/* Allocation statistics, see redisClusterSetOptionAllocStats() */
+typedef void(redisClusterAllocFn)(const char *name,
+                                  const struct hialloc_counters *counters,
+                                  void *privdata);
+/* Calls fn for every command type that counted allocations. */
+void redisClusterAllocForEach(redisClusterContext *cc, redisClusterAllocFn *fn,
+                              void *privdata);
+void redisClusterAllocReset(redisClusterContext *cc);
+/* The command type keying the latency statistics, 0 when unknown, and its
+ * name written to buf. */
+int redisClusterCommandType(const char *name, size_t len);
+const char *redisClusterCommandName(int type, char *buf, size_t size);
+/* Log synchronous commands taking threshold_us or longer, redirects,
+ * retries and reconnects included, in a ring of size entries (0: default).
+ * Unlike SLOWLOG on the server this covers the client side of a call. */
+int redisClusterSetOptionSlowlog(redisClusterContext *cc, int threshold_us,
+                                 uint32_t size);
+/* Takes the oldest entry out of the slowlog, see hislowlog.h. Returns 0 when
+ * there is none. One thread besides the owner of the context may do so
+ * concurrently. */
+int redisClusterSlowlogPop(redisClusterContext *cc,
+                           struct hislowlog_entry *entry);
+/* Copies the operational counters. Other threads may take the snapshot
+ * while the context is in use, each counter is read atomically. */
+void redisClusterGetStats(const redisClusterContext *cc,
+                          redisClusterStats *stats);
+/* Build replies in an arena owned by the context. Such replies must not be
+ * passed to freeReplyObject(), they stay valid until the next call to
+ * redisClusterFreeReplies() which releases all of them at once. */
+int redisClusterSetOptionReplyArena(redisClusterContext *cc);
+/* Record the latency of synchronous commands in usec, per command type and
+ * per node address, redirects and retries included. */
+int redisClusterSetOptionLatencyStats(redisClusterContext *cc);
+/* Count the allocations of synchronous commands per command type, from the
+ * formatted command to the reply, redirects and retries included. Installs
+ * the counting allocators of hialloc.h, which stay in place. Set before
+ * connecting, fails while another context or client of hialloc.h is open. */
+int redisClusterSetOptionAllocStats(redisClusterContext *cc);
 /* Deprecated function, replaced with redisClusterSetOptionMaxRetry() */
 void redisClusterSetMaxRedirect(redisClusterContext *cc,
                                 int max_redirect_count);
@@ -217,7 +422,15 @@ void redisClusterSetMaxRedirect(redisClusterContext *cc,
 int redisClusterSetConnectCallback(redisClusterContext *cc,
                                    void(fn)(const redisContext *c, int status));
 
-/* A hook for events. */
+/* A hook called with HIRCLUSTER_TRACE_BEGIN and HIRCLUSTER_TRACE_END around
+ * every command, blocking or pipelined. The trace is only valid during the
+ * call, fn must not use the context. NULL removes the hook. */
+int redisClusterSetTraceCallback(redisClusterContext *cc,
+                                 redisClusterTraceFn *fn, void *privdata);
+
+/* A hook for events, HIRCLUSTER_EVENT_*. Called from within the command
+ * that caused the event, the callback must not use the context beyond
+ * reading it, e.g. with redisClusterGetStats(). */
 int redisClusterSetEventCallback(redisClusterContext *cc,
                                  void(fn)(const redisClusterContext *cc,
                                           int event, void *privdata),
@@ -267,9 +480,45 @@ int redisClusterGetReply(redisClusterContext *cc, void **reply);
 /* Reset context after a performed pipelining */
 void redisClusterReset(redisClusterContext *cc);
 
+/* Release all replies built in the reply arena, see
+ * redisClusterSetOptionReplyArena(). */
+void redisClusterFreeReplies(redisClusterContext *cc);
+
 /* Update the slotmap by querying any node. */
 int redisClusterUpdateSlotmap(redisClusterContext *cc);
 
+/* Keep the slotmap up to date from a background thread, started after a
+ * successful redisClusterConnect2(). The thread queries the cluster every
+ * interval_ms milliseconds (0 for never) and whenever a MOVED redirect or a
+ * connection error calls for it. A changed topology is installed by the next
+ * command sent without outstanding pipelined requests, so commands no longer
+ * wait for topology discovery. Until then, commands for an unreachable node
+ * fail instead of updating the slotmap inline. The thread stops in
+ * redisClusterFree(). Not available on Windows, where REDIS_ERR is returned. */
+int redisClusterStartSlotmapRefresher(redisClusterContext *cc, int interval_ms);
+
+/* Connect and authenticate to every master serving slots, and to the replicas
+ * when slaves are parsed, concurrently, after a successful
+ * redisClusterConnect2(). Saves the first command on each node the connect
+ * and AUTH round trips. Returns REDIS_ERR when a node failed, that node keeps
+ * no connection (node->con is NULL) and is connected lazily later. */
+int redisClusterConnectAll(redisClusterContext *cc);
+
+/* A slotmap group lets contexts of the same cluster, e.g. those of a
+ * connection pool, share one route. A route one member gets from the cluster
+ * is installed by the others with their next command, found by a lock-free
+ * version check. Only one member queries the cluster at a time, the others
+ * wait for and adopt its result, as long as their deadline allows, so a
+ * failover costs one CLUSTER SLOTS query instead of one per context. The
+ * lookup table and the node directory are shared and never modified, every
+ * context only keeps its connections, in a node of its own per shared node.
+ * A MOVED redirect therefore does not patch the table, the refresh it
+ * triggers does for the whole group. Reference counted: the creator and each
+ * member context hold a reference. Not available on Windows, where NULL is
+ * returned. */
+redisClusterSlotmapGroup *redisClusterSlotmapGroupCreate(void);
+void redisClusterSlotmapGroupRelease(redisClusterSlotmapGroup *group);
+
 /* Internal functions */
 redisContext *ctx_get_by_node(redisClusterContext *cc, redisClusterNode *node);
 struct dict *parse_cluster_nodes(redisClusterContext *cc, char *str,
@@ -296,6 +545,14 @@ redisClusterAsyncContext *redisClusterAsyncConnect(const char *addrs,
 int redisClusterAsyncConnect2(redisClusterAsyncContext *acc);
 void redisClusterAsyncDisconnect(redisClusterAsyncContext *acc);
 
+/* Sends the commands whose TRYAGAIN or CLUSTERDOWN backoff has elapsed and
+ * returns the time in ms until the next one is due, -1 when none waits.
+ * Due retries also go out whenever a reply arrives or a command is sent,
+ * an otherwise idle event loop should call this from a timer. Commands
+ * still waiting are failed by redisClusterAsyncDisconnect() and
+ * redisClusterAsyncFree(). */
+int redisClusterAsyncHandleRetries(redisClusterAsyncContext *acc);
+
 /* Commands */
 int redisClusterAsyncCommand(redisClusterAsyncContext *acc,
                              redisClusterCallbackFn *fn, void *privdata,
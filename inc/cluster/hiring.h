@@ -0,0 +1,40 @@
+/********************************************************
+ * Description : growable ring buffer of pointers
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef __HIRING_H_
+#define __HIRING_H_
+
+#include <stdint.h>
+
+/* A FIFO of pointers kept in one contiguous, power of two sized buffer.
+ * Pushing and popping never allocate unless the ring has to grow. */
+struct hiring {
+    void **elem;             /* circular buffer */
+    uint32_t head;           /* index of the first element */
+    uint32_t nelem;          /* # element */
+    uint32_t nalloc;         /* # allocated element, a power of two */
+    void (*free)(void *ptr); /* destructor of elements, may be NULL */
+};
+
+static inline uint32_t hiring_n(const struct hiring *r) { return r->nelem; }
+
+/* Returns the first element without removing it, or NULL when empty. */
+static inline void *hiring_first(const struct hiring *r) {
+    return r->nelem == 0 ? NULL : r->elem[r->head];
+}
+
+struct hiring *hiring_create(uint32_t n);
+void hiring_destroy(struct hiring *r);
+void hiring_clear(struct hiring *r);
+
+int hiring_push(struct hiring *r, void *ptr);
+void *hiring_pop(struct hiring *r);
+void *hiring_get(const struct hiring *r, uint32_t idx);
+
+#endif
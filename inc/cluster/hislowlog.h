@@ -0,0 +1,65 @@
+/********************************************************
+ * Description : ring buffer of slow client-side commands
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef __HISLOWLOG_H_
+#define __HISLOWLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISLOWLOG_DEFAULT_SIZE 128
+#define HISLOWLOG_COMMAND_LEN 128 /* longer commands are truncated */
+#define HISLOWLOG_ADDR_LEN 64
+
+struct hislowlog_entry {
+    int64_t time;                        /* start, usec since the epoch */
+    int64_t duration;                    /* usec, reconnects and retries in */
+    int slot;                            /* -1 when not routed by key */
+    int retries;                         /* redirects and retries */
+    int reconnected;                     /* a connection had to be made */
+    char command[HISLOWLOG_COMMAND_LEN]; /* arguments separated by spaces */
+    char node[HISLOWLOG_ADDR_LEN];       /* node that answered last */
+};
+
+/* A single-producer single-consumer ring. The thread recording commands
+ * pushes, any one other thread may pop at the same time without locks.
+ * Entries pushed while the ring is full are dropped and counted. */
+struct hislowlog {
+    uint32_t size;    /* # entries, a power of two */
+    uint64_t head;    /* entries pushed, written by the producer */
+    uint64_t tail;    /* entries popped, written by the consumer */
+    uint64_t dropped; /* entries lost to a full ring */
+    struct hislowlog_entry *entries; /* allocated along with the ring */
+};
+
+struct hislowlog *hislowlog_create(uint32_t size);
+void hislowlog_destroy(struct hislowlog *l);
+
+/* Returns 0 when the entry was dropped. */
+int hislowlog_push(struct hislowlog *l, const struct hislowlog_entry *entry);
+/* Returns 0 when the ring is empty. */
+int hislowlog_pop(struct hislowlog *l, struct hislowlog_entry *entry);
+uint64_t hislowlog_dropped(const struct hislowlog *l);
+
+/* Writes the arguments of a command in the redis protocol to the entry,
+ * separated by spaces and truncated to fit. */
+void hislowlog_set_command(struct hislowlog_entry *entry, const char *cmd,
+                           size_t len);
+/* Microseconds since the epoch. */
+int64_t hislowlog_time_now(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
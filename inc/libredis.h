@@ -35,6 +35,113 @@
 
 class RedisDBImpl;
 
+enum RedisErrorKind
+{
+    redis_error_none = 0,                                           /* the last command got the reply it expected, or a plain negative one (e.g. missing key) */
+    redis_error_command,                                            /* the server rejected the command (WRONGTYPE, OOM, ...), the connection is kept */
+    redis_error_reply,                                              /* the reply is not of the type the operation expects, the connection is kept */
+    redis_error_cluster,                                            /* cluster redirects or retries ran out (TRYAGAIN, CLUSTERDOWN, ...) or a node answered READONLY/NOAUTH, the connections are kept and the route is reloaded */
+    redis_error_connection,                                         /* i/o error, timeout, lost authentication or READONLY on a single server, the connection is dropped and reopened by the next command */
+    redis_error_unavailable,                                        /* not open, or no connection could be made */
+    redis_error_timeout                                             /* the command timeout or the operation deadline passed, a connection with a command in flight is dropped */
+};
+
+struct LIBREDIS_API RedisOptions
+{
+    RedisOptions();
+
+    uint16_t                            table;                      /* database of a standalone server */
+    uint32_t                            timeout;                    /* milliseconds to connect */
+    uint32_t                            command_timeout;            /* milliseconds to wait for a reply, 0 for no limit */
+    uint32_t                            operation_timeout;          /* milliseconds a call may take, reconnects, redirects and retries included, 0 for no limit */
+    bool                                slotmap_refresh;            /* cluster only, keep the slotmap current from a background thread, not supported on windows */
+    uint32_t                            slotmap_refresh_interval;   /* milliseconds between two background refreshes, 0 to refresh on redirects and connection errors only */
+    std::string                         slotmap_file;               /* cluster only, snapshot of the slotmap to start from without querying the cluster, empty for none */
+    bool                                warm_up;                    /* cluster only, connect to all masters concurrently while opening instead of on their first command */
+    std::string                         slotmap_group;              /* cluster only, instances opened with the same group name share one slotmap and its refreshes, empty for none, not supported on windows */
+    std::string                         client_name;                /* name given to every connection with client setname, sent in the same round trip as auth, empty for none */
+    bool                                latency_stats;              /* record the latency of every command for stats() */
+    std::string                         trace_file;                 /* write every command as a chrome trace event (json) to this file, empty for none */
+    uint32_t                            slowlog_threshold;          /* microseconds a command may take, reconnects, redirects and retries included, before drain_slowlog() reports it, 0 for none */
+    uint32_t                            slowlog_size;               /* slow commands kept until drained, later ones are dropped */
+    bool                                alloc_stats;                /* count the allocations of every command for stats(), those of the c++ layer only when built with LIBREDIS_ALLOC_STATS, open fails while a db without it is open */
+};
+
+struct LIBREDIS_API RedisLatency
+{
+    RedisLatency();
+
+    std::string                         name;                       /* command, or node address */
+    uint64_t                            count;                      /* commands recorded */
+    uint64_t                            p50;                        /* microseconds, within 1/16 */
+    uint64_t                            p99;
+    uint64_t                            p999;
+    uint64_t                            max;
+};
+
+struct LIBREDIS_API RedisAllocations
+{
+    RedisAllocations();
+
+    std::string                         name;                       /* command */
+    uint64_t                            count;                      /* commands counted */
+    uint64_t                            allocs;                     /* allocations of all of them, made on the calling thread */
+    uint64_t                            bytes;                      /* bytes asked for by them */
+};
+
+struct LIBREDIS_API RedisStats
+{
+    RedisStats();
+
+    uint64_t                            connects;                   /* connections established, to the server or to cluster nodes */
+    uint64_t                            reconnects;                 /* connections established again after an i/o error */
+    uint64_t                            connect_failures;           /* connects, auth or select that failed */
+    uint64_t                            command_count;              /* commands sent, without redirects and retries */
+    uint64_t                            command_errors;             /* commands that got no reply */
+    uint64_t                            moved;                      /* cluster only, MOVED redirects */
+    uint64_t                            ask;                        /* cluster only, ASK redirects */
+    uint64_t                            retries;                    /* cluster only, TRYAGAIN and CLUSTERDOWN retries */
+    uint64_t                            slotmap_updates;            /* cluster only, slotmaps installed */
+    uint64_t                            bytes_out;                  /* cluster only, written to the sockets, before tls encryption */
+    uint64_t                            bytes_in;                   /* cluster only, read from the sockets, after tls decryption */
+    int64_t                             in_flight;                  /* cluster only, commands waiting for their reply */
+    std::list<RedisLatency>             commands;                   /* per command, reconnects, redirects and retries included */
+    std::list<RedisLatency>             nodes;                      /* cluster only, per node address, of the node that answered last */
+    std::list<RedisAllocations>         allocations;                /* per command, up to the decoded reply, the argument list built by the caller not included */
+};
+
+struct LIBREDIS_API RedisTrace
+{
+    RedisTrace();
+
+    std::string                         command;                    /* upper case name, e.g. GET or CLUSTER SLOTS */
+    int32_t                             slot;                       /* key slot, -1 for a standalone server or a command without key */
+    std::string                         node;                       /* address of the server or node that answered last, after only */
+    std::list<std::string>              redirects;                  /* cluster only, nodes asked before the one that answered, in order, after only */
+    uint32_t                            retries;                    /* cluster only, TRYAGAIN and CLUSTERDOWN retries, after only */
+    bool                                pipelined;                  /* cluster only, appended and read back separately */
+    bool                                replied;                    /* a reply arrived, after only */
+    uint64_t                            bytes_out;                  /* request bytes, resends included */
+    uint64_t                            bytes_in;                   /* cluster only, read from the sockets meanwhile, after only */
+    int64_t                             start_time;                 /* microseconds since the epoch */
+    int64_t                             duration;                   /* microseconds, after only */
+};
+
+typedef void (*RedisTraceHook)(const RedisTrace & trace, void * context);
+
+struct LIBREDIS_API RedisSlowCommand
+{
+    RedisSlowCommand();
+
+    std::string                         command;                    /* arguments separated by spaces, truncated */
+    int32_t                             slot;                       /* key slot, -1 for a standalone server or a command without key */
+    std::string                         node;                       /* address of the server or node that answered last */
+    uint32_t                            retries;                    /* cluster only, redirects and retries */
+    bool                                reconnected;                /* a connection had to be made for the command */
+    int64_t                             start_time;                 /* microseconds since the epoch */
+    int64_t                             duration;                   /* microseconds */
+};
+
 class LIBREDIS_API RedisDB
 {
 public:
@@ -47,9 +154,26 @@ public:
 
 public:
     bool open(const std::string & address, const std::string & username, const std::string & password, uint16_t table = 0, uint32_t timeout = 5000);
+    bool open(const std::string & address, const std::string & username, const std::string & password, const RedisOptions & options);
     void close();
     bool destroy();
 
+public:
+    bool warm_up(std::list<std::string> & failed_nodes);
+
+public:
+    void set_operation_timeout(uint32_t timeout);                   /* milliseconds each following call may take, 0 for no limit */
+    void set_trace_hooks(RedisTraceHook before, RedisTraceHook after, void * context); /* called around every command, nullptr for none */
+
+public:
+    RedisErrorKind error_kind() const;                              /* of the last operation */
+    std::string error_message() const;
+
+public:
+    bool stats(RedisStats & stats);                                 /* false unless open, latencies need latency_stats, allocations alloc_stats */
+    bool drain_slowlog(std::list<RedisSlowCommand> & commands);     /* takes the slow commands logged so far, false unless open with slowlog_threshold */
+    void reset_stats();                                             /* latencies and allocations only, the counters keep counting */
+
 public:
     bool find(const std::string & key);
     bool find(const std::string & pattern, std::list<std::string> & keys);
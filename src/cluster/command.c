@@ -37,6 +37,7 @@
 #include <string.h>
 
 #include "command.h"
+#include "hiarena.h"
 #include "hiarray.h"
 #include "hiutil.h"
 #include "win32.h"
@@ -116,6 +117,31 @@ cmddef *redis_lookup_cmd(const char *arg0, uint32_t arg0_len, const char *arg1,
     return NULL;
 }
 
+/* Returns the type of a command or subcommand, CMD_UNKNOWN when not found. */
+cmd_type_t redis_command_type(const char *arg0, uint32_t arg0_len,
+                              const char *arg1, uint32_t arg1_len) {
+    cmddef *c = redis_lookup_cmd(arg0, arg0_len, arg1, arg1_len);
+    return c != NULL ? c->type : CMD_UNKNOWN;
+}
+
+/* Returns the name of a request command type and sets *subname to its
+ * subcommand name or NULL. Returns NULL for other types. The table is
+ * generated in the order of the types. */
+const char *redis_command_name(cmd_type_t type, const char **subname) {
+    const cmddef *c;
+
+    if (type <= CMD_UNKNOWN ||
+        type > (cmd_type_t)(sizeof(redis_commands) / sizeof(cmddef))) {
+        return NULL;
+    }
+
+    c = &redis_commands[type - 1];
+    if (subname != NULL) {
+        *subname = c->subname;
+    }
+    return c->name;
+}
+
 /*
  * Return true, if the redis command is a vector command accepting one or
  * more keys, otherwise return false
@@ -286,7 +312,7 @@ void redis_parse_cmd(struct cmd *r) {
                 /* Keyword found. Now the first key is the next arg. */
                 if ((p = redis_parse_bulk(p, end, &arg, &arglen)) == NULL)
                     goto error;
-                struct keypos *kpos = hiarray_push(r->keys);
+                struct keypos *kpos = command_push_key(r);
                 if (kpos == NULL)
                     goto oom;
                 kpos->start = arg;
@@ -333,7 +359,7 @@ void redis_parse_cmd(struct cmd *r) {
         goto error;
     }
 
-    struct keypos *kpos = hiarray_push(r->keys);
+    struct keypos *kpos = command_push_key(r);
     if (kpos == NULL)
         goto oom;
     kpos->start = arg;
@@ -350,7 +376,7 @@ void redis_parse_cmd(struct cmd *r) {
                 goto error;
             if (redis_argkvx(r) && i % 2 == 0)
                 continue; /* not a key */
-            struct keypos *kpos = hiarray_push(r->keys);
+            struct keypos *kpos = command_push_key(r);
             if (kpos == NULL)
                 goto oom;
             kpos->start = arg;
@@ -393,20 +419,17 @@ oom:
     r->result = CMD_PARSE_ENOMEM;
 }
 
-struct cmd *command_get(void) {
-    struct cmd *command;
-    command = hi_malloc(sizeof(struct cmd));
-    if (command == NULL) {
-        return NULL;
-    }
+/* Keys arrays that grew beyond this are released when a command is recycled,
+ * so a single huge MGET does not pin its keypos storage in the pool. */
+#define CMD_POOL_MAX_KEYS 64
 
+static void command_init(struct cmd *command) {
     command->id = ++cmd_id;
     command->result = CMD_PARSE_OK;
     command->errstr = NULL;
     command->type = CMD_UNKNOWN;
     command->cmd = NULL;
     command->clen = 0;
-    command->keys = NULL;
     command->narg = 0;
     command->quit = 0;
     command->noforward = 0;
@@ -415,21 +438,13 @@ struct cmd *command_get(void) {
     command->reply = NULL;
     command->sub_commands = NULL;
     command->node_addr = NULL;
-
-    command->keys = hiarray_create(1, sizeof(struct keypos));
-    if (command->keys == NULL) {
-        hi_free(command);
-        return NULL;
-    }
-
-    return command;
+    command->started = 0;
+    command->next_free = NULL;
 }
 
-void command_destroy(struct cmd *command) {
-    if (command == NULL) {
-        return;
-    }
-
+/* Releases everything owned by the command except the struct itself and
+ * its keys array, which is emptied. */
+static void command_clear(struct cmd *command) {
     if (command->cmd != NULL) {
         hi_free(command->cmd);
         command->cmd = NULL;
@@ -440,27 +455,145 @@ void command_destroy(struct cmd *command) {
         command->errstr = NULL;
     }
 
-    if (command->keys != NULL) {
-        command->keys->nelem = 0;
-        hiarray_destroy(command->keys);
-        command->keys = NULL;
-    }
+    command->keys->nelem = 0;
 
     if (command->frag_seq != NULL) {
         hi_free(command->frag_seq);
         command->frag_seq = NULL;
     }
 
-    freeReplyObject(command->reply);
+    if (command->pool == NULL ||
+        !hiarena_owns(command->pool->reply_arena, command->reply)) {
+        freeReplyObject(command->reply);
+    }
+    command->reply = NULL;
 
     if (command->sub_commands != NULL) {
         listRelease(command->sub_commands);
+        command->sub_commands = NULL;
     }
 
     if (command->node_addr != NULL) {
         sdsfree(command->node_addr);
         command->node_addr = NULL;
     }
+}
 
+static void command_keys_release(struct cmd *command) {
+    if (command->keys_array.elem != command->keys_inline) {
+        hi_free(command->keys_array.elem);
+    }
+    hiarray_set(&command->keys_array, command->keys_inline,
+                sizeof(struct keypos), CMD_INLINE_KEYS);
+}
+
+static void command_free(struct cmd *command) {
+    if (command->keys_array.elem != command->keys_inline) {
+        hi_free(command->keys_array.elem);
+    }
     hi_free(command);
 }
+
+struct cmd *command_get(void) { return command_pool_get(NULL); }
+
+void command_destroy(struct cmd *command) {
+    struct cmd_pool *pool;
+
+    if (command == NULL) {
+        return;
+    }
+
+    command_clear(command);
+
+    pool = command->pool;
+    if (pool == NULL || pool->nfree >= pool->max_free) {
+        command_free(command);
+        return;
+    }
+
+    if (command->keys_array.nalloc > CMD_POOL_MAX_KEYS) {
+        command_keys_release(command);
+    }
+
+    command->next_free = pool->free_list;
+    pool->free_list = command;
+    pool->nfree++;
+}
+
+/* Appends a keypos to the command. Use this instead of hiarray_push() on
+ * command->keys, the first CMD_INLINE_KEYS keys live inside the command
+ * and that storage can not be passed to realloc. */
+struct keypos *command_push_key(struct cmd *command) {
+    struct hiarray *keys = command->keys;
+    void *elem;
+
+    if (keys->elem == command->keys_inline && keys->nelem == keys->nalloc) {
+        elem = hi_malloc(keys->size * keys->nalloc * 2);
+        if (elem == NULL) {
+            return NULL;
+        }
+        memcpy(elem, keys->elem, keys->size * keys->nelem);
+        keys->elem = elem;
+        keys->nalloc *= 2;
+    }
+
+    return hiarray_push(keys);
+}
+
+struct cmd_pool *command_pool_create(uint32_t max_free) {
+    struct cmd_pool *pool;
+
+    pool = hi_malloc(sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->free_list = NULL;
+    pool->nfree = 0;
+    pool->max_free = max_free;
+    pool->reply_arena = NULL;
+
+    return pool;
+}
+
+/* Frees the recycled commands. Commands still in use must have been
+ * destroyed before the pool. */
+void command_pool_destroy(struct cmd_pool *pool) {
+    struct cmd *command;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    while ((command = pool->free_list) != NULL) {
+        pool->free_list = command->next_free;
+        command_free(command);
+    }
+
+    hi_free(pool);
+}
+
+/* Returns a recycled command from the pool, or a new one when the pool is
+ * empty. A NULL pool always allocates. */
+struct cmd *command_pool_get(struct cmd_pool *pool) {
+    struct cmd *command;
+
+    if (pool != NULL && pool->free_list != NULL) {
+        command = pool->free_list;
+        pool->free_list = command->next_free;
+        pool->nfree--;
+    } else {
+        command = hi_malloc(sizeof(struct cmd));
+        if (command == NULL) {
+            return NULL;
+        }
+        command->pool = pool;
+        command->keys = &command->keys_array;
+        hiarray_set(command->keys, command->keys_inline,
+                    sizeof(struct keypos), CMD_INLINE_KEYS);
+    }
+
+    command_init(command);
+
+    return command;
+}
@@ -0,0 +1,146 @@
+/********************************************************
+ * Description : allocation counting of hiredis and hircluster
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <alloc.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+#include "hialloc.h"
+
+#ifdef _WIN32
+#define HIALLOC_THREAD __declspec(thread)
+#define HIALLOC_LOAD(p) InterlockedCompareExchange((p), 0, 0)
+#define HIALLOC_STORE(p, v) InterlockedExchange((p), (v))
+#define HIALLOC_ADD(p, v) InterlockedExchangeAdd((p), (v))
+#define HIALLOC_YIELD() SwitchToThread()
+#else
+#define HIALLOC_THREAD __thread
+/* Sequentially consistent, an install and a client opening at once must see
+ * each other */
+#define HIALLOC_LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define HIALLOC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define HIALLOC_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define HIALLOC_YIELD() sched_yield()
+#endif
+
+#define HIALLOC_NONE 0
+#define HIALLOC_INSTALLING 1
+#define HIALLOC_INSTALLED 2
+
+/* The counters are per thread, counting takes no lock and a command is
+ * measured on the thread that runs it. */
+static HIALLOC_THREAD struct hialloc_counters hialloc_thread;
+
+static volatile long hialloc_state = HIALLOC_NONE;
+static volatile long hialloc_clients = 0; /* see hialloc_client_open() */
+static hiredisAllocFuncs hialloc_next; /* allocators counted calls go to */
+
+static void *hialloc_malloc(size_t size) {
+    hialloc_thread.allocs++;
+    hialloc_thread.bytes += size;
+    return hialloc_next.mallocFn(size);
+}
+
+static void *hialloc_calloc(size_t nmemb, size_t size) {
+    hialloc_thread.allocs++;
+    hialloc_thread.bytes += nmemb * size;
+    return hialloc_next.callocFn(nmemb, size);
+}
+
+static void *hialloc_realloc(void *ptr, size_t size) {
+    hialloc_thread.allocs++;
+    hialloc_thread.bytes += size;
+    return hialloc_next.reallocFn(ptr, size);
+}
+
+static char *hialloc_strdup(const char *str) {
+    hialloc_thread.allocs++;
+    hialloc_thread.bytes += strlen(str) + 1;
+    return hialloc_next.strdupFn(str);
+}
+
+static void hialloc_free(void *ptr) { hialloc_next.freeFn(ptr); }
+
+/* Returns 1 for the one caller that gets to install the allocators. */
+static int hialloc_begin_install(void) {
+#ifdef _WIN32
+    return InterlockedCompareExchange(&hialloc_state, HIALLOC_INSTALLING,
+                                      HIALLOC_NONE) == HIALLOC_NONE;
+#else
+    long expected = HIALLOC_NONE;
+    return __atomic_compare_exchange_n(&hialloc_state, &expected,
+                                       HIALLOC_INSTALLING, 0, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+#endif
+}
+
+int hialloc_install(void) {
+    hiredisAllocFuncs counting = {hialloc_malloc, hialloc_calloc,
+                                  hialloc_realloc, hialloc_strdup,
+                                  hialloc_free};
+    long state;
+
+    while (!hialloc_begin_install()) {
+        state = HIALLOC_LOAD(&hialloc_state);
+        if (state == HIALLOC_INSTALLED) {
+            return 0;
+        }
+        if (state == HIALLOC_INSTALLING) {
+            /* Another thread installs them, wait until it is done */
+            HIALLOC_YIELD();
+        }
+    }
+
+    /* hiredisSetAllocators() overwrites the table without a lock, no
+     * client may be inside hi_malloc() meanwhile */
+    if (HIALLOC_LOAD(&hialloc_clients) != 0) {
+        HIALLOC_STORE(&hialloc_state, HIALLOC_NONE);
+        return -1;
+    }
+
+    hialloc_next = hiredisSetAllocators(&counting);
+    HIALLOC_STORE(&hialloc_state, HIALLOC_INSTALLED);
+
+    return 0;
+}
+
+void hialloc_client_open(void) {
+    HIALLOC_ADD(&hialloc_clients, 1);
+
+    /* Stay off the allocators until an install under way is done */
+    while (HIALLOC_LOAD(&hialloc_state) == HIALLOC_INSTALLING) {
+        HIALLOC_YIELD();
+    }
+}
+
+void hialloc_client_close(void) { HIALLOC_ADD(&hialloc_clients, -1); }
+
+int hialloc_installed(void) {
+    return HIALLOC_LOAD(&hialloc_state) == HIALLOC_INSTALLED;
+}
+
+void hialloc_record(size_t size) {
+    hialloc_thread.allocs++;
+    hialloc_thread.bytes += size;
+}
+
+void hialloc_thread_counters(struct hialloc_counters *counters) {
+    *counters = hialloc_thread;
+}
+
+void hialloc_add_since(struct hialloc_counters *total,
+                       const struct hialloc_counters *start) {
+    total->calls++;
+    total->allocs += hialloc_thread.allocs - start->allocs;
+    total->bytes += hialloc_thread.bytes - start->bytes;
+}
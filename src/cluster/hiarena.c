@@ -0,0 +1,338 @@
+/********************************************************
+ * Description : arena allocator for redis replies
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <alloc.h>
+#include <string.h>
+
+#include "hiarena.h"
+#include "hiutil.h"
+
+#define HIARENA_ALIGNMENT 16
+#define HIARENA_ALIGN(n)                                                       \
+    (((n) + (HIARENA_ALIGNMENT - 1)) & ~((size_t)HIARENA_ALIGNMENT - 1))
+
+/* Upper bound for the block kept across resets. */
+#define HIARENA_MAX_RETAIN (4 * 1024 * 1024)
+
+struct hiarena_block {
+    struct hiarena_block *next;
+    size_t size; /* usable bytes after the header */
+    size_t used;
+};
+
+#define HIARENA_HEADER_SIZE HIARENA_ALIGN(sizeof(struct hiarena_block))
+#define HIARENA_BLOCK_DATA(b) ((char *)(b) + HIARENA_HEADER_SIZE)
+
+static struct hiarena_block *hiarena_block_create(size_t size) {
+    struct hiarena_block *b;
+
+    b = hi_malloc(HIARENA_HEADER_SIZE + size);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+
+    return b;
+}
+
+struct hiarena *hiarena_create(size_t block_size) {
+    struct hiarena *a;
+
+    if (block_size == 0) {
+        block_size = HIARENA_DEFAULT_BLOCK_SIZE;
+    }
+
+    a = hi_malloc(sizeof(*a));
+    if (a == NULL) {
+        return NULL;
+    }
+
+    a->block_size = HIARENA_ALIGN(block_size);
+    a->allocated = 0;
+    a->first = hiarena_block_create(a->block_size);
+    if (a->first == NULL) {
+        hi_free(a);
+        return NULL;
+    }
+    a->blocks = a->first;
+
+    return a;
+}
+
+void hiarena_destroy(struct hiarena *a) {
+    struct hiarena_block *b, *next;
+
+    if (a == NULL) {
+        return;
+    }
+
+    for (b = a->blocks; b != NULL; b = next) {
+        next = b->next;
+        hi_free(b);
+    }
+
+    hi_free(a);
+}
+
+/* Releases everything allocated from the arena. When the last round did not
+ * fit into the retained block, that block is grown so the next round of the
+ * same size is served by a single block again. */
+void hiarena_reset(struct hiarena *a) {
+    struct hiarena_block *b, *next;
+
+    for (b = a->blocks; b != NULL; b = next) {
+        next = b->next;
+        if (b != a->first) {
+            hi_free(b);
+        }
+    }
+
+    if (a->allocated > a->first->size &&
+        a->allocated <= HIARENA_MAX_RETAIN) {
+        b = hiarena_block_create(HIARENA_ALIGN(a->allocated));
+        if (b != NULL) {
+            hi_free(a->first);
+            a->first = b;
+        }
+    }
+
+    a->first->next = NULL;
+    a->first->used = 0;
+    a->blocks = a->first;
+    a->allocated = 0;
+}
+
+void *hiarena_alloc(struct hiarena *a, size_t size) {
+    struct hiarena_block *b = a->blocks;
+    void *p;
+
+    size = HIARENA_ALIGN(size == 0 ? 1 : size);
+
+    if (b->size - b->used < size) {
+        if (size > a->block_size / 4) {
+            /* Large allocation, give it a block of its own and keep
+             * filling the current one. */
+            b = hiarena_block_create(size);
+            if (b == NULL) {
+                return NULL;
+            }
+            b->next = a->blocks->next;
+            a->blocks->next = b;
+        } else {
+            b = hiarena_block_create(a->block_size);
+            if (b == NULL) {
+                return NULL;
+            }
+            b->next = a->blocks;
+            a->blocks = b;
+        }
+    }
+
+    p = HIARENA_BLOCK_DATA(b) + b->used;
+    b->used += size;
+    a->allocated += size;
+
+    return p;
+}
+
+void *hiarena_calloc(struct hiarena *a, size_t nmemb, size_t size) {
+    void *p;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    p = hiarena_alloc(a, nmemb * size);
+    if (p != NULL) {
+        memset(p, 0, nmemb * size);
+    }
+
+    return p;
+}
+
+int hiarena_owns(const struct hiarena *a, const void *ptr) {
+    const struct hiarena_block *b;
+    const char *p = ptr;
+
+    if (a == NULL || ptr == NULL) {
+        return 0;
+    }
+
+    for (b = a->blocks; b != NULL; b = b->next) {
+        const char *data = HIARENA_BLOCK_DATA(b);
+        if (p >= data && p < data + b->size) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* The functions below mirror the default hiredis reply object functions,
+ * with every allocation taken from the arena. */
+
+static redisReply *createArenaReply(const redisReadTask *task) {
+    redisReply *r, *parent;
+
+    r = hiarena_calloc(task->privdata, 1, sizeof(*r));
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->type = task->type;
+
+    if (task->parent) {
+        parent = task->parent->obj;
+        ASSERT(parent->type == REDIS_REPLY_ARRAY ||
+               parent->type == REDIS_REPLY_MAP ||
+               parent->type == REDIS_REPLY_SET ||
+               parent->type == REDIS_REPLY_PUSH);
+        parent->element[task->idx] = r;
+    }
+
+    return r;
+}
+
+static void *createArenaString(const redisReadTask *task, char *str,
+                               size_t len) {
+    redisReply *r;
+    char *buf;
+
+    buf = hiarena_alloc(task->privdata, len + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    r = createArenaReply(task);
+    if (r == NULL) {
+        return NULL;
+    }
+
+    if (task->type == REDIS_REPLY_VERB) {
+        memcpy(r->vtype, str, 3);
+        r->vtype[3] = '\0';
+        memcpy(buf, str + 4, len - 4);
+        buf[len - 4] = '\0';
+        r->len = len - 4;
+    } else {
+        memcpy(buf, str, len);
+        buf[len] = '\0';
+        r->len = len;
+    }
+    r->str = buf;
+
+    return r;
+}
+
+static void *createArenaArray(const redisReadTask *task, size_t elements) {
+    redisReply *r;
+
+    r = createArenaReply(task);
+    if (r == NULL) {
+        return NULL;
+    }
+
+    if (elements > 0) {
+        r->element = hiarena_calloc(task->privdata, elements,
+                                    sizeof(redisReply *));
+        if (r->element == NULL) {
+            return NULL;
+        }
+    }
+    r->elements = elements;
+
+    return r;
+}
+
+static void *createArenaInteger(const redisReadTask *task, long long value) {
+    redisReply *r;
+
+    r = createArenaReply(task);
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->integer = value;
+
+    return r;
+}
+
+static void *createArenaDouble(const redisReadTask *task, double value,
+                               char *str, size_t len) {
+    redisReply *r;
+
+    r = createArenaReply(task);
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->dval = value;
+    r->str = hiarena_alloc(task->privdata, len + 1);
+    if (r->str == NULL) {
+        return NULL;
+    }
+    memcpy(r->str, str, len);
+    r->str[len] = '\0';
+    r->len = len;
+
+    return r;
+}
+
+static void *createArenaNil(const redisReadTask *task) {
+    return createArenaReply(task);
+}
+
+static void *createArenaBool(const redisReadTask *task, int bval) {
+    redisReply *r;
+
+    r = createArenaReply(task);
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->integer = bval != 0;
+
+    return r;
+}
+
+static void freeArenaReply(void *reply) { (void)reply; }
+
+redisReplyObjectFunctions hiarenaReplyFunctions = {
+    createArenaString, createArenaArray, createArenaInteger, createArenaDouble,
+    createArenaNil,    createArenaBool,  freeArenaReply};
+
+int hiarena_attach(redisContext *c, struct hiarena *a) {
+    redisReader *reader;
+
+    if (c == NULL || c->reader == NULL || a == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (c->reader->fn == &hiarenaReplyFunctions) {
+        c->reader->privdata = a;
+        return REDIS_OK;
+    }
+
+    reader = redisReaderCreateWithFunctions(&hiarenaReplyFunctions);
+    if (reader == NULL) {
+        return REDIS_ERR;
+    }
+
+    reader->privdata = a;
+    reader->maxbuf = c->reader->maxbuf;
+    reader->maxelements = c->reader->maxelements;
+
+    redisReaderFree(c->reader);
+    c->reader = reader;
+
+    return REDIS_OK;
+}
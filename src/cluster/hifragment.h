@@ -0,0 +1,34 @@
+/********************************************************
+ * Description : multi-key command splitting of hircluster, internal
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef __HIFRAGMENT_H_
+#define __HIFRAGMENT_H_
+
+#include "hircluster.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "adlist.h"
+#include "command.h"
+
+/* Split a parsed multi-key command into one sub-command per slot, appended
+ * to commands, and merge the replies of the sub-commands back. Not part of
+ * the library interface, the header is private to src and the benchmarks. */
+int command_pre_fragment(redisClusterContext *cc, struct cmd *command,
+                         hilist *commands);
+void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
+                            hilist *commands);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,110 @@
+/********************************************************
+ * Description : latency histogram with logarithmic buckets
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <alloc.h>
+#include <string.h>
+
+#include "hihistogram.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define HIHISTOGRAM_SUB_COUNT (1 << HIHISTOGRAM_SUB_BITS)
+#define HIHISTOGRAM_LIMIT (((uint64_t)1 << HIHISTOGRAM_MAX_BITS) - 1)
+
+/* Index of the highest bit set, value must not be 0. */
+static int hihistogram_msb(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+/* Values below HIHISTOGRAM_SUB_COUNT have a bucket each, the others share
+ * HIHISTOGRAM_SUB_COUNT buckets per power of two. */
+static uint32_t hihistogram_index(uint64_t value) {
+    int shift;
+
+    if (value < HIHISTOGRAM_SUB_COUNT) {
+        return (uint32_t)value;
+    }
+
+    shift = hihistogram_msb(value) - HIHISTOGRAM_SUB_BITS;
+    return (uint32_t)(((shift + 1) << HIHISTOGRAM_SUB_BITS) +
+                      (value >> shift) - HIHISTOGRAM_SUB_COUNT);
+}
+
+/* Highest value counted in a bucket. */
+static uint64_t hihistogram_bucket_end(uint32_t index) {
+    uint32_t shift;
+    uint64_t start;
+
+    if (index < HIHISTOGRAM_SUB_COUNT) {
+        return index;
+    }
+
+    shift = (index >> HIHISTOGRAM_SUB_BITS) - 1;
+    start = (uint64_t)(HIHISTOGRAM_SUB_COUNT +
+                       (index & (HIHISTOGRAM_SUB_COUNT - 1)))
+            << shift;
+    return start + ((uint64_t)1 << shift) - 1;
+}
+
+struct hihistogram *hihistogram_create(void) {
+    return hi_calloc(1, sizeof(struct hihistogram));
+}
+
+void hihistogram_destroy(struct hihistogram *h) { hi_free(h); }
+
+void hihistogram_reset(struct hihistogram *h) { memset(h, 0, sizeof(*h)); }
+
+void hihistogram_record(struct hihistogram *h, uint64_t value) {
+    if (value > HIHISTOGRAM_LIMIT) {
+        value = HIHISTOGRAM_LIMIT;
+    }
+
+    h->buckets[hihistogram_index(value)]++;
+    h->count++;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+uint64_t hihistogram_percentile(const struct hihistogram *h,
+                                double percentile) {
+    uint64_t target, seen = 0, end;
+    uint32_t i;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    if (percentile >= 100) {
+        return h->max;
+    }
+
+    target = (uint64_t)(percentile / 100 * (double)h->count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+
+    for (i = 0; i < HIHISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            end = hihistogram_bucket_end(i);
+            return end < h->max ? end : h->max;
+        }
+    }
+
+    return h->max;
+}
@@ -35,22 +35,33 @@
 #include <ctype.h>
 #include <errno.h>
 #include <alloc.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 
 #include "adlist.h"
 #include "command.h"
 #include "dict.h"
+#include "hialloc.h"
+#include "hiarena.h"
 #include "hiarray.h"
+#include "hifragment.h"
+#include "hihistogram.h"
 #include "hircluster.h"
+#include "hislowlog.h"
+#include "hiring.h"
 #include "hiutil.h"
 #include "win32.h"
 
-// Cluster errors are offset by 100 to be sufficiently out of range of
-// standard Redis errors
-#define REDIS_ERR_CLUSTER_TOO_MANY_RETRIES 100
-
 #define REDIS_ERROR_MOVED "MOVED"
 #define REDIS_ERROR_ASK "ASK"
 #define REDIS_ERROR_TRYAGAIN "TRYAGAIN"
@@ -60,7 +71,11 @@
 
 #define REDIS_COMMAND_CLUSTER_NODES "CLUSTER NODES"
 #define REDIS_COMMAND_CLUSTER_SLOTS "CLUSTER SLOTS"
-#define REDIS_COMMAND_ASKING "ASKING"
+
+/* ASKING in wire format, appended right in front of a redirected command */
+#define REDIS_COMMAND_ASKING_FORMATTED "*1\r\n$6\r\nASKING\r\n"
+#define REDIS_COMMAND_ASKING_FORMATTED_LEN                                     \
+    (sizeof(REDIS_COMMAND_ASKING_FORMATTED) - 1)
 
 #define IP_PORT_SEPARATOR ':'
 
@@ -69,6 +84,10 @@
 #define CLUSTER_ADDRESS_SEPARATOR ","
 
 #define CLUSTER_DEFAULT_MAX_RETRY_COUNT 5
+#define CLUSTER_DEFAULT_RETRY_BASE_DELAY_MS 10
+#define CLUSTER_DEFAULT_RETRY_MAX_DELAY_MS 1000
+#define CLUSTER_DEFAULT_COMMAND_POOL_SIZE 256
+#define CLUSTER_DEFAULT_REQUESTS_SIZE 64
 #define NO_RETRY -1
 
 #define CRLF "\x0d\x0a"
@@ -82,6 +101,9 @@ typedef struct cluster_async_data {
     struct cmd *command;
     redisClusterCallbackFn *callback;
     int retry_count;
+    int backoffs;     /* TRYAGAIN/CLUSTERDOWN waits, redirects not counted */
+    int64_t started;  /* Sent first (usec), when a retry deadline is set */
+    int64_t retry_at; /* Due (usec) while waiting in acc->retries */
     void *privdata;
 } cluster_async_data;
 
@@ -98,6 +120,13 @@ static void freeRedisClusterNode(redisClusterNode *node);
 static void cluster_slot_destroy(cluster_slot *slot);
 static void cluster_open_slot_destroy(copen_slot *oslot);
 static int updateNodesAndSlotmap(redisClusterContext *cc, dict *nodes);
+static redisClusterNode **clusterSlotTableCreate(redisClusterContext *cc,
+                                                 dict *nodes);
+static void clusterInstallRoute(redisClusterContext *cc, dict *nodes,
+                                redisClusterNode **table,
+                                struct slotmapSnapshot *s,
+                                redisClusterNode **links);
+static void askCacheFree(struct askcache *ac);
 static int updateSlotMapAsync(redisClusterAsyncContext *acc,
                               redisAsyncContext *ac);
 
@@ -157,6 +186,23 @@ dictType clusterNodesRefDictType = {
     NULL               /* val destructor */
 };
 
+void dictHistogramDestructor(void *privdata, void *val) {
+    DICT_NOTUSED(privdata);
+    hihistogram_destroy(val);
+}
+
+/* Latency per node address, outlives the nodes of a slotmap
+ * Has ownership of the histograms
+ */
+dictType nodeLatencyDictType = {
+    dictSdsHash,            /* hash function */
+    NULL,                   /* key dup */
+    NULL,                   /* val dup */
+    dictSdsKeyCompare,      /* key compare */
+    dictSdsDestructor,      /* key destructor */
+    dictHistogramDestructor /* val destructor */
+};
+
 void listCommandFree(void *command) {
     struct cmd *cmd = command;
     command_destroy(cmd);
@@ -255,15 +301,32 @@ static redisClusterNode *createRedisClusterNode(void) {
     return hi_calloc(1, sizeof(redisClusterNode));
 }
 
+/* Drops the replies read ahead on the node connection. They were built by
+ * the reader of that connection, so they are released the way it says. */
+static void clusterNodeDropReplies(redisClusterNode *node) {
+    void *reply;
+
+    if (node->replies != NULL && node->con != NULL) {
+        while ((reply = hiring_pop(node->replies)) != NULL) {
+            if (node->con->reader->fn && node->con->reader->fn->freeObject) {
+                node->con->reader->fn->freeObject(reply);
+            }
+        }
+    }
+
+    node->pending = 0;
+}
+
 /* Cleanup the cluster node structure */
 static void freeRedisClusterNode(redisClusterNode *node) {
     if (node == NULL) {
         return;
     }
 
-    sdsfree(node->name);
-    sdsfree(node->addr);
-    sdsfree(node->host);
+    clusterNodeDropReplies(node);
+    if (node->replies != NULL) {
+        hiring_destroy(node->replies);
+    }
     redisFree(node->con);
 
     if (node->acon != NULL) {
@@ -273,6 +336,16 @@ static void freeRedisClusterNode(redisClusterNode *node) {
         node->acon->data = NULL;
         redisAsyncFree(node->acon);
     }
+
+    if (node->shared) {
+        /* All else belongs to a shared route */
+        hi_free(node);
+        return;
+    }
+
+    sdsfree(node->name);
+    sdsfree(node->addr);
+    sdsfree(node->host);
     if (node->slots != NULL) {
         listRelease(node->slots);
     }
@@ -393,44 +466,240 @@ static void cluster_open_slot_destroy(copen_slot *oslot) {
     hi_free(oslot);
 }
 
-/**
- * Handle password authentication in the synchronous API
- */
-static int authenticate(redisClusterContext *cc, redisContext *c) {
+/* Frees a reply received by the synchronous API. Replies built in the reply
+ * arena are released together by redisClusterFreeReplies(). */
+static void freeClusterReply(redisClusterContext *cc, void *reply) {
+    if (!hiarena_owns(cc->reply_arena, reply)) {
+        freeReplyObject(reply);
+    }
+}
+
+/* Allocates a reply or reply member that is handed out to the user, from the
+ * reply arena when enabled. */
+static void *clusterReplyCalloc(redisClusterContext *cc, size_t nmemb,
+                                size_t size) {
+    if (cc->reply_arena != NULL) {
+        return hiarena_calloc(cc->reply_arena, nmemb, size);
+    }
+    return hi_calloc(nmemb, size);
+}
+
+/* Appends the commands setting up a new connection, AUTH and CLIENT SETNAME
+ * as configured, so that they leave in one write. Returns the number of
+ * replies to expect, or -1 when appending failed. */
+static int clusterAppendHandshake(redisClusterContext *cc, redisContext *c) {
+    int ret, n = 0;
+
+    if (cc->password != NULL) {
+        if (cc->username != NULL) {
+            ret = redisAppendCommand(c, "AUTH %s %s", cc->username,
+                                     cc->password);
+        } else {
+            ret = redisAppendCommand(c, "AUTH %s", cc->password);
+        }
+        if (ret != REDIS_OK) {
+            return -1;
+        }
+        n++;
+    }
+
+    if (cc->client_name != NULL) {
+        if (redisAppendCommand(c, "CLIENT SETNAME %s", cc->client_name) !=
+            REDIS_OK) {
+            return -1;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/* Sets up a new connection in a single round trip. */
+static int handshake(redisClusterContext *cc, redisContext *c) {
+    redisReply *reply;
+    int i, n, ret = REDIS_OK;
+
     if (cc == NULL || c == NULL) {
         return REDIS_ERR;
     }
 
-    // Skip if no password configured
-    if (cc->password == NULL) {
-        return REDIS_OK;
+    n = clusterAppendHandshake(cc, c);
+    if (n < 0) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        return REDIS_ERR;
     }
 
-    redisReply *reply;
-    if (cc->username != NULL) {
-        reply = redisCommand(c, "AUTH %s %s", cc->username, cc->password);
+    /* All replies are read, none is left for the first command */
+    for (i = 0; i < n; i++) {
+        if (redisGetReply(c, (void **)&reply) != REDIS_OK) {
+            __redisClusterSetError(cc, c->err, c->errstr);
+            return REDIS_ERR;
+        }
+
+        if (reply->type == REDIS_REPLY_ERROR && ret == REDIS_OK) {
+            __redisClusterSetError(cc, REDIS_ERR_OTHER, reply->str);
+            ret = REDIS_ERR;
+        }
+        freeClusterReply(cc, reply);
+    }
+
+    return ret;
+}
+
+/* Tells whether the operation deadline has passed, setting the error when
+ * it has. */
+static int clusterDeadlinePassed(redisClusterContext *cc) {
+    if (cc->deadline == 0 || hi_usec_now() < cc->deadline) {
+        return 0;
+    }
+
+    __redisClusterSetError(cc, REDIS_ERR_TIMEOUT,
+                           "operation deadline exceeded");
+    return 1;
+}
+
+/* Caps a timeout, NULL for none, at the time left until the operation
+ * deadline. Returns tv itself when there is no deadline, buf otherwise. */
+static const struct timeval *clusterDeadlineTimeout(redisClusterContext *cc,
+                                                    const struct timeval *tv,
+                                                    struct timeval *buf) {
+    int64_t left;
+
+    if (cc->deadline == 0) {
+        return tv;
+    }
+
+    /* A zero timeout would block forever */
+    left = cc->deadline - hi_usec_now();
+    if (left < 1000) {
+        left = 1000;
+    }
+    if (tv != NULL && tv->tv_sec * 1000000LL + tv->tv_usec < left) {
+        return tv;
+    }
+
+    buf->tv_sec = (long)(left / 1000000);
+    buf->tv_usec = (long)(left % 1000000);
+    return buf;
+}
+
+static int clusterTimeoutEqual(const struct timeval *a,
+                               const struct timeval *b) {
+    static const struct timeval none = {0, 0};
+
+    if (a == NULL) {
+        a = &none;
+    }
+    if (b == NULL) {
+        b = &none;
+    }
+    return a->tv_sec == b->tv_sec && a->tv_usec == b->tv_usec;
+}
+
+/* Bounds the socket timeout of a connection by the operation deadline, and
+ * gives it the configured command timeout back once there is none. Only
+ * touches the socket when the timeout changes. */
+static void clusterDeadlineApply(redisClusterContext *cc, redisContext *c) {
+    static const struct timeval none = {0, 0};
+    const struct timeval *tv;
+    struct timeval buf;
+
+    tv = clusterDeadlineTimeout(cc, cc->command_timeout, &buf);
+    if (clusterTimeoutEqual(tv, c->command_timeout)) {
+        return;
+    }
+
+    redisSetTimeout(c, tv != NULL ? *tv : none);
+}
+
+/* The counters have a single writer, the thread owning the context, so an
+ * update is a relaxed load and store instead of a locked read-modify-write.
+ * Snapshots taken on other threads still see whole values. */
+#ifndef _WIN32
+#define CLUSTER_STAT_ADD(cc, field, n)                                         \
+    __atomic_store_n(&(cc)->stats.field,                                       \
+                     __atomic_load_n(&(cc)->stats.field, __ATOMIC_RELAXED) +   \
+                         (n),                                                  \
+                     __ATOMIC_RELAXED)
+#define CLUSTER_STAT_LOAD(cc, field)                                           \
+    __atomic_load_n(&(cc)->stats.field, __ATOMIC_RELAXED)
+#else
+#define CLUSTER_STAT_ADD(cc, field, n)                                         \
+    InterlockedExchangeAdd64((volatile LONG64 *)&(cc)->stats.field,            \
+                             (LONG64)(n))
+#define CLUSTER_STAT_LOAD(cc, field)                                           \
+    InterlockedCompareExchange64((volatile LONG64 *)&(cc)->stats.field, 0, 0)
+#endif
+
+static void clusterEvent(redisClusterContext *cc, int event) {
+    if (cc->event_callback != NULL) {
+        cc->event_callback(cc, event, cc->event_privdata);
+    }
+}
+
+/* Counts the outcome of a connect, handshake included. */
+static void clusterStatConnected(redisClusterContext *cc, int ok,
+                                 int reconnect) {
+    if (!ok) {
+        CLUSTER_STAT_ADD(cc, connect_failures, 1);
+        clusterEvent(cc, HIRCLUSTER_EVENT_CONNECT_FAILED);
+    } else if (reconnect) {
+        CLUSTER_STAT_ADD(cc, reconnects, 1);
+        clusterEvent(cc, HIRCLUSTER_EVENT_RECONNECT);
     } else {
-        reply = redisCommand(c, "AUTH %s", cc->password);
+        CLUSTER_STAT_ADD(cc, connects, 1);
+        clusterEvent(cc, HIRCLUSTER_EVENT_CONNECT);
     }
+}
 
-    if (reply == NULL) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER,
-                               "Command AUTH reply error (NULL)");
-        goto error;
+/* The context of a tracked connection, found from the functions it uses so
+ * that c->privdata stays with its owner. */
+static redisClusterContext *clusterStatContext(redisContext *c) {
+    return (redisClusterContext *)((char *)c->funcs -
+                                   offsetof(redisClusterContext, stat_funcs));
+}
+
+static ssize_t clusterStatRead(redisContext *c, char *buf, size_t bufcap) {
+    redisClusterContext *cc = clusterStatContext(c);
+    ssize_t nread;
+
+    nread = cc->transport->read(c, buf, bufcap);
+    if (nread > 0) {
+        CLUSTER_STAT_ADD(cc, bytes_in, nread);
     }
+    return nread;
+}
 
-    if (reply->type == REDIS_REPLY_ERROR) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER, reply->str);
-        goto error;
+static ssize_t clusterStatWrite(redisContext *c) {
+    redisClusterContext *cc = clusterStatContext(c);
+    ssize_t nwritten;
+
+    nwritten = cc->transport->write(c);
+    if (nwritten > 0) {
+        CLUSTER_STAT_ADD(cc, bytes_out, nwritten);
     }
+    return nwritten;
+}
 
-    freeReplyObject(reply);
-    return REDIS_OK;
+/* Routes the socket reads and writes of a connection through the byte
+ * counters. All connections of a context share one transport, plain or TLS,
+ * a connection with a different one is left alone. The TLS state in
+ * c->privctx and the user data in c->privdata are not touched. */
+static void clusterStatTrack(redisClusterContext *cc, redisContext *c) {
+    if (c->funcs == NULL || c->funcs == &cc->stat_funcs) {
+        return;
+    }
 
-error:
-    freeReplyObject(reply);
+    if (cc->transport == NULL) {
+        cc->transport = c->funcs;
+        cc->stat_funcs = *c->funcs;
+        cc->stat_funcs.read = clusterStatRead;
+        cc->stat_funcs.write = clusterStatWrite;
+    } else if (c->funcs != cc->transport) {
+        return;
+    }
 
-    return REDIS_ERR;
+    c->funcs = &cc->stat_funcs;
 }
 
 /**
@@ -1207,8 +1476,9 @@ static int clusterUpdateRouteSendCommand(redisClusterContext *cc,
     return REDIS_OK;
 }
 
-/* Receives and handles a CLUSTER SLOTS reply from node with context c. */
-static int handleClusterSlotsReply(redisClusterContext *cc, redisContext *c) {
+/* Receives a CLUSTER SLOTS reply from node with context c. */
+static redisReply *receiveClusterSlotsReply(redisClusterContext *cc,
+                                            redisContext *c) {
     redisReply *reply = NULL;
     int result = redisGetReply(c, (void **)&reply);
     if (result != REDIS_OK) {
@@ -1221,7 +1491,7 @@ static int handleClusterSlotsReply(redisClusterContext *cc, redisContext *c) {
                 cc, REDIS_ERR_OTHER,
                 "Command (cluster slots) reply error (NULL).");
         }
-        return REDIS_ERR;
+        return NULL;
     } else if (reply->type != REDIS_REPLY_ARRAY) {
         if (reply->type == REDIS_REPLY_ERROR) {
             __redisClusterSetError(cc, REDIS_ERR_OTHER, reply->str);
@@ -1230,17 +1500,16 @@ static int handleClusterSlotsReply(redisClusterContext *cc, redisContext *c) {
                 cc, REDIS_ERR_OTHER,
                 "Command (cluster slots) reply error: type is not array.");
         }
-        freeReplyObject(reply);
-        return REDIS_ERR;
+        freeClusterReply(cc, reply);
+        return NULL;
     }
 
-    dict *nodes = parse_cluster_slots(cc, reply, cc->flags);
-    freeReplyObject(reply);
-    return updateNodesAndSlotmap(cc, nodes);
+    return reply;
 }
 
-/* Receives and handles a CLUSTER NODES reply from node with context c. */
-static int handleClusterNodesReply(redisClusterContext *cc, redisContext *c) {
+/* Receives a CLUSTER NODES reply from node with context c. */
+static redisReply *receiveClusterNodesReply(redisClusterContext *cc,
+                                            redisContext *c) {
     redisReply *reply = NULL;
     int result = redisGetReply(c, (void **)&reply);
     if (result != REDIS_OK) {
@@ -1253,7 +1522,7 @@ static int handleClusterNodesReply(redisClusterContext *cc, redisContext *c) {
                                    "Command (cluster nodes) reply error "
                                    "(NULL).");
         }
-        return REDIS_ERR;
+        return NULL;
     } else if (reply->type != REDIS_REPLY_STRING) {
         if (reply->type == REDIS_REPLY_ERROR) {
             __redisClusterSetError(cc, REDIS_ERR_OTHER, reply->str);
@@ -1262,779 +1531,2960 @@ static int handleClusterNodesReply(redisClusterContext *cc, redisContext *c) {
                                    "Command(cluster nodes) reply error: "
                                    "type is not string.");
         }
-        freeReplyObject(reply);
-        return REDIS_ERR;
+        freeClusterReply(cc, reply);
+        return NULL;
     }
 
-    dict *nodes = parse_cluster_nodes(cc, reply->str, reply->len, cc->flags);
-    freeReplyObject(reply);
-    return updateNodesAndSlotmap(cc, nodes);
+    return reply;
 }
 
-/* Receives and handles a CLUSTER SLOTS or CLUSTER NODES reply from node with
- * context c. */
-static int clusterUpdateRouteHandleReply(redisClusterContext *cc,
-                                         redisContext *c) {
+/* Receives a CLUSTER SLOTS or CLUSTER NODES reply from node with context c. */
+static redisReply *clusterUpdateRouteReceiveReply(redisClusterContext *cc,
+                                                  redisContext *c) {
     if (cc->flags & HIRCLUSTER_FLAG_ROUTE_USE_SLOTS) {
-        return handleClusterSlotsReply(cc, c);
+        return receiveClusterSlotsReply(cc, c);
     } else {
-        return handleClusterNodesReply(cc, c);
+        return receiveClusterNodesReply(cc, c);
     }
 }
 
-/**
- * Update route with the "cluster nodes" or "cluster slots" command reply.
- */
-static int cluster_update_route_by_addr(redisClusterContext *cc, const char *ip,
-                                        int port) {
-    redisContext *c = NULL;
-
-    if (cc == NULL) {
-        return REDIS_ERR;
+/* Parses a CLUSTER SLOTS or CLUSTER NODES reply into a collection of
+ * redisClusterNodes, which is not installed yet. */
+static dict *clusterUpdateRouteParseReply(redisClusterContext *cc,
+                                          redisReply *reply) {
+    if (cc->flags & HIRCLUSTER_FLAG_ROUTE_USE_SLOTS) {
+        return parse_cluster_slots(cc, reply, cc->flags);
+    } else {
+        return parse_cluster_nodes(cc, reply->str, reply->len, cc->flags);
     }
+}
 
-    if (ip == NULL || port <= 0) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER, "Ip or port error!");
-        goto error;
-    }
+#ifndef _WIN32
+/* A route shared by the contexts of a slotmap group, the slot table and the
+ * node directory it points into. It is never modified, a new route replaces
+ * it as a whole and the last user frees it. Its nodes are never connected,
+ * every member has a node of its own per shared node for its connections. */
+struct slotmapSnapshot {
+    int refs;
+    uint64_t version;
+    dict *nodes;              /* Masters by address, with their slots */
+    redisClusterNode **table; /* Slot to a node of nodes */
+    uint32_t nnodes;          /* Nodes are numbered by their index */
+};
 
-    redisOptions options = {0};
-    REDIS_OPTIONS_SET_TCP(&options, ip, port);
-    options.connect_timeout = cc->connect_timeout;
-    options.command_timeout = cc->command_timeout;
+struct redisClusterSlotmapGroup {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;                         /* Creator and member contexts */
+    int querying;                     /* A member queries the cluster */
+    uint64_t version;                 /* Of snapshot, read without the lock */
+    struct slotmapSnapshot *snapshot; /* Latest route, or NULL */
+};
 
-    c = redisConnectWithOptions(&options);
-    if (c == NULL) {
+/* Turns parsed nodes into a shared route, nodes are taken over even when it
+ * fails. */
+static struct slotmapSnapshot *slotmapSnapshotCreate(redisClusterContext *cc,
+                                                     dict *nodes) {
+    struct slotmapSnapshot *s;
+    redisClusterNode *node;
+    dictEntry *de;
+
+    if (nodes == NULL) {
+        return NULL;
+    }
+
+    s = hi_calloc(1, sizeof(*s));
+    if (s == NULL) {
         __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-        return REDIS_ERR;
+        dictRelease(nodes);
+        return NULL;
     }
 
-    if (cc->on_connect) {
-        cc->on_connect(c, c->err ? REDIS_ERR : REDIS_OK);
+    s->table = clusterSlotTableCreate(cc, nodes);
+    if (s->table == NULL) {
+        dictRelease(nodes);
+        hi_free(s);
+        return NULL;
     }
+    s->refs = 1;
+    s->nodes = nodes;
 
-    if (c->err) {
-        __redisClusterSetError(cc, c->err, c->errstr);
-        goto error;
+    dictIterator di;
+    dictInitIterator(&di, nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        node = dictGetEntryVal(de);
+        node->index = s->nnodes++;
     }
 
-    if (cc->ssl && cc->ssl_init_fn(c, cc->ssl) != REDIS_OK) {
-        __redisClusterSetError(cc, c->err, c->errstr);
-        goto error;
+    return s;
+}
+
+static void slotmapSnapshotRelease(struct slotmapSnapshot *s) {
+    if (s != NULL && __atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        dictRelease(s->nodes);
+        hi_free(s->table);
+        hi_free(s);
     }
+}
 
-    if (authenticate(cc, c) != REDIS_OK) {
-        goto error;
+/* Takes a reference to the latest route of the group, called locked. */
+static struct slotmapSnapshot *
+slotmapGroupSnapshot(struct redisClusterSlotmapGroup *g) {
+    struct slotmapSnapshot *s = g->snapshot;
+
+    if (s != NULL) {
+        __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
     }
+    return s;
+}
 
-    if (clusterUpdateRouteSendCommand(cc, c) != REDIS_OK) {
-        goto error;
+/* Installs a route of the group into cc. The table stays shared, cc gets a
+ * node per shared node which borrows all of it but the connection state. */
+static int slotmapGroupInstall(redisClusterContext *cc,
+                               struct slotmapSnapshot *s) {
+    redisClusterNode **links, *shared, *link;
+    dictEntry *de;
+    dict *nodes;
+    sds key;
+
+    nodes = dictCreate(&clusterNodesDictType, NULL);
+    links = hi_calloc(s->nnodes, sizeof(*links));
+    if (nodes == NULL || (links == NULL && s->nnodes > 0)) {
+        goto oom;
     }
 
-    if (clusterUpdateRouteHandleReply(cc, c) != REDIS_OK) {
-        goto error;
+    dictIterator di;
+    dictInitIterator(&di, s->nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        shared = dictGetEntryVal(de);
+
+        link = createRedisClusterNode();
+        if (link == NULL) {
+            goto oom;
+        }
+        link->name = shared->name;
+        link->addr = shared->addr;
+        link->host = shared->host;
+        link->port = shared->port;
+        link->role = shared->role;
+        link->shared = 1;
+        link->index = shared->index;
+        link->slots = shared->slots;
+        link->slaves = shared->slaves;
+        link->migrating = shared->migrating;
+        link->importing = shared->importing;
+
+        key = sdsnewlen(shared->addr, sdslen(shared->addr));
+        if (key == NULL || dictAdd(nodes, key, link) != DICT_OK) {
+            sdsfree(key);
+            freeRedisClusterNode(link);
+            goto oom;
+        }
+        links[shared->index] = link;
     }
 
-    redisFree(c);
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    clusterInstallRoute(cc, nodes, s->table, s, links);
+    cc->slotmap_group_version = s->version;
     return REDIS_OK;
 
-error:
-    redisFree(c);
+oom:
+    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+    if (nodes != NULL) {
+        dictRelease(nodes);
+    }
+    hi_free(links);
     return REDIS_ERR;
 }
 
-/* Update known cluster nodes with a new collection of redisClusterNodes.
- * Will also update the slot-to-node lookup table for the new nodes. */
-static int updateNodesAndSlotmap(redisClusterContext *cc, dict *nodes) {
-    if (nodes == NULL) {
+/* Makes a route cc got from the cluster the route of its group, and installs
+ * it. The other members pick it up with their next command. */
+static int slotmapGroupPublish(redisClusterContext *cc, dict *nodes) {
+    struct redisClusterSlotmapGroup *g = cc->slotmap_group;
+    struct slotmapSnapshot *s, *old;
+    int ret;
+
+    s = slotmapSnapshotCreate(cc, nodes);
+    if (s == NULL) {
         return REDIS_ERR;
     }
 
-    /* Create a slot to redisClusterNode lookup table */
-    redisClusterNode **table;
-    table = hi_calloc(REDIS_CLUSTER_SLOTS, sizeof(redisClusterNode *));
-    if (table == NULL) {
-        goto oom;
+    /* The reference of the creator goes to the group, another one is kept
+     * in case the route is replaced before cc installed it */
+    __atomic_add_fetch(&s->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&g->lock);
+    old = g->snapshot;
+    s->version = g->version + 1;
+    g->snapshot = s;
+    __atomic_store_n(&g->version, s->version, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g->lock);
+
+    slotmapSnapshotRelease(old);
+    ret = slotmapGroupInstall(cc, s);
+    slotmapSnapshotRelease(s);
+    return ret;
+}
+
+/* Installs a route another member published. The check is a plain atomic
+ * load, the lock is only taken when there is something to adopt. Only done
+ * between requests, never while pipelined commands wait for their replies. */
+static void slotmapGroupAdopt(redisClusterContext *cc) {
+    struct redisClusterSlotmapGroup *g = cc->slotmap_group;
+    struct slotmapSnapshot *s;
+
+    if (g == NULL || __atomic_load_n(&g->version, __ATOMIC_ACQUIRE) ==
+                         cc->slotmap_group_version) {
+        return;
     }
 
-    dictIterator di;
-    dictInitIterator(&di, nodes);
+    if (cc->requests != NULL && hiring_n(cc->requests) > 0) {
+        return;
+    }
 
-    dictEntry *de;
-    while ((de = dictNext(&di))) {
-        redisClusterNode *master = dictGetEntryVal(de);
-        if (master->role != REDIS_ROLE_MASTER) {
-            __redisClusterSetError(cc, REDIS_ERR_OTHER,
-                                   "Node role must be master");
-            goto error;
-        }
+    pthread_mutex_lock(&g->lock);
+    s = slotmapGroupSnapshot(g);
+    pthread_mutex_unlock(&g->lock);
 
-        if (master->slots == NULL) {
-            continue;
+    if (s == NULL) {
+        return;
+    }
+
+    if (slotmapGroupInstall(cc, s) != REDIS_OK) {
+        /* Keep the current slotmap, and do not try this route again */
+        cc->slotmap_group_version = s->version;
+        cc->err = 0;
+        cc->errstr[0] = '\0';
+    }
+    slotmapSnapshotRelease(s);
+}
+
+/* How long cc waits for another member to query the cluster: its deadline,
+ * or what a query of its own could take. Returns -1 for no limit. */
+static int64_t slotmapGroupWaitLimit(redisClusterContext *cc) {
+    int64_t limit = -1;
+
+    if (cc->connect_timeout != NULL || cc->command_timeout != NULL) {
+        limit = hi_usec_now();
+        if (cc->connect_timeout != NULL) {
+            limit += cc->connect_timeout->tv_sec * 1000000LL +
+                     cc->connect_timeout->tv_usec;
         }
+        if (cc->command_timeout != NULL) {
+            limit += cc->command_timeout->tv_sec * 1000000LL +
+                     cc->command_timeout->tv_usec;
+        }
+    }
+    if (cc->deadline != 0 && (limit < 0 || limit > cc->deadline)) {
+        limit = cc->deadline;
+    }
 
-        listIter li;
-        listRewind(master->slots, &li);
+    return limit;
+}
 
-        listNode *ln;
-        while ((ln = listNext(&li))) {
-            cluster_slot *slot = listNodeValue(ln);
-            if (slot->start > slot->end || slot->end >= REDIS_CLUSTER_SLOTS) {
-                __redisClusterSetError(cc, REDIS_ERR_OTHER,
-                                       "Slot region for node is invalid");
-                goto error;
-            }
-            for (uint32_t i = slot->start; i <= slot->end; i++) {
-                if (table[i] != NULL) {
-                    __redisClusterSetError(cc, REDIS_ERR_OTHER,
-                                           "Different node holds same slot");
-                    goto error;
-                }
-                table[i] = master;
-            }
-        }
-    }
-
-    /* Update slot-to-node table before changing cc->nodes since
-     * removal of nodes might trigger user callbacks which may
-     * send commands, which depend on the slot-to-node table. */
-    if (cc->table != NULL) {
-        hi_free(cc->table);
+/* Called before cc queries the cluster for the route. Only one member of a
+ * group queries at a time, the others wait for its result, as long as their
+ * deadline allows. Returns a route newer than the one of cc to install
+ * instead, or NULL when cc has to query, in which case querying tells whether
+ * slotmapGroupQueryDone() is due. A member that gave up waiting queries
+ * without taking over. */
+static struct slotmapSnapshot *slotmapGroupQueryBegin(redisClusterContext *cc,
+                                                      int *querying) {
+    struct redisClusterSlotmapGroup *g = cc->slotmap_group;
+    struct slotmapSnapshot *s = NULL;
+    struct timespec deadline;
+    int64_t limit, wait_usec;
+    int timedout = 0;
+
+    *querying = 0;
+    if (g == NULL) {
+        return NULL;
     }
-    cc->table = table;
 
-    cc->route_version++;
+    limit = slotmapGroupWaitLimit(cc);
 
-    // Move all hiredis contexts in cc->nodes to nodes
-    cluster_nodes_swap_ctx(cc->nodes, nodes);
+    pthread_mutex_lock(&g->lock);
+    while (g->querying && g->version == cc->slotmap_group_version) {
+        if (limit < 0) {
+            pthread_cond_wait(&g->cond, &g->lock);
+            continue;
+        }
 
-    /* Replace cc->nodes before releasing the old dict since
-     * the release procedure might access cc->nodes. */
-    dict *oldnodes = cc->nodes;
-    cc->nodes = nodes;
-    if (oldnodes != NULL) {
-        dictRelease(oldnodes);
-    }
-    if (cc->event_callback != NULL) {
-        cc->event_callback(cc, HIRCLUSTER_EVENT_SLOTMAP_UPDATED,
-                           cc->event_privdata);
-        if (cc->route_version == 1) {
-            /* Special event the first time the slotmap was updated. */
-            cc->event_callback(cc, HIRCLUSTER_EVENT_READY, cc->event_privdata);
+        wait_usec = limit - hi_usec_now();
+        if (wait_usec <= 0) {
+            timedout = 1;
+            break;
+        }
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait_usec / 1000000;
+        deadline.tv_nsec += (long)(wait_usec % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
         }
+        pthread_cond_timedwait(&g->cond, &g->lock, &deadline);
     }
-    cc->need_update_route = 0;
-    return REDIS_OK;
-
-oom:
-    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-    // passthrough
-error:
-    hi_free(table);
-    dictRelease(nodes);
-    return REDIS_ERR;
-}
-
-int redisClusterUpdateSlotmap(redisClusterContext *cc) {
-    int ret;
-    int flag_err_not_set = 1;
-    redisClusterNode *node;
-    dictEntry *de;
-
-    if (cc == NULL) {
-        return REDIS_ERR;
+    if (g->version != cc->slotmap_group_version) {
+        s = slotmapGroupSnapshot(g);
     }
-
-    if (cc->nodes == NULL) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER, "no server address");
-        return REDIS_ERR;
+    if (s == NULL && !timedout) {
+        g->querying = 1;
+        *querying = 1;
     }
+    pthread_mutex_unlock(&g->lock);
 
-    dictIterator di;
-    dictInitIterator(&di, cc->nodes);
-
-    while ((de = dictNext(&di)) != NULL) {
-        node = dictGetEntryVal(de);
-        if (node == NULL || node->host == NULL) {
-            continue;
-        }
+    return s;
+}
 
-        ret = cluster_update_route_by_addr(cc, node->host, node->port);
-        if (ret == REDIS_OK) {
-            if (cc->err) {
-                cc->err = 0;
-                memset(cc->errstr, '\0', strlen(cc->errstr));
-            }
-            return REDIS_OK;
-        }
+static void slotmapGroupQueryDone(redisClusterContext *cc) {
+    struct redisClusterSlotmapGroup *g = cc->slotmap_group;
 
-        flag_err_not_set = 0;
-    }
+    pthread_mutex_lock(&g->lock);
+    g->querying = 0;
+    pthread_cond_broadcast(&g->cond);
+    pthread_mutex_unlock(&g->lock);
+}
+#else
+struct slotmapSnapshot;
 
-    if (flag_err_not_set) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER, "no valid server address");
-    }
+static void slotmapSnapshotRelease(struct slotmapSnapshot *s) { (void)s; }
 
+static int slotmapGroupInstall(redisClusterContext *cc,
+                               struct slotmapSnapshot *s) {
+    (void)cc;
+    (void)s;
     return REDIS_ERR;
 }
 
-redisClusterContext *redisClusterContextInit(void) {
-    redisClusterContext *cc;
+static int slotmapGroupPublish(redisClusterContext *cc, dict *nodes) {
+    return updateNodesAndSlotmap(cc, nodes);
+}
 
-    cc = hi_calloc(1, sizeof(redisClusterContext));
-    if (cc == NULL)
-        return NULL;
+static void slotmapGroupAdopt(redisClusterContext *cc) { (void)cc; }
 
-    cc->max_retry_count = CLUSTER_DEFAULT_MAX_RETRY_COUNT;
-    return cc;
+static struct slotmapSnapshot *slotmapGroupQueryBegin(redisClusterContext *cc,
+                                                      int *querying) {
+    (void)cc;
+    *querying = 0;
+    return NULL;
 }
 
-void redisClusterFree(redisClusterContext *cc) {
+static void slotmapGroupQueryDone(redisClusterContext *cc) { (void)cc; }
+#endif
 
-    if (cc == NULL)
-        return;
+/* Installs a route received from the cluster. A member of a slotmap group
+ * shares it with the group. The reply stays with the caller. */
+static int clusterUpdateRouteInstallReply(redisClusterContext *cc,
+                                          redisReply *reply) {
+    dict *nodes = clusterUpdateRouteParseReply(cc, reply);
 
-    if (cc->event_callback) {
-        cc->event_callback(cc, HIRCLUSTER_EVENT_FREE_CONTEXT,
-                           cc->event_privdata);
+    if (cc->slotmap_group != NULL) {
+        return slotmapGroupPublish(cc, nodes);
     }
+    return updateNodesAndSlotmap(cc, nodes);
+}
 
-    if (cc->connect_timeout) {
-        hi_free(cc->connect_timeout);
-        cc->connect_timeout = NULL;
+/* Receives and handles a CLUSTER SLOTS or CLUSTER NODES reply from node with
+ * context c. */
+static int clusterUpdateRouteHandleReply(redisClusterContext *cc,
+                                         redisContext *c) {
+    redisReply *reply = clusterUpdateRouteReceiveReply(cc, c);
+    if (reply == NULL) {
+        return REDIS_ERR;
     }
 
-    if (cc->command_timeout) {
-        hi_free(cc->command_timeout);
-        cc->command_timeout = NULL;
-    }
+    int ret = clusterUpdateRouteInstallReply(cc, reply);
+    freeClusterReply(cc, reply);
+    return ret;
+}
 
-    if (cc->table != NULL) {
-        hi_free(cc->table);
-        cc->table = NULL;
+/**
+ * Fetch the route, the "cluster nodes" or "cluster slots" command reply, from
+ * the node at the given address.
+ */
+static redisReply *cluster_fetch_route_by_addr(redisClusterContext *cc,
+                                               const char *ip, int port) {
+    redisContext *c = NULL;
+    redisReply *reply = NULL;
+
+    if (ip == NULL || port <= 0) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER, "Ip or port error!");
+        goto error;
     }
 
-    if (cc->nodes != NULL) {
-        /* Clear cc->nodes before releasing the dict since the release procedure
-           might access cc->nodes. When a node and its hiredis context are freed
-           all pending callbacks are executed. Clearing cc->nodes prevents a pending
-           slotmap update command callback to trigger additional slotmap updates. */
-        dict *nodes = cc->nodes;
-        cc->nodes = NULL;
-        dictRelease(nodes);
+    struct timeval connect_tv, command_tv;
+    redisOptions options = {0};
+    REDIS_OPTIONS_SET_TCP(&options, ip, port);
+    options.connect_timeout =
+        clusterDeadlineTimeout(cc, cc->connect_timeout, &connect_tv);
+    options.command_timeout =
+        clusterDeadlineTimeout(cc, cc->command_timeout, &command_tv);
+
+    c = redisConnectWithOptions(&options);
+    if (c == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return NULL;
     }
 
-    if (cc->requests != NULL) {
-        listRelease(cc->requests);
+    if (cc->on_connect) {
+        cc->on_connect(c, c->err ? REDIS_ERR : REDIS_OK);
     }
 
-    if (cc->username != NULL) {
-        hi_free(cc->username);
-        cc->username = NULL;
+    if (c->err) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        goto error;
     }
 
-    if (cc->password != NULL) {
-        hi_free(cc->password);
-        cc->password = NULL;
+    if (cc->ssl && cc->ssl_init_fn(c, cc->ssl) != REDIS_OK) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        goto error;
     }
 
-    hi_free(cc);
-}
+    clusterStatTrack(cc, c);
 
-/* Connect to a Redis cluster. On error the field error in the returned
- * context will be set to the return value of the error function.
- * When no set of reply functions is given, the default set will be used. */
-static int _redisClusterConnect2(redisClusterContext *cc) {
+    if (handshake(cc, c) != REDIS_OK) {
+        goto error;
+    }
 
-    if (cc->nodes == NULL || dictSize(cc->nodes) == 0) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER,
-                               "servers address does not set up");
-        return REDIS_ERR;
+    if (clusterUpdateRouteSendCommand(cc, c) != REDIS_OK) {
+        goto error;
     }
 
-    return redisClusterUpdateSlotmap(cc);
+    /* The temporary context keeps the default reader, the reply is never
+     * built in the reply arena. */
+    reply = clusterUpdateRouteReceiveReply(cc, c);
+
+error:
+    redisFree(c);
+    return reply;
 }
 
-/* Connect to a Redis cluster. On error the field error in the returned
- * context will be set to the return value of the error function.
- * When no set of reply functions is given, the default set will be used. */
-static redisClusterContext *_redisClusterConnect(redisClusterContext *cc,
-                                                 const char *addrs) {
+/* Installs a route a seed answered with. A seed whose route does not install,
+ * e.g. one with an empty or partial slotmap, counts as failed. */
+typedef int(clusterRouteAcceptFn)(redisClusterContext *cc, redisReply *reply);
 
-    int ret;
+#ifndef _WIN32
+/* Head start of a seed probe before the next seed is tried as well */
+#define SEED_PROBE_STAGGER_USEC (100 * 1000)
 
-    ret = redisClusterSetOptionAddNodes(cc, addrs);
-    if (ret != REDIS_OK) {
-        return cc;
-    }
+#define SEED_PROBE_IDLE 0
+#define SEED_PROBE_CONNECTING 1
+#define SEED_PROBE_WAITING 2
+#define SEED_PROBE_FAILED 3
 
-    redisClusterUpdateSlotmap(cc);
+struct seedProbe {
+    redisClusterNode *node;
+    redisContext *c;
+    int state;
+    int handshake_pending; /* Handshake replies still to be read */
+    int64_t deadline; /* usec, -1 for none */
+};
 
-    return cc;
+static void seedProbeFail(redisClusterContext *cc, struct seedProbe *p,
+                          const char *reason) {
+    char msg[256];
+
+    snprintf(msg, sizeof(msg), "Query %s for the route failed: %s",
+             p->node->addr, reason);
+    __redisClusterSetError(cc, REDIS_ERR_OTHER, msg);
+
+    redisFree(p->c);
+    p->c = NULL;
+    p->state = SEED_PROBE_FAILED;
 }
 
-redisClusterContext *redisClusterConnect(const char *addrs, int flags) {
-    redisClusterContext *cc;
+/* Starts the connect of a probe. Returns REDIS_ERR only when out of memory,
+ * a seed failing right away is just marked so. */
+static int seedProbeStart(redisClusterContext *cc, struct seedProbe *p) {
+    int64_t now = hi_usec_now();
 
-    cc = redisClusterContextInit();
+    redisOptions options = {0};
+    REDIS_OPTIONS_SET_TCP(&options, p->node->host, p->node->port);
+    options.options |= REDIS_OPT_NONBLOCK;
+
+    p->state = SEED_PROBE_CONNECTING;
+    p->deadline = -1;
+    if (cc->connect_timeout != NULL || cc->command_timeout != NULL) {
+        p->deadline = now;
+        if (cc->connect_timeout != NULL) {
+            p->deadline += cc->connect_timeout->tv_sec * 1000000LL +
+                           cc->connect_timeout->tv_usec;
+        }
+        if (cc->command_timeout != NULL) {
+            p->deadline += cc->command_timeout->tv_sec * 1000000LL +
+                           cc->command_timeout->tv_usec;
+        }
+    }
+    if (cc->deadline != 0 && (p->deadline < 0 || p->deadline > cc->deadline)) {
+        p->deadline = cc->deadline;
+    }
 
-    if (cc == NULL) {
-        return NULL;
+    p->c = redisConnectWithOptions(&options);
+    if (p->c == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        p->state = SEED_PROBE_FAILED;
+        return REDIS_ERR;
     }
 
-    cc->flags = flags;
+    if (p->c->err) {
+        if (cc->on_connect) {
+            cc->on_connect(p->c, REDIS_ERR);
+        }
+        seedProbeFail(cc, p, p->c->errstr);
+    }
 
-    return _redisClusterConnect(cc, addrs);
+    return REDIS_OK;
 }
 
-redisClusterContext *redisClusterConnectWithTimeout(const char *addrs,
-                                                    const struct timeval tv,
-                                                    int flags) {
-    redisClusterContext *cc;
-
-    cc = redisClusterContextInit();
+/* The socket of a probe became writable, the handshake and the route
+ * command are pipelined right behind the connect. */
+static void seedProbeConnected(redisClusterContext *cc, struct seedProbe *p) {
+    redisContext *c = p->c;
+    socklen_t len = sizeof(int);
+    int err = 0, ret;
 
-    if (cc == NULL) {
-        return NULL;
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        err = errno;
     }
 
-    cc->flags = flags;
+    if (cc->on_connect) {
+        cc->on_connect(c, err ? REDIS_ERR : REDIS_OK);
+    }
 
-    if (cc->connect_timeout == NULL) {
-        cc->connect_timeout = hi_malloc(sizeof(struct timeval));
-        if (cc->connect_timeout == NULL) {
-            return NULL;
-        }
+    if (err) {
+        seedProbeFail(cc, p, strerror(err));
+        return;
     }
 
-    memcpy(cc->connect_timeout, &tv, sizeof(struct timeval));
+    clusterStatTrack(cc, c);
 
-    return _redisClusterConnect(cc, addrs);
+    p->handshake_pending = clusterAppendHandshake(cc, c);
+    ret = p->handshake_pending < 0 ? REDIS_ERR : REDIS_OK;
+    if (ret == REDIS_OK) {
+        ret = redisAppendCommand(c, cc->flags & HIRCLUSTER_FLAG_ROUTE_USE_SLOTS ?
+                                        REDIS_COMMAND_CLUSTER_SLOTS :
+                                        REDIS_COMMAND_CLUSTER_NODES);
+    }
+    if (ret != REDIS_OK) {
+        seedProbeFail(cc, p, c->errstr);
+        return;
+    }
+
+    p->state = SEED_PROBE_WAITING;
 }
 
-int redisClusterSetOptionAddNode(redisClusterContext *cc, const char *addr) {
-    dictEntry *node_entry;
-    redisClusterNode *node = NULL;
-    int port, ret;
-    sds ip = NULL;
+/* Some I/O happened on a probe waiting for its replies. Returns the route
+ * reply once it is complete. */
+static redisReply *seedProbeProgress(redisClusterContext *cc,
+                                     struct seedProbe *p, short revents) {
+    redisContext *c = p->c;
+    redisReply *reply;
+    int wdone, type;
 
-    if (cc == NULL) {
-        return REDIS_ERR;
+    if ((revents & POLLOUT) && sdslen(c->obuf) > 0 &&
+        redisBufferWrite(c, &wdone) != REDIS_OK) {
+        seedProbeFail(cc, p, c->errstr);
+        return NULL;
     }
 
-    if (cc->nodes == NULL) {
-        cc->nodes = dictCreate(&clusterNodesDictType, NULL);
-        if (cc->nodes == NULL) {
-            goto oom;
-        }
+    if (!(revents & (POLLIN | POLLERR | POLLHUP))) {
+        return NULL;
     }
 
-    sds addr_sds = sdsnew(addr);
-    if (addr_sds == NULL) {
-        goto oom;
+    if (redisBufferRead(c) != REDIS_OK) {
+        seedProbeFail(cc, p, c->errstr);
+        return NULL;
     }
-    node_entry = dictFind(cc->nodes, addr_sds);
-    sdsfree(addr_sds);
-    if (node_entry == NULL) {
 
-        char *p;
-        if ((p = strrchr(addr, IP_PORT_SEPARATOR)) == NULL) {
-            __redisClusterSetError(
-                cc, REDIS_ERR_OTHER,
-                "server address is incorrect, port separator missing.");
-            return REDIS_ERR;
+    for (;;) {
+        reply = NULL;
+        if (redisGetReplyFromReader(c, (void **)&reply) != REDIS_OK) {
+            seedProbeFail(cc, p, c->errstr);
+            return NULL;
         }
-        // p includes separator
-
-        if (p - addr <= 0) { /* length until separator */
-            __redisClusterSetError(
-                cc, REDIS_ERR_OTHER,
-                "server address is incorrect, address part missing.");
-            return REDIS_ERR;
+        if (reply == NULL) {
+            return NULL;
         }
 
-        ip = sdsnewlen(addr, p - addr);
-        if (ip == NULL) {
-            goto oom;
+        if (reply->type == REDIS_REPLY_ERROR) {
+            seedProbeFail(cc, p, reply->str);
+            freeReplyObject(reply);
+            return NULL;
         }
-        p++; // remove separator character
 
-        if (strlen(p) <= 0) {
-            __redisClusterSetError(
-                cc, REDIS_ERR_OTHER,
-                "server address is incorrect, port part missing.");
-            goto error;
+        if (p->handshake_pending == 0) {
+            break;
         }
+        p->handshake_pending--;
+        freeReplyObject(reply);
+    }
 
-        port = hi_atoi(p, strlen(p));
-        if (port <= 0) {
-            __redisClusterSetError(cc, REDIS_ERR_OTHER,
-                                   "server port is incorrect");
-            goto error;
+    type = cc->flags & HIRCLUSTER_FLAG_ROUTE_USE_SLOTS ? REDIS_REPLY_ARRAY :
+                                                         REDIS_REPLY_STRING;
+    if (reply->type != type) {
+        seedProbeFail(cc, p, "unexpected reply type");
+        freeReplyObject(reply);
+        return NULL;
+    }
+
+    return reply;
+}
+
+/* Queries the seeds for the route, happy eyeballs style. The first seed gets
+ * a head start, every SEED_PROBE_STAGGER_USEC or whenever a probe fails the
+ * next seed is queried as well, and the first reply that installs wins. Dead
+ * seeds thus cost a fraction of the connect timeout instead of all of it
+ * each. */
+static redisReply *clusterProbeSeeds(redisClusterContext *cc,
+                                     redisClusterNode **seeds, uint32_t n,
+                                     clusterRouteAcceptFn *accept) {
+    struct seedProbe *probes;
+    struct pollfd *fds;
+    redisReply *reply = NULL;
+    uint32_t i, started = 0, active, failed, replaced = 0;
+    int64_t now, next_start = 0, wait;
+    int timeout;
+
+    probes = hi_calloc(n, sizeof(*probes));
+    fds = hi_calloc(n, sizeof(*fds));
+    if (probes == NULL || fds == NULL) {
+        hi_free(probes);
+        hi_free(fds);
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        probes[i].node = seeds[i];
+    }
+
+    while (reply == NULL) {
+        now = hi_usec_now();
+
+        active = 0;
+        failed = 0;
+        for (i = 0; i < started; i++) {
+            if (probes[i].state == SEED_PROBE_CONNECTING ||
+                probes[i].state == SEED_PROBE_WAITING) {
+                if (probes[i].deadline >= 0 && probes[i].deadline <= now) {
+                    seedProbeFail(cc, &probes[i], "Timeout");
+                } else {
+                    active++;
+                }
+            }
+            if (probes[i].state == SEED_PROBE_FAILED) {
+                failed++;
+            }
         }
 
-        node = createRedisClusterNode();
-        if (node == NULL) {
-            goto oom;
+        /* The next seed starts when its turn comes, for each probe that
+         * failed, or when nothing is left */
+        if (started < n &&
+            (failed > replaced || active == 0 || now >= next_start)) {
+            if (seedProbeStart(cc, &probes[started]) != REDIS_OK) {
+                break;
+            }
+            if (failed > replaced) {
+                replaced++;
+            }
+            started++;
+            next_start = now + SEED_PROBE_STAGGER_USEC;
+            continue;
         }
 
-        node->addr = sdsnew(addr);
-        if (node->addr == NULL) {
-            goto oom;
+        if (active == 0) {
+            break;
         }
 
-        node->host = ip;
-        node->port = port;
+        wait = -1;
+        if (started < n) {
+            wait = next_start - now;
+        }
+        for (i = 0; i < started; i++) {
+            struct seedProbe *p = &probes[i];
+
+            fds[i].fd = -1;
+            fds[i].events = 0;
+            fds[i].revents = 0;
+            if (p->state == SEED_PROBE_CONNECTING) {
+                fds[i].events = POLLOUT;
+            } else if (p->state == SEED_PROBE_WAITING) {
+                fds[i].events = POLLIN;
+                if (sdslen(p->c->obuf) > 0) {
+                    fds[i].events |= POLLOUT;
+                }
+            } else {
+                continue;
+            }
+            fds[i].fd = p->c->fd;
 
-        sds key = sdsnewlen(node->addr, sdslen(node->addr));
-        if (key == NULL) {
-            goto oom;
+            if (p->deadline >= 0 && (wait < 0 || p->deadline - now < wait)) {
+                wait = p->deadline - now;
+            }
         }
-        ret = dictAdd(cc->nodes, key, node);
-        if (ret != DICT_OK) {
-            sdsfree(key);
-            goto oom;
+        timeout = wait < 0 ? -1 : (int)((wait + 999) / 1000);
+
+        int rv = poll(fds, started, timeout);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            __redisClusterSetError(cc, REDIS_ERR_IO, NULL);
+            break;
         }
-    }
 
-    return REDIS_OK;
+        for (i = 0; i < started && rv > 0 && reply == NULL; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
 
-oom:
-    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-    // passthrough
+            if (probes[i].state == SEED_PROBE_CONNECTING) {
+                seedProbeConnected(cc, &probes[i]);
+            } else if (probes[i].state == SEED_PROBE_WAITING) {
+                reply = seedProbeProgress(cc, &probes[i], fds[i].revents);
+                if (reply != NULL && accept(cc, reply) != REDIS_OK) {
+                    seedProbeFail(cc, &probes[i], cc->errstr);
+                    freeReplyObject(reply);
+                    reply = NULL;
+                }
+            }
+        }
+    }
 
-error:
-    sdsfree(ip);
-    if (node != NULL) {
-        sdsfree(node->addr);
-        hi_free(node);
+    for (i = 0; i < n; i++) {
+        redisFree(probes[i].c);
     }
-    return REDIS_ERR;
+    hi_free(probes);
+    hi_free(fds);
+
+    return reply;
 }
+#endif
 
-int redisClusterSetOptionAddNodes(redisClusterContext *cc, const char *addrs) {
-    int ret;
-    sds *address = NULL;
-    int address_count = 0;
-    int i;
+/**
+ * Fetch the route from the first of the nodes in cc->nodes whose answer
+ * accept installs. The installed reply is returned to the caller.
+ */
+static redisReply *cluster_fetch_route(redisClusterContext *cc,
+                                       clusterRouteAcceptFn *accept) {
+    redisClusterNode **seeds;
+    redisClusterNode *node;
+    redisReply *reply = NULL;
+    dictEntry *de;
+    uint32_t i, n = 0;
 
-    if (cc == NULL) {
-        return REDIS_ERR;
+    if (cc->nodes == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER, "no server address");
+        return NULL;
     }
 
-    address = sdssplitlen(addrs, strlen(addrs), CLUSTER_ADDRESS_SEPARATOR,
-                          strlen(CLUSTER_ADDRESS_SEPARATOR), &address_count);
-    if (address == NULL) {
-        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-        return REDIS_ERR;
+    if (dictSize(cc->nodes) == 0) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER, "no valid server address");
+        return NULL;
     }
 
-    if (address_count <= 0) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER,
-                               "invalid server addresses (example format: "
-                               "127.0.0.1:1234,127.0.0.2:5678)");
-        sdsfreesplitres(address, address_count);
-        return REDIS_ERR;
+    seeds = hi_malloc(dictSize(cc->nodes) * sizeof(*seeds));
+    if (seeds == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return NULL;
     }
 
-    for (i = 0; i < address_count; i++) {
-        ret = redisClusterSetOptionAddNode(cc, address[i]);
-        if (ret != REDIS_OK) {
-            sdsfreesplitres(address, address_count);
-            return REDIS_ERR;
+    dictIterator di;
+    dictInitIterator(&di, cc->nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        node = dictGetEntryVal(de);
+        if (node != NULL && node->host != NULL) {
+            seeds[n++] = node;
         }
     }
 
-    sdsfreesplitres(address, address_count);
-
-    return REDIS_OK;
-}
+    if (n == 0) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER, "no valid server address");
+        hi_free(seeds);
+        return NULL;
+    }
 
-/* Deprecated function, option has no effect. */
-int redisClusterSetOptionConnectBlock(redisClusterContext *cc) {
-    if (cc == NULL) {
-        return REDIS_ERR;
+#ifndef _WIN32
+    /* The TLS handshake of hiredis blocks, so does a single seed */
+    if (n > 1 && cc->ssl == NULL) {
+        reply = clusterProbeSeeds(cc, seeds, n, accept);
+        hi_free(seeds);
+        return reply;
     }
-    return REDIS_OK;
-}
+#endif
 
-/* Deprecated function, option has no effect. */
-int redisClusterSetOptionConnectNonBlock(redisClusterContext *cc) {
-    if (cc == NULL) {
-        return REDIS_ERR;
+    /* A failed install leaves cc->nodes as it was, the seeds stay valid */
+    for (i = 0; i < n && reply == NULL; i++) {
+        reply = cluster_fetch_route_by_addr(cc, seeds[i]->host, seeds[i]->port);
+        if (reply != NULL && accept(cc, reply) != REDIS_OK) {
+            freeReplyObject(reply);
+            reply = NULL;
+        }
     }
-    return REDIS_OK;
+
+    hi_free(seeds);
+    return reply;
 }
 
-/**
- * Configure a username used during authentication, see
- * the Redis AUTH command.
- * Disabled by default. Can be disabled again by providing an
- * empty string or a null pointer.
- */
-int redisClusterSetOptionUsername(redisClusterContext *cc,
-                                  const char *username) {
-    if (cc == NULL) {
-        return REDIS_ERR;
-    }
+/* Hashes the slot to node mapping, FNV-1a over the slot ranges. */
+static uint64_t slotmapSignature(redisClusterContext *cc) {
+    uint64_t h = 14695981039346656037ULL;
+    redisClusterNode *prev = NULL;
+    const char *p;
+    uint32_t i;
 
-    // Disabling option
-    if (username == NULL || username[0] == '\0') {
-        hi_free(cc->username);
-        cc->username = NULL;
-        return REDIS_OK;
-    }
+    for (i = 0; i < REDIS_CLUSTER_SLOTS; i++) {
+        if (cc->table[i] == prev) {
+            continue;
+        }
+        prev = cc->table[i];
 
-    hi_free(cc->username);
-    cc->username = hi_strdup(username);
-    if (cc->username == NULL) {
-        return REDIS_ERR;
+        h = (h ^ i) * 1099511628211ULL;
+        if (prev != NULL && prev->addr != NULL) {
+            for (p = prev->addr; *p != '\0'; p++) {
+                h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+            }
+        }
     }
 
-    return REDIS_OK;
+    return h;
 }
 
-/**
- * Configure a password used when connecting to password-protected
- * Redis instances. (See Redis AUTH command)
+/* The slotmap snapshot file, a line per master with its slot ranges:
+ *
+ *   hircluster-slotmap 1
+ *   <ip>:<port> <start>-<end> [<start>-<end> ...]
  */
-int redisClusterSetOptionPassword(redisClusterContext *cc,
-                                  const char *password) {
+#define SLOTMAP_FILE_HEADER "hircluster-slotmap 1"
 
-    if (cc == NULL) {
+/* Writes the installed slotmap to the snapshot file. The file is written
+ * under a temporary name and renamed, readers never see it half written.
+ * The name is unique per context, contexts of one process sharing the file
+ * do not write into each other's. */
+static int slotmapFileSave(redisClusterContext *cc) {
+    redisClusterNode *node;
+    cluster_slot *slot;
+    dictEntry *de;
+    listNode *ln;
+    FILE *fp;
+    sds tmp;
+    int ok;
+
+    tmp = sdscatprintf(sdsempty(), "%s.%d.%p.tmp", cc->slotmap_file,
+                       (int)getpid(), (void *)cc);
+    if (tmp == NULL) {
         return REDIS_ERR;
     }
 
-    // Disabling use of password
-    if (password == NULL || password[0] == '\0') {
-        hi_free(cc->password);
-        cc->password = NULL;
-        return REDIS_OK;
-    }
-
-    hi_free(cc->password);
-    cc->password = hi_strdup(password);
-    if (cc->password == NULL) {
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        sdsfree(tmp);
         return REDIS_ERR;
     }
 
-    return REDIS_OK;
-}
-
-int redisClusterSetOptionParseSlaves(redisClusterContext *cc) {
-
-    if (cc == NULL) {
-        return REDIS_ERR;
-    }
+    fputs(SLOTMAP_FILE_HEADER "\n", fp);
 
-    cc->flags |= HIRCLUSTER_FLAG_ADD_SLAVE;
+    dictIterator di;
+    dictInitIterator(&di, cc->nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        node = dictGetEntryVal(de);
+        if (node->role != REDIS_ROLE_MASTER || node->slots == NULL ||
+            listLength(node->slots) == 0) {
+            continue;
+        }
 
-    return REDIS_OK;
-}
+        fputs(node->addr, fp);
 
-int redisClusterSetOptionParseOpenSlots(redisClusterContext *cc) {
+        listIter li;
+        listRewind(node->slots, &li);
+        while ((ln = listNext(&li)) != NULL) {
+            slot = listNodeValue(ln);
+            fprintf(fp, " %u-%u", slot->start, slot->end);
+        }
+        fputc('\n', fp);
+    }
 
-    if (cc == NULL) {
+    ok = !ferror(fp);
+    ok = (fclose(fp) == 0) && ok;
+#ifdef _WIN32
+    /* rename() does not replace an existing file here */
+    if (ok) {
+        remove(cc->slotmap_file);
+    }
+#endif
+    if (!ok || rename(tmp, cc->slotmap_file) != 0) {
+        remove(tmp);
+        sdsfree(tmp);
         return REDIS_ERR;
     }
 
-    cc->flags |= HIRCLUSTER_FLAG_ADD_OPENSLOT;
-
+    sdsfree(tmp);
     return REDIS_OK;
 }
 
-int redisClusterSetOptionRouteUseSlots(redisClusterContext *cc) {
-
-    if (cc == NULL) {
-        return REDIS_ERR;
+/* Creates the slot-to-node lookup table of a collection of masters. */
+static redisClusterNode **clusterSlotTableCreate(redisClusterContext *cc,
+                                                 dict *nodes) {
+    redisClusterNode **table;
+    table = hi_calloc(REDIS_CLUSTER_SLOTS, sizeof(redisClusterNode *));
+    if (table == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return NULL;
     }
 
-    cc->flags |= HIRCLUSTER_FLAG_ROUTE_USE_SLOTS;
+    dictIterator di;
+    dictInitIterator(&di, nodes);
 
-    return REDIS_OK;
-}
+    dictEntry *de;
+    while ((de = dictNext(&di))) {
+        redisClusterNode *master = dictGetEntryVal(de);
+        if (master->role != REDIS_ROLE_MASTER) {
+            __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                                   "Node role must be master");
+            goto error;
+        }
 
-int redisClusterSetOptionConnectTimeout(redisClusterContext *cc,
-                                        const struct timeval tv) {
+        if (master->slots == NULL) {
+            continue;
+        }
 
-    if (cc == NULL) {
-        return REDIS_ERR;
-    }
+        listIter li;
+        listRewind(master->slots, &li);
 
-    if (cc->connect_timeout == NULL) {
-        cc->connect_timeout = hi_malloc(sizeof(struct timeval));
-        if (cc->connect_timeout == NULL) {
-            __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-            return REDIS_ERR;
+        listNode *ln;
+        while ((ln = listNext(&li))) {
+            cluster_slot *slot = listNodeValue(ln);
+            if (slot->start > slot->end || slot->end >= REDIS_CLUSTER_SLOTS) {
+                __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                                       "Slot region for node is invalid");
+                goto error;
+            }
+            for (uint32_t i = slot->start; i <= slot->end; i++) {
+                if (table[i] != NULL) {
+                    __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                                           "Different node holds same slot");
+                    goto error;
+                }
+                table[i] = master;
+            }
         }
     }
 
-    memcpy(cc->connect_timeout, &tv, sizeof(struct timeval));
+    return table;
 
-    return REDIS_OK;
+error:
+    hi_free(table);
+    return NULL;
 }
 
-int redisClusterSetOptionTimeout(redisClusterContext *cc,
-                                 const struct timeval tv) {
-    if (cc == NULL) {
-        return REDIS_ERR;
+/* Makes nodes and table the route of cc. The table either belongs to cc, or
+ * to the shared route s of a slotmap group, then links maps each node of s to
+ * the node of cc borrowing from it. */
+static void clusterInstallRoute(redisClusterContext *cc, dict *nodes,
+                                redisClusterNode **table,
+                                struct slotmapSnapshot *s,
+                                redisClusterNode **links) {
+    struct slotmapSnapshot *old_snapshot = cc->slotmap_snapshot;
+    redisClusterNode **old_links = cc->slotmap_links;
+
+    /* Update slot-to-node table before changing cc->nodes since
+     * removal of nodes might trigger user callbacks which may
+     * send commands, which depend on the slot-to-node table. */
+    if (old_snapshot == NULL) {
+        hi_free(cc->table);
     }
+    cc->table = table;
+    cc->slotmap_snapshot = s;
+    cc->slotmap_links = links;
 
-    if (cc->command_timeout == NULL ||
-        cc->command_timeout->tv_sec != tv.tv_sec ||
-        cc->command_timeout->tv_usec != tv.tv_usec) {
+    cc->route_version++;
 
-        if (cc->command_timeout == NULL) {
-            cc->command_timeout = hi_malloc(sizeof(struct timeval));
-            if (cc->command_timeout == NULL) {
-                __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-                return REDIS_ERR;
-            }
+    // Move all hiredis contexts in cc->nodes to nodes
+    cluster_nodes_swap_ctx(cc->nodes, nodes);
+
+    /* Replace cc->nodes before releasing the old dict since
+     * the release procedure might access cc->nodes. */
+    dict *oldnodes = cc->nodes;
+    cc->nodes = nodes;
+    if (oldnodes != NULL) {
+        dictRelease(oldnodes);
+    }
+
+    /* The old nodes may have borrowed from the old shared route */
+    hi_free(old_links);
+    slotmapSnapshotRelease(old_snapshot);
+
+    /* Keep the snapshot in line with the cluster, it is rewritten only when
+     * the topology actually changed. Saving is best effort. */
+    if (cc->slotmap_file != NULL) {
+        uint64_t signature = slotmapSignature(cc);
+        if (signature != cc->slotmap_file_signature &&
+            slotmapFileSave(cc) == REDIS_OK) {
+            cc->slotmap_file_signature = signature;
+        }
+    }
+    CLUSTER_STAT_ADD(cc, slotmap_updates, 1);
+    if (cc->event_callback != NULL) {
+        cc->event_callback(cc, HIRCLUSTER_EVENT_SLOTMAP_UPDATED,
+                           cc->event_privdata);
+        if (cc->route_version == 1) {
+            /* Special event the first time the slotmap was updated. */
+            cc->event_callback(cc, HIRCLUSTER_EVENT_READY, cc->event_privdata);
         }
+    }
+    cc->need_update_route = 0;
+}
 
-        memcpy(cc->command_timeout, &tv, sizeof(struct timeval));
+/* Update known cluster nodes with a new collection of redisClusterNodes.
+ * Will also update the slot-to-node lookup table for the new nodes. */
+static int updateNodesAndSlotmap(redisClusterContext *cc, dict *nodes) {
+    redisClusterNode **table;
 
-        /* Set timeout on already connected nodes */
-        if (cc->nodes && dictSize(cc->nodes) > 0) {
-            dictEntry *de;
-            redisClusterNode *node;
+    if (nodes == NULL) {
+        return REDIS_ERR;
+    }
 
-            dictIterator di;
-            dictInitIterator(&di, cc->nodes);
+    table = clusterSlotTableCreate(cc, nodes);
+    if (table == NULL) {
+        dictRelease(nodes);
+        return REDIS_ERR;
+    }
 
-            while ((de = dictNext(&di)) != NULL) {
-                node = dictGetEntryVal(de);
-                if (node->acon) {
-                    redisAsyncSetTimeout(node->acon, tv);
-                }
-                if (node->con && node->con->err == 0) {
-                    redisSetTimeout(node->con, tv);
-                }
+    clusterInstallRoute(cc, nodes, table, NULL, NULL);
+    return REDIS_OK;
+}
 
-                if (node->slaves && listLength(node->slaves) > 0) {
-                    redisClusterNode *slave;
-                    listNode *ln;
+int redisClusterUpdateSlotmap(redisClusterContext *cc) {
+    struct slotmapSnapshot *snapshot;
+    redisReply *reply;
+    int ret, querying;
 
-                    listIter li;
-                    listRewind(node->slaves, &li);
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
 
-                    while ((ln = listNext(&li)) != NULL) {
-                        slave = listNodeValue(ln);
-                        if (slave->acon) {
-                            redisAsyncSetTimeout(slave->acon, tv);
-                        }
-                        if (slave->con && slave->con->err == 0) {
-                            redisSetTimeout(slave->con, tv);
-                        }
-                    }
-                }
+    /* A route another member of the group got meanwhile is as fresh */
+    snapshot = slotmapGroupQueryBegin(cc, &querying);
+    if (snapshot != NULL) {
+        ret = slotmapGroupInstall(cc, snapshot);
+        slotmapSnapshotRelease(snapshot);
+        if (ret == REDIS_OK) {
+            if (cc->err) {
+                cc->err = 0;
+                memset(cc->errstr, '\0', strlen(cc->errstr));
             }
+            return REDIS_OK;
         }
     }
 
-    return REDIS_OK;
-}
-
-int redisClusterSetOptionMaxRetry(redisClusterContext *cc,
-                                  int max_retry_count) {
-    if (cc == NULL || max_retry_count <= 0) {
+    /* Seeds are tried until one of them answers with a route that installs */
+    reply = cluster_fetch_route(cc, clusterUpdateRouteInstallReply);
+    if (querying) {
+        slotmapGroupQueryDone(cc);
+    }
+    if (reply == NULL) {
+        CLUSTER_STAT_ADD(cc, slotmap_update_failures, 1);
+        clusterEvent(cc, HIRCLUSTER_EVENT_SLOTMAP_UPDATE_FAILED);
         return REDIS_ERR;
     }
 
-    cc->max_retry_count = max_retry_count;
+    freeReplyObject(reply);
+    if (cc->err) {
+        cc->err = 0;
+        memset(cc->errstr, '\0', strlen(cc->errstr));
+    }
 
     return REDIS_OK;
 }
 
-int redisClusterConnect2(redisClusterContext *cc) {
-
-    if (cc == NULL) {
-        return REDIS_ERR;
-    }
+#ifndef _WIN32
+/* A thread refreshing the slotmap on behalf of a synchronous context. It
+ * works on a private scratch context, seeded with the nodes of the owner, and
+ * publishes the raw route reply whenever the topology changed. The owner
+ * parses and installs it between two requests. */
+struct slotmapRefresher {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;                     /* Ask the thread to exit */
+    int triggered;                /* A refresh was requested */
+    int interval_ms;              /* Periodic refresh, 0 for none */
+    int64_t last_refresh;         /* Timestamp of the last query (usec) */
+    redisClusterContext *scratch; /* Context used by the thread only */
+    redisReply *fresh;            /* Route waiting to be adopted */
+    int published;                /* fresh is set, read without the lock */
+    uint64_t signature;           /* Topology of the last published route */
+};
 
-    return _redisClusterConnect2(cc);
+static int slotmapRefresherInstall(redisClusterContext *scratch,
+                                   redisReply *reply) {
+    return updateNodesAndSlotmap(scratch,
+                                 clusterUpdateRouteParseReply(scratch, reply));
 }
 
-redisContext *ctx_get_by_node(redisClusterContext *cc, redisClusterNode *node) {
-    redisContext *c = NULL;
-    if (node == NULL) {
+/* Queries the seeds of the scratch context for the route. The scratch
+ * context installs the result itself, so its nodes follow the cluster and
+ * serve as seeds next time. */
+static redisReply *slotmapRefresherFetch(redisClusterContext *scratch,
+                                         uint64_t *signature) {
+    redisReply *reply;
+
+    reply = cluster_fetch_route(scratch, slotmapRefresherInstall);
+    if (reply == NULL) {
         return NULL;
     }
 
-    c = node->con;
-    if (c != NULL) {
-        if (c->err) {
-            redisReconnect(c);
+    *signature = slotmapSignature(scratch);
+    return reply;
+}
 
-            if (cc->on_connect) {
-                cc->on_connect(c, c->err ? REDIS_ERR : REDIS_OK);
+static void *slotmapRefresherMain(void *arg) {
+    struct slotmapRefresher *r = arg;
+    struct timespec deadline;
+    uint64_t signature = 0;
+    redisReply *reply;
+    int64_t wait_usec;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop) {
+        if (!r->triggered) {
+            if (r->interval_ms > 0) {
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += r->interval_ms / 1000;
+                deadline.tv_nsec += (long)(r->interval_ms % 1000) * 1000000;
+                if (deadline.tv_nsec >= 1000000000) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                pthread_cond_timedwait(&r->cond, &r->lock, &deadline);
+            } else {
+                pthread_cond_wait(&r->cond, &r->lock);
             }
-
-            if (cc->ssl && cc->ssl_init_fn(c, cc->ssl) != REDIS_OK) {
-                __redisClusterSetError(cc, c->err, c->errstr);
+            if (r->stop) {
+                break;
             }
+        }
 
-            authenticate(cc, c); // err and errstr handled in function
+        /* Bursts of redirects or errors cause one query per throttle
+         * period at most */
+        if (r->triggered) {
+            wait_usec =
+                r->last_refresh + SLOTMAP_UPDATE_THROTTLE_USEC - hi_usec_now();
+            if (wait_usec > 0) {
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += wait_usec / 1000000;
+                deadline.tv_nsec += (long)(wait_usec % 1000000) * 1000;
+                if (deadline.tv_nsec >= 1000000000) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                pthread_cond_timedwait(&r->cond, &r->lock, &deadline);
+                continue;
+            }
+        }
+        r->triggered = 0;
+        r->last_refresh = hi_usec_now();
+        pthread_mutex_unlock(&r->lock);
+
+        reply = slotmapRefresherFetch(r->scratch, &signature);
+        r->scratch->err = 0;
+        r->scratch->errstr[0] = '\0';
+
+        pthread_mutex_lock(&r->lock);
+        if (reply != NULL && signature != r->signature) {
+            if (r->fresh != NULL) {
+                freeReplyObject(r->fresh);
+            }
+            r->fresh = reply;
+            r->signature = signature;
+            __atomic_store_n(&r->published, 1, __ATOMIC_RELEASE);
+        } else if (reply != NULL) {
+            freeReplyObject(reply);
         }
+    }
+    pthread_mutex_unlock(&r->lock);
 
-        return c;
+    return NULL;
+}
+
+static void slotmapRefresherStop(redisClusterContext *cc) {
+    struct slotmapRefresher *r = cc->refresher;
+
+    if (r == NULL) {
+        return;
     }
 
-    if (node->host == NULL || node->port <= 0) {
-        return NULL;
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+
+    if (r->fresh != NULL) {
+        freeReplyObject(r->fresh);
     }
+    redisClusterFree(r->scratch);
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    hi_free(r);
 
-    redisOptions options = {0};
-    REDIS_OPTIONS_SET_TCP(&options, node->host, node->port);
-    options.connect_timeout = cc->connect_timeout;
-    options.command_timeout = cc->command_timeout;
+    cc->refresher = NULL;
+}
 
-    c = redisConnectWithOptions(&options);
-    if (c == NULL) {
-        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-        return NULL;
+/* Asks the refresher for an update, returns REDIS_ERR when there is no
+ * refresher and the caller has to update the slotmap itself. */
+static int slotmapRefresherTrigger(redisClusterContext *cc) {
+    struct slotmapRefresher *r = cc->refresher;
+
+    if (r == NULL) {
+        return REDIS_ERR;
     }
 
-    if (cc->on_connect) {
-        cc->on_connect(c, c->err ? REDIS_ERR : REDIS_OK);
+    pthread_mutex_lock(&r->lock);
+    if (!r->triggered) {
+        r->triggered = 1;
+        pthread_cond_signal(&r->cond);
     }
+    pthread_mutex_unlock(&r->lock);
 
-    if (c->err) {
-        __redisClusterSetError(cc, c->err, c->errstr);
-        redisFree(c);
-        return NULL;
+    return REDIS_OK;
+}
+
+/* Installs a route published by the refresher. Only done between requests,
+ * never while pipelined commands wait for their replies. */
+static void slotmapRefresherAdopt(redisClusterContext *cc) {
+    struct slotmapRefresher *r = cc->refresher;
+    redisReply *reply;
+
+    if (r == NULL || !__atomic_load_n(&r->published, __ATOMIC_ACQUIRE)) {
+        return;
     }
 
-    if (cc->ssl && cc->ssl_init_fn(c, cc->ssl) != REDIS_OK) {
-        __redisClusterSetError(cc, c->err, c->errstr);
-        redisFree(c);
-        return NULL;
+    if (cc->requests != NULL && hiring_n(cc->requests) > 0) {
+        return;
     }
 
-    if (authenticate(cc, c) != REDIS_OK) {
-        redisFree(c);
-        return NULL;
+    pthread_mutex_lock(&r->lock);
+    reply = r->fresh;
+    r->fresh = NULL;
+    __atomic_store_n(&r->published, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&r->lock);
+
+    if (reply == NULL) {
+        return;
     }
 
-    node->con = c;
+    int ret = clusterUpdateRouteInstallReply(cc, reply);
+    freeReplyObject(reply);
+    if (ret != REDIS_OK) {
+        /* Keep the current slotmap, the next refresh brings another try */
+        cc->err = 0;
+        cc->errstr[0] = '\0';
+    }
+}
+#else
+static void slotmapRefresherStop(redisClusterContext *cc) { (void)cc; }
 
-    return c;
+static int slotmapRefresherTrigger(redisClusterContext *cc) {
+    (void)cc;
+    return REDIS_ERR;
 }
 
-static redisClusterNode *node_get_by_table(redisClusterContext *cc,
-                                           uint32_t slot_num) {
+static void slotmapRefresherAdopt(redisClusterContext *cc) { (void)cc; }
+#endif
+
+int redisClusterStartSlotmapRefresher(redisClusterContext *cc,
+                                      int interval_ms) {
+#ifdef _WIN32
+    (void)interval_ms;
+    __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                           "slotmap refresher is not supported on Windows");
+    return REDIS_ERR;
+#else
+    struct slotmapRefresher *r;
+    redisClusterContext *scratch;
+    redisClusterNode *node;
+    dictEntry *de;
+
     if (cc == NULL) {
-        return NULL;
+        return REDIS_ERR;
     }
 
-    if (slot_num >= REDIS_CLUSTER_SLOTS) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER, "invalid slot");
-        return NULL;
+    if (cc->refresher != NULL) {
+        return REDIS_OK;
     }
 
-    if (cc->table == NULL) {
-        __redisClusterSetError(cc, REDIS_ERR_OTHER, "slotmap not available");
-        return NULL;
+    if (cc->nodes == NULL || cc->table == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                               "slotmap refresher needs a connected context");
+        return REDIS_ERR;
+    }
+
+    /* The scratch context shares the configuration, but not the callbacks
+     * which are not prepared to run on another thread. */
+    scratch = redisClusterContextInit();
+    if (scratch == NULL) {
+        goto oom;
+    }
+    scratch->flags = cc->flags;
+    scratch->ssl = cc->ssl;
+    scratch->ssl_init_fn = cc->ssl_init_fn;
+    if ((cc->connect_timeout != NULL &&
+         redisClusterSetOptionConnectTimeout(scratch, *cc->connect_timeout) !=
+             REDIS_OK) ||
+        (cc->command_timeout != NULL &&
+         redisClusterSetOptionTimeout(scratch, *cc->command_timeout) !=
+             REDIS_OK) ||
+        (cc->username != NULL &&
+         redisClusterSetOptionUsername(scratch, cc->username) != REDIS_OK) ||
+        (cc->password != NULL &&
+         redisClusterSetOptionPassword(scratch, cc->password) != REDIS_OK) ||
+        (cc->client_name != NULL &&
+         redisClusterSetOptionClientName(scratch, cc->client_name) !=
+             REDIS_OK)) {
+        redisClusterFree(scratch);
+        goto oom;
+    }
+
+    dictIterator di;
+    dictInitIterator(&di, cc->nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        node = dictGetEntryVal(de);
+        if (node != NULL && node->addr != NULL &&
+            redisClusterSetOptionAddNode(scratch, node->addr) != REDIS_OK) {
+            __redisClusterSetError(cc, scratch->err, scratch->errstr);
+            redisClusterFree(scratch);
+            return REDIS_ERR;
+        }
+    }
+
+    r = hi_calloc(1, sizeof(*r));
+    if (r == NULL) {
+        redisClusterFree(scratch);
+        goto oom;
+    }
+    r->interval_ms = interval_ms;
+    r->scratch = scratch;
+    r->signature = slotmapSignature(cc);
+    r->last_refresh = hi_usec_now();
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    if (pthread_create(&r->thread, NULL, slotmapRefresherMain, r) != 0) {
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        hi_free(r);
+        redisClusterFree(scratch);
+        __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                               "failed to start the slotmap refresher");
+        return REDIS_ERR;
+    }
+
+    cc->refresher = r;
+    return REDIS_OK;
+
+oom:
+    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+#endif
+}
+
+redisClusterSlotmapGroup *redisClusterSlotmapGroupCreate(void) {
+#ifdef _WIN32
+    return NULL;
+#else
+    struct redisClusterSlotmapGroup *g;
+
+    g = hi_calloc(1, sizeof(*g));
+    if (g == NULL) {
+        return NULL;
+    }
+    g->refs = 1;
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->cond, NULL);
+
+    return g;
+#endif
+}
+
+void redisClusterSlotmapGroupRelease(redisClusterSlotmapGroup *g) {
+#ifdef _WIN32
+    (void)g;
+#else
+    if (g == NULL || __atomic_sub_fetch(&g->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    slotmapSnapshotRelease(g->snapshot);
+    pthread_cond_destroy(&g->cond);
+    pthread_mutex_destroy(&g->lock);
+    hi_free(g);
+#endif
+}
+
+redisClusterContext *redisClusterContextInit(void) {
+    redisClusterContext *cc;
+
+    /* Before the first allocation, see hialloc_install() */
+    hialloc_client_open();
+
+    cc = hi_calloc(1, sizeof(redisClusterContext));
+    if (cc == NULL) {
+        hialloc_client_close();
+        return NULL;
+    }
+
+    cc->command_pool = command_pool_create(CLUSTER_DEFAULT_COMMAND_POOL_SIZE);
+    if (cc->command_pool == NULL) {
+        hi_free(cc);
+        hialloc_client_close();
+        return NULL;
+    }
+
+    cc->max_retry_count = CLUSTER_DEFAULT_MAX_RETRY_COUNT;
+    cc->retry_base_delay_ms = CLUSTER_DEFAULT_RETRY_BASE_DELAY_MS;
+    cc->retry_max_delay_ms = CLUSTER_DEFAULT_RETRY_MAX_DELAY_MS;
+    return cc;
+}
+
+void redisClusterFree(redisClusterContext *cc) {
+
+    if (cc == NULL)
+        return;
+
+    /* The thread may still use the configuration */
+    slotmapRefresherStop(cc);
+
+    if (cc->event_callback) {
+        cc->event_callback(cc, HIRCLUSTER_EVENT_FREE_CONTEXT,
+                           cc->event_privdata);
+    }
+
+    if (cc->connect_timeout) {
+        hi_free(cc->connect_timeout);
+        cc->connect_timeout = NULL;
+    }
+
+    if (cc->command_timeout) {
+        hi_free(cc->command_timeout);
+        cc->command_timeout = NULL;
+    }
+
+    if (cc->slotmap_snapshot == NULL) {
+        hi_free(cc->table);
+    }
+    cc->table = NULL;
+
+    if (cc->nodes != NULL) {
+        /* Clear cc->nodes before releasing the dict since the release procedure
+           might access cc->nodes. When a node and its hiredis context are freed
+           all pending callbacks are executed. Clearing cc->nodes prevents a pending
+           slotmap update command callback to trigger additional slotmap updates. */
+        dict *nodes = cc->nodes;
+        cc->nodes = NULL;
+        dictRelease(nodes);
+    }
+
+    /* After the nodes, which may borrow from the shared route */
+    hi_free(cc->slotmap_links);
+    slotmapSnapshotRelease(cc->slotmap_snapshot);
+
+    if (cc->requests != NULL) {
+        hiring_destroy(cc->requests);
+    }
+
+    if (cc->username != NULL) {
+        hi_free(cc->username);
+        cc->username = NULL;
+    }
+
+    if (cc->password != NULL) {
+        hi_free(cc->password);
+        cc->password = NULL;
+    }
+
+    hi_free(cc->client_name);
+    hi_free(cc->slotmap_file);
+    redisClusterSlotmapGroupRelease(cc->slotmap_group);
+    hi_free(cc->poll_fds);
+    hi_free(cc->poll_nodes);
+    askCacheFree(cc->ask_cache);
+
+    if (cc->command_latency != NULL) {
+        int type;
+        for (type = 0; type < CMD_SENTINEL; type++) {
+            hihistogram_destroy(cc->command_latency[type]);
+        }
+        hi_free(cc->command_latency);
+    }
+    if (cc->node_latency != NULL) {
+        dictRelease(cc->node_latency);
+    }
+    hi_free(cc->command_allocs);
+    hislowlog_destroy(cc->slowlog);
+
+    /* Last, all commands have been returned to the pool by now. */
+    command_pool_destroy(cc->command_pool);
+    hiarena_destroy(cc->reply_arena);
+
+    hi_free(cc);
+
+    hialloc_client_close();
+}
+
+/* Builds the nodes of the snapshot file, seeded nodes not in the file are
+ * kept in case the snapshot is outdated altogether. Returns NULL when there is
+ * no usable snapshot. */
+static dict *slotmapFileLoad(redisClusterContext *cc) {
+    redisClusterNode *node;
+    cluster_slot *slot;
+    dictEntry *de;
+    dict *seeds, *nodes;
+    sds content = NULL, *lines = NULL, *part = NULL, addr;
+    int nlines = 0, npart = 0, nmasters = 0, i, j, start, end;
+    char buf[4096], *p;
+    size_t n;
+    FILE *fp;
+
+    fp = fopen(cc->slotmap_file, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    content = sdsempty();
+    while (content != NULL && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        content = sdscatlen(content, buf, n);
+    }
+    fclose(fp);
+    if (content == NULL) {
+        return NULL;
+    }
+
+    lines = sdssplitlen(content, (int)sdslen(content), "\n", 1, &nlines);
+    sdsfree(content);
+    if (lines == NULL || nlines < 2 ||
+        strcmp(lines[0], SLOTMAP_FILE_HEADER) != 0) {
+        sdsfreesplitres(lines, nlines);
+        return NULL;
+    }
+
+    /* Nodes are created into a fresh cc->nodes, the way they are added as
+     * seeds */
+    seeds = cc->nodes;
+    cc->nodes = NULL;
+
+    for (i = 1; i < nlines; i++) {
+        if (sdslen(lines[i]) == 0) {
+            continue;
+        }
+
+        part = sdssplitlen(lines[i], (int)sdslen(lines[i]), " ", 1, &npart);
+        if (part == NULL || npart < 2 ||
+            redisClusterSetOptionAddNode(cc, part[0]) != REDIS_OK) {
+            goto error;
+        }
+
+        de = dictFind(cc->nodes, part[0]);
+        if (de == NULL) {
+            goto error;
+        }
+        node = dictGetEntryVal(de);
+        node->role = REDIS_ROLE_MASTER;
+        nmasters++;
+
+        for (j = 1; j < npart; j++) {
+            p = strchr(part[j], '-');
+            if (p == NULL) {
+                goto error;
+            }
+            start = hi_atoi(part[j], (p - part[j]));
+            end = hi_atoi(p + 1, strlen(p + 1));
+            if (start < 0 || end < start || end >= REDIS_CLUSTER_SLOTS) {
+                goto error;
+            }
+
+            slot = cluster_slot_create(node);
+            if (slot == NULL) {
+                goto error;
+            }
+            slot->start = (uint32_t)start;
+            slot->end = (uint32_t)end;
+        }
+
+        sdsfreesplitres(part, npart);
+        part = NULL;
+        npart = 0;
+    }
+    sdsfreesplitres(lines, nlines);
+    lines = NULL;
+
+    if (nmasters == 0) {
+        goto error;
+    }
+
+    /* Add the seeds as well, as masters without slots, so they stay around
+     * as entry points when the snapshot turns out to be stale */
+    if (seeds != NULL) {
+        dictIterator di;
+        dictInitIterator(&di, seeds);
+        while ((de = dictNext(&di)) != NULL) {
+            addr = dictGetEntryKey(de);
+            if (redisClusterSetOptionAddNode(cc, addr) != REDIS_OK) {
+                goto error;
+            }
+            de = dictFind(cc->nodes, addr);
+            if (de == NULL) {
+                goto error;
+            }
+            node = dictGetEntryVal(de);
+            node->role = REDIS_ROLE_MASTER;
+        }
+    }
+
+    nodes = cc->nodes;
+    cc->nodes = seeds;
+    return nodes;
+
+error:
+    sdsfreesplitres(part, npart);
+    sdsfreesplitres(lines, nlines);
+    if (cc->nodes != NULL) {
+        dictRelease(cc->nodes);
+    }
+    cc->nodes = seeds;
+    cc->err = 0;
+    cc->errstr[0] = '\0';
+    return NULL;
+}
+
+/* Connect to a Redis cluster. On error the field error in the returned
+ * context will be set to the return value of the error function.
+ * When no set of reply functions is given, the default set will be used. */
+static int _redisClusterConnect2(redisClusterContext *cc) {
+
+    if (cc->nodes == NULL || dictSize(cc->nodes) == 0) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                               "servers address does not set up");
+        return REDIS_ERR;
+    }
+
+    /* Serve from the snapshot right away. The first command validates it, a
+     * refresh is pipelined with it. */
+    if (cc->slotmap_file != NULL) {
+        dict *nodes = slotmapFileLoad(cc);
+        if (nodes != NULL) {
+            char *file = cc->slotmap_file;
+
+            cc->slotmap_file = NULL; /* nothing new to save */
+            int ret = updateNodesAndSlotmap(cc, nodes);
+            cc->slotmap_file = file;
+
+            if (ret == REDIS_OK) {
+                cc->slotmap_file_signature = slotmapSignature(cc);
+                cc->need_update_route = 1;
+                return REDIS_OK;
+            }
+            cc->err = 0;
+            cc->errstr[0] = '\0';
+        }
+    }
+
+    return redisClusterUpdateSlotmap(cc);
+}
+
+/* Connect to a Redis cluster. On error the field error in the returned
+ * context will be set to the return value of the error function.
+ * When no set of reply functions is given, the default set will be used. */
+static redisClusterContext *_redisClusterConnect(redisClusterContext *cc,
+                                                 const char *addrs) {
+
+    int ret;
+
+    ret = redisClusterSetOptionAddNodes(cc, addrs);
+    if (ret != REDIS_OK) {
+        return cc;
+    }
+
+    redisClusterUpdateSlotmap(cc);
+
+    return cc;
+}
+
+redisClusterContext *redisClusterConnect(const char *addrs, int flags) {
+    redisClusterContext *cc;
+
+    cc = redisClusterContextInit();
+
+    if (cc == NULL) {
+        return NULL;
+    }
+
+    cc->flags = flags;
+
+    return _redisClusterConnect(cc, addrs);
+}
+
+redisClusterContext *redisClusterConnectWithTimeout(const char *addrs,
+                                                    const struct timeval tv,
+                                                    int flags) {
+    redisClusterContext *cc;
+
+    cc = redisClusterContextInit();
+
+    if (cc == NULL) {
+        return NULL;
+    }
+
+    cc->flags = flags;
+
+    if (cc->connect_timeout == NULL) {
+        cc->connect_timeout = hi_malloc(sizeof(struct timeval));
+        if (cc->connect_timeout == NULL) {
+            return NULL;
+        }
+    }
+
+    memcpy(cc->connect_timeout, &tv, sizeof(struct timeval));
+
+    return _redisClusterConnect(cc, addrs);
+}
+
+int redisClusterSetOptionAddNode(redisClusterContext *cc, const char *addr) {
+    dictEntry *node_entry;
+    redisClusterNode *node = NULL;
+    int port, ret;
+    sds ip = NULL;
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (cc->nodes == NULL) {
+        cc->nodes = dictCreate(&clusterNodesDictType, NULL);
+        if (cc->nodes == NULL) {
+            goto oom;
+        }
+    }
+
+    sds addr_sds = sdsnew(addr);
+    if (addr_sds == NULL) {
+        goto oom;
+    }
+    node_entry = dictFind(cc->nodes, addr_sds);
+    sdsfree(addr_sds);
+    if (node_entry == NULL) {
+
+        char *p;
+        if ((p = strrchr(addr, IP_PORT_SEPARATOR)) == NULL) {
+            __redisClusterSetError(
+                cc, REDIS_ERR_OTHER,
+                "server address is incorrect, port separator missing.");
+            return REDIS_ERR;
+        }
+        // p includes separator
+
+        if (p - addr <= 0) { /* length until separator */
+            __redisClusterSetError(
+                cc, REDIS_ERR_OTHER,
+                "server address is incorrect, address part missing.");
+            return REDIS_ERR;
+        }
+
+        ip = sdsnewlen(addr, p - addr);
+        if (ip == NULL) {
+            goto oom;
+        }
+        p++; // remove separator character
+
+        if (strlen(p) <= 0) {
+            __redisClusterSetError(
+                cc, REDIS_ERR_OTHER,
+                "server address is incorrect, port part missing.");
+            goto error;
+        }
+
+        port = hi_atoi(p, strlen(p));
+        if (port <= 0) {
+            __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                                   "server port is incorrect");
+            goto error;
+        }
+
+        node = createRedisClusterNode();
+        if (node == NULL) {
+            goto oom;
+        }
+
+        node->addr = sdsnew(addr);
+        if (node->addr == NULL) {
+            goto oom;
+        }
+
+        node->host = ip;
+        node->port = port;
+
+        sds key = sdsnewlen(node->addr, sdslen(node->addr));
+        if (key == NULL) {
+            goto oom;
+        }
+        ret = dictAdd(cc->nodes, key, node);
+        if (ret != DICT_OK) {
+            sdsfree(key);
+            goto oom;
+        }
+    }
+
+    return REDIS_OK;
+
+oom:
+    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+    // passthrough
+
+error:
+    sdsfree(ip);
+    if (node != NULL) {
+        sdsfree(node->addr);
+        hi_free(node);
+    }
+    return REDIS_ERR;
+}
+
+int redisClusterSetOptionAddNodes(redisClusterContext *cc, const char *addrs) {
+    int ret;
+    sds *address = NULL;
+    int address_count = 0;
+    int i;
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    address = sdssplitlen(addrs, strlen(addrs), CLUSTER_ADDRESS_SEPARATOR,
+                          strlen(CLUSTER_ADDRESS_SEPARATOR), &address_count);
+    if (address == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return REDIS_ERR;
+    }
+
+    if (address_count <= 0) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                               "invalid server addresses (example format: "
+                               "127.0.0.1:1234,127.0.0.2:5678)");
+        sdsfreesplitres(address, address_count);
+        return REDIS_ERR;
+    }
+
+    for (i = 0; i < address_count; i++) {
+        ret = redisClusterSetOptionAddNode(cc, address[i]);
+        if (ret != REDIS_OK) {
+            sdsfreesplitres(address, address_count);
+            return REDIS_ERR;
+        }
+    }
+
+    sdsfreesplitres(address, address_count);
+
+    return REDIS_OK;
+}
+
+/* Deprecated function, option has no effect. */
+int redisClusterSetOptionConnectBlock(redisClusterContext *cc) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* Deprecated function, option has no effect. */
+int redisClusterSetOptionConnectNonBlock(redisClusterContext *cc) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/**
+ * Configure a username used during authentication, see
+ * the Redis AUTH command.
+ * Disabled by default. Can be disabled again by providing an
+ * empty string or a null pointer.
+ */
+int redisClusterSetOptionUsername(redisClusterContext *cc,
+                                  const char *username) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    // Disabling option
+    if (username == NULL || username[0] == '\0') {
+        hi_free(cc->username);
+        cc->username = NULL;
+        return REDIS_OK;
+    }
+
+    hi_free(cc->username);
+    cc->username = hi_strdup(username);
+    if (cc->username == NULL) {
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+/**
+ * Configure a password used when connecting to password-protected
+ * Redis instances. (See Redis AUTH command)
+ */
+int redisClusterSetOptionPassword(redisClusterContext *cc,
+                                  const char *password) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    // Disabling use of password
+    if (password == NULL || password[0] == '\0') {
+        hi_free(cc->password);
+        cc->password = NULL;
+        return REDIS_OK;
+    }
+
+    hi_free(cc->password);
+    cc->password = hi_strdup(password);
+    if (cc->password == NULL) {
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+/**
+ * Configure a name announced with CLIENT SETNAME on every new connection,
+ * pipelined with AUTH so that it costs no extra round trip.
+ */
+int redisClusterSetOptionClientName(redisClusterContext *cc,
+                                    const char *name) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (name == NULL || name[0] == '\0') {
+        hi_free(cc->client_name);
+        cc->client_name = NULL;
+        return REDIS_OK;
+    }
+
+    hi_free(cc->client_name);
+    cc->client_name = hi_strdup(name);
+    if (cc->client_name == NULL) {
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionSlotmapFile(redisClusterContext *cc,
+                                     const char *path) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    hi_free(cc->slotmap_file);
+    cc->slotmap_file = NULL;
+    cc->slotmap_file_signature = 0;
+
+    if (path == NULL || path[0] == '\0') {
+        return REDIS_OK;
+    }
+
+    cc->slotmap_file = hi_strdup(path);
+    if (cc->slotmap_file == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionSlotmapGroup(redisClusterContext *cc,
+                                      redisClusterSlotmapGroup *group) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+#ifdef _WIN32
+    if (group != NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                               "slotmap groups are not supported on Windows");
+        return REDIS_ERR;
+    }
+#else
+    if (group != NULL) {
+        __atomic_add_fetch(&group->refs, 1, __ATOMIC_RELAXED);
+    }
+#endif
+
+    redisClusterSlotmapGroupRelease(cc->slotmap_group);
+    cc->slotmap_group = group;
+    cc->slotmap_group_version = 0;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionParseSlaves(redisClusterContext *cc) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    cc->flags |= HIRCLUSTER_FLAG_ADD_SLAVE;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionParseOpenSlots(redisClusterContext *cc) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    cc->flags |= HIRCLUSTER_FLAG_ADD_OPENSLOT;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionRouteUseSlots(redisClusterContext *cc) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    cc->flags |= HIRCLUSTER_FLAG_ROUTE_USE_SLOTS;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionConnectTimeout(redisClusterContext *cc,
+                                        const struct timeval tv) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (cc->connect_timeout == NULL) {
+        cc->connect_timeout = hi_malloc(sizeof(struct timeval));
+        if (cc->connect_timeout == NULL) {
+            __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+            return REDIS_ERR;
+        }
+    }
+
+    memcpy(cc->connect_timeout, &tv, sizeof(struct timeval));
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionTimeout(redisClusterContext *cc,
+                                 const struct timeval tv) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (cc->command_timeout == NULL ||
+        cc->command_timeout->tv_sec != tv.tv_sec ||
+        cc->command_timeout->tv_usec != tv.tv_usec) {
+
+        if (cc->command_timeout == NULL) {
+            cc->command_timeout = hi_malloc(sizeof(struct timeval));
+            if (cc->command_timeout == NULL) {
+                __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+                return REDIS_ERR;
+            }
+        }
+
+        memcpy(cc->command_timeout, &tv, sizeof(struct timeval));
+
+        /* Set timeout on already connected nodes */
+        if (cc->nodes && dictSize(cc->nodes) > 0) {
+            dictEntry *de;
+            redisClusterNode *node;
+
+            dictIterator di;
+            dictInitIterator(&di, cc->nodes);
+
+            while ((de = dictNext(&di)) != NULL) {
+                node = dictGetEntryVal(de);
+                if (node->acon) {
+                    redisAsyncSetTimeout(node->acon, tv);
+                }
+                if (node->con && node->con->err == 0) {
+                    redisSetTimeout(node->con, tv);
+                }
+
+                if (node->slaves && listLength(node->slaves) > 0) {
+                    redisClusterNode *slave;
+                    listNode *ln;
+
+                    listIter li;
+                    listRewind(node->slaves, &li);
+
+                    while ((ln = listNext(&li)) != NULL) {
+                        slave = listNodeValue(ln);
+                        if (slave->acon) {
+                            redisAsyncSetTimeout(slave->acon, tv);
+                        }
+                        if (slave->con && slave->con->err == 0) {
+                            redisSetTimeout(slave->con, tv);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionMaxRetry(redisClusterContext *cc,
+                                  int max_retry_count) {
+    if (cc == NULL || max_retry_count <= 0) {
+        return REDIS_ERR;
+    }
+
+    cc->max_retry_count = max_retry_count;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionRetryBackoff(redisClusterContext *cc,
+                                      int base_delay_ms, int max_delay_ms) {
+    if (cc == NULL || base_delay_ms < 0 || max_delay_ms < base_delay_ms) {
+        return REDIS_ERR;
+    }
+
+    cc->retry_base_delay_ms = base_delay_ms;
+    cc->retry_max_delay_ms = max_delay_ms;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionRetryDeadline(redisClusterContext *cc,
+                                       int deadline_ms) {
+    if (cc == NULL || deadline_ms < 0) {
+        return REDIS_ERR;
+    }
+
+    cc->retry_deadline_ms = deadline_ms;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionRetryBudget(redisClusterContext *cc,
+                                     int retries_per_second) {
+    if (cc == NULL || retries_per_second < 0) {
+        return REDIS_ERR;
+    }
+
+    cc->retry_budget = retries_per_second;
+    cc->retry_tokens = retries_per_second;
+    cc->retry_tokens_time = 0;
+
+    return REDIS_OK;
+}
+
+int redisClusterSetDeadline(redisClusterContext *cc, int timeout_ms) {
+    if (cc == NULL || timeout_ms < 0) {
+        return REDIS_ERR;
+    }
+
+    cc->deadline = timeout_ms > 0 ? hi_usec_now() + timeout_ms * 1000LL : 0;
+
+    return REDIS_OK;
+}
+
+void redisClusterLatencyForEach(redisClusterContext *cc,
+                                redisClusterLatencyFn *command_fn,
+                                redisClusterLatencyFn *node_fn,
+                                void *privdata) {
+    char name[128];
+    dictEntry *de;
+    int type;
+
+    if (cc == NULL || cc->command_latency == NULL) {
+        return;
+    }
+
+    if (command_fn != NULL) {
+        for (type = CMD_UNKNOWN + 1; type < CMD_SENTINEL; type++) {
+            if (cc->command_latency[type] != NULL &&
+                cc->command_latency[type]->count > 0 &&
+                redisClusterCommandName(type, name, sizeof(name)) != NULL) {
+                command_fn(name, cc->command_latency[type], privdata);
+            }
+        }
+    }
+
+    if (node_fn != NULL) {
+        dictIterator di;
+        dictInitIterator(&di, cc->node_latency);
+        while ((de = dictNext(&di)) != NULL) {
+            struct hihistogram *h = dictGetEntryVal(de);
+            if (h->count > 0) {
+                node_fn(dictGetEntryKey(de), h, privdata);
+            }
+        }
+    }
+}
+
+void redisClusterLatencyReset(redisClusterContext *cc) {
+    dictEntry *de;
+    int type;
+
+    if (cc == NULL || cc->command_latency == NULL) {
+        return;
+    }
+
+    for (type = 0; type < CMD_SENTINEL; type++) {
+        if (cc->command_latency[type] != NULL) {
+            hihistogram_reset(cc->command_latency[type]);
+        }
+    }
+
+    dictIterator di;
+    dictInitIterator(&di, cc->node_latency);
+    while ((de = dictNext(&di)) != NULL) {
+        hihistogram_reset(dictGetEntryVal(de));
+    }
+}
+
+void redisClusterAllocForEach(redisClusterContext *cc, redisClusterAllocFn *fn,
+                              void *privdata) {
+    char name[128];
+    int type;
+
+    if (cc == NULL || cc->command_allocs == NULL || fn == NULL) {
+        return;
+    }
+
+    for (type = CMD_UNKNOWN + 1; type < CMD_SENTINEL; type++) {
+        if (cc->command_allocs[type].calls > 0 &&
+            redisClusterCommandName(type, name, sizeof(name)) != NULL) {
+            fn(name, &cc->command_allocs[type], privdata);
+        }
+    }
+}
+
+void redisClusterAllocReset(redisClusterContext *cc) {
+    if (cc == NULL || cc->command_allocs == NULL) {
+        return;
+    }
+
+    memset(cc->command_allocs, 0,
+           CMD_SENTINEL * sizeof(struct hialloc_counters));
+}
+
+int redisClusterCommandType(const char *name, size_t len) {
+    if (name == NULL) {
+        return CMD_UNKNOWN;
+    }
+
+    return redis_command_type(name, (uint32_t)len, NULL, 0);
+}
+
+const char *redisClusterCommandName(int type, char *buf, size_t size) {
+    const char *name, *subname = NULL;
+
+    name = redis_command_name((cmd_type_t)type, &subname);
+    if (name == NULL || buf == NULL || size == 0) {
+        return NULL;
+    }
+
+    if (subname != NULL) {
+        snprintf(buf, size, "%s %s", name, subname);
+    } else {
+        snprintf(buf, size, "%s", name);
+    }
+    return buf;
+}
+
+int redisClusterSetOptionSlowlog(redisClusterContext *cc, int threshold_us,
+                                 uint32_t size) {
+    if (cc == NULL || threshold_us < 0) {
+        return REDIS_ERR;
+    }
+
+    if (cc->slowlog == NULL) {
+        cc->slowlog = hislowlog_create(size);
+        if (cc->slowlog == NULL) {
+            __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+            return REDIS_ERR;
+        }
+    }
+    cc->slowlog_threshold_us = threshold_us;
+
+    return REDIS_OK;
+}
+
+int redisClusterSlowlogPop(redisClusterContext *cc,
+                           struct hislowlog_entry *entry) {
+    if (cc == NULL || cc->slowlog == NULL || entry == NULL) {
+        return 0;
+    }
+
+    return hislowlog_pop(cc->slowlog, entry);
+}
+
+void redisClusterGetStats(const redisClusterContext *cc,
+                          redisClusterStats *stats) {
+    if (cc == NULL || stats == NULL) {
+        return;
+    }
+
+    stats->connects = CLUSTER_STAT_LOAD(cc, connects);
+    stats->reconnects = CLUSTER_STAT_LOAD(cc, reconnects);
+    stats->connect_failures = CLUSTER_STAT_LOAD(cc, connect_failures);
+    stats->commands = CLUSTER_STAT_LOAD(cc, commands);
+    stats->command_errors = CLUSTER_STAT_LOAD(cc, command_errors);
+    stats->moved = CLUSTER_STAT_LOAD(cc, moved);
+    stats->ask = CLUSTER_STAT_LOAD(cc, ask);
+    stats->tryagain = CLUSTER_STAT_LOAD(cc, tryagain);
+    stats->clusterdown = CLUSTER_STAT_LOAD(cc, clusterdown);
+    stats->slotmap_updates = CLUSTER_STAT_LOAD(cc, slotmap_updates);
+    stats->slotmap_update_failures =
+        CLUSTER_STAT_LOAD(cc, slotmap_update_failures);
+    stats->bytes_out = CLUSTER_STAT_LOAD(cc, bytes_out);
+    stats->bytes_in = CLUSTER_STAT_LOAD(cc, bytes_in);
+    stats->in_flight = CLUSTER_STAT_LOAD(cc, in_flight);
+}
+
+int redisClusterSetOptionLatencyStats(redisClusterContext *cc) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (cc->command_latency != NULL) {
+        return REDIS_OK;
+    }
+
+    cc->node_latency = dictCreate(&nodeLatencyDictType, NULL);
+    if (cc->node_latency == NULL) {
+        goto oom;
+    }
+
+    cc->command_latency = hi_calloc(CMD_SENTINEL, sizeof(struct hihistogram *));
+    if (cc->command_latency == NULL) {
+        dictRelease(cc->node_latency);
+        cc->node_latency = NULL;
+        goto oom;
+    }
+
+    return REDIS_OK;
+
+oom:
+    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+}
+
+int redisClusterSetOptionAllocStats(redisClusterContext *cc) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (cc->command_allocs != NULL) {
+        return REDIS_OK;
+    }
+
+    if (cc->table != NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER,
+                               "alloc stats must be set before connecting");
+        return REDIS_ERR;
+    }
+
+    /* Only this thread uses the context before it connects, other clients
+     * keep the allocators from being swapped */
+    hialloc_client_close();
+    int ret = hialloc_install();
+    hialloc_client_open();
+    if (ret != 0) {
+        __redisClusterSetError(
+            cc, REDIS_ERR_OTHER,
+            "alloc stats must be set before other clients open");
+        return REDIS_ERR;
+    }
+
+    cc->command_allocs =
+        hi_calloc(CMD_SENTINEL, sizeof(struct hialloc_counters));
+    if (cc->command_allocs == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+int redisClusterSetOptionReplyArena(redisClusterContext *cc) {
+    dictEntry *de;
+    redisClusterNode *node;
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (cc->reply_arena != NULL) {
+        return REDIS_OK;
+    }
+
+    cc->reply_arena = hiarena_create(HIARENA_DEFAULT_BLOCK_SIZE);
+    if (cc->reply_arena == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return REDIS_ERR;
+    }
+    cc->command_pool->reply_arena = cc->reply_arena;
+
+    /* Switch already connected nodes, they have no pending replies since the
+     * caller is not in the middle of a pipeline. */
+    if (cc->nodes != NULL) {
+        dictIterator di;
+        dictInitIterator(&di, cc->nodes);
+
+        while ((de = dictNext(&di)) != NULL) {
+            node = dictGetEntryVal(de);
+            if (node->con != NULL && node->con->err == 0 &&
+                hiarena_attach(node->con, cc->reply_arena) != REDIS_OK) {
+                __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+                return REDIS_ERR;
+            }
+        }
+    }
+
+    return REDIS_OK;
+}
+
+int redisClusterConnect2(redisClusterContext *cc) {
+
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    return _redisClusterConnect2(cc);
+}
+
+redisContext *ctx_get_by_node(redisClusterContext *cc, redisClusterNode *node) {
+    redisContext *c = NULL;
+    int reconnect = 0;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    c = node->con;
+    if (c != NULL && c->err && cc->deadline != 0) {
+        /* redisReconnect() would wait the whole connect timeout, a new
+         * connection is bounded by the deadline */
+        clusterNodeDropReplies(node);
+        redisFree(c);
+        node->con = NULL;
+        c = NULL;
+        reconnect = 1;
+    }
+    if (c != NULL) {
+        if (c->err) {
+            /* Whatever was read ahead belongs to the lost connection */
+            clusterNodeDropReplies(node);
+            redisReconnect(c);
+
+            /* A reconnect replaces the reader */
+            if (cc->reply_arena != NULL && c->err == 0 &&
+                hiarena_attach(c, cc->reply_arena) != REDIS_OK) {
+                __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+            }
+
+            if (cc->on_connect) {
+                cc->on_connect(c, c->err ? REDIS_ERR : REDIS_OK);
+            }
+
+            if (cc->ssl && cc->ssl_init_fn(c, cc->ssl) != REDIS_OK) {
+                __redisClusterSetError(cc, c->err, c->errstr);
+            }
+
+            /* TLS replaces the transport functions */
+            clusterStatTrack(cc, c);
+
+            // err and errstr handled in function
+            int ret = handshake(cc, c);
+            clusterStatConnected(cc, c->err == 0 && ret == REDIS_OK, 1);
+        }
+
+        if (c->err == 0) {
+            clusterDeadlineApply(cc, c);
+        }
+
+        return c;
+    }
+
+    if (node->host == NULL || node->port <= 0) {
+        return NULL;
+    }
+
+    if (clusterDeadlinePassed(cc)) {
+        return NULL;
+    }
+
+    struct timeval connect_tv, command_tv;
+    redisOptions options = {0};
+    REDIS_OPTIONS_SET_TCP(&options, node->host, node->port);
+    options.connect_timeout =
+        clusterDeadlineTimeout(cc, cc->connect_timeout, &connect_tv);
+    options.command_timeout =
+        clusterDeadlineTimeout(cc, cc->command_timeout, &command_tv);
+
+    c = redisConnectWithOptions(&options);
+    if (c == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        return NULL;
+    }
+
+    if (cc->on_connect) {
+        cc->on_connect(c, c->err ? REDIS_ERR : REDIS_OK);
+    }
+
+    if (c->err) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        goto error;
+    }
+
+    if (cc->ssl && cc->ssl_init_fn(c, cc->ssl) != REDIS_OK) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        goto error;
+    }
+
+    if (cc->reply_arena != NULL &&
+        hiarena_attach(c, cc->reply_arena) != REDIS_OK) {
+        __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+        goto error;
+    }
+
+    clusterStatTrack(cc, c);
+
+    if (handshake(cc, c) != REDIS_OK) {
+        goto error;
+    }
+
+    node->con = c;
+    clusterStatConnected(cc, 1, reconnect);
+
+    return c;
+
+error:
+    redisFree(c);
+    clusterStatConnected(cc, 0, reconnect);
+    return NULL;
+}
+
+#ifndef _WIN32
+/* Progress of a node connected by redisClusterConnectAll() */
+#define WARMUP_CONNECTING 0
+#define WARMUP_HANDSHAKE 1
+#define WARMUP_DONE 2
+#define WARMUP_FAILED 3
+
+struct warmupTarget {
+    redisClusterNode *node;
+    redisContext *c;
+    int state;
+    int pending; /* Handshake replies still to be read */
+};
+
+static void warmupFail(redisClusterContext *cc, struct warmupTarget *t,
+                       const char *reason) {
+    char msg[256];
+
+    snprintf(msg, sizeof(msg), "Connect to %s failed: %s", t->node->addr,
+             reason);
+    __redisClusterSetError(cc, REDIS_ERR_OTHER, msg);
+
+    redisFree(t->c);
+    t->c = NULL;
+    t->state = WARMUP_FAILED;
+    clusterStatConnected(cc, 0, 0);
+}
+
+/* Puts an established connection back into the blocking mode the context
+ * works in, and hands it over to its node. TLS is set up here too, hiredis
+ * only does it on a blocking socket. */
+static void warmupFinish(redisClusterContext *cc, struct warmupTarget *t) {
+    redisContext *c = t->c;
+    int flags;
+
+    flags = fcntl(c->fd, F_GETFL);
+    if (flags == -1 || fcntl(c->fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        warmupFail(cc, t, strerror(errno));
+        return;
+    }
+    c->flags |= REDIS_BLOCK;
+
+    if (cc->command_timeout != NULL &&
+        redisSetTimeout(c, *cc->command_timeout) != REDIS_OK) {
+        warmupFail(cc, t, c->errstr);
+        return;
+    }
+
+    if (cc->ssl != NULL) {
+        if (cc->ssl_init_fn(c, cc->ssl) != REDIS_OK) {
+            warmupFail(cc, t, c->errstr);
+            return;
+        }
+        if (handshake(cc, c) != REDIS_OK) {
+            warmupFail(cc, t, cc->errstr);
+            return;
+        }
+    }
+
+    if (cc->reply_arena != NULL &&
+        hiarena_attach(c, cc->reply_arena) != REDIS_OK) {
+        warmupFail(cc, t, "Out of memory");
+        return;
+    }
+
+    clusterStatTrack(cc, c);
+
+    t->node->con = c;
+    t->c = NULL;
+    t->state = WARMUP_DONE;
+    clusterStatConnected(cc, 1, 0);
+}
+
+/* The socket of a connecting node became writable. */
+static void warmupConnected(redisClusterContext *cc, struct warmupTarget *t) {
+    redisContext *c = t->c;
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        err = errno;
+    }
+
+    if (cc->on_connect) {
+        cc->on_connect(c, err ? REDIS_ERR : REDIS_OK);
+    }
+
+    if (err) {
+        warmupFail(cc, t, strerror(err));
+        return;
+    }
+
+    /* The handshake goes out right away, its replies are awaited along with
+     * the other nodes. Over TLS it has to wait for the TLS handshake. */
+    if (cc->ssl != NULL) {
+        warmupFinish(cc, t);
+        return;
+    }
+
+    t->pending = clusterAppendHandshake(cc, c);
+    if (t->pending < 0) {
+        warmupFail(cc, t, c->errstr);
+        return;
+    }
+    if (t->pending == 0) {
+        warmupFinish(cc, t);
+        return;
+    }
+    t->state = WARMUP_HANDSHAKE;
+}
+
+/* Some I/O happened on a node waiting for its handshake replies. */
+static void warmupHandshake(redisClusterContext *cc, struct warmupTarget *t,
+                            short revents) {
+    redisContext *c = t->c;
+    redisReply *reply;
+    int wdone;
+
+    if ((revents & POLLOUT) && sdslen(c->obuf) > 0 &&
+        redisBufferWrite(c, &wdone) != REDIS_OK) {
+        warmupFail(cc, t, c->errstr);
+        return;
+    }
+
+    if (!(revents & (POLLIN | POLLERR | POLLHUP))) {
+        return;
+    }
+
+    if (redisBufferRead(c) != REDIS_OK) {
+        warmupFail(cc, t, c->errstr);
+        return;
+    }
+
+    while (t->pending > 0) {
+        reply = NULL;
+        if (redisGetReplyFromReader(c, (void **)&reply) != REDIS_OK) {
+            warmupFail(cc, t, c->errstr);
+            return;
+        }
+        if (reply == NULL) {
+            return;
+        }
+
+        if (reply->type == REDIS_REPLY_ERROR) {
+            warmupFail(cc, t, reply->str);
+            freeReplyObject(reply);
+            return;
+        }
+        freeReplyObject(reply);
+        t->pending--;
+    }
+
+    warmupFinish(cc, t);
+}
+
+/* Adds a node to the warm up set unless it is connected already. */
+static void warmupAddTarget(struct warmupTarget *targets, uint32_t *n,
+                            redisClusterNode *node) {
+    if (node->con != NULL || node->host == NULL || node->port <= 0) {
+        return;
+    }
+    if (targets != NULL) {
+        targets[*n].node = node;
+    }
+    (*n)++;
+}
+
+/* Collects the masters serving slots, and their replicas when those are
+ * parsed. Only counts them when targets is NULL. */
+static uint32_t warmupCollectTargets(redisClusterContext *cc,
+                                     struct warmupTarget *targets) {
+    redisClusterNode *master;
+    dictEntry *de;
+    listIter li;
+    listNode *ln;
+    uint32_t n = 0;
+
+    dictIterator di;
+    dictInitIterator(&di, cc->nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        master = dictGetEntryVal(de);
+        if (master->slots == NULL || listLength(master->slots) == 0) {
+            continue;
+        }
+        warmupAddTarget(targets, &n, master);
+
+        if (!(cc->flags & HIRCLUSTER_FLAG_ADD_SLAVE) ||
+            master->slaves == NULL) {
+            continue;
+        }
+        listRewind(master->slaves, &li);
+        while ((ln = listNext(&li)) != NULL) {
+            warmupAddTarget(targets, &n, listNodeValue(ln));
+        }
+    }
+
+    return n;
+}
+#endif
+
+/* Connects and authenticates to every master, and to the replicas when
+ * slaves are parsed, before the first command needs them. The connects are
+ * non-blocking and run concurrently, as do the handshake round trips, so it
+ * takes about as long as the slowest node. Nodes that could not be reached keep no
+ * connection, the error names the last of them, and commands connect them
+ * lazily as usual. On Windows the nodes are connected one after another. */
+int redisClusterConnectAll(redisClusterContext *cc) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    if (cc->nodes == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER, "no server address");
+        return REDIS_ERR;
+    }
+
+#ifdef _WIN32
+    redisClusterNode *node;
+    dictEntry *de;
+    int failed = 0;
+
+    dictIterator di;
+    dictInitIterator(&di, cc->nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        node = dictGetEntryVal(de);
+        if (node->slots == NULL || listLength(node->slots) == 0) {
+            continue;
+        }
+        if (ctx_get_by_node(cc, node) == NULL) {
+            failed = 1;
+        }
+        if (!(cc->flags & HIRCLUSTER_FLAG_ADD_SLAVE) || node->slaves == NULL) {
+            continue;
+        }
+        listIter li;
+        listNode *ln;
+        listRewind(node->slaves, &li);
+        while ((ln = listNext(&li)) != NULL) {
+            if (ctx_get_by_node(cc, listNodeValue(ln)) == NULL) {
+                failed = 1;
+            }
+        }
+    }
+
+    return failed ? REDIS_ERR : REDIS_OK;
+#else
+    struct warmupTarget *targets = NULL;
+    struct pollfd *fds = NULL;
+    struct warmupTarget *t;
+    uint32_t i, n, active;
+    int64_t deadline = -1, remaining;
+    int timeout, failed = 0;
+
+    n = warmupCollectTargets(cc, NULL);
+    if (n == 0) {
+        return REDIS_OK;
+    }
+
+    targets = hi_calloc(n, sizeof(*targets));
+    fds = hi_calloc(n, sizeof(*fds));
+    if (targets == NULL || fds == NULL) {
+        goto oom;
+    }
+    n = warmupCollectTargets(cc, targets);
+
+    /* One budget for the whole round, the slowest node may need both */
+    if (cc->connect_timeout != NULL || cc->command_timeout != NULL) {
+        deadline = hi_usec_now();
+        if (cc->connect_timeout != NULL) {
+            deadline += cc->connect_timeout->tv_sec * 1000000LL +
+                        cc->connect_timeout->tv_usec;
+        }
+        if (cc->command_timeout != NULL) {
+            deadline += cc->command_timeout->tv_sec * 1000000LL +
+                        cc->command_timeout->tv_usec;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        t = &targets[i];
+
+        redisOptions options = {0};
+        REDIS_OPTIONS_SET_TCP(&options, t->node->host, t->node->port);
+        options.options |= REDIS_OPT_NONBLOCK;
+        options.connect_timeout = cc->connect_timeout;
+
+        t->c = redisConnectWithOptions(&options);
+        if (t->c == NULL) {
+            goto oom;
+        }
+        t->state = WARMUP_CONNECTING;
+        if (t->c->err) {
+            if (cc->on_connect) {
+                cc->on_connect(t->c, REDIS_ERR);
+            }
+            warmupFail(cc, t, t->c->errstr);
+        }
+    }
+
+    for (;;) {
+        active = 0;
+        for (i = 0; i < n; i++) {
+            t = &targets[i];
+            fds[i].fd = -1;
+            fds[i].events = 0;
+            fds[i].revents = 0;
+
+            if (t->state == WARMUP_CONNECTING) {
+                fds[i].events = POLLOUT;
+            } else if (t->state == WARMUP_HANDSHAKE) {
+                fds[i].events = POLLIN;
+                if (sdslen(t->c->obuf) > 0) {
+                    fds[i].events |= POLLOUT;
+                }
+            }
+            if (fds[i].events) {
+                fds[i].fd = t->c->fd;
+                active++;
+            }
+        }
+
+        if (active == 0) {
+            break;
+        }
+
+        timeout = -1;
+        if (deadline >= 0) {
+            remaining = deadline - hi_usec_now();
+            if (remaining <= 0) {
+                for (i = 0; i < n; i++) {
+                    if (fds[i].events) {
+                        warmupFail(cc, &targets[i], "Timeout");
+                    }
+                }
+                break;
+            }
+            timeout = (int)((remaining + 999) / 1000);
+        }
+
+        int rv = poll(fds, n, timeout);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            for (i = 0; i < n; i++) {
+                if (fds[i].events) {
+                    warmupFail(cc, &targets[i], strerror(errno));
+                }
+            }
+            break;
+        }
+
+        for (i = 0; i < n && rv > 0; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            t = &targets[i];
+            if (t->state == WARMUP_CONNECTING) {
+                warmupConnected(cc, t);
+            } else if (t->state == WARMUP_HANDSHAKE) {
+                warmupHandshake(cc, t, fds[i].revents);
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (targets[i].state == WARMUP_FAILED) {
+            failed = 1;
+        }
+    }
+
+    hi_free(targets);
+    hi_free(fds);
+
+    return failed ? REDIS_ERR : REDIS_OK;
+
+oom:
+    if (targets != NULL) {
+        for (i = 0; i < n; i++) {
+            redisFree(targets[i].c);
+        }
+    }
+    hi_free(targets);
+    hi_free(fds);
+    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+#endif
+}
+
+static redisClusterNode *node_get_by_table(redisClusterContext *cc,
+                                           uint32_t slot_num) {
+    if (cc == NULL) {
+        return NULL;
+    }
+
+    if (slot_num >= REDIS_CLUSTER_SLOTS) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER, "invalid slot");
+        return NULL;
+    }
+
+    if (cc->table == NULL) {
+        __redisClusterSetError(cc, REDIS_ERR_OTHER, "slotmap not available");
+        return NULL;
     }
 
     if (cc->table[slot_num] == NULL) {
@@ -2043,45 +4493,303 @@ static redisClusterNode *node_get_by_table(redisClusterContext *cc,
         return NULL;
     }
 
-    return cc->table[slot_num];
-}
+    /* A shared table points at nodes of the group, not of cc */
+    if (cc->slotmap_snapshot != NULL) {
+        return cc->slotmap_links[cc->table[slot_num]->index];
+    }
+
+    return cc->table[slot_num];
+}
+
+/* Helper function for the redisClusterAppendCommand* family of functions.
+ *
+ * Write a formatted command to the output buffer. When this family
+ * is used, you need to call redisGetReply yourself to retrieve
+ * the reply (or replies in pub/sub).
+ */
+static int __redisClusterAppendCommand(redisClusterContext *cc,
+                                       struct cmd *command) {
+
+    redisClusterNode *node;
+    redisContext *c = NULL;
+
+    if (cc == NULL || command == NULL) {
+        return REDIS_ERR;
+    }
+
+    node = node_get_by_table(cc, (uint32_t)command->slot_num);
+    if (node == NULL) {
+        return REDIS_ERR;
+    }
+
+    c = ctx_get_by_node(cc, node);
+    if (c == NULL) {
+        return REDIS_ERR;
+    } else if (c->err) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        return REDIS_ERR;
+    }
+
+    if (redisAppendFormattedCommand(c, command->cmd, command->clen) !=
+        REDIS_OK) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        return REDIS_ERR;
+    }
+    node->pending++;
+
+    return REDIS_OK;
+}
+
+#ifndef _WIN32
+/* Switches the connections taking part in a poll round between blocking and
+ * non-blocking mode, hiredis has to know about it as well. */
+static void clusterPollSetBlocking(redisClusterContext *cc, uint32_t n,
+                                   int blocking) {
+    redisContext *c;
+    uint32_t i;
+    int flags;
+
+    for (i = 0; i < n; i++) {
+        c = cc->poll_nodes[i]->con;
+        flags = fcntl(c->fd, F_GETFL);
+        if (flags == -1) {
+            continue;
+        }
+
+        if (blocking) {
+            fcntl(c->fd, F_SETFL, flags & ~O_NONBLOCK);
+            c->flags |= REDIS_BLOCK;
+        } else {
+            fcntl(c->fd, F_SETFL, flags | O_NONBLOCK);
+            c->flags &= ~REDIS_BLOCK;
+        }
+    }
+}
+
+/* Parses the complete replies in the reader of a node into its reply queue. */
+static int clusterNodeQueueReplies(redisClusterContext *cc,
+                                   redisClusterNode *node) {
+    void *reply;
+
+    while (node->pending > 0) {
+        if (redisGetReplyFromReader(node->con, &reply) != REDIS_OK ||
+            reply == NULL) {
+            /* A protocol error stays on the connection */
+            return REDIS_OK;
+        }
+
+        if (node->replies == NULL) {
+            node->replies = hiring_create(CLUSTER_DEFAULT_REQUESTS_SIZE);
+        }
+        if (node->replies == NULL ||
+            hiring_push(node->replies, reply) != HI_OK) {
+            if (node->con->reader->fn && node->con->reader->fn->freeObject) {
+                node->con->reader->fn->freeObject(reply);
+            }
+            __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+            return REDIS_ERR;
+        }
+        node->pending--;
+    }
+
+    return REDIS_OK;
+}
+#endif
+
+/* Makes progress on all nodes of a pipeline at once. Output buffers are
+ * written concurrently and replies are read into the queue of their node as
+ * they arrive, so a slow node does not hold back the others. Returns when the
+ * target node has a reply queued, or when no target is given, once every
+ * output buffer is flushed. A connection failing on the way keeps its error
+ * for whoever reads from it next.
+ *
+ * Nothing is done for a single busy connection, for TLS where data may sit
+ * in the SSL layer unseen by poll(), and on Windows: the blocking calls of
+ * hiredis serve these cases. */
+static int clusterPollNodes(redisClusterContext *cc,
+                            redisClusterNode *target) {
+#ifdef _WIN32
+    (void)cc;
+    (void)target;
+    return REDIS_OK;
+#else
+    dictEntry *de;
+    redisClusterNode *node;
+    redisContext *c;
+    uint32_t i, n, nalloc, busy;
+    int timeout, wdone, status = REDIS_OK;
+    int64_t deadline, left;
+    short events, revents;
+
+    if (cc->ssl != NULL || cc->nodes == NULL) {
+        return REDIS_OK;
+    }
+
+    if (target != NULL &&
+        (target->con == NULL || target->con->err || target->pending == 0)) {
+        return REDIS_OK;
+    }
+
+    /* Collect the connections with something to write or to read */
+    n = 0;
+    dictIterator di;
+    dictInitIterator(&di, cc->nodes);
+    while ((de = dictNext(&di)) != NULL) {
+        node = dictGetEntryVal(de);
+        c = node->con;
+        if (c == NULL || c->err || c->fd == REDIS_INVALID_FD) {
+            continue;
+        }
+        if (node->pending == 0 && sdslen(c->obuf) == 0) {
+            continue;
+        }
+
+        if (n == cc->poll_nalloc) {
+            struct pollfd *fds;
+            redisClusterNode **nodes;
+
+            nalloc = n == 0 ? 16 : n * 2;
+            fds = hi_realloc(cc->poll_fds, nalloc * sizeof(*fds));
+            if (fds == NULL) {
+                goto oom;
+            }
+            cc->poll_fds = fds;
+            nodes = hi_realloc(cc->poll_nodes, nalloc * sizeof(*nodes));
+            if (nodes == NULL) {
+                goto oom;
+            }
+            cc->poll_nodes = nodes;
+            cc->poll_nalloc = nalloc;
+        }
+        cc->poll_nodes[n++] = node;
+    }
+
+    if (n < 2) {
+        return REDIS_OK;
+    }
+
+    /* Replies may already be buffered by an earlier blocking read, poll()
+     * would never report them */
+    for (i = 0; i < n; i++) {
+        if (clusterNodeQueueReplies(cc, cc->poll_nodes[i]) != REDIS_OK) {
+            return REDIS_ERR;
+        }
+    }
+
+    /* One deadline for the whole wait, a node trickling in a few bytes at a
+     * time does not stretch it */
+    struct timeval buf;
+    const struct timeval *tv =
+        clusterDeadlineTimeout(cc, cc->command_timeout, &buf);
+    deadline = 0;
+    if (tv != NULL) {
+        deadline = hi_usec_now() + tv->tv_sec * 1000000LL + tv->tv_usec;
+    }
+
+    clusterPollSetBlocking(cc, n, 0);
+
+    for (;;) {
+        if (target != NULL) {
+            if (target->replies != NULL && hiring_n(target->replies) > 0) {
+                break;
+            }
+            if (target->con->err || target->pending == 0) {
+                break;
+            }
+        }
+
+        busy = 0;
+        for (i = 0; i < n; i++) {
+            node = cc->poll_nodes[i];
+            c = node->con;
+            events = 0;
+            if (!c->err) {
+                if (sdslen(c->obuf) > 0) {
+                    events |= POLLOUT;
+                    busy++;
+                }
+                if (node->pending > 0) {
+                    events |= POLLIN;
+                }
+            }
+            cc->poll_fds[i].fd = events ? c->fd : -1;
+            cc->poll_fds[i].events = events;
+            cc->poll_fds[i].revents = 0;
+        }
+
+        /* Flushing is done once no output is left */
+        if (target == NULL && busy == 0) {
+            break;
+        }
 
-/* Helper function for the redisClusterAppendCommand* family of functions.
- *
- * Write a formatted command to the output buffer. When this family
- * is used, you need to call redisGetReply yourself to retrieve
- * the reply (or replies in pub/sub).
- */
-static int __redisClusterAppendCommand(redisClusterContext *cc,
-                                       struct cmd *command) {
+        timeout = -1;
+        if (deadline != 0) {
+            left = deadline - hi_usec_now();
+            timeout = left > 0 ? (int)((left + 999) / 1000) : 0;
+        }
 
-    redisClusterNode *node;
-    redisContext *c = NULL;
+        int rv = poll(cc->poll_fds, n, timeout);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            __redisClusterSetError(cc, REDIS_ERR_IO, NULL);
+            status = REDIS_ERR;
+            break;
+        } else if (rv == 0) {
+            /* A reply arriving late would answer the next request, the
+             * connections still waiting are dropped like hiredis does */
+            for (i = 0; i < n; i++) {
+                node = cc->poll_nodes[i];
+                c = node->con;
+                if (c->err || node->pending == 0) {
+                    continue;
+                }
+                __redisSetError(c, REDIS_ERR_TIMEOUT, "Timeout");
+                clusterNodeDropReplies(node);
+            }
+            __redisClusterSetError(cc, REDIS_ERR_TIMEOUT, "Timeout");
+            status = REDIS_ERR;
+            break;
+        }
 
-    if (cc == NULL || command == NULL) {
-        return REDIS_ERR;
-    }
+        for (i = 0; i < n; i++) {
+            revents = cc->poll_fds[i].revents;
+            if (revents == 0) {
+                continue;
+            }
 
-    node = node_get_by_table(cc, (uint32_t)command->slot_num);
-    if (node == NULL) {
-        return REDIS_ERR;
+            node = cc->poll_nodes[i];
+            c = node->con;
+            if ((revents & (POLLOUT | POLLERR | POLLHUP)) &&
+                sdslen(c->obuf) > 0) {
+                if (redisBufferWrite(c, &wdone) != REDIS_OK) {
+                    continue;
+                }
+            }
+            if ((revents & (POLLIN | POLLERR | POLLHUP)) && node->pending > 0) {
+                if (redisBufferRead(c) != REDIS_OK) {
+                    continue;
+                }
+                if (clusterNodeQueueReplies(cc, node) != REDIS_OK) {
+                    status = REDIS_ERR;
+                    break;
+                }
+            }
+        }
+        if (status != REDIS_OK) {
+            break;
+        }
     }
 
-    c = ctx_get_by_node(cc, node);
-    if (c == NULL) {
-        return REDIS_ERR;
-    } else if (c->err) {
-        __redisClusterSetError(cc, c->err, c->errstr);
-        return REDIS_ERR;
-    }
+    clusterPollSetBlocking(cc, n, 1);
 
-    if (redisAppendFormattedCommand(c, command->cmd, command->clen) !=
-        REDIS_OK) {
-        __redisClusterSetError(cc, c->err, c->errstr);
-        return REDIS_ERR;
-    }
+    return status;
 
-    return REDIS_OK;
+oom:
+    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+    return REDIS_ERR;
+#endif
 }
 
 /* Helper functions for the redisClusterGetReply* family of functions.
@@ -2097,6 +4805,17 @@ static int __redisClusterGetReplyFromNode(redisClusterContext *cc,
     c = node->con;
     if (c == NULL) {
         return REDIS_ERR;
+    }
+
+    /* Read the other nodes while waiting for this one */
+    if (node->replies == NULL || hiring_n(node->replies) == 0) {
+        if (clusterPollNodes(cc, node) != REDIS_OK) {
+            return REDIS_ERR;
+        }
+    }
+
+    if (node->replies != NULL && hiring_n(node->replies) > 0) {
+        *reply = hiring_pop(node->replies);
     } else if (c->err) {
         if (cc->need_update_route == 0) {
             cc->retry_count++;
@@ -2107,15 +4826,21 @@ static int __redisClusterGetReplyFromNode(redisClusterContext *cc,
         }
         __redisClusterSetError(cc, c->err, c->errstr);
         return REDIS_ERR;
+    } else {
+        if (redisGetReply(c, reply) != REDIS_OK) {
+            __redisClusterSetError(cc, c->err, c->errstr);
+            return REDIS_ERR;
+        }
+        if (node->pending > 0) {
+            node->pending--;
+        }
     }
 
-    if (redisGetReply(c, reply) != REDIS_OK) {
-        __redisClusterSetError(cc, c->err, c->errstr);
-        return REDIS_ERR;
-    }
-
-    if (cluster_reply_error_type(*reply) == CLUSTER_ERR_MOVED)
+    if (cluster_reply_error_type(*reply) == CLUSTER_ERR_MOVED) {
         cc->need_update_route = 1;
+        CLUSTER_STAT_ADD(cc, moved, 1);
+        clusterEvent(cc, HIRCLUSTER_EVENT_MOVED);
+    }
 
     return REDIS_OK;
 }
@@ -2198,30 +4923,495 @@ static redisClusterNode *getNodeFromRedirectReply(redisClusterContext *cc,
     p++; // remove found separator character
     node->port = hi_atoi(p, strlen(p));
 
-    sds key = sdsnewlen(node->addr, sdslen(node->addr));
-    if (key == NULL) {
-        goto oom;
+    sds key = sdsnewlen(node->addr, sdslen(node->addr));
+    if (key == NULL) {
+        goto oom;
+    }
+
+    if (dictAdd(cc->nodes, key, node) != DICT_OK) {
+        sdsfree(key);
+        goto oom;
+    }
+
+done:
+    sdsfreesplitres(part, part_len);
+    return node;
+
+oom:
+    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
+    sdsfreesplitres(part, part_len);
+    if (node != NULL) {
+        sdsfree(node->addr);
+        sdsfree(node->host);
+        hi_free(node);
+    }
+
+    return NULL;
+}
+
+/* While a slot migrates, keys already moved to the importing node are
+ * answered with ASK by the source node. Such keys are remembered for a short
+ * time, so further accesses go to the importing node right away. The cache is
+ * direct mapped, a key simply replaces the one it collides with. Its entries
+ * are only valid for the slotmap they were learned with. */
+#define CLUSTER_ASK_CACHE_SIZE 256 /* power of two */
+#define CLUSTER_ASK_CACHE_TTL_USEC 5000000
+
+typedef struct askCacheEntry {
+    sds key;                /* NULL when unused */
+    int slot;               /* slot of the key */
+    int64_t expires;        /* usec timestamp */
+    redisClusterNode *node; /* importing node */
+} askCacheEntry;
+
+struct askcache {
+    uint64_t route_version; /* slotmap version of the entries */
+    uint32_t used;          /* # entries holding a key */
+    askCacheEntry entries[CLUSTER_ASK_CACHE_SIZE];
+};
+
+static void askCacheClear(struct askcache *ac) {
+    uint32_t i;
+
+    for (i = 0; i < CLUSTER_ASK_CACHE_SIZE && ac->used > 0; i++) {
+        if (ac->entries[i].key != NULL) {
+            sdsfree(ac->entries[i].key);
+            ac->entries[i].key = NULL;
+            ac->used--;
+        }
+    }
+}
+
+static void askCacheFree(struct askcache *ac) {
+    if (ac == NULL) {
+        return;
+    }
+
+    askCacheClear(ac);
+    hi_free(ac);
+}
+
+/* Returns the entry a command maps to. Only commands with a single key are
+ * cached. */
+static askCacheEntry *askCacheEntryOf(struct askcache *ac, struct cmd *command,
+                                      char **key, int *len) {
+    struct keypos *kp;
+
+    if (hiarray_n(command->keys) != 1) {
+        return NULL;
+    }
+
+    kp = hiarray_get(command->keys, 0);
+    *key = kp->start;
+    *len = (int)(kp->end - kp->start);
+
+    return &ac->entries[dictGenHashFunction((unsigned char *)*key, *len) &
+                        (CLUSTER_ASK_CACHE_SIZE - 1)];
+}
+
+/* Returns the importing node a command has to be sent to with ASKING, or NULL
+ * when the slotmap applies. */
+static redisClusterNode *askCacheLookup(redisClusterContext *cc,
+                                        struct cmd *command) {
+    struct askcache *ac = cc->ask_cache;
+    askCacheEntry *e;
+    char *key;
+    int len;
+
+    if (ac == NULL || ac->used == 0) {
+        return NULL;
+    }
+
+    if (ac->route_version != cc->route_version) {
+        askCacheClear(ac);
+        return NULL;
+    }
+
+    e = askCacheEntryOf(ac, command, &key, &len);
+    if (e == NULL || e->key == NULL || e->slot != command->slot_num ||
+        (int)sdslen(e->key) != len || memcmp(e->key, key, len) != 0) {
+        return NULL;
+    }
+
+    if (e->expires < hi_usec_now()) {
+        sdsfree(e->key);
+        e->key = NULL;
+        ac->used--;
+        return NULL;
+    }
+
+    cc->ask_cache_hits++;
+    return e->node;
+}
+
+/* Remembers the importing node a command was redirected to by ASK. The cache
+ * is best effort, running out of memory only means nothing is cached. */
+static void askCacheInsert(redisClusterContext *cc, struct cmd *command,
+                           redisClusterNode *node) {
+    struct askcache *ac;
+    askCacheEntry *e;
+    char *key;
+    int len;
+
+    cc->ask_cache_misses++;
+
+    if (cc->ask_cache == NULL) {
+        cc->ask_cache = hi_calloc(1, sizeof(*cc->ask_cache));
+        if (cc->ask_cache == NULL) {
+            return;
+        }
+        cc->ask_cache->route_version = cc->route_version;
+    }
+    ac = cc->ask_cache;
+
+    if (ac->route_version != cc->route_version) {
+        askCacheClear(ac);
+        ac->route_version = cc->route_version;
+    }
+
+    e = askCacheEntryOf(ac, command, &key, &len);
+    if (e == NULL) {
+        return;
+    }
+
+    if (e->key == NULL) {
+        e->key = sdsnewlen(key, len);
+        if (e->key == NULL) {
+            return;
+        }
+        ac->used++;
+    } else {
+        sds k = sdscpylen(e->key, key, len);
+        if (k == NULL) {
+            sdsfree(e->key);
+            e->key = NULL;
+            ac->used--;
+            return;
+        }
+        e->key = k;
+    }
+
+    e->slot = command->slot_num;
+    e->expires = hi_usec_now() + CLUSTER_ASK_CACHE_TTL_USEC;
+    e->node = node;
+}
+
+/* The migration of a slot has finished when a MOVED for it shows up. */
+static void askCacheEvictSlot(redisClusterContext *cc, int slot) {
+    struct askcache *ac = cc->ask_cache;
+    uint32_t i;
+
+    if (ac == NULL || ac->used == 0) {
+        return;
+    }
+
+    for (i = 0; i < CLUSTER_ASK_CACHE_SIZE; i++) {
+        if (ac->entries[i].key != NULL && ac->entries[i].slot == slot) {
+            sdsfree(ac->entries[i].key);
+            ac->entries[i].key = NULL;
+            ac->used--;
+        }
+    }
+}
+
+/* Tells whether the retry deadline of a command started at started (usec, 0
+ * when not tracked) has passed, or would have after a further delay. */
+static int clusterRetryDeadlinePassed(redisClusterContext *cc, int64_t started,
+                                      int64_t delay) {
+    if (cc->retry_deadline_ms <= 0 || started == 0) {
+        return 0;
+    }
+
+    return hi_usec_now() + delay >=
+           started + (int64_t)cc->retry_deadline_ms * 1000;
+}
+
+/* Takes a retry from the budget of the context, a token bucket refilled
+ * with retry_budget tokens per second. */
+static int clusterRetryTakeToken(redisClusterContext *cc) {
+    int64_t now;
+
+    if (cc->retry_budget <= 0) {
+        return REDIS_OK;
+    }
+
+    now = hi_usec_now();
+    if (cc->retry_tokens_time == 0) {
+        cc->retry_tokens = cc->retry_budget;
+    } else {
+        cc->retry_tokens +=
+            (double)(now - cc->retry_tokens_time) * cc->retry_budget / 1000000;
+        if (cc->retry_tokens > cc->retry_budget) {
+            cc->retry_tokens = cc->retry_budget;
+        }
+    }
+    cc->retry_tokens_time = now;
+
+    if (cc->retry_tokens < 1) {
+        return REDIS_ERR;
+    }
+    cc->retry_tokens -= 1;
+
+    return REDIS_OK;
+}
+
+/* Exponential backoff before retry number attempt, with half of it random
+ * so that clients do not come back in lockstep. In usec. */
+static int64_t clusterRetryDelay(redisClusterContext *cc, int attempt) {
+    int64_t delay, cap;
+    uint64_t x;
+
+    if (cc->retry_base_delay_ms <= 0) {
+        return 0;
+    }
+
+    delay = (int64_t)cc->retry_base_delay_ms * 1000;
+    cap = (int64_t)cc->retry_max_delay_ms * 1000;
+    while (--attempt > 0 && delay < cap) {
+        delay *= 2;
+    }
+    if (delay > cap) {
+        delay = cap;
+    }
+
+    /* xorshift64 */
+    x = cc->retry_seed;
+    if (x == 0) {
+        x = (uint64_t)hi_usec_now() ^ (uint64_t)(uintptr_t)cc;
+        x |= 1;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    cc->retry_seed = x;
+
+    return delay / 2 + (int64_t)(x % (uint64_t)(delay / 2 + 1));
+}
+
+/* Checks whether a command failing with TRYAGAIN or CLUSTERDOWN may be sent
+ * again, and returns the delay to wait before, in usec. Sets the error when
+ * it may not. */
+static int clusterRetryBackoff(redisClusterContext *cc, int64_t started,
+                               int attempt, int64_t *delay) {
+    if (cc->deadline != 0 && hi_usec_now() >= cc->deadline) {
+        __redisClusterSetError(cc, REDIS_ERR_TIMEOUT,
+                               "operation deadline exceeded");
+        return REDIS_ERR;
+    }
+
+    if (clusterRetryTakeToken(cc) != REDIS_OK) {
+        __redisClusterSetError(cc, REDIS_ERR_CLUSTER_TOO_MANY_RETRIES,
+                               "cluster retry budget exhausted");
+        return REDIS_ERR;
+    }
+
+    *delay = clusterRetryDelay(cc, attempt);
+    if (clusterRetryDeadlinePassed(cc, started, *delay)) {
+        __redisClusterSetError(cc, REDIS_ERR_CLUSTER_TOO_MANY_RETRIES,
+                               "cluster retry deadline exceeded");
+        return REDIS_ERR;
+    }
+
+    /* Sleeping past the operation deadline is pointless */
+    if (cc->deadline != 0 && hi_usec_now() + *delay >= cc->deadline) {
+        __redisClusterSetError(cc, REDIS_ERR_TIMEOUT,
+                               "operation deadline exceeded");
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+static void clusterRetrySleep(int64_t usec) {
+    if (usec <= 0) {
+        return;
+    }
+#ifdef _WIN32
+    Sleep((DWORD)((usec + 999) / 1000));
+#else
+    struct timespec ts;
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+#endif
+}
+
+/* The latency histogram of a node, created on first use. NULL when latency
+ * is not recorded, or out of memory which only costs the sample. */
+static struct hihistogram *clusterNodeLatency(redisClusterContext *cc,
+                                              redisClusterNode *node) {
+    struct hihistogram *h;
+    dictEntry *de;
+    sds addr;
+
+    if (cc->node_latency == NULL || node->addr == NULL) {
+        return NULL;
+    }
+
+    if (node->latency != NULL) {
+        return node->latency;
+    }
+
+    /* Nodes are replaced by slotmap updates, the histogram stays */
+    de = dictFind(cc->node_latency, node->addr);
+    if (de != NULL) {
+        node->latency = dictGetEntryVal(de);
+        return node->latency;
+    }
+
+    h = hihistogram_create();
+    addr = sdsdup(node->addr);
+    if (h == NULL || addr == NULL ||
+        dictAdd(cc->node_latency, addr, h) != DICT_OK) {
+        hihistogram_destroy(h);
+        sdsfree(addr);
+        return NULL;
+    }
+
+    node->latency = h;
+    return h;
+}
+
+static void clusterLatencyRecord(redisClusterContext *cc, cmd_type_t type,
+                                 struct hihistogram *node_latency,
+                                 int64_t usec) {
+    struct hihistogram **h;
+
+    if (usec < 0) {
+        usec = 0; /* the clock went back */
+    }
+
+    if (type > CMD_UNKNOWN && type < CMD_SENTINEL) {
+        h = &cc->command_latency[type];
+        if (*h == NULL) {
+            *h = hihistogram_create();
+        }
+        if (*h != NULL) {
+            hihistogram_record(*h, (uint64_t)usec);
+        }
+    }
+
+    if (node_latency != NULL) {
+        hihistogram_record(node_latency, (uint64_t)usec);
+    }
+}
+
+/* Adds the allocations made since start to the type of the command. */
+static void clusterAllocRecord(redisClusterContext *cc,
+                               const struct cmd *command,
+                               const struct hialloc_counters *start) {
+    if (cc->command_allocs != NULL && command->type > CMD_UNKNOWN &&
+        command->type < CMD_SENTINEL) {
+        hialloc_add_since(&cc->command_allocs[command->type], start);
+    }
+}
+
+/* Starts the trace of a command. bytes_in holds the counter at the start
+ * until clusterTraceEnd() turns it into a difference. */
+static void clusterTraceInit(redisClusterContext *cc, redisClusterTrace *trace,
+                             const struct cmd *command, int pipelined) {
+    trace->type = command->type;
+    trace->slot = command->slot_num;
+    trace->pipelined = pipelined;
+    trace->status = REDIS_OK;
+    trace->start_us = hi_usec_now();
+    trace->duration_us = 0;
+    trace->bytes_out = pipelined ? command->clen : 0;
+    trace->bytes_in = cc->stats.bytes_in;
+    trace->redirects = 0;
+    trace->retries = 0;
+    trace->nhops = 0;
+}
+
+static void clusterTraceBegin(redisClusterContext *cc,
+                              redisClusterTrace *trace,
+                              const struct cmd *command, int pipelined) {
+    clusterTraceInit(cc, trace, command, pipelined);
+    cc->trace_fn(trace, HIRCLUSTER_TRACE_BEGIN, cc->trace_privdata);
+}
+
+/* A request of bytes went to node, repeated sends to the same node make a
+ * single hop. */
+static void clusterTraceHop(redisClusterTrace *trace, redisClusterNode *node,
+                            size_t bytes) {
+    int i;
+
+    trace->bytes_out += bytes;
+    if (node == NULL || node->addr == NULL) {
+        return;
+    }
+    if (trace->nhops > 0 &&
+        strcmp(trace->hops[trace->nhops - 1], node->addr) == 0) {
+        return;
+    }
+
+    if (trace->nhops < HIRCLUSTER_TRACE_MAX_HOPS) {
+        i = trace->nhops++;
+    } else {
+        i = HIRCLUSTER_TRACE_MAX_HOPS - 1;
+    }
+    snprintf(trace->hops[i], sizeof(trace->hops[i]), "%s", node->addr);
+}
+
+static void clusterTraceEnd(redisClusterContext *cc, redisClusterTrace *trace,
+                            int status) {
+    trace->status = status;
+    trace->duration_us = hi_usec_now() - trace->start_us;
+    if (trace->duration_us < 0) {
+        trace->duration_us = 0; /* the clock went back */
     }
+    trace->bytes_in = cc->stats.bytes_in - trace->bytes_in;
 
-    if (dictAdd(cc->nodes, key, node) != DICT_OK) {
-        sdsfree(key);
-        goto oom;
+    cc->trace_fn(trace, HIRCLUSTER_TRACE_END, cc->trace_privdata);
+}
+
+/* What a slow command is logged with, gathered while it runs. */
+struct slowlogProbe {
+    int64_t start;
+    int retries;       /* cc->retry_count at the start */
+    uint64_t connects; /* connects and reconnects at the start */
+    char node[HISLOWLOG_ADDR_LEN];
+};
+
+static void clusterSlowlogStart(redisClusterContext *cc,
+                                struct slowlogProbe *probe) {
+    probe->start = hi_usec_now();
+    probe->retries = cc->retry_count;
+    probe->connects = cc->stats.connects + cc->stats.reconnects;
+    probe->node[0] = '\0';
+}
+
+/* Nodes may be released by a slotmap update before the command ends, the
+ * address is copied. */
+static void clusterSlowlogNode(struct slowlogProbe *probe,
+                               redisClusterNode *node) {
+    if (node->addr != NULL) {
+        snprintf(probe->node, sizeof(probe->node), "%s", node->addr);
     }
+}
 
-done:
-    sdsfreesplitres(part, part_len);
-    return node;
+static void clusterSlowlogEnd(redisClusterContext *cc,
+                              struct slowlogProbe *probe,
+                              const struct cmd *command) {
+    struct hislowlog_entry entry;
+    int64_t duration;
 
-oom:
-    __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
-    sdsfreesplitres(part, part_len);
-    if (node != NULL) {
-        sdsfree(node->addr);
-        sdsfree(node->host);
-        hi_free(node);
+    duration = hi_usec_now() - probe->start;
+    if (duration < cc->slowlog_threshold_us) {
+        return;
     }
 
-    return NULL;
+    entry.time = hislowlog_time_now() - duration;
+    entry.duration = duration;
+    entry.slot = command->slot_num;
+    entry.retries = cc->retry_count - probe->retries;
+    entry.reconnected =
+        cc->stats.connects + cc->stats.reconnects != probe->connects;
+    hislowlog_set_command(&entry, command->cmd, command->clen);
+    memcpy(entry.node, probe->node, sizeof(entry.node));
+
+    hislowlog_push(cc->slowlog, &entry);
 }
 
 static void *redis_cluster_command_execute(redisClusterContext *cc,
@@ -2230,12 +5420,48 @@ static void *redis_cluster_command_execute(redisClusterContext *cc,
     redisClusterNode *node;
     redisContext *c = NULL;
     int error_type;
+    int asking = 0; /* ASKING goes in front of the command */
     redisContext *c_updating_route = NULL;
+    int64_t started = cc->retry_deadline_ms > 0 ? hi_usec_now() : 0;
+    int64_t delay;
+    int backoffs = 0; /* TRYAGAIN/CLUSTERDOWN waits, redirects not counted */
+    int64_t latency_start = cc->command_latency != NULL ? hi_usec_now() : 0;
+    struct hihistogram *node_latency = NULL;
+    redisClusterTrace trace;
+    int tracing = cc->trace_fn != NULL;
+    struct slowlogProbe slowlog;
+
+    if (tracing) {
+        clusterTraceBegin(cc, &trace, command, 0);
+    }
+    if (cc->slowlog != NULL) {
+        clusterSlowlogStart(cc, &slowlog);
+    }
+
+    /* Topology changes found by the refresher or another member of the
+     * slotmap group are installed here, while update requests are handed
+     * over to the refresher. */
+    slotmapGroupAdopt(cc);
+    slotmapRefresherAdopt(cc);
+    if (cc->need_update_route && slotmapRefresherTrigger(cc) == REDIS_OK) {
+        cc->need_update_route = 0;
+    }
+
+    CLUSTER_STAT_ADD(cc, commands, 1);
+    CLUSTER_STAT_ADD(cc, in_flight, 1);
 
 retry:
 
+    if (clusterDeadlinePassed(cc)) {
+        goto error;
+    }
+
     node = node_get_by_table(cc, (uint32_t)command->slot_num);
     if (node == NULL) {
+        /* The refresher looks for a node serving the slot. */
+        if (slotmapRefresherTrigger(cc) == REDIS_OK) {
+            goto error;
+        }
         /* Update the slotmap since the slot is not served. */
         if (redisClusterUpdateSlotmap(cc) != REDIS_OK) {
             goto error;
@@ -2247,10 +5473,24 @@ retry:
         }
     }
 
+    /* A key already moved by a slot migration */
+    redisClusterNode *importing = askCacheLookup(cc, command);
+    if (importing != NULL) {
+        node = importing;
+        asking = 1;
+    }
+
     c = ctx_get_by_node(cc, node);
     if (c == NULL || c->err) {
         /* Failed to connect. Maybe there was a failover and this node is gone.
          * Update slotmap to find out. */
+        asking = 0;
+        if (slotmapRefresherTrigger(cc) == REDIS_OK) {
+            if (c != NULL) {
+                __redisClusterSetError(cc, c->err, c->errstr);
+            }
+            goto error;
+        }
         if (redisClusterUpdateSlotmap(cc) != REDIS_OK) {
             goto error;
         }
@@ -2271,6 +5511,29 @@ retry:
 moved_retry:
 ask_retry:
 
+    /* Samples go to the node that was asked last */
+    if (latency_start != 0) {
+        node_latency = clusterNodeLatency(cc, node);
+    }
+    if (tracing) {
+        clusterTraceHop(&trace, node, command->clen);
+        if (asking) {
+            trace.bytes_out += REDIS_COMMAND_ASKING_FORMATTED_LEN;
+        }
+    }
+    if (cc->slowlog != NULL) {
+        clusterSlowlogNode(&slowlog, node);
+    }
+
+    /* After an ASK redirect, ASKING goes out in the same write as the
+     * command. */
+    if (asking && redisAppendFormattedCommand(
+                      c, REDIS_COMMAND_ASKING_FORMATTED,
+                      REDIS_COMMAND_ASKING_FORMATTED_LEN) != REDIS_OK) {
+        __redisClusterSetError(cc, c->err, c->errstr);
+        goto error;
+    }
+
     if (redisAppendFormattedCommand(c, command->cmd, command->clen) !=
         REDIS_OK) {
         __redisClusterSetError(cc, c->err, c->errstr);
@@ -2284,12 +5547,23 @@ ask_retry:
         }
     }
 
+    if (asking) {
+        /* The reply of ASKING comes first */
+        asking = 0;
+        if (redisGetReply(c, &reply) != REDIS_OK) {
+            __redisClusterSetError(cc, c->err, c->errstr);
+            goto error;
+        }
+        freeClusterReply(cc, reply);
+        reply = NULL;
+    }
+
     if (redisGetReply(c, &reply) != REDIS_OK) {
         __redisClusterSetError(cc, c->err, c->errstr);
         /* We may need to update the slotmap if this node is removed from the
          * cluster, but the current request may have already timed out so we
          * schedule it for later. */
-        if (c->err != REDIS_ERR_OOM)
+        if (c->err != REDIS_ERR_OOM && slotmapRefresherTrigger(cc) != REDIS_OK)
             cc->need_update_route = 1;
         goto error;
     }
@@ -2302,12 +5576,26 @@ ask_retry:
                                    "too many cluster retries");
             goto error;
         }
+        if (clusterRetryDeadlinePassed(cc, started, 0)) {
+            __redisClusterSetError(cc, REDIS_ERR_CLUSTER_TOO_MANY_RETRIES,
+                                   "cluster retry deadline exceeded");
+            goto error;
+        }
+        if (clusterDeadlinePassed(cc)) {
+            goto error;
+        }
 
         int slot = -1;
         switch (error_type) {
         case CLUSTER_ERR_MOVED:
+            CLUSTER_STAT_ADD(cc, moved, 1);
+            clusterEvent(cc, HIRCLUSTER_EVENT_MOVED);
+            if (tracing) {
+                trace.redirects++;
+            }
+
             node = getNodeFromRedirectReply(cc, reply, &slot);
-            freeReplyObject(reply);
+            freeClusterReply(cc, reply);
             reply = NULL;
 
             if (node == NULL) {
@@ -2315,12 +5603,18 @@ ask_retry:
                 goto error;
             }
 
-            /* Update the slot mapping entry for this slot. */
+            /* Update the slot mapping entry for this slot. A shared table
+             * is never modified, the refresh corrects it for the group. */
             if (slot >= 0) {
-                cc->table[slot] = node;
+                if (cc->slotmap_snapshot == NULL) {
+                    cc->table[slot] = node;
+                }
+                askCacheEvictSlot(cc, slot);
             }
 
-            if (c_updating_route == NULL) {
+            if (slotmapRefresherTrigger(cc) == REDIS_OK) {
+                /* Updated in the background */
+            } else if (c_updating_route == NULL) {
                 if (clusterUpdateRouteSendCommand(cc, c) == REDIS_OK) {
                     /* Deferred update route using the node that sent the
                      * redirect. */
@@ -2347,12 +5641,19 @@ ask_retry:
 
             break;
         case CLUSTER_ERR_ASK:
+            CLUSTER_STAT_ADD(cc, ask, 1);
+            clusterEvent(cc, HIRCLUSTER_EVENT_ASK);
+            if (tracing) {
+                trace.redirects++;
+            }
+
             node = getNodeFromRedirectReply(cc, reply, NULL);
             if (node == NULL) {
                 goto error;
             }
+            askCacheInsert(cc, command, node);
 
-            freeReplyObject(reply);
+            freeClusterReply(cc, reply);
             reply = NULL;
 
             c = ctx_get_by_node(cc, node);
@@ -2363,22 +5664,30 @@ ask_retry:
                 goto error;
             }
 
-            reply = redisCommand(c, REDIS_COMMAND_ASKING);
-            if (reply == NULL) {
-                __redisClusterSetError(cc, c->err, c->errstr);
-                goto error;
-            }
-
-            freeReplyObject(reply);
-            reply = NULL;
-
+            asking = 1;
             goto ask_retry;
 
             break;
         case CLUSTER_ERR_TRYAGAIN:
         case CLUSTER_ERR_CLUSTERDOWN:
-            freeReplyObject(reply);
+            freeClusterReply(cc, reply);
             reply = NULL;
+
+            /* Give the cluster time to finish the failover or migration */
+            if (clusterRetryBackoff(cc, started, ++backoffs, &delay) !=
+                REDIS_OK) {
+                goto error;
+            }
+            if (error_type == CLUSTER_ERR_TRYAGAIN) {
+                CLUSTER_STAT_ADD(cc, tryagain, 1);
+            } else {
+                CLUSTER_STAT_ADD(cc, clusterdown, 1);
+            }
+            clusterEvent(cc, HIRCLUSTER_EVENT_RETRY);
+            if (tracing) {
+                trace.retries++;
+            }
+            clusterRetrySleep(delay);
             goto retry;
 
             break;
@@ -2392,7 +5701,7 @@ ask_retry:
 
 error:
     if (reply) {
-        freeReplyObject(reply);
+        freeClusterReply(cc, reply);
         reply = NULL;
     }
 
@@ -2406,17 +5715,33 @@ done:
             cc->errstr[0] = '\0';
             if (redisClusterUpdateSlotmap(cc) != REDIS_OK) {
                 /* Clear the reply to indicate failure. */
-                freeReplyObject(reply);
+                freeClusterReply(cc, reply);
                 reply = NULL;
             }
         }
     }
 
+    if (latency_start != 0) {
+        clusterLatencyRecord(cc, command->type, node_latency,
+                             hi_usec_now() - latency_start);
+    }
+
+    CLUSTER_STAT_ADD(cc, in_flight, -1);
+    if (reply == NULL) {
+        CLUSTER_STAT_ADD(cc, command_errors, 1);
+    }
+    if (tracing) {
+        clusterTraceEnd(cc, &trace, reply != NULL ? REDIS_OK : REDIS_ERR);
+    }
+    if (cc->slowlog != NULL) {
+        clusterSlowlogEnd(cc, &slowlog, command);
+    }
+
     return reply;
 }
 
-static int command_pre_fragment(redisClusterContext *cc, struct cmd *command,
-                                hilist *commands) {
+int command_pre_fragment(redisClusterContext *cc, struct cmd *command,
+                         hilist *commands) {
 
     struct keypos *kp, *sub_kp;
     uint32_t key_count;
@@ -2458,7 +5783,7 @@ static int command_pre_fragment(redisClusterContext *cc, struct cmd *command,
         }
 
         if (sub_commands[slot_num] == NULL) {
-            sub_commands[slot_num] = command_get();
+            sub_commands[slot_num] = command_pool_get(cc->command_pool);
             if (sub_commands[slot_num] == NULL) {
                 goto oom;
             }
@@ -2468,7 +5793,7 @@ static int command_pre_fragment(redisClusterContext *cc, struct cmd *command,
 
         sub_command->narg++;
 
-        sub_kp = hiarray_push(sub_command->keys);
+        sub_kp = command_push_key(sub_command);
         if (sub_kp == NULL) {
             goto oom;
         }
@@ -2713,8 +6038,8 @@ oom:
     return -1; // failing slot_num
 }
 
-static void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
-                                   hilist *commands) {
+void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
+                            hilist *commands) {
     struct cmd *sub_command;
     listNode *list_node;
     redisReply *reply = NULL, *sub_reply;
@@ -2760,7 +6085,7 @@ static void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
         }
     }
 
-    reply = hi_calloc(1, sizeof(*reply));
+    reply = clusterReplyCalloc(cc, 1, sizeof(*reply));
     if (reply == NULL) {
         goto oom;
     }
@@ -2774,7 +6099,8 @@ static void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
         key_count = hiarray_n(command->keys);
 
         reply->elements = key_count;
-        reply->element = hi_calloc(key_count, sizeof(*reply->element));
+        reply->element =
+            clusterReplyCalloc(cc, key_count, sizeof(*reply->element));
         if (reply->element == NULL) {
             goto oom;
         }
@@ -2782,7 +6108,7 @@ static void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
         for (i = key_count - 1; i >= 0; i--) {       /* for each key */
             sub_reply = command->frag_seq[i]->reply; /* get it's reply */
             if (sub_reply == NULL) {
-                freeReplyObject(reply);
+                freeClusterReply(cc, reply);
                 __redisClusterSetError(cc, REDIS_ERR_OTHER,
                                        "sub reply is null");
                 return NULL;
@@ -2792,7 +6118,7 @@ static void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
                 reply->element[i] = sub_reply;
             } else if (sub_reply->type == REDIS_REPLY_ARRAY) {
                 if (sub_reply->elements == 0) {
-                    freeReplyObject(reply);
+                    freeClusterReply(cc, reply);
                     __redisClusterSetError(cc, REDIS_ERR_OTHER,
                                            "sub reply elements error");
                     return NULL;
@@ -2811,7 +6137,7 @@ static void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
     } else if (command->type == CMD_REQ_REDIS_MSET) {
         reply->type = REDIS_REPLY_STATUS;
         uint32_t str_len = strlen(REDIS_STATUS_OK);
-        reply->str = hi_malloc((str_len + 1) * sizeof(char));
+        reply->str = clusterReplyCalloc(cc, str_len + 1, sizeof(char));
         if (reply->str == NULL) {
             goto oom;
         }
@@ -2826,7 +6152,7 @@ static void *command_post_fragment(redisClusterContext *cc, struct cmd *command,
     return reply;
 
 oom:
-    freeReplyObject(reply);
+    freeClusterReply(cc, reply);
     __redisClusterSetError(cc, REDIS_ERR_OOM, "Out of memory");
     return NULL;
 }
@@ -2900,6 +6226,17 @@ int redisClusterSetConnectCallback(redisClusterContext *cc,
     return REDIS_ERR;
 }
 
+int redisClusterSetTraceCallback(redisClusterContext *cc,
+                                 redisClusterTraceFn *fn, void *privdata) {
+    if (cc == NULL) {
+        return REDIS_ERR;
+    }
+
+    cc->trace_fn = fn;
+    cc->trace_privdata = fn != NULL ? privdata : NULL;
+    return REDIS_OK;
+}
+
 int redisClusterSetEventCallback(redisClusterContext *cc,
                                  void(fn)(const redisClusterContext *cc,
                                           int event, void *privdata),
@@ -2919,17 +6256,22 @@ void *redisClusterFormattedCommand(redisClusterContext *cc, char *cmd,
     struct cmd *command = NULL, *sub_command;
     hilist *commands = NULL;
     listNode *list_node;
+    struct hialloc_counters alloc_start = {0, 0, 0};
 
     if (cc == NULL) {
         return NULL;
     }
 
+    if (cc->command_allocs != NULL) {
+        hialloc_thread_counters(&alloc_start);
+    }
+
     if (cc->err) {
         cc->err = 0;
         memset(cc->errstr, '\0', strlen(cc->errstr));
     }
 
-    command = command_get();
+    command = command_pool_get(cc->command_pool);
     if (command == NULL) {
         goto oom;
     }
@@ -2981,6 +6323,7 @@ void *redisClusterFormattedCommand(redisClusterContext *cc, char *cmd,
 
 done:
 
+    clusterAllocRecord(cc, command, &alloc_start);
     command->cmd = NULL;
     command_destroy(command);
 
@@ -2997,6 +6340,7 @@ oom:
 
 error:
     if (command != NULL) {
+        clusterAllocRecord(cc, command, &alloc_start);
         command->cmd = NULL;
         command_destroy(command);
     }
@@ -3076,15 +6420,17 @@ void *redisClusterCommandToNode(redisClusterContext *cc, redisClusterNode *node,
     }
 
     if (cc->need_update_route) {
-        /* Pipeline slotmap update on the same connection. */
-        if (clusterUpdateRouteSendCommand(cc, c) == REDIS_OK) {
+        if (slotmapRefresherTrigger(cc) == REDIS_OK) {
+            cc->need_update_route = 0;
+        } else if (clusterUpdateRouteSendCommand(cc, c) == REDIS_OK) {
+            /* Pipeline slotmap update on the same connection. */
             updating_slotmap = 1;
         }
     }
 
     if (redisGetReply(c, &reply) != REDIS_OK) {
         __redisClusterSetError(cc, c->err, c->errstr);
-        if (c->err != REDIS_ERR_OOM)
+        if (c->err != REDIS_ERR_OOM && slotmapRefresherTrigger(cc) != REDIS_OK)
             cc->need_update_route = 1;
         return NULL;
     }
@@ -3126,16 +6472,21 @@ int redisClusterAppendFormattedCommand(redisClusterContext *cc, char *cmd,
     struct cmd *command = NULL, *sub_command;
     hilist *commands = NULL;
     listNode *list_node;
+    redisClusterTrace trace;
 
     if (cc->requests == NULL) {
-        cc->requests = listCreate();
+        cc->requests = hiring_create(CLUSTER_DEFAULT_REQUESTS_SIZE);
         if (cc->requests == NULL) {
             goto oom;
         }
         cc->requests->free = listCommandFree;
     }
 
-    command = command_get();
+    /* A new pipeline starts with the latest slotmap */
+    slotmapGroupAdopt(cc);
+    slotmapRefresherAdopt(cc);
+
+    command = command_pool_get(cc->command_pool);
     if (command == NULL) {
         goto oom;
     }
@@ -3189,9 +6540,16 @@ int redisClusterAppendFormattedCommand(redisClusterContext *cc, char *cmd,
     commands = NULL;
     command->cmd = NULL;
 
-    if (listAddNodeTail(cc->requests, command) == NULL) {
+    if (hiring_push(cc->requests, command) != HI_OK) {
         goto oom;
     }
+    CLUSTER_STAT_ADD(cc, in_flight, 1);
+
+    if (cc->trace_fn != NULL) {
+        clusterTraceBegin(cc, &trace, command, 1);
+        command->started = trace.start_us;
+    }
+
     return REDIS_OK;
 
 oom:
@@ -3260,9 +6618,10 @@ int redisClusterAppendCommandToNode(redisClusterContext *cc,
     struct cmd *command = NULL;
     char *cmd = NULL;
     int len;
+    redisClusterTrace trace;
 
     if (cc->requests == NULL) {
-        cc->requests = listCreate();
+        cc->requests = hiring_create(CLUSTER_DEFAULT_REQUESTS_SIZE);
         if (cc->requests == NULL)
             goto oom;
 
@@ -3295,9 +6654,10 @@ int redisClusterAppendCommandToNode(redisClusterContext *cc,
         hi_free(cmd);
         return REDIS_ERR;
     }
+    node->pending++;
 
     // Keep the command in the outstanding request list
-    command = command_get();
+    command = command_pool_get(cc->command_pool);
     if (command == NULL) {
         hi_free(cmd);
         goto oom;
@@ -3308,8 +6668,14 @@ int redisClusterAppendCommandToNode(redisClusterContext *cc,
     if (command->node_addr == NULL)
         goto oom;
 
-    if (listAddNodeTail(cc->requests, command) == NULL)
+    if (hiring_push(cc->requests, command) != HI_OK)
         goto oom;
+    CLUSTER_STAT_ADD(cc, in_flight, 1);
+
+    if (cc->trace_fn != NULL) {
+        clusterTraceBegin(cc, &trace, command, 1);
+        command->started = trace.start_us;
+    }
 
     return REDIS_OK;
 
@@ -3348,6 +6714,11 @@ static int redisClusterSendAll(redisClusterContext *cc) {
         return REDIS_ERR;
     }
 
+    /* Write to all nodes at once, what is left is written below */
+    if (clusterPollNodes(cc, NULL) != REDIS_OK) {
+        return REDIS_ERR;
+    }
+
     dictIterator di;
     dictInitIterator(&di, cc->nodes);
 
@@ -3405,6 +6776,7 @@ static int redisClusterClearAll(redisClusterContext *cc) {
             continue;
         }
 
+        clusterNodeDropReplies(node);
         redisFree(c);
         node->con = NULL;
     }
@@ -3416,9 +6788,11 @@ int redisClusterGetReply(redisClusterContext *cc, void **reply) {
 
     struct cmd *command, *sub_command;
     hilist *commands = NULL;
-    listNode *list_command, *list_sub_command;
+    listNode *list_sub_command;
     int slot_num;
     void *sub_reply;
+    redisClusterTrace trace;
+    int tracing = 0, ret;
 
     if (cc == NULL || reply == NULL)
         return REDIS_ERR;
@@ -3431,41 +6805,59 @@ int redisClusterGetReply(redisClusterContext *cc, void **reply) {
     if (cc->requests == NULL)
         return REDIS_ERR; // No queued requests
 
-    list_command = listFirst(cc->requests);
-
     // no more reply
-    if (list_command == NULL) {
+    if (hiring_n(cc->requests) == 0) {
         *reply = NULL;
         return REDIS_OK;
     }
 
-    command = list_command->value;
+    command = hiring_pop(cc->requests);
     if (command == NULL) {
         __redisClusterSetError(cc, REDIS_ERR_OTHER,
                                "command in the requests list is null");
         goto error;
     }
+    CLUSTER_STAT_ADD(cc, in_flight, -1);
+
+    /* Commands appended while tracing was on */
+    tracing = cc->trace_fn != NULL && command->started != 0;
+    if (tracing) {
+        clusterTraceInit(cc, &trace, command, 1);
+        trace.start_us = command->started;
+    }
 
     slot_num = command->slot_num;
     if (slot_num >= 0) {
         /* Command was sent via single slot */
-        listDelNode(cc->requests, list_command);
-        return __redisClusterGetReply(cc, slot_num, reply);
+        command_destroy(command);
+        ret = __redisClusterGetReply(cc, slot_num, reply);
+        if (tracing) {
+            clusterTraceHop(&trace, node_get_by_table(cc, (uint32_t)slot_num),
+                            0);
+            clusterTraceEnd(cc, &trace, ret);
+        }
+        return ret;
 
     } else if (command->node_addr) {
         /* Command was sent to a single node */
         dictEntry *de;
 
         de = dictFind(cc->nodes, command->node_addr);
-        if (de != NULL) {
-            listDelNode(cc->requests, list_command);
-            return __redisClusterGetReplyFromNode(cc, dictGetEntryVal(de),
-                                                  reply);
-        } else {
+        command_destroy(command);
+        if (de == NULL) {
             __redisClusterSetError(cc, REDIS_ERR_OTHER,
                                    "command was sent to a now unknown node");
-            goto error;
+            ret = REDIS_ERR;
+        } else {
+            ret = __redisClusterGetReplyFromNode(cc, dictGetEntryVal(de),
+                                                 reply);
+        }
+        if (tracing) {
+            clusterTraceHop(&trace, de != NULL ? dictGetEntryVal(de) : NULL,
+                            0);
+            clusterTraceEnd(cc, &trace, ret);
         }
+        return ret;
     }
 
     commands = command->sub_commands;
@@ -3497,6 +6889,10 @@ int redisClusterGetReply(redisClusterContext *cc, void **reply) {
         if (__redisClusterGetReply(cc, slot_num, &sub_reply) != REDIS_OK) {
             goto error;
         }
+        if (tracing) {
+            clusterTraceHop(&trace, node_get_by_table(cc, (uint32_t)slot_num),
+                            0);
+        }
 
         sub_command->reply = sub_reply;
     }
@@ -3506,12 +6902,18 @@ int redisClusterGetReply(redisClusterContext *cc, void **reply) {
         goto error;
     }
 
-    listDelNode(cc->requests, list_command);
+    command_destroy(command);
+    if (tracing) {
+        clusterTraceEnd(cc, &trace, REDIS_OK);
+    }
     return REDIS_OK;
 
 error:
 
-    listDelNode(cc->requests, list_command);
+    command_destroy(command);
+    if (tracing) {
+        clusterTraceEnd(cc, &trace, REDIS_ERR);
+    }
     return REDIS_ERR;
 }
 
@@ -3537,7 +6939,7 @@ void redisClusterReset(redisClusterContext *cc) {
         do {
             status = redisClusterGetReply(cc, &reply);
             if (status == REDIS_OK) {
-                freeReplyObject(reply);
+                freeClusterReply(cc, reply);
             } else {
                 redisClusterClearAll(cc);
                 break;
@@ -3546,11 +6948,17 @@ void redisClusterReset(redisClusterContext *cc) {
     }
 
     if (cc->requests) {
-        listRelease(cc->requests);
-        cc->requests = NULL;
+        /* Commands dropped without their reply */
+        CLUSTER_STAT_ADD(cc, in_flight, -(int64_t)hiring_n(cc->requests));
+        /* The buffer is kept for the next pipeline, freed with the context */
+        hiring_clear(cc->requests);
     }
 
     if (cc->need_update_route) {
+        if (slotmapRefresherTrigger(cc) == REDIS_OK) {
+            cc->need_update_route = 0;
+            return;
+        }
         status = redisClusterUpdateSlotmap(cc);
         if (status != REDIS_OK) {
             /* Specific error already set */
@@ -3560,6 +6968,20 @@ void redisClusterReset(redisClusterContext *cc) {
     }
 }
 
+void redisClusterFreeReplies(redisClusterContext *cc) {
+    if (cc == NULL || cc->reply_arena == NULL) {
+        return;
+    }
+
+    /* Replies of an unfinished pipeline may already sit in the arena, keep
+     * them until the next call. */
+    if (cc->requests != NULL && hiring_n(cc->requests) > 0) {
+        return;
+    }
+
+    hiarena_reset(cc->reply_arena);
+}
+
 /*############redis cluster async############*/
 
 static void __redisClusterAsyncSetError(redisClusterAsyncContext *acc, int type,
@@ -3702,6 +7124,17 @@ redisAsyncContext *actx_get_by_node(redisClusterAsyncContext *acc,
         }
     }
 
+    // Queued behind AUTH, both leave with the first write
+    if (acc->cc->client_name != NULL) {
+        ret = redisAsyncCommand(ac, NULL, NULL, "CLIENT SETNAME %s",
+                                acc->cc->client_name);
+        if (ret != REDIS_OK) {
+            __redisClusterAsyncSetError(acc, ac->c.err, ac->c.errstr);
+            redisAsyncFree(ac);
+            return NULL;
+        }
+    }
+
     if (acc->adapter) {
         ret = acc->attach_fn(ac, acc->adapter);
         if (ret != REDIS_OK) {
@@ -3932,6 +7365,150 @@ static void throttledUpdateSlotMapAsync(redisClusterAsyncContext *acc,
     }
 }
 
+static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
+                                      void *privdata);
+
+/* Hands a command which cannot be sent again to its callback, with the
+ * error set on acc. */
+static void clusterAsyncRetryFail(redisClusterAsyncContext *acc,
+                                  cluster_async_data *cad) {
+    redisClusterContext *cc = acc->cc;
+
+    cad->callback(acc, NULL, cad->privdata);
+
+    if (cc->err) {
+        cc->err = 0;
+        memset(cc->errstr, '\0', strlen(cc->errstr));
+    }
+
+    if (acc->err) {
+        acc->err = 0;
+        memset(acc->errstr, '\0', strlen(acc->errstr));
+    }
+
+    cluster_async_data_free(cad);
+}
+
+/* Parks a command until its backoff has elapsed, the list is kept sorted
+ * by due time. */
+static int clusterAsyncRetryLater(redisClusterAsyncContext *acc,
+                                  cluster_async_data *cad, int64_t delay) {
+    listNode *ln;
+    cluster_async_data *prev;
+
+    if (acc->retries == NULL) {
+        acc->retries = listCreate();
+        if (acc->retries == NULL) {
+            return REDIS_ERR;
+        }
+    }
+
+    cad->retry_at = hi_usec_now() + delay;
+
+    for (ln = listLast(acc->retries); ln != NULL; ln = listPrevNode(ln)) {
+        prev = listNodeValue(ln);
+        if (prev->retry_at <= cad->retry_at) {
+            break;
+        }
+    }
+
+    if (ln == NULL) {
+        if (listAddNodeHead(acc->retries, cad) == NULL) {
+            return REDIS_ERR;
+        }
+    } else if (listInsertNode(acc->retries, ln, cad, 1) == NULL) {
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+/* Sends a command whose backoff has elapsed to the node serving its slot
+ * now, which the failover or migration may have changed. */
+static int clusterAsyncRetrySend(redisClusterAsyncContext *acc,
+                                 cluster_async_data *cad) {
+    redisClusterContext *cc = acc->cc;
+    struct cmd *command = cad->command;
+    redisClusterNode *node, *importing;
+    redisAsyncContext *ac;
+
+    node = node_get_by_table(cc, (uint32_t)command->slot_num);
+    if (node == NULL) {
+        throttledUpdateSlotMapAsync(acc, NULL);
+        __redisClusterAsyncSetError(acc, cc->err, cc->errstr);
+        return REDIS_ERR;
+    }
+
+    importing = askCacheLookup(cc, command);
+    if (importing != NULL) {
+        node = importing;
+    }
+
+    ac = actx_get_by_node(acc, node);
+    if (ac == NULL) {
+        /* Specific error already set */
+        return REDIS_ERR;
+    }
+
+    if ((importing != NULL &&
+         redisAsyncFormattedCommand(ac, NULL, NULL,
+                                    REDIS_COMMAND_ASKING_FORMATTED,
+                                    REDIS_COMMAND_ASKING_FORMATTED_LEN) !=
+             REDIS_OK) ||
+        redisAsyncFormattedCommand(ac, redisClusterAsyncCallback, cad,
+                                   command->cmd, command->clen) != REDIS_OK) {
+        __redisClusterAsyncSetError(acc, REDIS_ERR_OTHER,
+                                    "failed to send the retried command");
+        return REDIS_ERR;
+    }
+
+    return REDIS_OK;
+}
+
+/* Sends the waiting commands which are due. One leaves the list at a time
+ * since a failing one calls back into the user, who may send more. */
+static void clusterAsyncSendDueRetries(redisClusterAsyncContext *acc) {
+    listNode *ln;
+    cluster_async_data *cad;
+    int64_t now;
+
+    if (acc->retries == NULL) {
+        return;
+    }
+
+    now = hi_usec_now();
+    while ((ln = listFirst(acc->retries)) != NULL) {
+        cad = listNodeValue(ln);
+        if (cad->retry_at > now) {
+            break;
+        }
+        listDelNode(acc->retries, ln);
+
+        if (clusterAsyncRetrySend(acc, cad) != REDIS_OK) {
+            clusterAsyncRetryFail(acc, cad);
+        }
+    }
+}
+
+/* Fails every command still waiting out a backoff. */
+static void clusterAsyncFailRetries(redisClusterAsyncContext *acc) {
+    listNode *ln;
+    cluster_async_data *cad;
+
+    if (acc->retries == NULL) {
+        return;
+    }
+
+    while ((ln = listFirst(acc->retries)) != NULL) {
+        cad = listNodeValue(ln);
+        listDelNode(acc->retries, ln);
+
+        __redisClusterAsyncSetError(acc, REDIS_ERR_OTHER,
+                                    "disconnected before the retry was sent");
+        clusterAsyncRetryFail(acc, cad);
+    }
+}
+
 static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
                                       void *privdata) {
     int ret;
@@ -3943,6 +7520,7 @@ static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
     int error_type;
     redisClusterNode *node;
     struct cmd *command;
+    int64_t delay;
 
     if (cad == NULL) {
         goto error;
@@ -3963,6 +7541,8 @@ static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
         goto error;
     }
 
+    clusterAsyncSendDueRetries(acc);
+
     if (reply == NULL) {
         /* Copy reply specific error from hiredis */
         __redisClusterAsyncSetError(acc, ac->err, ac->errstr);
@@ -3989,6 +7569,11 @@ static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
                                         "too many cluster retries");
             goto done;
         }
+        if (clusterRetryDeadlinePassed(cc, cad->started, 0)) {
+            __redisClusterAsyncSetError(acc, REDIS_ERR_CLUSTER_TOO_MANY_RETRIES,
+                                        "cluster retry deadline exceeded");
+            goto done;
+        }
 
         int slot = -1;
         switch (error_type) {
@@ -4001,9 +7586,13 @@ static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
                 __redisClusterAsyncSetError(acc, cc->err, cc->errstr);
                 goto done;
             }
-            /* Update the slot mapping entry for this slot. */
+            /* Update the slot mapping entry for this slot. A shared table
+             * is never modified, the refresh corrects it for the group. */
             if (slot >= 0) {
-                cc->table[slot] = node;
+                if (cc->slotmap_snapshot == NULL) {
+                    cc->table[slot] = node;
+                }
+                askCacheEvictSlot(cc, slot);
             }
             ac_retry = actx_get_by_node(acc, node);
 
@@ -4014,6 +7603,7 @@ static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
                 __redisClusterAsyncSetError(acc, cc->err, cc->errstr);
                 goto done;
             }
+            askCacheInsert(cc, cad->command, node);
 
             ac_retry = actx_get_by_node(acc, node);
             if (ac_retry == NULL) {
@@ -4021,7 +7611,11 @@ static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
                 goto done;
             }
 
-            ret = redisAsyncCommand(ac_retry, NULL, NULL, REDIS_COMMAND_ASKING);
+            /* Lands in the same output buffer as the retried command, both
+             * leave in one write. */
+            ret = redisAsyncFormattedCommand(ac_retry, NULL, NULL,
+                                             REDIS_COMMAND_ASKING_FORMATTED,
+                                             REDIS_COMMAND_ASKING_FORMATTED_LEN);
             if (ret != REDIS_OK) {
                 goto error;
             }
@@ -4029,6 +7623,20 @@ static void redisClusterAsyncCallback(redisAsyncContext *ac, void *r,
             break;
         case CLUSTER_ERR_TRYAGAIN:
         case CLUSTER_ERR_CLUSTERDOWN:
+            if (clusterRetryBackoff(cc, cad->started, ++cad->backoffs,
+                                    &delay) != REDIS_OK) {
+                __redisClusterAsyncSetError(acc, cc->err, cc->errstr);
+                goto done;
+            }
+            if (delay > 0) {
+                /* Sent from acc->retries once the backoff has elapsed */
+                if (clusterAsyncRetryLater(acc, cad, delay) != REDIS_OK) {
+                    __redisClusterAsyncSetError(acc, REDIS_ERR_OOM,
+                                                "Out of memory");
+                    goto done;
+                }
+                return;
+            }
             ac_retry = ac;
 
             break;
@@ -4097,6 +7705,8 @@ int redisClusterAsyncFormattedCommand(redisClusterAsyncContext *acc,
 
     cc = acc->cc;
 
+    clusterAsyncSendDueRetries(acc);
+
     if (cc->err) {
         cc->err = 0;
         memset(cc->errstr, '\0', strlen(cc->errstr));
@@ -4107,7 +7717,7 @@ int redisClusterAsyncFormattedCommand(redisClusterAsyncContext *acc,
         memset(acc->errstr, '\0', strlen(acc->errstr));
     }
 
-    command = command_get();
+    command = command_pool_get(cc->command_pool);
     if (command == NULL) {
         goto oom;
     }
@@ -4157,12 +7767,26 @@ int redisClusterAsyncFormattedCommand(redisClusterAsyncContext *acc,
         goto error;
     }
 
+    /* A key already moved by a slot migration */
+    redisClusterNode *importing = askCacheLookup(cc, command);
+    if (importing != NULL) {
+        node = importing;
+    }
+
     ac = actx_get_by_node(acc, node);
     if (ac == NULL) {
         /* Specific error already set */
         goto error;
     }
 
+    if (importing != NULL &&
+        redisAsyncFormattedCommand(ac, NULL, NULL,
+                                   REDIS_COMMAND_ASKING_FORMATTED,
+                                   REDIS_COMMAND_ASKING_FORMATTED_LEN) !=
+            REDIS_OK) {
+        goto error;
+    }
+
     cad = cluster_async_data_create();
     if (cad == NULL) {
         goto oom;
@@ -4172,6 +7796,9 @@ int redisClusterAsyncFormattedCommand(redisClusterAsyncContext *acc,
     cad->command = command;
     cad->callback = fn;
     cad->privdata = privdata;
+    if (cc->retry_deadline_ms > 0) {
+        cad->started = hi_usec_now();
+    }
 
     status = redisAsyncFormattedCommand(ac, redisClusterAsyncCallback, cad, cmd,
                                         len);
@@ -4226,7 +7853,7 @@ int redisClusterAsyncFormattedCommandToNode(redisClusterAsyncContext *acc,
         memset(acc->errstr, '\0', strlen(acc->errstr));
     }
 
-    command = command_get();
+    command = command_pool_get(cc->command_pool);
     if (command == NULL) {
         goto oom;
     }
@@ -4392,6 +8019,8 @@ void redisClusterAsyncDisconnect(redisClusterAsyncContext *acc) {
 
     cc = acc->cc;
 
+    clusterAsyncFailRetries(acc);
+
     if (cc->nodes == NULL) {
         return;
     }
@@ -4412,6 +8041,26 @@ void redisClusterAsyncDisconnect(redisClusterAsyncContext *acc) {
     }
 }
 
+int redisClusterAsyncHandleRetries(redisClusterAsyncContext *acc) {
+    cluster_async_data *cad;
+    int64_t wait;
+
+    if (acc == NULL) {
+        return -1;
+    }
+
+    clusterAsyncSendDueRetries(acc);
+
+    if (acc->retries == NULL || listLength(acc->retries) == 0) {
+        return -1;
+    }
+
+    cad = listNodeValue(listFirst(acc->retries));
+    wait = cad->retry_at - hi_usec_now();
+
+    return wait > 0 ? (int)((wait + 999) / 1000) : 0;
+}
+
 void redisClusterAsyncFree(redisClusterAsyncContext *acc) {
     redisClusterContext *cc;
 
@@ -4421,6 +8070,11 @@ void redisClusterAsyncFree(redisClusterAsyncContext *acc) {
 
     cc = acc->cc;
 
+    clusterAsyncFailRetries(acc);
+    if (acc->retries != NULL) {
+        listRelease(acc->retries);
+    }
+
     redisClusterFree(cc);
 
     hi_free(acc);
@@ -0,0 +1,114 @@
+/********************************************************
+ * Description : growable ring buffer of pointers
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <alloc.h>
+#include <string.h>
+
+#include "hiring.h"
+#include "hiutil.h"
+
+struct hiring *hiring_create(uint32_t n) {
+    struct hiring *r;
+    uint32_t nalloc = 1;
+
+    while (nalloc < n) {
+        nalloc <<= 1;
+    }
+
+    r = hi_malloc(sizeof(*r));
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->elem = hi_malloc(nalloc * sizeof(void *));
+    if (r->elem == NULL) {
+        hi_free(r);
+        return NULL;
+    }
+
+    r->head = 0;
+    r->nelem = 0;
+    r->nalloc = nalloc;
+    r->free = NULL;
+
+    return r;
+}
+
+void hiring_destroy(struct hiring *r) {
+    if (r == NULL) {
+        return;
+    }
+
+    hiring_clear(r);
+    hi_free(r->elem);
+    hi_free(r);
+}
+
+/* Removes all elements, calling the destructor on each of them in order. */
+void hiring_clear(struct hiring *r) {
+    void *ptr;
+
+    while (r->nelem > 0) {
+        ptr = hiring_pop(r);
+        if (r->free) {
+            r->free(ptr);
+        }
+    }
+    r->head = 0;
+}
+
+int hiring_push(struct hiring *r, void *ptr) {
+    void **elem;
+    uint32_t wrapped;
+
+    if (r->nelem == r->nalloc) {
+        if (r->nalloc > UINT32_MAX / 2) {
+            return HI_ERROR;
+        }
+
+        elem = hi_realloc(r->elem, 2 * r->nalloc * sizeof(void *));
+        if (elem == NULL) {
+            return HI_ERROR;
+        }
+
+        /* Unwrap: the elements before head follow the old end now. */
+        wrapped = r->head;
+        memcpy(elem + r->nalloc, elem, wrapped * sizeof(void *));
+
+        r->elem = elem;
+        r->nalloc *= 2;
+    }
+
+    r->elem[(r->head + r->nelem) & (r->nalloc - 1)] = ptr;
+    r->nelem++;
+
+    return HI_OK;
+}
+
+/* Removes and returns the first element, or NULL when empty. The destructor
+ * is not called, the element belongs to the caller. */
+void *hiring_pop(struct hiring *r) {
+    void *ptr;
+
+    if (r->nelem == 0) {
+        return NULL;
+    }
+
+    ptr = r->elem[r->head];
+    r->head = (r->head + 1) & (r->nalloc - 1);
+    r->nelem--;
+
+    return ptr;
+}
+
+void *hiring_get(const struct hiring *r, uint32_t idx) {
+    ASSERT(idx < r->nelem);
+
+    return r->elem[(r->head + idx) & (r->nalloc - 1)];
+}
@@ -0,0 +1,158 @@
+/********************************************************
+ * Description : ring buffer of slow client-side commands
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <alloc.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "hislowlog.h"
+
+/* The producer publishes an entry by storing head with release semantics,
+ * the consumer frees its slot by storing tail the same way. */
+#ifdef _WIN32
+#define HISLOWLOG_LOAD(p)                                                      \
+    ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0))
+#define HISLOWLOG_STORE(p, v)                                                  \
+    InterlockedExchange64((volatile LONG64 *)(p), (LONG64)(v))
+#else
+#define HISLOWLOG_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define HISLOWLOG_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+struct hislowlog *hislowlog_create(uint32_t size) {
+    struct hislowlog *l;
+    uint32_t n = 1;
+
+    if (size == 0) {
+        size = HISLOWLOG_DEFAULT_SIZE;
+    }
+    while (n < size && n < 0x80000000u) {
+        n <<= 1;
+    }
+
+    l = hi_malloc(sizeof(*l) + (size_t)n * sizeof(struct hislowlog_entry));
+    if (l == NULL) {
+        return NULL;
+    }
+
+    l->size = n;
+    l->head = 0;
+    l->tail = 0;
+    l->dropped = 0;
+    l->entries = (struct hislowlog_entry *)(l + 1);
+
+    return l;
+}
+
+void hislowlog_destroy(struct hislowlog *l) { hi_free(l); }
+
+int hislowlog_push(struct hislowlog *l, const struct hislowlog_entry *entry) {
+    uint64_t head = l->head;
+
+    if (head - HISLOWLOG_LOAD(&l->tail) >= l->size) {
+        HISLOWLOG_STORE(&l->dropped, l->dropped + 1);
+        return 0;
+    }
+
+    memcpy(&l->entries[head & (l->size - 1)], entry, sizeof(*entry));
+    HISLOWLOG_STORE(&l->head, head + 1);
+
+    return 1;
+}
+
+int hislowlog_pop(struct hislowlog *l, struct hislowlog_entry *entry) {
+    uint64_t tail = l->tail;
+
+    if (tail == HISLOWLOG_LOAD(&l->head)) {
+        return 0;
+    }
+
+    memcpy(entry, &l->entries[tail & (l->size - 1)], sizeof(*entry));
+    HISLOWLOG_STORE(&l->tail, tail + 1);
+
+    return 1;
+}
+
+uint64_t hislowlog_dropped(const struct hislowlog *l) {
+    return HISLOWLOG_LOAD(&l->dropped);
+}
+
+/* Appends n bytes to the command, non-printable ones as dots. Returns 0 once
+ * the command is full. */
+static int hislowlog_append(struct hislowlog_entry *entry, size_t *pos,
+                            const char *str, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (*pos >= HISLOWLOG_COMMAND_LEN - 1) {
+            memcpy(entry->command + HISLOWLOG_COMMAND_LEN - 4, "...", 3);
+            return 0;
+        }
+        entry->command[(*pos)++] =
+            (unsigned char)str[i] < 0x20 ? '.' : str[i];
+    }
+
+    return 1;
+}
+
+void hislowlog_set_command(struct hislowlog_entry *entry, const char *cmd,
+                           size_t len) {
+    const char *p = cmd, *end = cmd + len;
+    size_t pos = 0, n;
+
+    if (len == 0 || cmd[0] != '*') {
+        /* Inline command */
+        hislowlog_append(entry, &pos, cmd, len);
+        entry->command[pos] = '\0';
+        return;
+    }
+
+    /* *<argc>\r\n then $<len>\r\n<arg>\r\n per argument */
+    p = memchr(p, '\n', (size_t)(end - p));
+    while (p != NULL && ++p < end && *p == '$') {
+        n = 0;
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            n = n * 10 + (size_t)(*p - '0');
+        }
+        p += 2;
+        if (p >= end || n > (size_t)(end - p)) {
+            break;
+        }
+
+        if ((pos > 0 && !hislowlog_append(entry, &pos, " ", 1)) ||
+            !hislowlog_append(entry, &pos, p, n)) {
+            break;
+        }
+        p += n + 1;
+    }
+
+    entry->command[pos] = '\0';
+}
+
+int64_t hislowlog_time_now(void) {
+#ifdef _WIN32
+    FILETIME ft;
+    ULARGE_INTEGER t;
+
+    /* 100 nsec intervals since 1601 */
+    GetSystemTimeAsFileTime(&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return (int64_t)((t.QuadPart - 116444736000000000ULL) / 10);
+#else
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+#endif
+}
@@ -9,18 +9,33 @@
 
 #ifdef _MSC_VER
     #include <winsock2.h>
+    #include <process.h>
 #else
     #include <sys/time.h>
+    #include <unistd.h>
 #endif // _MSC_VER
+#include <cctype>
 #include <cstring>
 #include <cstdio>
 #include <string>
 #include <list>
+#include <map>
 #include <vector>
+#include <mutex>
 #include <sstream>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <new>
+#include <cstdlib>
+#include <climits>
 #include "hiredis.h"
 #include "hircluster.h"
+#include "hialloc.h"
+#include "hihistogram.h"
+#include "hislowlog.h"
 #include "libredis.h"
+#include "redis_utility.h"
 
 #if 0 // defined(DEBUG) || defined(_DEBUG)
     #define RUN_LOG_ERR(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
@@ -32,82 +47,84 @@
     #define RUN_LOG_DBG(fmt, ...)
 #endif // defined(DEBUG) || defined(_DEBUG)
 
-template <typename T>
-bool string_to_type(const std::string & str, T & val)
+#ifdef LIBREDIS_ALLOC_STATS
+
+/*
+ * counts the allocations of the c++ layer along with those of hiredis for
+ * alloc_stats, these replace the global operators of the whole program
+ */
+void * operator new (std::size_t size)
 {
-    std::istringstream iss(str);
-    iss.setf(std::ios::boolalpha);
-    iss >> val;
-    return (!iss.fail());
+    hialloc_record(size);
+    void * ptr = malloc(0 == size ? 1 : size);
+    if (nullptr == ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return (ptr);
 }
 
-template <typename T>
-bool string_to_type(const std::string & str, T * val);
+void * operator new [] (std::size_t size)
+{
+    return (operator new (size));
+}
 
-template <typename T>
-bool type_to_string(T val, std::string & str)
+void * operator new (std::size_t size, const std::nothrow_t &) noexcept
 {
-    std::ostringstream oss;
-    oss.setf(std::ios::fixed, std::ios::floatfield);
-    oss.setf(std::ios::boolalpha);
-    oss << val;
-    str = oss.str();
-    return (true);
+    hialloc_record(size);
+    return (malloc(0 == size ? 1 : size));
 }
 
-template <typename T>
-bool type_to_string(T * val, std::string & str);
+void * operator new [] (std::size_t size, const std::nothrow_t &) noexcept
+{
+    hialloc_record(size);
+    return (malloc(0 == size ? 1 : size));
+}
 
-template <>
-bool type_to_string(const char * val, std::string & str)
+void operator delete (void * ptr) noexcept
 {
-    if (nullptr == val)
-    {
-        return (false);
-    }
-    else
-    {
-        str = val;
-        return (true);
-    }
+    free(ptr);
 }
 
-template <typename T>
-bool string_to_type(const std::list<std::string> & str_list, std::list<T> & val_list)
+void operator delete [] (void * ptr) noexcept
 {
-    bool ret = true;
-    for (std::list<std::string>::const_iterator iter = str_list.begin(); str_list.end() != iter; ++iter)
-    {
-        T val;
-        if (string_to_type(*iter, val))
-        {
-            val_list.push_back(val);
-        }
-        else
-        {
-            ret = false;
-        }
-    }
-    return (ret);
+    free(ptr);
 }
 
-template <typename T>
-bool type_to_string(const std::list<T> & val_list, std::list<std::string> & str_list)
+void operator delete (void * ptr, const std::nothrow_t &) noexcept
 {
-    bool ret = true;
-    for (typename std::list<T>::const_iterator iter = val_list.begin(); val_list.end() != iter; ++iter)
+    free(ptr);
+}
+
+void operator delete [] (void * ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+#endif // LIBREDIS_ALLOC_STATS
+
+/*
+ * slotmap groups by name, they live as long as the process
+ */
+static redisClusterSlotmapGroup * get_slotmap_group(const std::string & name)
+{
+    static std::mutex s_slotmap_group_mutex;
+    static std::map<std::string, redisClusterSlotmapGroup *> s_slotmap_groups;
+
+    std::lock_guard<std::mutex> locker(s_slotmap_group_mutex);
+
+    std::map<std::string, redisClusterSlotmapGroup *>::iterator iter = s_slotmap_groups.find(name);
+    if (s_slotmap_groups.end() != iter)
     {
-        std::string str;
-        if (type_to_string(*iter, str))
-        {
-            str_list.push_back(str);
-        }
-        else
-        {
-            ret = false;
-        }
+        return (iter->second);
     }
-    return (ret);
+
+    redisClusterSlotmapGroup * slotmap_group = redisClusterSlotmapGroupCreate();
+    if (nullptr != slotmap_group)
+    {
+        s_slotmap_groups[name] = slotmap_group;
+    }
+    return (slotmap_group);
 }
 
 class RedisDBImpl
@@ -117,10 +134,15 @@ public:
     ~RedisDBImpl();
 
 public:
-    bool open(const std::string & address, const std::string & username, const std::string & password, const std::string & table, uint32_t timeout);
+    bool open(const std::string & address, const std::string & username, const std::string & password, const RedisOptions & options);
     void close();
     bool destroy();
 
+public:
+    bool warm_up(std::list<std::string> & failed_nodes);
+    void set_operation_timeout(uint32_t timeout);
+    void set_trace_hooks(RedisTraceHook before, RedisTraceHook after, void * context);
+
 public:
     bool set(const std::string & key, const std::string & value);
     bool get(const std::string & key, std::string & value);
@@ -155,11 +177,122 @@ public:
 private:
     bool login();
     void logoff();
-    bool authenticate();
-    bool select_table();
+    bool handshake();
+    void count_login();
+    bool connect_nodes(std::list<std::string> & failed_nodes);
+
+private:
+    bool tracing() const;
+    void apply_trace_callback();
+    void trace_before(const RedisTrace & trace);
+    void trace_after(const RedisTrace & trace);
+    void write_trace(const RedisTrace & trace);
+    static void cluster_trace(const redisClusterTrace * cluster_span, int phase, void * privdata);
+
+private:
+    /*
+     * the outermost guard of a call starts its deadline, so that calls made of
+     * several commands share one
+     */
+    class OperationGuard
+    {
+    public:
+        explicit OperationGuard(RedisDBImpl & redis_db);
+        ~OperationGuard();
+
+    private:
+        OperationGuard(const OperationGuard &);
+        OperationGuard & operator = (const OperationGuard &);
+
+    private:
+        RedisDBImpl                   & m_redis_db;
+    };
+
+    int64_t remaining_time() const;
+    bool deadline_passed() const;
+    int cluster_deadline() const;
+    struct timeval limit_timeout(const struct timeval & timeout) const;
+    void apply_command_timeout();
+
+public:
+    RedisErrorKind error_kind() const;
+    const std::string & error_message() const;
+
+public:
+    bool stats(RedisStats & stats);
+    void reset_stats();
+    bool drain_slowlog(std::list<RedisSlowCommand> & commands);
+
+private:
+    /*
+     * times a command sent to a standalone server, the cluster context keeps
+     * its own statistics
+     */
+    class LatencyRecorder
+    {
+    public:
+        LatencyRecorder(RedisDBImpl & redis_db, const std::string & command);
+        ~LatencyRecorder();
+
+    private:
+        LatencyRecorder(const LatencyRecorder &);
+        LatencyRecorder & operator = (const LatencyRecorder &);
+
+    private:
+        RedisDBImpl                   & m_redis_db;
+        int                             m_type;
+        int64_t                         m_start;
+    };
+
+    /*
+     * logs a command sent to a standalone server that took longer than the
+     * slowlog threshold, the cluster context logs its commands itself
+     */
+    class SlowlogRecorder
+    {
+    public:
+        SlowlogRecorder(RedisDBImpl & redis_db, const std::list<std::string> & args);
+        ~SlowlogRecorder();
+
+    public:
+        void set_reconnected();
+
+    private:
+        SlowlogRecorder(const SlowlogRecorder &);
+        SlowlogRecorder & operator = (const SlowlogRecorder &);
+
+    private:
+        RedisDBImpl                   & m_redis_db;
+        const std::list<std::string>  & m_args;
+        int64_t                         m_start;
+        bool                            m_reconnected;
+    };
+
+    /*
+     * counts the allocations a command makes on the calling thread, to the
+     * server or to the cluster
+     */
+    class AllocRecorder
+    {
+    public:
+        AllocRecorder(RedisDBImpl & redis_db, const std::string & command);
+        ~AllocRecorder();
+
+    private:
+        AllocRecorder(const AllocRecorder &);
+        AllocRecorder & operator = (const AllocRecorder &);
+
+    private:
+        RedisDBImpl                   & m_redis_db;
+        int                             m_type;
+        hialloc_counters                m_start;
+    };
 
 private:
     bool execute_command(const std::list<std::string> & args, int return_type, void * result);
+    void set_error(RedisErrorKind kind, const std::string & message);
+    static RedisErrorKind reply_error_kind(const std::string & error, bool cluster);
+    static RedisErrorKind cluster_error_kind(int err);
 
 private:
     bool                            m_running;
@@ -168,6 +301,23 @@ private:
     std::string                     m_redis_password;
     std::string                     m_redis_table;
     struct timeval                  m_redis_timeout;
+    RedisOptions                    m_redis_options;
+    struct timeval                  m_redis_command_timeout;
+    RedisErrorKind                  m_error_kind;
+    std::string                     m_error_message;
+    uint32_t                        m_operation_timeout;
+    uint32_t                        m_operation_depth;
+    int64_t                         m_operation_deadline;
+    std::vector<hihistogram *>      m_command_latency;
+    std::vector<hialloc_counters>   m_command_allocs;
+    redisClusterStats               m_redis_stats;
+    bool                            m_redis_lost;
+    RedisTraceHook                  m_trace_before;
+    RedisTraceHook                  m_trace_after;
+    void                          * m_trace_context;
+    FILE                          * m_trace_file;
+    uint64_t                        m_trace_events;
+    hislowlog                     * m_slowlog;
     redisContext                  * m_redis_context;
     redisClusterContext           * m_redis_cluster_context;
 };
@@ -209,6 +359,348 @@ static int strcmp_ignore_case(const char * str1, const char * str2)
 #endif // _MSC_VER
 }
 
+/*
+ * decodes a reply straight into the result of execute_command(), standalone
+ * connections feed it from the hiredis reader so no reply tree is ever built
+ */
+class RedisReplyVisitor
+{
+public:
+    RedisReplyVisitor(int return_type, void * result);
+
+public:
+    static bool attach(redisContext * context);
+    void visit(const redisReply * reply);
+
+public:
+    int type() const;
+    bool matched() const;
+    bool good() const;
+    bool ret() const;
+    const std::string & error() const;
+
+private:
+    void on_string(int depth, int type, const char * str, size_t len);
+    void on_array(int depth, size_t elements);
+    void on_integer(int depth, long long value);
+    void on_nil(int depth);
+    void on_other(int depth, int type);
+
+private:
+    static int depth_of(const redisReadTask * task);
+    static void * object_of(const redisReadTask * task);
+    static void * create_string(const redisReadTask * task, char * str, size_t len);
+    static void * create_array(const redisReadTask * task, size_t elements);
+    static void * create_integer(const redisReadTask * task, long long value);
+    static void * create_double(const redisReadTask * task, double value, char * str, size_t len);
+    static void * create_nil(const redisReadTask * task);
+    static void * create_bool(const redisReadTask * task, int value);
+    static void free_object(void *);
+
+private:
+    static redisReplyObjectFunctions    s_functions;
+    static redisReply                   s_reply;                    /* what hiredis gets back for every reply, a nil */
+
+private:
+    int                                 m_return_type;
+    void                              * m_result;
+    int                                 m_type;
+    bool                                m_good;
+    bool                                m_ret;
+    std::string                         m_error;
+};
+
+redisReplyObjectFunctions RedisReplyVisitor::s_functions =
+{
+    &RedisReplyVisitor::create_string,
+    &RedisReplyVisitor::create_array,
+    &RedisReplyVisitor::create_integer,
+    &RedisReplyVisitor::create_double,
+    &RedisReplyVisitor::create_nil,
+    &RedisReplyVisitor::create_bool,
+    &RedisReplyVisitor::free_object
+};
+
+redisReply RedisReplyVisitor::s_reply = { REDIS_REPLY_NIL };
+
+RedisReplyVisitor::RedisReplyVisitor(int return_type, void * result)
+    : m_return_type(return_type)
+    , m_result(result)
+    , m_type(0)
+    , m_good(true)
+    , m_ret(false)
+    , m_error()
+{
+
+}
+
+bool RedisReplyVisitor::attach(redisContext * context)
+{
+    if (nullptr == context || nullptr == context->reader)
+    {
+        return (false);
+    }
+
+    redisReader * reader = redisReaderCreateWithFunctions(&s_functions);
+    if (nullptr == reader)
+    {
+        return (false);
+    }
+
+    reader->maxbuf = context->reader->maxbuf;
+    reader->maxelements = context->reader->maxelements;
+    redisReaderFree(context->reader);
+    context->reader = reader;
+
+    /* the replies are not redisReply trees, keep hiredis from freeing or inspecting them as pushes */
+    redisSetPushCallback(context, nullptr);
+
+    return (true);
+}
+
+void RedisReplyVisitor::visit(const redisReply * reply)
+{
+    switch (reply->type)
+    {
+        case REDIS_REPLY_ARRAY:
+        {
+            on_array(0, reply->elements);
+            for (size_t index = 0; index < reply->elements; ++index)
+            {
+                const redisReply * element = reply->element[index];
+                if (REDIS_REPLY_STRING == element->type)
+                {
+                    on_string(1, element->type, element->str, element->len);
+                }
+                else
+                {
+                    on_other(1, element->type);
+                }
+            }
+            break;
+        }
+        case REDIS_REPLY_STRING:
+        case REDIS_REPLY_STATUS:
+        case REDIS_REPLY_ERROR:
+        {
+            on_string(0, reply->type, reply->str, reply->len);
+            break;
+        }
+        case REDIS_REPLY_INTEGER:
+        {
+            on_integer(0, reply->integer);
+            break;
+        }
+        case REDIS_REPLY_NIL:
+        {
+            on_nil(0);
+            break;
+        }
+        default:
+        {
+            on_other(0, reply->type);
+            break;
+        }
+    }
+}
+
+int RedisReplyVisitor::type() const
+{
+    return (m_type);
+}
+
+bool RedisReplyVisitor::matched() const
+{
+    return (m_return_type == m_type);
+}
+
+bool RedisReplyVisitor::good() const
+{
+    return (m_good);
+}
+
+bool RedisReplyVisitor::ret() const
+{
+    return (m_ret);
+}
+
+const std::string & RedisReplyVisitor::error() const
+{
+    return (m_error);
+}
+
+void RedisReplyVisitor::on_string(int depth, int type, const char * str, size_t len)
+{
+    if (0 == depth)
+    {
+        m_type = type;
+        if (REDIS_REPLY_ERROR == type)
+        {
+            m_error.assign(str, len);
+        }
+        if (!matched())
+        {
+            return;
+        }
+        switch (type)
+        {
+            case REDIS_REPLY_STRING:
+            {
+                reinterpret_cast<std::string *>(m_result)->assign(str, len);
+                m_ret = true;
+                break;
+            }
+            case REDIS_REPLY_STATUS:
+            {
+                m_ret = (0 == strcmp_ignore_case(str, "ok"));
+                break;
+            }
+            default:
+            {
+                m_good = false;
+                break;
+            }
+        }
+    }
+    else if (1 == depth && REDIS_REPLY_ARRAY == m_type && matched() && REDIS_REPLY_STRING == type)
+    {
+        reinterpret_cast<std::list<std::string> *>(m_result)->push_back(std::string(str, len));
+    }
+}
+
+void RedisReplyVisitor::on_array(int depth, size_t elements)
+{
+    if (0 == depth)
+    {
+        m_type = REDIS_REPLY_ARRAY;
+        m_ret = matched();
+    }
+}
+
+void RedisReplyVisitor::on_integer(int depth, long long value)
+{
+    if (0 == depth)
+    {
+        m_type = REDIS_REPLY_INTEGER;
+        m_ret = (matched() && value > 0);
+    }
+}
+
+void RedisReplyVisitor::on_nil(int depth)
+{
+    if (0 == depth)
+    {
+        m_type = REDIS_REPLY_NIL;
+    }
+}
+
+void RedisReplyVisitor::on_other(int depth, int type)
+{
+    if (0 == depth)
+    {
+        m_type = type;
+        m_good = !matched();
+    }
+}
+
+int RedisReplyVisitor::depth_of(const redisReadTask * task)
+{
+    int depth = 0;
+    for (const redisReadTask * parent = task->parent; nullptr != parent; parent = parent->parent)
+    {
+        ++depth;
+    }
+    return (depth);
+}
+
+void * RedisReplyVisitor::object_of(const redisReadTask *)
+{
+    /*
+     * hiredis may read the type of what it gets back (push replies), so it
+     * gets a real reply, the decoded values went to the visitor already
+     */
+    return (&s_reply);
+}
+
+void * RedisReplyVisitor::create_string(const redisReadTask * task, char * str, size_t len)
+{
+    RedisReplyVisitor * visitor = reinterpret_cast<RedisReplyVisitor *>(task->privdata);
+    if (nullptr != visitor)
+    {
+        if (REDIS_REPLY_VERB == task->type && len >= 4)
+        {
+            visitor->on_string(depth_of(task), REDIS_REPLY_STRING, str + 4, len - 4);
+        }
+        else
+        {
+            visitor->on_string(depth_of(task), task->type, str, len);
+        }
+    }
+    return (object_of(task));
+}
+
+void * RedisReplyVisitor::create_array(const redisReadTask * task, size_t elements)
+{
+    RedisReplyVisitor * visitor = reinterpret_cast<RedisReplyVisitor *>(task->privdata);
+    if (nullptr != visitor)
+    {
+        if (REDIS_REPLY_ARRAY == task->type)
+        {
+            visitor->on_array(depth_of(task), elements);
+        }
+        else
+        {
+            visitor->on_other(depth_of(task), task->type);
+        }
+    }
+    return (object_of(task));
+}
+
+void * RedisReplyVisitor::create_integer(const redisReadTask * task, long long value)
+{
+    RedisReplyVisitor * visitor = reinterpret_cast<RedisReplyVisitor *>(task->privdata);
+    if (nullptr != visitor)
+    {
+        visitor->on_integer(depth_of(task), value);
+    }
+    return (object_of(task));
+}
+
+void * RedisReplyVisitor::create_double(const redisReadTask * task, double value, char * str, size_t len)
+{
+    RedisReplyVisitor * visitor = reinterpret_cast<RedisReplyVisitor *>(task->privdata);
+    if (nullptr != visitor)
+    {
+        visitor->on_other(depth_of(task), task->type);
+    }
+    return (object_of(task));
+}
+
+void * RedisReplyVisitor::create_nil(const redisReadTask * task)
+{
+    RedisReplyVisitor * visitor = reinterpret_cast<RedisReplyVisitor *>(task->privdata);
+    if (nullptr != visitor)
+    {
+        visitor->on_nil(depth_of(task));
+    }
+    return (object_of(task));
+}
+
+void * RedisReplyVisitor::create_bool(const redisReadTask * task, int value)
+{
+    RedisReplyVisitor * visitor = reinterpret_cast<RedisReplyVisitor *>(task->privdata);
+    if (nullptr != visitor)
+    {
+        visitor->on_other(depth_of(task), task->type);
+    }
+    return (object_of(task));
+}
+
+void RedisReplyVisitor::free_object(void *)
+{
+
+}
+
 RedisDBImpl::RedisDBImpl()
     : m_running(false)
     , m_redis_address("127.0.0.1:6379")
@@ -216,19 +708,43 @@ RedisDBImpl::RedisDBImpl()
     , m_redis_password()
     , m_redis_table("0")
     , m_redis_timeout()
+    , m_redis_options()
+    , m_redis_command_timeout()
+    , m_error_kind(redis_error_none)
+    , m_error_message()
+    , m_operation_timeout(0)
+    , m_operation_depth(0)
+    , m_operation_deadline(0)
+    , m_command_latency()
+    , m_command_allocs()
+    , m_redis_stats()
+    , m_redis_lost(false)
+    , m_trace_before(nullptr)
+    , m_trace_after(nullptr)
+    , m_trace_context(nullptr)
+    , m_trace_file(nullptr)
+    , m_trace_events(0)
+    , m_slowlog(nullptr)
     , m_redis_context(nullptr)
     , m_redis_cluster_context(nullptr)
 {
     m_redis_timeout.tv_sec = 5;
     m_redis_timeout.tv_usec = 0;
+    m_redis_command_timeout.tv_sec = 0;
+    m_redis_command_timeout.tv_usec = 0;
 }
 
 RedisDBImpl::~RedisDBImpl()
 {
     close();
+
+    for (std::vector<hihistogram *>::iterator iter = m_command_latency.begin(); m_command_latency.end() != iter; ++iter)
+    {
+        hihistogram_destroy(*iter);
+    }
 }
 
-bool RedisDBImpl::open(const std::string & address, const std::string & username, const std::string & password, const std::string & table, uint32_t timeout)
+bool RedisDBImpl::open(const std::string & address, const std::string & username, const std::string & password, const RedisOptions & options)
 {
     close();
 
@@ -241,14 +757,46 @@ bool RedisDBImpl::open(const std::string & address, const std::string & username
         m_redis_address = address;
         m_redis_username = username;
         m_redis_password = password;
-        m_redis_table = table;
-        m_redis_timeout.tv_sec = timeout / 1000;
-        m_redis_timeout.tv_usec = timeout % 1000 * 1000;
-
-        if (!login())
+        m_redis_options = options;
+        type_to_string(options.table, m_redis_table);
+        m_redis_timeout.tv_sec = options.timeout / 1000;
+        m_redis_timeout.tv_usec = options.timeout % 1000 * 1000;
+        m_redis_command_timeout.tv_sec = options.command_timeout / 1000;
+        m_redis_command_timeout.tv_usec = options.command_timeout % 1000 * 1000;
+        m_operation_timeout = options.operation_timeout;
+
+        if (!options.trace_file.empty())
         {
-            RUN_LOG_ERR("redis db init failure while login to redis server");
-            break;
+            m_trace_file = fopen(options.trace_file.c_str(), "w");
+            if (nullptr == m_trace_file)
+            {
+                RUN_LOG_ERR("redis db init failure while open trace file [%s]", options.trace_file.c_str());
+                break;
+            }
+            fputs("[\n", m_trace_file);
+            m_trace_events = 0;
+        }
+
+        if (0 != options.slowlog_threshold)
+        {
+            m_slowlog = hislowlog_create(options.slowlog_size);
+            if (nullptr == m_slowlog)
+            {
+                RUN_LOG_ERR("redis db init failure while create slowlog");
+                break;
+            }
+        }
+
+        if (options.alloc_stats && 0 != hialloc_install())
+        {
+            RUN_LOG_ERR("redis db init failure while install allocation counting, another redis db is open");
+            break;
+        }
+
+        if (!login())
+        {
+            RUN_LOG_ERR("redis db init failure while login to redis server");
+            break;
         }
 
         RUN_LOG_DBG("redis db init success");
@@ -273,274 +821,1247 @@ void RedisDBImpl::close()
 
         logoff();
 
-        RUN_LOG_DBG("redis db exit end");
+        if (nullptr != m_trace_file)
+        {
+            fputs("\n]\n", m_trace_file);
+            fclose(m_trace_file);
+            m_trace_file = nullptr;
+        }
+
+        hislowlog_destroy(m_slowlog);
+        m_slowlog = nullptr;
+
+        RUN_LOG_DBG("redis db exit end");
+    }
+}
+
+static void cluster_event_callback(const redisClusterContext * cluster_context, int event, void * privdata)
+{
+    switch (event)
+    {
+        case HIRCLUSTER_EVENT_RECONNECT:
+            RUN_LOG_DBG("redis cluster node reconnected");
+            break;
+        case HIRCLUSTER_EVENT_CONNECT_FAILED:
+            RUN_LOG_ERR("redis cluster node connect failure (%s)", cluster_context->errstr);
+            break;
+        case HIRCLUSTER_EVENT_SLOTMAP_UPDATED:
+            RUN_LOG_DBG("redis cluster slotmap updated");
+            break;
+        case HIRCLUSTER_EVENT_SLOTMAP_UPDATE_FAILED:
+            RUN_LOG_ERR("redis cluster slotmap update failure (%s)", cluster_context->errstr);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * the counters of a cluster context are kept when it is freed
+ */
+static void add_cluster_stats(redisClusterStats & total, const redisClusterStats & stats)
+{
+    total.connects += stats.connects;
+    total.reconnects += stats.reconnects;
+    total.connect_failures += stats.connect_failures;
+    total.commands += stats.commands;
+    total.command_errors += stats.command_errors;
+    total.moved += stats.moved;
+    total.ask += stats.ask;
+    total.tryagain += stats.tryagain;
+    total.clusterdown += stats.clusterdown;
+    total.slotmap_updates += stats.slotmap_updates;
+    total.slotmap_update_failures += stats.slotmap_update_failures;
+    total.bytes_out += stats.bytes_out;
+    total.bytes_in += stats.bytes_in;
+}
+
+bool RedisDBImpl::login()
+{
+    if (nullptr != m_redis_context || nullptr != m_redis_cluster_context)
+    {
+        return (true);
+    }
+
+    if (std::string::npos == m_redis_address.find(','))
+    {
+        std::string redis_host;
+        uint16_t redis_port = 6379;
+        std::string::size_type pos = m_redis_address.find(':');
+        if (std::string::npos == pos)
+        {
+            redis_host = m_redis_address;
+        }
+        else
+        {
+            redis_host = m_redis_address.substr(0, pos);
+            string_to_type(m_redis_address.substr(pos + 1), redis_port);
+        }
+
+        hialloc_client_open();
+        m_redis_context = redisConnectWithTimeout(redis_host.c_str(), redis_port, limit_timeout(m_redis_timeout));
+        if (nullptr == m_redis_context)
+        {
+            hialloc_client_close();
+        }
+        if (nullptr != m_redis_context && 0 == m_redis_context->err)
+        {
+            RUN_LOG_DBG("connect redis server [%s] success", m_redis_address.c_str());
+            apply_command_timeout();
+            if (!RedisReplyVisitor::attach(m_redis_context))
+            {
+                RUN_LOG_ERR("attach reply visitor to redis server [%s] failure", m_redis_address.c_str());
+            }
+            else if (handshake())
+            {
+                count_login();
+                return (true);
+            }
+        }
+        else
+        {
+            RUN_LOG_ERR("connect redis server [%s] failure (%s)", m_redis_address.c_str(), (nullptr != m_redis_context ? m_redis_context->errstr : "unknown"));
+        }
+    }
+    else
+    {
+        do
+        {
+            m_redis_cluster_context = redisClusterContextInit();
+            if (nullptr == m_redis_cluster_context)
+            {
+                RUN_LOG_ERR("init redis cluster failure");
+                break;
+            }
+
+            int result = redisClusterSetOptionAddNodes(m_redis_cluster_context, m_redis_address.c_str());
+            if (REDIS_OK != result)
+            {
+                RUN_LOG_ERR("set redis cluster nodes [%s] failure (%s)", m_redis_address.c_str(), m_redis_cluster_context->errstr);
+                break;
+            }
+
+            if (!m_redis_username.empty())
+            {
+                result = redisClusterSetOptionUsername(m_redis_cluster_context, m_redis_username.c_str());
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster username [%s] failure (%s)", m_redis_username.c_str(), m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            if (!m_redis_password.empty())
+            {
+                result = redisClusterSetOptionPassword(m_redis_cluster_context, m_redis_password.c_str());
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster password [%s] failure (%s)", m_redis_password.c_str(), m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            redisClusterSetEventCallback(m_redis_cluster_context, &cluster_event_callback, nullptr);
+            apply_trace_callback();
+
+            if (0 != m_redis_options.slowlog_threshold)
+            {
+                result = redisClusterSetOptionSlowlog(m_redis_cluster_context, static_cast<int>(m_redis_options.slowlog_threshold), m_redis_options.slowlog_size);
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster slowlog failure (%s)", m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            if (!m_redis_options.client_name.empty())
+            {
+                result = redisClusterSetOptionClientName(m_redis_cluster_context, m_redis_options.client_name.c_str());
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster client name [%s] failure (%s)", m_redis_options.client_name.c_str(), m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            result = redisClusterSetOptionConnectTimeout(m_redis_cluster_context, m_redis_timeout);
+            if (REDIS_OK != result)
+            {
+                RUN_LOG_ERR("set redis cluster timeout failure (%s)", m_redis_cluster_context->errstr);
+                break;
+            }
+
+            if (0 != m_redis_command_timeout.tv_sec || 0 != m_redis_command_timeout.tv_usec)
+            {
+                result = redisClusterSetOptionTimeout(m_redis_cluster_context, m_redis_command_timeout);
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster command timeout failure (%s)", m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            /* the slotmap query and the connects are bounded by the deadline of the call that logs in */
+            if (0 != m_operation_deadline)
+            {
+                redisClusterSetDeadline(m_redis_cluster_context, cluster_deadline());
+            }
+
+            result = redisClusterSetOptionRouteUseSlots(m_redis_cluster_context);
+            if (REDIS_OK != result)
+            {
+                RUN_LOG_ERR("set redis cluster slots failure (%s)", m_redis_cluster_context->errstr);
+                break;
+            }
+
+            if (!m_redis_options.slotmap_file.empty())
+            {
+                result = redisClusterSetOptionSlotmapFile(m_redis_cluster_context, m_redis_options.slotmap_file.c_str());
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster slotmap file [%s] failure (%s)", m_redis_options.slotmap_file.c_str(), m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            if (!m_redis_options.slotmap_group.empty())
+            {
+                redisClusterSlotmapGroup * slotmap_group = get_slotmap_group(m_redis_options.slotmap_group);
+                if (nullptr == slotmap_group)
+                {
+                    RUN_LOG_ERR("create redis cluster slotmap group [%s] failure", m_redis_options.slotmap_group.c_str());
+                    break;
+                }
+
+                result = redisClusterSetOptionSlotmapGroup(m_redis_cluster_context, slotmap_group);
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster slotmap group [%s] failure (%s)", m_redis_options.slotmap_group.c_str(), m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            if (m_redis_options.latency_stats)
+            {
+                result = redisClusterSetOptionLatencyStats(m_redis_cluster_context);
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("set redis cluster latency stats failure (%s)", m_redis_cluster_context->errstr);
+                    break;
+                }
+            }
+
+            result = redisClusterSetOptionReplyArena(m_redis_cluster_context);
+            if (REDIS_OK != result)
+            {
+                RUN_LOG_ERR("set redis cluster reply arena failure (%s)", m_redis_cluster_context->errstr);
+                break;
+            }
+
+            result = redisClusterConnect2(m_redis_cluster_context);
+            if (REDIS_OK != result)
+            {
+                RUN_LOG_ERR("connect redis cluster [%s] failure (%s)", m_redis_address.c_str(), m_redis_cluster_context->errstr);
+                break;
+            }
+
+            RUN_LOG_DBG("connect redis cluster [%s] success", m_redis_address.c_str());
+
+            if (m_redis_options.slotmap_refresh)
+            {
+                result = redisClusterStartSlotmapRefresher(m_redis_cluster_context, static_cast<int>(m_redis_options.slotmap_refresh_interval));
+                if (REDIS_OK != result)
+                {
+                    RUN_LOG_ERR("start redis cluster slotmap refresher failure (%s), slotmap will be updated inline", m_redis_cluster_context->errstr);
+                }
+            }
+
+            if (m_redis_options.warm_up)
+            {
+                std::list<std::string> failed_nodes;
+                if (!connect_nodes(failed_nodes))
+                {
+                    for (std::list<std::string>::const_iterator iter = failed_nodes.begin(); failed_nodes.end() != iter; ++iter)
+                    {
+                        RUN_LOG_ERR("warm up redis cluster node [%s] failure, it will be connected on demand", iter->c_str());
+                    }
+                }
+            }
+
+            count_login();
+            return (true);
+        } while (false);
+    }
+
+    ++m_redis_stats.connect_failures;
+
+    logoff();
+
+    return (false);
+}
+
+/*
+ * a cluster context counts the connects to its nodes itself
+ */
+void RedisDBImpl::count_login()
+{
+    if (m_redis_lost)
+    {
+        m_redis_lost = false;
+        ++m_redis_stats.reconnects;
+    }
+    else if (nullptr != m_redis_context)
+    {
+        ++m_redis_stats.connects;
+    }
+}
+
+void RedisDBImpl::logoff()
+{
+    if (nullptr != m_redis_context)
+    {
+        redisFree(m_redis_context);
+        m_redis_context = nullptr;
+        hialloc_client_close();
+    }
+
+    if (nullptr != m_redis_cluster_context)
+    {
+        redisClusterStats cluster_stats;
+        redisClusterGetStats(m_redis_cluster_context, &cluster_stats);
+        add_cluster_stats(m_redis_stats, cluster_stats);
+
+        /* slow commands not drained yet outlive the context */
+        hislowlog_entry entry;
+        while (nullptr != m_slowlog && 0 != redisClusterSlowlogPop(m_redis_cluster_context, &entry))
+        {
+            hislowlog_push(m_slowlog, &entry);
+        }
+
+        redisClusterFree(m_redis_cluster_context);
+        m_redis_cluster_context = nullptr;
+    }
+}
+
+bool RedisDBImpl::connect_nodes(std::list<std::string> & failed_nodes)
+{
+    failed_nodes.clear();
+
+    if (nullptr == m_redis_cluster_context)
+    {
+        return (nullptr != m_redis_context);
+    }
+
+    if (REDIS_OK == redisClusterConnectAll(m_redis_cluster_context))
+    {
+        return (true);
+    }
+
+    RUN_LOG_ERR("connect redis cluster nodes failure (%s)", m_redis_cluster_context->errstr);
+
+    redisClusterNodeIterator node_iter;
+    redisClusterInitNodeIterator(&node_iter, m_redis_cluster_context);
+    redisClusterNode * node = nullptr;
+    while (nullptr != (node = redisClusterNodeNext(&node_iter)))
+    {
+        if (nullptr != node->slots && nullptr == node->con)
+        {
+            failed_nodes.push_back(node->addr);
+        }
+    }
+
+    return (false);
+}
+
+static int64_t get_system_time_us()
+{
+    return (static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count()));
+}
+
+static std::string trace_command_name(const std::string & command)
+{
+    char name[128] = { 0x0 };
+    if (nullptr != redisClusterCommandName(redisClusterCommandType(command.c_str(), command.size()), name, sizeof(name)) && '\0' != name[0])
+    {
+        return (name);
+    }
+
+    std::string upper_name(command);
+    for (std::string::iterator iter = upper_name.begin(); upper_name.end() != iter; ++iter)
+    {
+        *iter = static_cast<char>(toupper(static_cast<unsigned char>(*iter)));
+    }
+    return (upper_name);
+}
+
+static uint64_t decimal_digits(uint64_t value)
+{
+    uint64_t digits = 1;
+    while (value >= 10)
+    {
+        value /= 10;
+        ++digits;
+    }
+    return (digits);
+}
+
+/*
+ * bytes of the request in the redis protocol
+ */
+static uint64_t request_size(const std::list<std::string> & args)
+{
+    uint64_t size = 1 + decimal_digits(args.size()) + 2;
+    for (std::list<std::string>::const_iterator iter = args.begin(); args.end() != iter; ++iter)
+    {
+        size += 1 + decimal_digits(iter->size()) + 2 + iter->size() + 2;
+    }
+    return (size);
+}
+
+bool RedisDBImpl::execute_command(const std::list<std::string> & args, int return_type, void * result)
+{
+    OperationGuard operation_guard(*this);
+    LatencyRecorder latency_recorder(*this, (args.empty() ? std::string() : args.front()));
+    SlowlogRecorder slowlog_recorder(*this, args);
+    /* destroyed first, the histogram and slowlog updates are not the command's */
+    AllocRecorder alloc_recorder(*this, (args.empty() ? std::string() : args.front()));
+
+    set_error(redis_error_none, std::string());
+
+    if (!m_running || args.empty())
+    {
+        set_error(redis_error_unavailable, "redis db is not open");
+        return (false);
+    }
+
+    if (deadline_passed())
+    {
+        set_error(redis_error_timeout, "operation deadline exceeded");
+        return (false);
+    }
+
+    bool connected = (nullptr != m_redis_context || nullptr != m_redis_cluster_context);
+
+    if (!login())
+    {
+        if (deadline_passed())
+        {
+            set_error(redis_error_timeout, "operation deadline exceeded");
+        }
+        else
+        {
+            /* keep the reason of a rejected AUTH or SELECT */
+            set_error(redis_error_unavailable, (m_error_message.empty() ? std::string("connect to redis failed") : m_error_message));
+        }
+        return (false);
+    }
+
+    if (!connected)
+    {
+        slowlog_recorder.set_reconnected();
+    }
+
+    std::vector<const char *> arg_ptr;
+    std::vector<size_t> arg_len;
+    build_command_argv(args, arg_ptr, arg_len);
+    const char * redis_name = nullptr;
+    bool replied = false;
+    RedisReplyVisitor visitor(return_type, result);
+    if (nullptr != m_redis_context)
+    {
+        redis_name = "server";
+        ++m_redis_stats.commands;
+        apply_command_timeout();
+        RedisTrace trace;
+        bool traced = tracing();
+        if (traced)
+        {
+            trace.command = trace_command_name(args.front());
+            trace.node = m_redis_address;
+            trace.bytes_out = request_size(args);
+            trace.start_time = get_system_time_us();
+            trace_before(trace);
+        }
+        m_redis_context->reader->privdata = &visitor;
+        replied = (nullptr != redisCommandArgv(m_redis_context, static_cast<int>(args.size()), &arg_ptr[0], &arg_len[0]));
+        m_redis_context->reader->privdata = nullptr;
+        if (traced)
+        {
+            trace.replied = replied;
+            trace.duration = get_system_time_us() - trace.start_time;
+            trace_after(trace);
+        }
+    }
+    else
+    {
+        redis_name = "cluster";
+        if (0 != m_operation_deadline)
+        {
+            if (deadline_passed())
+            {
+                /* the login may have used up the time left */
+                set_error(redis_error_timeout, "operation deadline exceeded");
+                return (false);
+            }
+            redisClusterSetDeadline(m_redis_cluster_context, cluster_deadline());
+        }
+        redisReply * redis_reply = reinterpret_cast<redisReply *>(redisClusterCommandArgv(m_redis_cluster_context, static_cast<int>(args.size()), &arg_ptr[0], &arg_len[0]));
+        if (nullptr != redis_reply)
+        {
+            visitor.visit(redis_reply);
+            replied = true;
+        }
+        redisClusterFreeReplies(m_redis_cluster_context);
+    }
+    if (!replied)
+    {
+        RUN_LOG_ERR("redis %s execute command [%s] failure (%s)", redis_name, build_command_text(args).c_str(), (nullptr != m_redis_context ? m_redis_context->errstr : m_redis_cluster_context->errstr));
+        if (nullptr != m_redis_context)
+        {
+            /* hiredis gives a context up after any failure */
+            set_error(redis_error_connection, m_redis_context->errstr);
+            ++m_redis_stats.command_errors;
+            m_redis_lost = true;
+            logoff();
+        }
+        else
+        {
+            /* a broken node connection is reopened by the next command sent to it, the others stay */
+            set_error(cluster_error_kind(m_redis_cluster_context->err), m_redis_cluster_context->errstr);
+        }
+        if (redis_error_connection == m_error_kind && deadline_passed())
+        {
+            /* the socket timeout was cut down to the deadline */
+            m_error_kind = redis_error_timeout;
+        }
+        return (false);
+    }
+
+    bool ret = visitor.ret();
+    bool good = visitor.good();
+
+    if (REDIS_REPLY_ERROR == visitor.type())
+    {
+        set_error(reply_error_kind(visitor.error(), nullptr != m_redis_cluster_context), visitor.error());
+        if (redis_error_cluster == m_error_kind)
+        {
+            /* the next command reloads the slots from the cluster, the other node connections stay */
+            m_redis_cluster_context->need_update_route = 1;
+        }
+    }
+    else if (!good)
+    {
+        set_error(redis_error_reply, "unexpected reply type");
+    }
+
+    if (visitor.matched())
+    {
+        if (ret)
+        {
+            RUN_LOG_DBG("redis execute command [%s] success", build_command_text(args).c_str());
+        }
+        else if (good)
+        {
+            RUN_LOG_TRK("redis execute command [%s] failure (%s)", build_command_text(args).c_str(), (REDIS_REPLY_ERROR == visitor.type() ? visitor.error().c_str() : "unknown"));
+        }
+        else
+        {
+            RUN_LOG_ERR("redis execute command [%s] exception (%s)", build_command_text(args).c_str(), (REDIS_REPLY_ERROR == visitor.type() ? visitor.error().c_str() : "unknown"));
+        }
+    }
+
+    if (redis_error_connection == m_error_kind)
+    {
+        RUN_LOG_DBG("disconnect to redis %s", redis_name);
+        m_redis_lost = true;
+        logoff();
+    }
+
+    return (ret);
+}
+
+void RedisDBImpl::set_error(RedisErrorKind kind, const std::string & message)
+{
+    m_error_kind = kind;
+    m_error_message = message;
+}
+
+RedisErrorKind RedisDBImpl::reply_error_kind(const std::string & error, bool cluster)
+{
+    /* the connection lost its authentication or landed on a replica after a failover, a new one fixes that */
+    if (0 == error.compare(0, 6, "NOAUTH") || 0 == error.compare(0, 8, "READONLY"))
+    {
+        /* a cluster only needs its route refreshed, reopening every node connection would storm it */
+        return (cluster ? redis_error_cluster : redis_error_connection);
+    }
+    return (redis_error_command);
+}
+
+RedisErrorKind RedisDBImpl::cluster_error_kind(int err)
+{
+    switch (err)
+    {
+        case REDIS_ERR_IO:
+        case REDIS_ERR_EOF:
+        case REDIS_ERR_PROTOCOL:
+        {
+            return (redis_error_connection);
+        }
+        case REDIS_ERR_TIMEOUT:
+        {
+            return (redis_error_timeout);
+        }
+        case REDIS_ERR_CLUSTER_TOO_MANY_RETRIES:
+        {
+            return (redis_error_cluster);
+        }
+        default:
+        {
+            return (redis_error_command);
+        }
+    }
+}
+
+RedisErrorKind RedisDBImpl::error_kind() const
+{
+    return (m_error_kind);
+}
+
+const std::string & RedisDBImpl::error_message() const
+{
+    return (m_error_message);
+}
+
+static int64_t get_steady_time_ms()
+{
+    return (static_cast<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+RedisDBImpl::OperationGuard::OperationGuard(RedisDBImpl & redis_db)
+    : m_redis_db(redis_db)
+{
+    if (0 == m_redis_db.m_operation_depth++ && 0 != m_redis_db.m_operation_timeout)
+    {
+        m_redis_db.m_operation_deadline = get_steady_time_ms() + m_redis_db.m_operation_timeout;
+    }
+}
+
+RedisDBImpl::OperationGuard::~OperationGuard()
+{
+    if (0 == --m_redis_db.m_operation_depth && 0 != m_redis_db.m_operation_deadline)
+    {
+        m_redis_db.m_operation_deadline = 0;
+        if (nullptr != m_redis_db.m_redis_cluster_context)
+        {
+            redisClusterSetDeadline(m_redis_db.m_redis_cluster_context, 0);
+        }
+    }
+}
+
+static int64_t get_steady_time_us()
+{
+    return (static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+RedisDBImpl::LatencyRecorder::LatencyRecorder(RedisDBImpl & redis_db, const std::string & command)
+    : m_redis_db(redis_db)
+    , m_type(0)
+    , m_start(0)
+{
+    if (m_redis_db.m_redis_options.latency_stats && std::string::npos == m_redis_db.m_redis_address.find(','))
+    {
+        m_type = redisClusterCommandType(command.c_str(), command.size());
+        m_start = get_steady_time_us();
+    }
+}
+
+RedisDBImpl::LatencyRecorder::~LatencyRecorder()
+{
+    if (0 == m_type)
+    {
+        return;
+    }
+
+    std::vector<hihistogram *> & command_latency = m_redis_db.m_command_latency;
+    if (command_latency.size() <= static_cast<size_t>(m_type))
+    {
+        command_latency.resize(m_type + 1, nullptr);
+    }
+
+    hihistogram *& histogram = command_latency[m_type];
+    if (nullptr == histogram)
+    {
+        histogram = hihistogram_create();
+    }
+
+    if (nullptr != histogram)
+    {
+        hihistogram_record(histogram, static_cast<uint64_t>(get_steady_time_us() - m_start));
+    }
+}
+
+/*
+ * milliseconds left until the deadline of the current call, -1 without one
+ */
+int64_t RedisDBImpl::remaining_time() const
+{
+    if (0 == m_operation_deadline)
+    {
+        return (-1);
+    }
+    int64_t remaining = m_operation_deadline - get_steady_time_ms();
+    return (remaining > 0 ? remaining : 0);
+}
+
+bool RedisDBImpl::deadline_passed() const
+{
+    return (0 == remaining_time());
+}
+
+/*
+ * the time left for redisClusterSetDeadline(), never 0 which means no deadline there
+ */
+int RedisDBImpl::cluster_deadline() const
+{
+    int64_t remaining = remaining_time();
+    if (remaining < 1)
+    {
+        remaining = 1;
+    }
+    return (remaining < INT_MAX ? static_cast<int>(remaining) : INT_MAX);
+}
+
+/*
+ * cuts a timeout ({0, 0} for none) down to the time left, never to {0, 0}
+ * which would block forever
+ */
+struct timeval RedisDBImpl::limit_timeout(const struct timeval & timeout) const
+{
+    int64_t remaining = remaining_time();
+    if (remaining < 0)
+    {
+        return (timeout);
+    }
+
+    if (remaining < 1)
+    {
+        remaining = 1;
+    }
+
+    int64_t timeout_ms = static_cast<int64_t>(timeout.tv_sec) * 1000 + timeout.tv_usec / 1000;
+    if (0 != timeout_ms && timeout_ms <= remaining)
+    {
+        return (timeout);
+    }
+
+    struct timeval limited;
+    limited.tv_sec = static_cast<long>(remaining / 1000);
+    limited.tv_usec = static_cast<long>(remaining % 1000 * 1000);
+    return (limited);
+}
+
+/*
+ * the socket is only touched when the timeout changes, which is on every
+ * command while calls have deadlines
+ */
+void RedisDBImpl::apply_command_timeout()
+{
+    struct timeval timeout = limit_timeout(m_redis_command_timeout);
+    const struct timeval * current = m_redis_context->command_timeout;
+    if (nullptr == current ? (0 == timeout.tv_sec && 0 == timeout.tv_usec) : (current->tv_sec == timeout.tv_sec && current->tv_usec == timeout.tv_usec))
+    {
+        return;
+    }
+    redisSetTimeout(m_redis_context, timeout);
+}
+
+static void fill_latency(const char * name, const hihistogram * histogram, RedisLatency & latency)
+{
+    latency.name = name;
+    latency.count = histogram->count;
+    latency.p50 = hihistogram_percentile(histogram, 50.0);
+    latency.p99 = hihistogram_percentile(histogram, 99.0);
+    latency.p999 = hihistogram_percentile(histogram, 99.9);
+    latency.max = histogram->max;
+}
+
+static void collect_command_latency(const char * name, const hihistogram * histogram, void * privdata)
+{
+    RedisStats * stats = reinterpret_cast<RedisStats *>(privdata);
+    stats->commands.push_back(RedisLatency());
+    fill_latency(name, histogram, stats->commands.back());
+}
+
+RedisDBImpl::AllocRecorder::AllocRecorder(RedisDBImpl & redis_db, const std::string & command)
+    : m_redis_db(redis_db)
+    , m_type(0)
+    , m_start()
+{
+    if (m_redis_db.m_redis_options.alloc_stats)
+    {
+        m_type = redisClusterCommandType(command.c_str(), command.size());
+        hialloc_thread_counters(&m_start);
+    }
+}
+
+RedisDBImpl::AllocRecorder::~AllocRecorder()
+{
+    if (0 == m_type)
+    {
+        return;
+    }
+
+    hialloc_counters allocs = { 0, 0, 0 };
+    hialloc_add_since(&allocs, &m_start);
+
+    std::vector<hialloc_counters> & command_allocs = m_redis_db.m_command_allocs;
+    if (command_allocs.size() <= static_cast<size_t>(m_type))
+    {
+        const hialloc_counters none = { 0, 0, 0 };
+        command_allocs.resize(m_type + 1, none);
+    }
+
+    hialloc_counters & counters = command_allocs[m_type];
+    counters.calls += allocs.calls;
+    counters.allocs += allocs.allocs;
+    counters.bytes += allocs.bytes;
+}
+
+RedisDBImpl::SlowlogRecorder::SlowlogRecorder(RedisDBImpl & redis_db, const std::list<std::string> & args)
+    : m_redis_db(redis_db)
+    , m_args(args)
+    , m_start(0)
+    , m_reconnected(false)
+{
+    if (nullptr != m_redis_db.m_slowlog && std::string::npos == m_redis_db.m_redis_address.find(','))
+    {
+        m_start = get_steady_time_us();
+    }
+}
+
+RedisDBImpl::SlowlogRecorder::~SlowlogRecorder()
+{
+    if (0 == m_start)
+    {
+        return;
+    }
+
+    int64_t duration = get_steady_time_us() - m_start;
+    if (duration < static_cast<int64_t>(m_redis_db.m_redis_options.slowlog_threshold))
+    {
+        return;
+    }
+
+    std::string command;
+    for (std::list<std::string>::const_iterator iter = m_args.begin(); m_args.end() != iter && command.size() < HISLOWLOG_COMMAND_LEN; ++iter)
+    {
+        if (!command.empty())
+        {
+            command += ' ';
+        }
+        command += *iter;
+    }
+    if (command.size() >= HISLOWLOG_COMMAND_LEN)
+    {
+        command = command.substr(0, HISLOWLOG_COMMAND_LEN - 4) + "...";
+    }
+
+    hislowlog_entry entry;
+    entry.time = hislowlog_time_now() - duration;
+    entry.duration = duration;
+    entry.slot = -1;
+    entry.retries = 0;
+    entry.reconnected = (m_reconnected ? 1 : 0);
+    strncpy(entry.command, command.c_str(), sizeof(entry.command) - 1);
+    entry.command[sizeof(entry.command) - 1] = '\0';
+    strncpy(entry.node, m_redis_db.m_redis_address.c_str(), sizeof(entry.node) - 1);
+    entry.node[sizeof(entry.node) - 1] = '\0';
+
+    hislowlog_push(m_redis_db.m_slowlog, &entry);
+}
+
+void RedisDBImpl::SlowlogRecorder::set_reconnected()
+{
+    m_reconnected = true;
+}
+
+static void collect_node_latency(const char * name, const hihistogram * histogram, void * privdata)
+{
+    RedisStats * stats = reinterpret_cast<RedisStats *>(privdata);
+    stats->nodes.push_back(RedisLatency());
+    fill_latency(name, histogram, stats->nodes.back());
+}
+
+bool RedisDBImpl::stats(RedisStats & stats)
+{
+    stats = RedisStats();
+
+    if (!m_running)
+    {
+        return (false);
+    }
+
+    redisClusterStats counters = m_redis_stats;
+    if (nullptr != m_redis_cluster_context)
+    {
+        redisClusterStats cluster_stats;
+        redisClusterGetStats(m_redis_cluster_context, &cluster_stats);
+        add_cluster_stats(counters, cluster_stats);
+        counters.in_flight = cluster_stats.in_flight;
+    }
+
+    stats.connects = counters.connects;
+    stats.reconnects = counters.reconnects;
+    stats.connect_failures = counters.connect_failures;
+    stats.command_count = counters.commands;
+    stats.command_errors = counters.command_errors;
+    stats.moved = counters.moved;
+    stats.ask = counters.ask;
+    stats.retries = counters.tryagain + counters.clusterdown;
+    stats.slotmap_updates = counters.slotmap_updates;
+    stats.bytes_out = counters.bytes_out;
+    stats.bytes_in = counters.bytes_in;
+    stats.in_flight = counters.in_flight;
+
+    for (size_t type = 0; type < m_command_allocs.size(); ++type)
+    {
+        char name[128] = { 0x0 };
+        const hialloc_counters & allocs = m_command_allocs[type];
+        if (0 != allocs.calls && nullptr != redisClusterCommandName(static_cast<int>(type), name, sizeof(name)))
+        {
+            stats.allocations.push_back(RedisAllocations());
+            RedisAllocations & allocations = stats.allocations.back();
+            allocations.name = name;
+            allocations.count = allocs.calls;
+            allocations.allocs = allocs.allocs;
+            allocations.bytes = allocs.bytes;
+        }
+    }
+
+    if (!m_redis_options.latency_stats)
+    {
+        return (true);
+    }
+
+    for (size_t type = 0; type < m_command_latency.size(); ++type)
+    {
+        char name[128] = { 0x0 };
+        const hihistogram * histogram = m_command_latency[type];
+        if (nullptr != histogram && 0 != histogram->count && nullptr != redisClusterCommandName(static_cast<int>(type), name, sizeof(name)))
+        {
+            collect_command_latency(name, histogram, &stats);
+        }
+    }
+
+    if (nullptr != m_redis_cluster_context)
+    {
+        redisClusterLatencyForEach(m_redis_cluster_context, &collect_command_latency, &collect_node_latency, &stats);
+    }
+
+    return (true);
+}
+
+void RedisDBImpl::reset_stats()
+{
+    m_command_allocs.clear();
+
+    for (std::vector<hihistogram *>::iterator iter = m_command_latency.begin(); m_command_latency.end() != iter; ++iter)
+    {
+        if (nullptr != *iter)
+        {
+            hihistogram_reset(*iter);
+        }
+    }
+
+    if (nullptr != m_redis_cluster_context)
+    {
+        redisClusterLatencyReset(m_redis_cluster_context);
+    }
+}
+
+static void fill_slow_command(const hislowlog_entry & entry, RedisSlowCommand & slow_command)
+{
+    slow_command.command = entry.command;
+    slow_command.slot = entry.slot;
+    slow_command.node = entry.node;
+    slow_command.retries = static_cast<uint32_t>(entry.retries);
+    slow_command.reconnected = (0 != entry.reconnected);
+    slow_command.start_time = entry.time;
+    slow_command.duration = entry.duration;
+}
+
+bool RedisDBImpl::drain_slowlog(std::list<RedisSlowCommand> & commands)
+{
+    commands.clear();
+
+    if (!m_running || nullptr == m_slowlog)
+    {
+        return (false);
+    }
+
+    hislowlog_entry entry;
+    while (0 != hislowlog_pop(m_slowlog, &entry))
+    {
+        commands.push_back(RedisSlowCommand());
+        fill_slow_command(entry, commands.back());
+    }
+
+    while (nullptr != m_redis_cluster_context && 0 != redisClusterSlowlogPop(m_redis_cluster_context, &entry))
+    {
+        commands.push_back(RedisSlowCommand());
+        fill_slow_command(entry, commands.back());
+    }
+
+    return (true);
+}
+
+bool RedisDBImpl::tracing() const
+{
+    return (nullptr != m_trace_before || nullptr != m_trace_after || nullptr != m_trace_file);
+}
+
+void RedisDBImpl::set_trace_hooks(RedisTraceHook before, RedisTraceHook after, void * context)
+{
+    m_trace_before = before;
+    m_trace_after = after;
+    m_trace_context = context;
+    apply_trace_callback();
+}
+
+void RedisDBImpl::apply_trace_callback()
+{
+    if (nullptr != m_redis_cluster_context)
+    {
+        redisClusterSetTraceCallback(m_redis_cluster_context, (tracing() ? &RedisDBImpl::cluster_trace : nullptr), this);
+    }
+}
+
+void RedisDBImpl::trace_before(const RedisTrace & trace)
+{
+    if (nullptr != m_trace_before)
+    {
+        m_trace_before(trace, m_trace_context);
     }
 }
 
-bool RedisDBImpl::login()
+void RedisDBImpl::trace_after(const RedisTrace & trace)
 {
-    if (nullptr != m_redis_context || nullptr != m_redis_cluster_context)
+    if (nullptr != m_trace_after)
     {
-        return (true);
+        m_trace_after(trace, m_trace_context);
     }
 
-    if (std::string::npos == m_redis_address.find(','))
+    if (nullptr != m_trace_file)
     {
-        std::string redis_host;
-        uint16_t redis_port = 6379;
-        std::string::size_type pos = m_redis_address.find(':');
-        if (std::string::npos == pos)
-        {
-            redis_host = m_redis_address;
-        }
-        else
+        write_trace(trace);
+    }
+}
+
+static std::string json_string(const std::string & str)
+{
+    std::string json("\"");
+    for (std::string::const_iterator iter = str.begin(); str.end() != iter; ++iter)
+    {
+        unsigned char c = static_cast<unsigned char>(*iter);
+        if ('"' == c || '\\' == c)
         {
-            redis_host = m_redis_address.substr(0, pos);
-            string_to_type(m_redis_address.substr(pos + 1), redis_port);
+            json += '\\';
+            json += static_cast<char>(c);
         }
-
-        m_redis_context = redisConnectWithTimeout(redis_host.c_str(), redis_port, m_redis_timeout);
-        if (nullptr != m_redis_context && 0 == m_redis_context->err)
+        else if (c < 0x20)
         {
-            RUN_LOG_DBG("connect redis server [%s] success", m_redis_address.c_str());
-            if (authenticate() && select_table())
-            {
-                return (true);
-            }
+            char escaped[8] = { 0x0 };
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            json += escaped;
         }
         else
         {
-            RUN_LOG_ERR("connect redis server [%s] failure (%s)", m_redis_address.c_str(), (nullptr != m_redis_context ? m_redis_context->errstr : "unknown"));
+            json += static_cast<char>(c);
         }
     }
-    else
-    {
-        do
-        {
-            m_redis_cluster_context = redisClusterContextInit();
-            if (nullptr == m_redis_cluster_context)
-            {
-                RUN_LOG_ERR("init redis cluster failure");
-                break;
-            }
-
-            int result = redisClusterSetOptionAddNodes(m_redis_cluster_context, m_redis_address.c_str());
-            if (REDIS_OK != result)
-            {
-                RUN_LOG_ERR("set redis cluster nodes [%s] failure (%s)", m_redis_address.c_str(), m_redis_cluster_context->errstr);
-                break;
-            }
-
-            if (!m_redis_username.empty())
-            {
-                result = redisClusterSetOptionUsername(m_redis_cluster_context, m_redis_username.c_str());
-                if (REDIS_OK != result)
-                {
-                    RUN_LOG_ERR("set redis cluster username [%s] failure (%s)", m_redis_username.c_str(), m_redis_cluster_context->errstr);
-                    break;
-                }
-            }
-
-            if (!m_redis_password.empty())
-            {
-                result = redisClusterSetOptionPassword(m_redis_cluster_context, m_redis_password.c_str());
-                if (REDIS_OK != result)
-                {
-                    RUN_LOG_ERR("set redis cluster password [%s] failure (%s)", m_redis_password.c_str(), m_redis_cluster_context->errstr);
-                    break;
-                }
-            }
-
-            result = redisClusterSetOptionConnectTimeout(m_redis_cluster_context, m_redis_timeout);
-            if (REDIS_OK != result)
-            {
-                RUN_LOG_ERR("set redis cluster timeout failure (%s)", m_redis_cluster_context->errstr);
-                break;
-            }
-
-            result = redisClusterSetOptionRouteUseSlots(m_redis_cluster_context);
-            if (REDIS_OK != result)
-            {
-                RUN_LOG_ERR("set redis cluster slots failure (%s)", m_redis_cluster_context->errstr);
-                break;
-            }
-
-            result = redisClusterConnect2(m_redis_cluster_context);
-            if (REDIS_OK != result)
-            {
-                RUN_LOG_ERR("connect redis cluster [%s] failure (%s)", m_redis_address.c_str(), m_redis_cluster_context->errstr);
-                break;
-            }
-
-            RUN_LOG_DBG("connect redis cluster [%s] success", m_redis_address.c_str());
-
-            return (true);
-        } while (false);
-    }
+    json += '"';
+    return (json);
+}
 
-    logoff();
+static uint32_t get_process_id()
+{
+#ifdef _MSC_VER
+    return (static_cast<uint32_t>(_getpid()));
+#else
+    return (static_cast<uint32_t>(getpid()));
+#endif // _MSC_VER
+}
 
-    return (false);
+static uint32_t get_thread_id()
+{
+    return (static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())));
 }
 
-void RedisDBImpl::logoff()
+/*
+ * one complete event ("ph":"X") of the chrome trace event format per command,
+ * the closing bracket is written by close() and may be missing after a crash,
+ * which the trace viewers accept
+ */
+void RedisDBImpl::write_trace(const RedisTrace & trace)
 {
-    if (nullptr != m_redis_context)
+    std::ostringstream oss;
+    oss << (0 == m_trace_events ? "" : ",\n");
+    oss << "{\"name\":" << json_string(trace.command) << ",\"cat\":\"libredis\",\"ph\":\"X\"";
+    oss << ",\"ts\":" << trace.start_time << ",\"dur\":" << trace.duration;
+    oss << ",\"pid\":" << get_process_id() << ",\"tid\":" << get_thread_id();
+    oss << ",\"args\":{\"slot\":" << trace.slot << ",\"node\":" << json_string(trace.node);
+    oss << ",\"redirects\":[";
+    for (std::list<std::string>::const_iterator iter = trace.redirects.begin(); trace.redirects.end() != iter; ++iter)
     {
-        redisFree(m_redis_context);
-        m_redis_context = nullptr;
+        oss << (trace.redirects.begin() == iter ? "" : ",") << json_string(*iter);
     }
+    oss << "],\"retries\":" << trace.retries;
+    oss << ",\"pipelined\":" << (trace.pipelined ? "true" : "false") << ",\"replied\":" << (trace.replied ? "true" : "false");
+    oss << ",\"bytes_out\":" << trace.bytes_out << ",\"bytes_in\":" << trace.bytes_in << "}}";
 
-    if (nullptr != m_redis_cluster_context)
-    {
-        redisClusterFree(m_redis_cluster_context);
-        m_redis_cluster_context = nullptr;
-    }
+    const std::string event = oss.str();
+    fwrite(event.data(), 1, event.size(), m_trace_file);
+    ++m_trace_events;
 }
 
-bool RedisDBImpl::execute_command(const std::list<std::string> & args, int return_type, void * result)
+void RedisDBImpl::cluster_trace(const redisClusterTrace * cluster_span, int phase, void * privdata)
 {
-    if (!m_running || args.empty() || !login())
+    RedisDBImpl * redis_db = reinterpret_cast<RedisDBImpl *>(privdata);
+
+    char name[128] = { 0x0 };
+    RedisTrace trace;
+    trace.command = (nullptr != redisClusterCommandName(cluster_span->type, name, sizeof(name)) && '\0' != name[0] ? name : "UNKNOWN");
+    trace.slot = cluster_span->slot;
+    trace.pipelined = (0 != cluster_span->pipelined);
+    trace.bytes_out = cluster_span->bytes_out;
+
+    if (HIRCLUSTER_TRACE_BEGIN == phase)
     {
-        return (false);
+        trace.start_time = get_system_time_us();
+        redis_db->trace_before(trace);
+        return;
     }
 
-    std::string command;
-    std::vector<const char *> arg_ptr;
-    std::vector<size_t> arg_len;
-    for (std::list<std::string>::const_iterator iter = args.begin(); args.end() != iter; ++iter)
+    /* the cluster clock is not the system clock, the span is anchored at its end */
+    trace.duration = cluster_span->duration_us;
+    trace.start_time = get_system_time_us() - trace.duration;
+    trace.replied = (REDIS_OK == cluster_span->status);
+    trace.bytes_in = cluster_span->bytes_in;
+    trace.retries = static_cast<uint32_t>(cluster_span->retries);
+    for (int hop = 0; hop < cluster_span->nhops; ++hop)
     {
-        const std::string & arg = *iter;
-        if (command.empty())
+        if (hop + 1 < cluster_span->nhops)
         {
-            command = arg;
+            trace.redirects.push_back(cluster_span->hops[hop]);
         }
         else
         {
-            command += " \"" + arg + "\"";
+            trace.node = cluster_span->hops[hop];
         }
-        arg_ptr.push_back(arg.c_str());
-        arg_len.push_back(arg.size());
     }
-    const char * redis_name = nullptr;
-    redisReply * redis_reply = nullptr;
-    if (nullptr != m_redis_context)
+    redis_db->trace_after(trace);
+}
+
+/*
+ * auth, client setname and select are pipelined so that a new connection
+ * is ready after a single round trip, select 0 is left out
+ */
+bool RedisDBImpl::handshake()
+{
+    std::list<std::list<std::string>> commands;
+
+    if (!m_redis_password.empty())
     {
-        redis_name = "server";
-        redis_reply = reinterpret_cast<redisReply *>(redisCommandArgv(m_redis_context, static_cast<int>(args.size()), &arg_ptr[0], &arg_len[0]));
+        std::list<std::string> args;
+        args.push_back("auth");
+        if (!m_redis_username.empty())
+        {
+            args.push_back(m_redis_username);
+        }
+        args.push_back(m_redis_password);
+        commands.push_back(args);
     }
-    else
+
+    if (!m_redis_options.client_name.empty())
     {
-        redis_name = "cluster";
-        redis_reply = reinterpret_cast<redisReply *>(redisClusterCommandArgv(m_redis_cluster_context, static_cast<int>(args.size()), &arg_ptr[0], &arg_len[0]));
+        std::list<std::string> args;
+        args.push_back("client");
+        args.push_back("setname");
+        args.push_back(m_redis_options.client_name);
+        commands.push_back(args);
     }
-    if (nullptr == redis_reply)
+
+    if ("0" != m_redis_table)
     {
-        RUN_LOG_ERR("redis %s execute command [%s] failure", redis_name, command.c_str());
-        logoff();
-        return (false);
+        std::list<std::string> args;
+        args.push_back("select");
+        args.push_back(m_redis_table);
+        commands.push_back(args);
     }
 
-    bool ret = false;
-    bool good = true;
-
-    if (return_type == redis_reply->type)
+    for (std::list<std::list<std::string>>::const_iterator iter = commands.begin(); commands.end() != iter; ++iter)
     {
-        switch (return_type)
+        std::vector<const char *> arg_ptr;
+        std::vector<size_t> arg_len;
+        for (std::list<std::string>::const_iterator arg_iter = iter->begin(); iter->end() != arg_iter; ++arg_iter)
         {
-            case REDIS_REPLY_STRING:
-            {
-                std::string & value = *reinterpret_cast<std::string *>(result);
-                value = redis_reply->str;
-                ret = true;
-                break;
-            }
-            case REDIS_REPLY_ARRAY:
-            {
-                std::list<std::string> & values = *reinterpret_cast<std::list<std::string> *>(result);
-                for (size_t index = 0; index < redis_reply->elements; ++index)
-                {
-                    values.push_back(redis_reply->element[index]->str);
-                }
-                ret = true;
-                break;
-            }
-            case REDIS_REPLY_INTEGER:
-            {
-                ret = (redis_reply->integer > 0);
-                break;
-            }
-            case REDIS_REPLY_NIL:
-            {
-                break;
-            }
-            case REDIS_REPLY_STATUS:
-            {
-                ret = (0 == strcmp_ignore_case(redis_reply->str, "ok"));
-                break;
-            }
-            case REDIS_REPLY_ERROR:
-            {
-                good = false;
-                break;
-            }
-            default:
-            {
-                good = false;
-                break;
-            }
+            arg_ptr.push_back(arg_iter->c_str());
+            arg_len.push_back(arg_iter->size());
         }
-
-        if (ret)
+        if (REDIS_OK != redisAppendCommandArgv(m_redis_context, static_cast<int>(arg_ptr.size()), &arg_ptr[0], &arg_len[0]))
         {
-            RUN_LOG_DBG("redis execute command [%s] success", command.c_str());
+            RUN_LOG_ERR("redis server append command [%s] failure (%s)", iter->front().c_str(), m_redis_context->errstr);
+            set_error(redis_error_connection, m_redis_context->errstr);
+            return (false);
         }
-        else if (good)
+    }
+
+    for (std::list<std::list<std::string>>::const_iterator iter = commands.begin(); commands.end() != iter; ++iter)
+    {
+        void * reply = nullptr;
+        RedisReplyVisitor visitor(REDIS_REPLY_STATUS, nullptr);
+        m_redis_context->reader->privdata = &visitor;
+        int result = redisGetReply(m_redis_context, &reply);
+        m_redis_context->reader->privdata = nullptr;
+        if (REDIS_OK != result)
         {
-            RUN_LOG_TRK("redis execute command [%s] failure (%s)", command.c_str(), (REDIS_REPLY_ERROR == redis_reply->type ? redis_reply->str : "unknown"));
+            RUN_LOG_ERR("redis server execute command [%s] failure (%s)", iter->front().c_str(), m_redis_context->errstr);
+            set_error(redis_error_connection, m_redis_context->errstr);
+            return (false);
         }
-        else
+        if (!visitor.ret())
         {
-            RUN_LOG_ERR("redis execute command [%s] exception (%s)", command.c_str(), (REDIS_REPLY_ERROR == redis_reply->type ? redis_reply->str : "unknown"));
+            RUN_LOG_ERR("redis server execute command [%s] failure (%s)", iter->front().c_str(), (REDIS_REPLY_ERROR == visitor.type() ? visitor.error().c_str() : "unknown"));
+            set_error(reply_error_kind(visitor.error(), false), (REDIS_REPLY_ERROR == visitor.type() ? visitor.error() : std::string("unexpected reply type")));
+            return (false);
         }
     }
 
-    freeReplyObject(redis_reply);
-
-    if (!good)
-    {
-        RUN_LOG_DBG("disconnect to redis %s", redis_name);
-        logoff();
-    }
-
-    return (ret);
+    return (true);
 }
 
-bool RedisDBImpl::authenticate()
+bool RedisDBImpl::destroy()
 {
-    if (m_redis_password.empty())
-    {
-        return (true);
-    }
     std::list<std::string> args;
-    args.push_back("auth");
-    args.push_back(m_redis_password);
+    args.push_back("flushdb");
     return (execute_command(args, REDIS_REPLY_STATUS, nullptr));
 }
 
-bool RedisDBImpl::select_table()
+bool RedisDBImpl::warm_up(std::list<std::string> & failed_nodes)
 {
-    std::list<std::string> args;
-    args.push_back("select");
-    args.push_back(m_redis_table);
-    return (execute_command(args, REDIS_REPLY_STATUS, nullptr));
+    failed_nodes.clear();
+
+    if (!m_running || !login())
+    {
+        return (false);
+    }
+
+    return (connect_nodes(failed_nodes));
 }
 
-bool RedisDBImpl::destroy()
+void RedisDBImpl::set_operation_timeout(uint32_t timeout)
 {
-    std::list<std::string> args;
-    args.push_back("flushdb");
-    return (execute_command(args, REDIS_REPLY_STATUS, nullptr));
+    m_operation_timeout = timeout;
 }
 
 bool RedisDBImpl::set(const std::string & key, const std::string & value)
@@ -591,6 +2112,7 @@ bool RedisDBImpl::erase(const std::string & key)
 
 bool RedisDBImpl::erase(const std::list<std::string> & keys)
 {
+    OperationGuard operation_guard(*this);
     bool ret = true;
     for (std::list<std::string>::const_iterator iter = keys.begin(); keys.end() != iter; ++iter)
     {
@@ -612,6 +2134,7 @@ bool RedisDBImpl::persist(const std::string & key)
 
 bool RedisDBImpl::persist(const std::list<std::string> & keys)
 {
+    OperationGuard operation_guard(*this);
     bool ret = true;
     for (std::list<std::string>::const_iterator iter = keys.begin(); keys.end() != iter; ++iter)
     {
@@ -634,6 +2157,7 @@ bool RedisDBImpl::expire(const std::string & key, const std::string & seconds)
 
 bool RedisDBImpl::expire(const std::list<std::string> & keys, const std::string & seconds)
 {
+    OperationGuard operation_guard(*this);
     bool ret = true;
     for (std::list<std::string>::const_iterator iter = keys.begin(); keys.end() != iter; ++iter)
     {
@@ -667,6 +2191,94 @@ bool RedisDBImpl::clear(const std::string & queue)
     return (erase(queue));
 }
 
+RedisOptions::RedisOptions()
+    : table(0)
+    , timeout(5000)
+    , command_timeout(0)
+    , operation_timeout(0)
+    , slotmap_refresh(false)
+    , slotmap_refresh_interval(0)
+    , slotmap_file()
+    , warm_up(false)
+    , slotmap_group()
+    , client_name()
+    , latency_stats(false)
+    , trace_file()
+    , slowlog_threshold(0)
+    , slowlog_size(128)
+    , alloc_stats(false)
+{
+
+}
+
+RedisLatency::RedisLatency()
+    : name()
+    , count(0)
+    , p50(0)
+    , p99(0)
+    , p999(0)
+    , max(0)
+{
+
+}
+
+RedisAllocations::RedisAllocations()
+    : name()
+    , count(0)
+    , allocs(0)
+    , bytes(0)
+{
+
+}
+
+RedisTrace::RedisTrace()
+    : command()
+    , slot(-1)
+    , node()
+    , redirects()
+    , retries(0)
+    , pipelined(false)
+    , replied(false)
+    , bytes_out(0)
+    , bytes_in(0)
+    , start_time(0)
+    , duration(0)
+{
+
+}
+
+RedisSlowCommand::RedisSlowCommand()
+    : command()
+    , slot(-1)
+    , node()
+    , retries(0)
+    , reconnected(false)
+    , start_time(0)
+    , duration(0)
+{
+
+}
+
+RedisStats::RedisStats()
+    : connects(0)
+    , reconnects(0)
+    , connect_failures(0)
+    , command_count(0)
+    , command_errors(0)
+    , moved(0)
+    , ask(0)
+    , retries(0)
+    , slotmap_updates(0)
+    , bytes_out(0)
+    , bytes_in(0)
+    , in_flight(0)
+    , commands()
+    , nodes()
+    , allocations()
+{
+
+}
+
 RedisDB::RedisDB() : m_redis_db_impl(nullptr)
 {
 
@@ -679,13 +2291,18 @@ RedisDB::~RedisDB()
 
 bool RedisDB::open(const std::string & address, const std::string & username, const std::string & password, uint16_t table, uint32_t timeout)
 {
-    close();
+    RedisOptions options;
+    options.table = table;
+    options.timeout = timeout;
+    return (open(address, username, password, options));
+}
 
-    std::string str_table("0");
-    type_to_string(table, str_table);
+bool RedisDB::open(const std::string & address, const std::string & username, const std::string & password, const RedisOptions & options)
+{
+    close();
 
     m_redis_db_impl = new RedisDBImpl;
-    if (nullptr != m_redis_db_impl && m_redis_db_impl->open(address, username, password, str_table, timeout))
+    if (nullptr != m_redis_db_impl && m_redis_db_impl->open(address, username, password, options))
     {
         return (true);
     }
@@ -710,6 +2327,58 @@ bool RedisDB::destroy()
     return (nullptr != m_redis_db_impl && m_redis_db_impl->destroy());
 }
 
+RedisErrorKind RedisDB::error_kind() const
+{
+    return (nullptr != m_redis_db_impl ? m_redis_db_impl->error_kind() : redis_error_unavailable);
+}
+
+std::string RedisDB::error_message() const
+{
+    return (nullptr != m_redis_db_impl ? m_redis_db_impl->error_message() : std::string("redis db is not open"));
+}
+
+bool RedisDB::stats(RedisStats & stats)
+{
+    stats = RedisStats();
+    return (nullptr != m_redis_db_impl && m_redis_db_impl->stats(stats));
+}
+
+bool RedisDB::drain_slowlog(std::list<RedisSlowCommand> & commands)
+{
+    commands.clear();
+    return (nullptr != m_redis_db_impl && m_redis_db_impl->drain_slowlog(commands));
+}
+
+void RedisDB::reset_stats()
+{
+    if (nullptr != m_redis_db_impl)
+    {
+        m_redis_db_impl->reset_stats();
+    }
+}
+
+bool RedisDB::warm_up(std::list<std::string> & failed_nodes)
+{
+    failed_nodes.clear();
+    return (nullptr != m_redis_db_impl && m_redis_db_impl->warm_up(failed_nodes));
+}
+
+void RedisDB::set_operation_timeout(uint32_t timeout)
+{
+    if (nullptr != m_redis_db_impl)
+    {
+        m_redis_db_impl->set_operation_timeout(timeout);
+    }
+}
+
+void RedisDB::set_trace_hooks(RedisTraceHook before, RedisTraceHook after, void * context)
+{
+    if (nullptr != m_redis_db_impl)
+    {
+        m_redis_db_impl->set_trace_hooks(before, after, context);
+    }
+}
+
 bool RedisDB::find(const std::string & key)
 {
     return (nullptr != m_redis_db_impl && m_redis_db_impl->find(key));
@@ -0,0 +1,135 @@
+/********************************************************
+ * Description : value conversions and argument building of redis db
+ * Author      : baoc, yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef REDIS_UTILITY_H
+#define REDIS_UTILITY_H
+
+
+#include <cstddef>
+#include <string>
+#include <list>
+#include <vector>
+#include <sstream>
+
+template <typename T>
+bool string_to_type(const std::string & str, T & val)
+{
+    std::istringstream iss(str);
+    iss.setf(std::ios::boolalpha);
+    iss >> val;
+    return (!iss.fail());
+}
+
+template <typename T>
+bool string_to_type(const std::string & str, T * val);
+
+template <typename T>
+bool type_to_string(T val, std::string & str)
+{
+    std::ostringstream oss;
+    oss.setf(std::ios::fixed, std::ios::floatfield);
+    oss.setf(std::ios::boolalpha);
+    oss << val;
+    str = oss.str();
+    return (true);
+}
+
+template <typename T>
+bool type_to_string(T * val, std::string & str);
+
+template <>
+inline bool type_to_string(const char * val, std::string & str)
+{
+    if (nullptr == val)
+    {
+        return (false);
+    }
+    else
+    {
+        str = val;
+        return (true);
+    }
+}
+
+template <typename T>
+bool string_to_type(const std::list<std::string> & str_list, std::list<T> & val_list)
+{
+    bool ret = true;
+    for (std::list<std::string>::const_iterator iter = str_list.begin(); str_list.end() != iter; ++iter)
+    {
+        T val;
+        if (string_to_type(*iter, val))
+        {
+            val_list.push_back(val);
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+    return (ret);
+}
+
+template <typename T>
+bool type_to_string(const std::list<T> & val_list, std::list<std::string> & str_list)
+{
+    bool ret = true;
+    for (typename std::list<T>::const_iterator iter = val_list.begin(); val_list.end() != iter; ++iter)
+    {
+        std::string str;
+        if (type_to_string(*iter, str))
+        {
+            str_list.push_back(str);
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+    return (ret);
+}
+
+/*
+ * the argv and argvlen arrays of hiredis, pointing into args
+ */
+inline void build_command_argv(const std::list<std::string> & args, std::vector<const char *> & arg_ptr, std::vector<size_t> & arg_len)
+{
+    arg_ptr.clear();
+    arg_len.clear();
+    arg_ptr.reserve(args.size());
+    arg_len.reserve(args.size());
+    for (std::list<std::string>::const_iterator iter = args.begin(); args.end() != iter; ++iter)
+    {
+        arg_ptr.push_back(iter->c_str());
+        arg_len.push_back(iter->size());
+    }
+}
+
+/*
+ * the command as it is logged, arguments after the first one quoted
+ */
+inline std::string build_command_text(const std::list<std::string> & args)
+{
+    std::string command;
+    for (std::list<std::string>::const_iterator iter = args.begin(); args.end() != iter; ++iter)
+    {
+        if (args.begin() == iter)
+        {
+            command = *iter;
+        }
+        else
+        {
+            command += " \"" + *iter + "\"";
+        }
+    }
+    return (command);
+}
+
+
+#endif // REDIS_UTILITY_H
@@ -0,0 +1,1071 @@
+/********************************************************
+ * Description : mock redis cluster speaking resp on local ports
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include "mock_cluster.h"
+
+struct MockConnection
+{
+    int                                 fd;
+    uint32_t                            node;
+    bool                                asking;
+    uint64_t                            last_due;
+    std::string                         input;
+    std::list<std::pair<uint64_t, std::string>> replies;            /* due time, reply */
+    std::string                         output;
+};
+
+static uint64_t get_time_us()
+{
+    return (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+static bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return (flags >= 0 && 0 == fcntl(fd, F_SETFL, flags | O_NONBLOCK));
+}
+
+static void reply_status(std::string & reply, const char * status)
+{
+    reply = std::string("+") + status + "\r\n";
+}
+
+static void reply_error(std::string & reply, const std::string & error)
+{
+    reply = "-" + error + "\r\n";
+}
+
+static void reply_integer(std::string & reply, int64_t value)
+{
+    reply = ":" + std::to_string(value) + "\r\n";
+}
+
+static void reply_bulk(std::string & reply, const std::string & value)
+{
+    reply = "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+}
+
+static void append_bulk(std::string & reply, const std::string & value)
+{
+    reply += "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+}
+
+static std::string upper_case(const std::string & str)
+{
+    std::string result(str);
+    for (std::string::iterator iter = result.begin(); result.end() != iter; ++iter)
+    {
+        if (*iter >= 'a' && *iter <= 'z')
+        {
+            *iter = static_cast<char>(*iter - 'a' + 'A');
+        }
+    }
+    return (result);
+}
+
+/*
+ * takes one multibulk request off the input,
+ * returns 0 when incomplete, -1 on a protocol error
+ */
+static int parse_request(std::string & input, std::vector<std::string> & args)
+{
+    args.clear();
+    if (input.empty())
+    {
+        return (0);
+    }
+    if ('*' != input[0])
+    {
+        return (-1);
+    }
+
+    std::string::size_type pos = input.find("\r\n");
+    if (std::string::npos == pos)
+    {
+        return (0);
+    }
+    long count = strtol(input.c_str() + 1, nullptr, 10);
+    if (count <= 0 || count > 1024 * 1024)
+    {
+        return (-1);
+    }
+    pos += 2;
+
+    for (long index = 0; index < count; ++index)
+    {
+        if (pos >= input.size())
+        {
+            return (0);
+        }
+        if ('$' != input[pos])
+        {
+            return (-1);
+        }
+        std::string::size_type end = input.find("\r\n", pos);
+        if (std::string::npos == end)
+        {
+            return (0);
+        }
+        long len = strtol(input.c_str() + pos + 1, nullptr, 10);
+        if (len < 0 || len > 512 * 1024 * 1024)
+        {
+            return (-1);
+        }
+        pos = end + 2;
+        if (input.size() < pos + static_cast<size_t>(len) + 2)
+        {
+            return (0);
+        }
+        args.push_back(input.substr(pos, static_cast<size_t>(len)));
+        pos += static_cast<size_t>(len) + 2;
+    }
+
+    input.erase(0, pos);
+    return (1);
+}
+
+MockCluster::MockCluster()
+    : m_mutex()
+    , m_nodes()
+    , m_slots(MOCK_CLUSTER_SLOTS)
+    , m_faults()
+    , m_actions()
+    , m_connections()
+    , m_running(false)
+    , m_thread()
+{
+    m_wake_fds[0] = -1;
+    m_wake_fds[1] = -1;
+}
+
+MockCluster::~MockCluster()
+{
+    stop();
+}
+
+bool MockCluster::start(uint32_t nodes, uint16_t base_port)
+{
+    stop();
+
+    if (0 == nodes || 0 != pipe(m_wake_fds))
+    {
+        return (false);
+    }
+    set_nonblocking(m_wake_fds[0]);
+    set_nonblocking(m_wake_fds[1]);
+
+    m_nodes.resize(nodes);
+    for (uint32_t index = 0; index < nodes; ++index)
+    {
+        MockNode & node = m_nodes[index];
+        node.port = 0;
+        node.listen_fd = -1;
+        node.alive = true;
+        node.latency_us = 0;
+        memset(&node.stats, 0, sizeof(node.stats));
+        if (!listen_node(node, (0 == base_port ? 0 : static_cast<uint16_t>(base_port + index))))
+        {
+            stop();
+            return (false);
+        }
+    }
+
+    reset();
+
+    m_running = true;
+    m_thread = std::thread(&MockCluster::run, this);
+
+    return (true);
+}
+
+void MockCluster::stop()
+{
+    if (m_running)
+    {
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_running = false;
+        }
+        wake_up();
+        m_thread.join();
+    }
+
+    for (std::list<MockConnection *>::iterator iter = m_connections.begin(); m_connections.end() != iter; ++iter)
+    {
+        close((*iter)->fd);
+        delete *iter;
+    }
+    m_connections.clear();
+
+    for (std::vector<MockNode>::iterator iter = m_nodes.begin(); m_nodes.end() != iter; ++iter)
+    {
+        if (iter->listen_fd >= 0)
+        {
+            close(iter->listen_fd);
+        }
+    }
+    m_nodes.clear();
+    m_faults.clear();
+    m_actions.clear();
+
+    for (int index = 0; index < 2; ++index)
+    {
+        if (m_wake_fds[index] >= 0)
+        {
+            close(m_wake_fds[index]);
+            m_wake_fds[index] = -1;
+        }
+    }
+}
+
+std::string MockCluster::address() const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    std::string address;
+    for (std::vector<MockNode>::const_iterator iter = m_nodes.begin(); m_nodes.end() != iter; ++iter)
+    {
+        address += (address.empty() ? "" : ",") + std::string("127.0.0.1:") + std::to_string(iter->port);
+    }
+    return (address);
+}
+
+std::string MockCluster::node_address(uint32_t node) const
+{
+    return ("127.0.0.1:" + std::to_string(m_nodes[node].port));
+}
+
+uint32_t MockCluster::slot_owner(uint16_t slot) const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return (m_slots[slot % MOCK_CLUSTER_SLOTS].owner);
+}
+
+uint16_t MockCluster::key_slot(const std::string & key)
+{
+    std::string::size_type beg = key.find('{');
+    std::string::size_type len = key.size();
+    std::string::size_type off = 0;
+    if (std::string::npos != beg)
+    {
+        std::string::size_type end = key.find('}', beg + 1);
+        if (std::string::npos != end && end > beg + 1)
+        {
+            off = beg + 1;
+            len = end - beg - 1;
+        }
+    }
+
+    uint16_t crc = 0;
+    for (std::string::size_type index = off; index < off + len; ++index)
+    {
+        crc = static_cast<uint16_t>(crc ^ (static_cast<uint8_t>(key[index]) << 8));
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = static_cast<uint16_t>((crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1));
+        }
+    }
+    return (static_cast<uint16_t>(crc & (MOCK_CLUSTER_SLOTS - 1)));
+}
+
+void MockCluster::reset()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        const uint32_t count = static_cast<uint32_t>(m_nodes.size());
+        for (uint32_t slot = 0; slot < MOCK_CLUSTER_SLOTS; ++slot)
+        {
+            m_slots[slot].owner = slot * count / MOCK_CLUSTER_SLOTS;
+            m_slots[slot].target = m_slots[slot].owner;
+        }
+        for (std::vector<MockNode>::iterator iter = m_nodes.begin(); m_nodes.end() != iter; ++iter)
+        {
+            iter->alive = true;
+            iter->latency_us = 0;
+            iter->data.clear();
+            memset(&iter->stats, 0, sizeof(iter->stats));
+        }
+        m_faults.clear();
+        m_actions.clear();
+    }
+    wake_up();
+}
+
+void MockCluster::assign_slots(uint32_t node, uint16_t first, uint16_t last)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    for (uint32_t slot = first; slot <= last && slot < MOCK_CLUSTER_SLOTS; ++slot)
+    {
+        m_slots[slot].owner = node;
+        m_slots[slot].target = node;
+    }
+
+    /* keys of a slot are with its owner or with the node importing it */
+    std::map<std::string, std::string> & target = m_nodes[node].data;
+    for (uint32_t index = 0; index < m_nodes.size(); ++index)
+    {
+        std::map<std::string, std::string> & source = m_nodes[index].data;
+        for (std::map<std::string, std::string>::iterator iter = source.begin(); node != index && source.end() != iter; )
+        {
+            uint16_t slot = key_slot(iter->first);
+            if (slot >= first && slot <= last)
+            {
+                target[iter->first] = iter->second;
+                iter = source.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+}
+
+void MockCluster::migrate_slot(uint16_t slot, uint32_t target)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_slots[slot % MOCK_CLUSTER_SLOTS].target = target;
+}
+
+void MockCluster::finish_migration(uint16_t slot)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    MockSlot & mock_slot = m_slots[slot % MOCK_CLUSTER_SLOTS];
+    if (mock_slot.owner != mock_slot.target)
+    {
+        move_keys(slot, mock_slot.owner, mock_slot.target);
+        mock_slot.owner = mock_slot.target;
+    }
+}
+
+void MockCluster::set_latency(uint32_t node, uint32_t latency_us)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_nodes[node].latency_us = latency_us;
+}
+
+void MockCluster::add_fault(const MockFault & fault)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_faults.push_back(fault);
+}
+
+void MockCluster::kill_node(uint32_t node)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_nodes[node].alive = false;
+    }
+    wake_up();
+}
+
+void MockCluster::revive_node(uint32_t node)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_nodes[node].alive = true;
+    }
+    wake_up();
+}
+
+void MockCluster::failover(uint32_t node, uint32_t replica)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_nodes[node].alive = false;
+        for (uint32_t slot = 0; slot < MOCK_CLUSTER_SLOTS; ++slot)
+        {
+            if (node == m_slots[slot].owner)
+            {
+                m_slots[slot].owner = replica;
+            }
+            if (node == m_slots[slot].target)
+            {
+                m_slots[slot].target = m_slots[slot].owner;
+            }
+        }
+        m_nodes[replica].data.insert(m_nodes[node].data.begin(), m_nodes[node].data.end());
+        m_nodes[node].data.clear();
+    }
+    wake_up();
+}
+
+void MockCluster::schedule(uint32_t delay_ms, const std::function<void ()> & action)
+{
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        MockAction mock_action;
+        mock_action.due = get_time_us() + static_cast<uint64_t>(delay_ms) * 1000;
+        mock_action.action = action;
+        m_actions.push_back(mock_action);
+    }
+    wake_up();
+}
+
+MockNodeStats MockCluster::node_stats(uint32_t node) const
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return (m_nodes[node].stats);
+}
+
+bool MockCluster::listen_node(MockNode & node, uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return (false);
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    if (0 != bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) || 0 != listen(fd, 128) ||
+        0 != getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &addr_len) || !set_nonblocking(fd))
+    {
+        close(fd);
+        return (false);
+    }
+
+    node.port = ntohs(addr.sin_port);
+    node.listen_fd = fd;
+    return (true);
+}
+
+void MockCluster::run()
+{
+    std::vector<struct pollfd> fds;
+
+    while (true)
+    {
+        uint64_t now = get_time_us();
+        int timeout = 100;
+
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if (!m_running)
+            {
+                break;
+            }
+
+            sync_nodes();
+
+            fds.clear();
+            struct pollfd wake = { m_wake_fds[0], POLLIN, 0 };
+            fds.push_back(wake);
+            for (std::vector<MockNode>::const_iterator iter = m_nodes.begin(); m_nodes.end() != iter; ++iter)
+            {
+                struct pollfd listen = { iter->listen_fd, POLLIN, 0 };
+                fds.push_back(listen);
+            }
+            for (std::list<MockConnection *>::const_iterator iter = m_connections.begin(); m_connections.end() != iter; ++iter)
+            {
+                const MockConnection & connection = **iter;
+                struct pollfd client = { connection.fd, POLLIN, 0 };
+                if (!connection.output.empty())
+                {
+                    client.events |= POLLOUT;
+                }
+                else if (!connection.replies.empty())
+                {
+                    uint64_t due = connection.replies.front().first;
+                    timeout = std::min(timeout, static_cast<int>(due > now ? (due - now + 999) / 1000 : 0));
+                }
+                fds.push_back(client);
+            }
+            for (std::list<MockAction>::const_iterator iter = m_actions.begin(); m_actions.end() != iter; ++iter)
+            {
+                timeout = std::min(timeout, static_cast<int>(iter->due > now ? (iter->due - now + 999) / 1000 : 0));
+            }
+        }
+
+        poll(&fds[0], fds.size(), timeout);
+
+        now = get_time_us();
+
+        if (0 != (fds[0].revents & POLLIN))
+        {
+            char buffer[64];
+            while (read(m_wake_fds[0], buffer, sizeof(buffer)) > 0)
+            {
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+
+            for (uint32_t node = 0; node < m_nodes.size(); ++node)
+            {
+                if (0 != (fds[node + 1].revents & POLLIN))
+                {
+                    accept_connections(node);
+                }
+            }
+
+            /* connections accepted above are at the back and were not polled */
+            size_t index = 1 + m_nodes.size();
+            for (std::list<MockConnection *>::iterator iter = m_connections.begin(); m_connections.end() != iter; )
+            {
+                MockConnection * connection = *iter;
+                bool ok = true;
+                if (index < fds.size() && fds[index].fd == connection->fd)
+                {
+                    if (0 != (fds[index].revents & (POLLIN | POLLHUP | POLLERR)))
+                    {
+                        ok = read_connection(*connection);
+                    }
+                    ++index;
+                }
+                if (ok)
+                {
+                    ok = write_connection(*connection, now);
+                }
+                if (ok)
+                {
+                    ++iter;
+                }
+                else
+                {
+                    close(connection->fd);
+                    delete connection;
+                    iter = m_connections.erase(iter);
+                }
+            }
+        }
+
+        run_actions(now);
+    }
+}
+
+/*
+ * opens the ports of revived nodes, closes the ports and connections of killed ones
+ */
+void MockCluster::sync_nodes()
+{
+    for (uint32_t index = 0; index < m_nodes.size(); ++index)
+    {
+        MockNode & node = m_nodes[index];
+        if (node.alive && node.listen_fd < 0)
+        {
+            listen_node(node, node.port);
+        }
+        else if (!node.alive && node.listen_fd >= 0)
+        {
+            close(node.listen_fd);
+            node.listen_fd = -1;
+            for (std::list<MockConnection *>::iterator iter = m_connections.begin(); m_connections.end() != iter; )
+            {
+                if (index == (*iter)->node)
+                {
+                    close((*iter)->fd);
+                    delete *iter;
+                    iter = m_connections.erase(iter);
+                }
+                else
+                {
+                    ++iter;
+                }
+            }
+        }
+    }
+}
+
+void MockCluster::accept_connections(uint32_t node)
+{
+    while (m_nodes[node].listen_fd >= 0)
+    {
+        int fd = accept(m_nodes[node].listen_fd, nullptr, nullptr);
+        if (fd < 0)
+        {
+            break;
+        }
+
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        set_nonblocking(fd);
+
+        MockConnection * connection = new MockConnection;
+        connection->fd = fd;
+        connection->node = node;
+        connection->asking = false;
+        connection->last_due = 0;
+        m_connections.push_back(connection);
+
+        ++m_nodes[node].stats.connections;
+    }
+}
+
+bool MockCluster::read_connection(MockConnection & connection)
+{
+    char buffer[16 * 1024];
+    while (true)
+    {
+        ssize_t bytes = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (bytes > 0)
+        {
+            connection.input.append(buffer, static_cast<size_t>(bytes));
+            continue;
+        }
+        if (0 == bytes || (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno))
+        {
+            return (false);
+        }
+        break;
+    }
+
+    if (!m_nodes[connection.node].alive)
+    {
+        return (false);
+    }
+
+    const uint64_t now = get_time_us();
+    std::vector<std::string> args;
+    while (true)
+    {
+        int ret = parse_request(connection.input, args);
+        if (ret < 0)
+        {
+            return (false);
+        }
+        if (0 == ret)
+        {
+            break;
+        }
+
+        std::string reply;
+        if (!execute(connection, args, reply))
+        {
+            return (false);
+        }
+
+        /* replies keep their order whatever the latency was when they were made */
+        uint64_t due = std::max(now + m_nodes[connection.node].latency_us, connection.last_due);
+        connection.last_due = due;
+        connection.replies.push_back(std::make_pair(due, reply));
+    }
+
+    return (true);
+}
+
+bool MockCluster::write_connection(MockConnection & connection, uint64_t now)
+{
+    while (!connection.replies.empty() && connection.replies.front().first <= now)
+    {
+        connection.output += connection.replies.front().second;
+        connection.replies.pop_front();
+    }
+
+    while (!connection.output.empty())
+    {
+        ssize_t bytes = send(connection.fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+        if (bytes > 0)
+        {
+            connection.output.erase(0, static_cast<size_t>(bytes));
+            continue;
+        }
+        if (bytes < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+        {
+            break;
+        }
+        return (false);
+    }
+
+    return (true);
+}
+
+/*
+ * returns false when the connection has to be dropped
+ */
+bool MockCluster::execute(MockConnection & connection, const std::vector<std::string> & args, std::string & reply)
+{
+    MockNode & node = m_nodes[connection.node];
+    const std::string command = upper_case(args[0]);
+    const bool asking = connection.asking;
+    connection.asking = false;
+
+    ++node.stats.commands;
+
+    if ("PING" == command)
+    {
+        if (args.size() > 1)
+        {
+            reply_bulk(reply, args[1]);
+        }
+        else
+        {
+            reply_status(reply, "PONG");
+        }
+        return (true);
+    }
+
+    if ("AUTH" == command || "SELECT" == command || "CLIENT" == command || "READONLY" == command || "READWRITE" == command)
+    {
+        reply_status(reply, "OK");
+        return (true);
+    }
+
+    if ("ECHO" == command && 2 == args.size())
+    {
+        reply_bulk(reply, args[1]);
+        return (true);
+    }
+
+    if ("ASKING" == command)
+    {
+        connection.asking = true;
+        reply_status(reply, "OK");
+        return (true);
+    }
+
+    if ("CLUSTER" == command && args.size() >= 2)
+    {
+        const std::string sub_command = upper_case(args[1]);
+        if ("SLOTS" == sub_command)
+        {
+            cluster_slots(reply);
+        }
+        else if ("NODES" == sub_command)
+        {
+            std::string nodes;
+            cluster_nodes(nodes);
+            std::string myself = node_id(connection.node) + " " + node_address(connection.node) + "@";
+            std::string::size_type pos = nodes.find(myself);
+            if (std::string::npos != pos)
+            {
+                pos = nodes.find(' ', pos + myself.size());
+                nodes.insert(pos + 1, "myself,");
+            }
+            reply_bulk(reply, nodes);
+        }
+        else if ("INFO" == sub_command)
+        {
+            reply_bulk(reply, "cluster_state:ok\r\ncluster_slots_assigned:16384\r\ncluster_slots_ok:16384\r\ncluster_known_nodes:" +
+                std::to_string(m_nodes.size()) + "\r\ncluster_size:" + std::to_string(m_nodes.size()) + "\r\n");
+        }
+        else if ("MYID" == sub_command)
+        {
+            reply_bulk(reply, node_id(connection.node));
+        }
+        else if ("KEYSLOT" == sub_command && 3 == args.size())
+        {
+            reply_integer(reply, key_slot(args[2]));
+        }
+        else
+        {
+            reply_error(reply, "ERR unknown subcommand '" + args[1] + "'");
+        }
+        return (true);
+    }
+
+    const bool key_command = (("GET" == command && 2 == args.size()) || ("SET" == command && args.size() >= 3) ||
+        ("DEL" == command && args.size() >= 2) || ("EXISTS" == command && args.size() >= 2) || ("INCR" == command && 2 == args.size()) ||
+        ("EXPIRE" == command && 3 == args.size()) || ("PERSIST" == command && 2 == args.size()));
+    if (!key_command)
+    {
+        reply_error(reply, "ERR unknown command '" + args[0] + "'");
+        return (true);
+    }
+
+    for (size_t index = 2; index < args.size() && ("DEL" == command || "EXISTS" == command); ++index)
+    {
+        if (key_slot(args[index]) != key_slot(args[1]))
+        {
+            reply_error(reply, "CROSSSLOT Keys in request don't hash to the same slot");
+            return (true);
+        }
+    }
+
+    if (!check_fault(connection.node, reply))
+    {
+        return (!reply.empty());
+    }
+
+    if (!route(connection.node, args[1], asking, reply))
+    {
+        return (true);
+    }
+
+    std::map<std::string, std::string> & data = node.data;
+    if ("GET" == command)
+    {
+        std::map<std::string, std::string>::const_iterator iter = data.find(args[1]);
+        if (data.end() != iter)
+        {
+            reply_bulk(reply, iter->second);
+        }
+        else
+        {
+            reply = "$-1\r\n";
+        }
+    }
+    else if ("SET" == command)
+    {
+        data[args[1]] = args[2];
+        reply_status(reply, "OK");
+    }
+    else if ("DEL" == command || "EXISTS" == command)
+    {
+        int64_t count = 0;
+        for (size_t index = 1; index < args.size(); ++index)
+        {
+            if ("DEL" == command)
+            {
+                count += static_cast<int64_t>(data.erase(args[index]));
+            }
+            else
+            {
+                count += static_cast<int64_t>(data.count(args[index]));
+            }
+        }
+        reply_integer(reply, count);
+    }
+    else if ("INCR" == command)
+    {
+        std::string & value = data[args[1]];
+        int64_t number = strtoll(value.c_str(), nullptr, 10) + 1;
+        value = std::to_string(number);
+        reply_integer(reply, number);
+    }
+    else
+    {
+        reply_integer(reply, static_cast<int64_t>(data.count(args[1])));
+    }
+
+    return (true);
+}
+
+/*
+ * returns false when a scheduled fault hits the command,
+ * the reply is left empty when the connection has to be dropped
+ */
+bool MockCluster::check_fault(uint32_t node, std::string & reply)
+{
+    bool hit = false;
+    for (std::list<MockFault>::iterator iter = m_faults.begin(); m_faults.end() != iter; )
+    {
+        MockFault & fault = *iter;
+        if (node != fault.node)
+        {
+            ++iter;
+            continue;
+        }
+
+        if (fault.skip > 0)
+        {
+            --fault.skip;
+            ++iter;
+            continue;
+        }
+
+        if (!hit)
+        {
+            hit = true;
+            ++m_nodes[node].stats.faults;
+            if (mock_fault_tryagain == fault.kind)
+            {
+                reply_error(reply, "TRYAGAIN Multiple keys request during rehashing of slot");
+            }
+            else if (mock_fault_clusterdown == fault.kind)
+            {
+                reply_error(reply, "CLUSTERDOWN The cluster is down");
+            }
+            else
+            {
+                reply.clear();
+            }
+
+            if (0 == --fault.count)
+            {
+                iter = m_faults.erase(iter);
+                continue;
+            }
+        }
+        ++iter;
+    }
+    return (!hit);
+}
+
+bool MockCluster::route(uint32_t node_index, const std::string & key, bool asking, std::string & reply)
+{
+    const uint16_t slot = key_slot(key);
+    const MockSlot & mock_slot = m_slots[slot];
+    MockNode & node = m_nodes[node_index];
+
+    if (node_index == mock_slot.owner)
+    {
+        if (mock_slot.target != mock_slot.owner && 0 == node.data.count(key))
+        {
+            ++node.stats.ask;
+            reply_error(reply, "ASK " + std::to_string(slot) + " " + node_address(mock_slot.target));
+            return (false);
+        }
+        return (true);
+    }
+
+    if (node_index == mock_slot.target && asking)
+    {
+        return (true);
+    }
+
+    ++node.stats.moved;
+    reply_error(reply, "MOVED " + std::to_string(slot) + " " + node_address(mock_slot.owner));
+    return (false);
+}
+
+void MockCluster::move_keys(uint16_t slot, uint32_t from, uint32_t to)
+{
+    std::map<std::string, std::string> & source = m_nodes[from].data;
+    std::map<std::string, std::string> & target = m_nodes[to].data;
+    for (std::map<std::string, std::string>::iterator iter = source.begin(); source.end() != iter; )
+    {
+        if (slot == key_slot(iter->first))
+        {
+            target[iter->first] = iter->second;
+            iter = source.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+void MockCluster::cluster_slots(std::string & reply) const
+{
+    std::string ranges;
+    uint32_t count = 0;
+    uint32_t first = 0;
+    for (uint32_t slot = 1; slot <= MOCK_CLUSTER_SLOTS; ++slot)
+    {
+        if (MOCK_CLUSTER_SLOTS != slot && m_slots[slot].owner == m_slots[first].owner)
+        {
+            continue;
+        }
+
+        const uint32_t owner = m_slots[first].owner;
+        ranges += "*3\r\n:" + std::to_string(first) + "\r\n:" + std::to_string(slot - 1) + "\r\n*3\r\n";
+        append_bulk(ranges, "127.0.0.1");
+        ranges += ":" + std::to_string(m_nodes[owner].port) + "\r\n";
+        append_bulk(ranges, node_id(owner));
+        ++count;
+        first = slot;
+    }
+    reply = "*" + std::to_string(count) + "\r\n" + ranges;
+}
+
+void MockCluster::cluster_nodes(std::string & reply) const
+{
+    reply.clear();
+    for (uint32_t index = 0; index < m_nodes.size(); ++index)
+    {
+        const MockNode & node = m_nodes[index];
+        reply += node_id(index) + " " + node_address(index) + "@" + std::to_string(node.port + 10000) + " " +
+            (node.alive ? "master" : "master,fail") + " - 0 0 " + std::to_string(index + 1) + " " + (node.alive ? "connected" : "disconnected");
+
+        uint32_t first = MOCK_CLUSTER_SLOTS;
+        for (uint32_t slot = 0; slot <= MOCK_CLUSTER_SLOTS; ++slot)
+        {
+            bool owned = (MOCK_CLUSTER_SLOTS != slot && index == m_slots[slot].owner);
+            if (owned && MOCK_CLUSTER_SLOTS == first)
+            {
+                first = slot;
+            }
+            else if (!owned && MOCK_CLUSTER_SLOTS != first)
+            {
+                reply += " " + std::to_string(first);
+                if (slot - 1 != first)
+                {
+                    reply += "-" + std::to_string(slot - 1);
+                }
+                first = MOCK_CLUSTER_SLOTS;
+            }
+        }
+
+        for (uint32_t slot = 0; slot < MOCK_CLUSTER_SLOTS; ++slot)
+        {
+            const MockSlot & mock_slot = m_slots[slot];
+            if (mock_slot.owner == mock_slot.target)
+            {
+                continue;
+            }
+            if (index == mock_slot.owner)
+            {
+                reply += " [" + std::to_string(slot) + "->-" + node_id(mock_slot.target) + "]";
+            }
+            else if (index == mock_slot.target)
+            {
+                reply += " [" + std::to_string(slot) + "-<-" + node_id(mock_slot.owner) + "]";
+            }
+        }
+
+        reply += "\n";
+    }
+}
+
+std::string MockCluster::node_id(uint32_t node) const
+{
+    char id[64] = { 0x0 };
+    snprintf(id, sizeof(id), "%040x", node + 1);
+    return (id);
+}
+
+void MockCluster::run_actions(uint64_t now)
+{
+    std::list<MockAction> due_actions;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        for (std::list<MockAction>::iterator iter = m_actions.begin(); m_actions.end() != iter; )
+        {
+            if (iter->due <= now)
+            {
+                due_actions.push_back(*iter);
+                iter = m_actions.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    for (std::list<MockAction>::iterator iter = due_actions.begin(); due_actions.end() != iter; ++iter)
+    {
+        iter->action();
+    }
+}
+
+void MockCluster::wake_up()
+{
+    if (m_wake_fds[1] >= 0)
+    {
+        const char signal = 0;
+        ssize_t bytes = write(m_wake_fds[1], &signal, 1);
+        (void)bytes;
+    }
+}
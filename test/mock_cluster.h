@@ -0,0 +1,144 @@
+/********************************************************
+ * Description : mock redis cluster speaking resp on local ports
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#ifndef MOCK_CLUSTER_H
+#define MOCK_CLUSTER_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <functional>
+
+#define MOCK_CLUSTER_SLOTS  16384
+
+enum MockFaultKind
+{
+    mock_fault_tryagain = 0,                                        /* reply -TRYAGAIN */
+    mock_fault_clusterdown,                                         /* reply -CLUSTERDOWN */
+    mock_fault_drop                                                 /* close the connection instead of replying */
+};
+
+struct MockFault
+{
+    MockFaultKind                       kind;
+    uint32_t                            node;
+    uint32_t                            skip;                       /* key commands of the node let through before the fault starts */
+    uint32_t                            count;                      /* key commands of the node the fault hits */
+};
+
+struct MockNodeStats
+{
+    uint64_t                            connections;
+    uint64_t                            commands;
+    uint64_t                            moved;
+    uint64_t                            ask;
+    uint64_t                            faults;
+};
+
+struct MockConnection;
+
+/*
+ * a single thread serves every node of the cluster, nodes only keep
+ * strings, slot ownership, migrations, latency, faults and node failures
+ * are scripted by the test, right away or after a delay
+ */
+class MockCluster
+{
+public:
+    MockCluster();
+    ~MockCluster();
+
+public:
+    bool start(uint32_t nodes, uint16_t base_port = 0);             /* ports picked by the system when base_port is 0, slots spread evenly */
+    void stop();
+
+public:
+    std::string address() const;                                    /* seeds of all nodes, host:port separated by ',' */
+    std::string node_address(uint32_t node) const;
+    uint32_t slot_owner(uint16_t slot) const;
+    static uint16_t key_slot(const std::string & key);
+
+public:
+    void reset();                                                   /* even slots, no data, latency, faults or failures */
+    void assign_slots(uint32_t node, uint16_t first, uint16_t last);/* the keys of the slots move along, others get MOVED */
+    void migrate_slot(uint16_t slot, uint32_t target);              /* the owner answers ASK for keys it does not have */
+    void finish_migration(uint16_t slot);                           /* the target owns the slot and its keys */
+    void set_latency(uint32_t node, uint32_t latency_us);           /* delay of every reply of the node */
+    void add_fault(const MockFault & fault);
+    void kill_node(uint32_t node);                                  /* close its port and connections */
+    void revive_node(uint32_t node);
+    void failover(uint32_t node, uint32_t replica);                 /* kill the node, its slots and keys go to the replica */
+    void schedule(uint32_t delay_ms, const std::function<void ()> & action); /* run from the serving thread */
+
+public:
+    MockNodeStats node_stats(uint32_t node) const;
+
+private:
+    MockCluster(const MockCluster &);
+    MockCluster & operator = (const MockCluster &);
+
+private:
+    struct MockNode
+    {
+        uint16_t                        port;
+        int                             listen_fd;
+        bool                            alive;
+        uint32_t                        latency_us;
+        std::map<std::string, std::string> data;
+        MockNodeStats                   stats;
+    };
+
+    struct MockSlot
+    {
+        uint32_t                        owner;
+        uint32_t                        target;                     /* node importing the slot, owner when not migrating */
+    };
+
+    struct MockAction
+    {
+        uint64_t                        due;
+        std::function<void ()>          action;
+    };
+
+private:
+    bool listen_node(MockNode & node, uint16_t port);
+    void run();
+    void sync_nodes();
+    void accept_connections(uint32_t node);
+    bool read_connection(MockConnection & connection);
+    bool write_connection(MockConnection & connection, uint64_t now);
+    bool execute(MockConnection & connection, const std::vector<std::string> & args, std::string & reply);
+    bool check_fault(uint32_t node, std::string & reply);
+    bool route(uint32_t node, const std::string & key, bool asking, std::string & reply);
+    void move_keys(uint16_t slot, uint32_t from, uint32_t to);
+    void cluster_slots(std::string & reply) const;
+    void cluster_nodes(std::string & reply) const;
+    std::string node_id(uint32_t node) const;
+    void run_actions(uint64_t now);
+    void wake_up();
+
+private:
+    mutable std::mutex                  m_mutex;
+    std::vector<MockNode>               m_nodes;
+    std::vector<MockSlot>               m_slots;
+    std::list<MockFault>                m_faults;
+    std::list<MockAction>               m_actions;
+    std::list<MockConnection *>         m_connections;
+    int                                 m_wake_fds[2];
+    bool                                m_running;
+    std::thread                         m_thread;
+};
+
+
+#endif // MOCK_CLUSTER_H
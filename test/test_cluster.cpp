@@ -0,0 +1,606 @@
+/********************************************************
+ * Description : redirect and failover test of redis cluster against the mock cluster
+ * Author      : yanrk
+ * Email       : yanrkchina@163.com
+ * Version     : 3.0
+ * History     :
+ * Copyright(C): 2023
+ ********************************************************/
+
+#include <poll.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <list>
+#include <iostream>
+#include "hircluster.h"
+#include "hihistogram.h"
+#include "mock_cluster.h"
+
+#define MOCK_NODES      3
+#define ASYNC_WINDOW    32
+#define RUN_DEADLINE_MS 20000
+
+enum ScenarioCheck
+{
+    check_clean = 0,                                                /* no errors at all */
+    check_recover                                                   /* errors allowed, the last commands must succeed */
+};
+
+struct Scenario
+{
+    const char                        * name;
+    ScenarioCheck                       check;
+    void                             (* prepare)(MockCluster & mock_cluster);
+};
+
+struct RunResult
+{
+    uint64_t                            ops;
+    uint64_t                            errors;
+    uint64_t                            mismatches;
+    uint64_t                            tail_successes;             /* commands in a row that succeeded at the end */
+    uint64_t                            elapsed_ns;
+    hihistogram                       * latency;
+};
+
+static uint64_t get_time_ns()
+{
+    return (static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()));
+}
+
+static std::string test_key(uint32_t index)
+{
+    return ("test:cluster:" + std::to_string(index % 1000));
+}
+
+static std::string test_value(uint32_t index)
+{
+    return ("value:" + std::to_string(index));
+}
+
+static void run_result_init(RunResult & result)
+{
+    result.ops = 0;
+    result.errors = 0;
+    result.mismatches = 0;
+    result.tail_successes = 0;
+    result.elapsed_ns = 0;
+    result.latency = hihistogram_create();
+}
+
+static void run_result_record(RunResult & result, uint64_t latency_ns, bool ok)
+{
+    ++result.ops;
+    if (ok)
+    {
+        ++result.tail_successes;
+    }
+    else
+    {
+        ++result.errors;
+        result.tail_successes = 0;
+    }
+    if (nullptr != result.latency)
+    {
+        hihistogram_record(result.latency, latency_ns);
+    }
+}
+
+/*
+ * scenarios, each one scripts the mock cluster after a reset
+ */
+
+static void prepare_steady(MockCluster & mock_cluster)
+{
+    (void)mock_cluster;
+}
+
+static void prepare_resharding(MockCluster & mock_cluster)
+{
+    /* a range of 512 slots changes hands every 20 ms */
+    for (uint32_t step = 0; step < 16; ++step)
+    {
+        uint16_t first = static_cast<uint16_t>((step * 1024) % MOCK_CLUSTER_SLOTS);
+        uint32_t node = (mock_cluster.slot_owner(first) + 1 + step) % MOCK_NODES;
+        mock_cluster.schedule(20 * (step + 1), [&mock_cluster, node, first]() { mock_cluster.assign_slots(node, first, static_cast<uint16_t>(first + 511)); });
+    }
+}
+
+static void prepare_migration(MockCluster & mock_cluster)
+{
+    /* the slots of the test keys move from their owners to the next node, in two steps */
+    std::vector<uint16_t> slots;
+    for (uint32_t index = 0; index < 1000; index += 7)
+    {
+        slots.push_back(MockCluster::key_slot(test_key(index)));
+    }
+    for (std::vector<uint16_t>::const_iterator iter = slots.begin(); slots.end() != iter; ++iter)
+    {
+        mock_cluster.migrate_slot(*iter, (mock_cluster.slot_owner(*iter) + 1) % MOCK_NODES);
+    }
+    mock_cluster.schedule(200, [&mock_cluster, slots]()
+    {
+        for (std::vector<uint16_t>::const_iterator iter = slots.begin(); slots.end() != iter; ++iter)
+        {
+            mock_cluster.finish_migration(*iter);
+        }
+    });
+}
+
+static void prepare_tryagain(MockCluster & mock_cluster)
+{
+    for (uint32_t node = 0; node < MOCK_NODES; ++node)
+    {
+        MockFault fault = { mock_fault_tryagain, node, 100, 3 };
+        mock_cluster.add_fault(fault);
+    }
+}
+
+static void prepare_clusterdown(MockCluster & mock_cluster)
+{
+    for (uint32_t node = 0; node < MOCK_NODES; ++node)
+    {
+        MockFault fault = { mock_fault_clusterdown, node, 200, 2 };
+        mock_cluster.add_fault(fault);
+    }
+}
+
+static void prepare_slow_node(MockCluster & mock_cluster)
+{
+    mock_cluster.set_latency(1, 2000);
+}
+
+static void prepare_dropped(MockCluster & mock_cluster)
+{
+    MockFault fault = { mock_fault_drop, 2, 300, 2 };
+    mock_cluster.add_fault(fault);
+}
+
+static void prepare_failover(MockCluster & mock_cluster)
+{
+    mock_cluster.schedule(50, [&mock_cluster]() { mock_cluster.failover(2, 0); });
+}
+
+static const Scenario s_scenarios[] =
+{
+    { "steady",      check_clean,   prepare_steady      },
+    { "resharding",  check_clean,   prepare_resharding  },
+    { "migration",   check_clean,   prepare_migration   },
+    { "tryagain",    check_clean,   prepare_tryagain    },
+    { "clusterdown", check_clean,   prepare_clusterdown },
+    { "slow_node",   check_clean,   prepare_slow_node   },
+    { "dropped",     check_recover, prepare_dropped     },
+    { "failover",    check_recover, prepare_failover    }
+};
+
+/*
+ * synchronous path, every SET is read back with a GET of the same key,
+ * ops counts both
+ */
+static bool run_sync(const std::string & address, uint32_t ops, RunResult & result)
+{
+    redisClusterContext * cc = redisClusterContextInit();
+    if (nullptr == cc)
+    {
+        return (false);
+    }
+
+    const struct timeval timeout = { 1, 0 };
+    if (REDIS_OK != redisClusterSetOptionAddNodes(cc, address.c_str()) || REDIS_OK != redisClusterSetOptionRouteUseSlots(cc) ||
+        REDIS_OK != redisClusterSetOptionConnectTimeout(cc, timeout) || REDIS_OK != redisClusterSetOptionTimeout(cc, timeout) ||
+        REDIS_OK != redisClusterConnect2(cc))
+    {
+        std::cout << "connect [" << address << "] failure: " << cc->errstr << std::endl;
+        redisClusterFree(cc);
+        return (false);
+    }
+
+    uint64_t time_beg = get_time_ns();
+
+    for (uint32_t index = 0; index < ops / 2; ++index)
+    {
+        const std::string key = test_key(index);
+        const std::string value = test_value(index);
+
+        const char * set_argv[3] = { "SET", key.c_str(), value.c_str() };
+        size_t set_argvlen[3] = { 3, key.size(), value.size() };
+        uint64_t time_set = get_time_ns();
+        redisReply * reply = reinterpret_cast<redisReply *>(redisClusterCommandArgv(cc, 3, set_argv, set_argvlen));
+        bool ok = (nullptr != reply && REDIS_REPLY_STATUS == reply->type);
+        freeReplyObject(reply);
+        run_result_record(result, get_time_ns() - time_set, ok);
+        if (!ok)
+        {
+            continue;
+        }
+
+        const char * get_argv[2] = { "GET", key.c_str() };
+        size_t get_argvlen[2] = { 3, key.size() };
+        uint64_t time_get = get_time_ns();
+        reply = reinterpret_cast<redisReply *>(redisClusterCommandArgv(cc, 2, get_argv, get_argvlen));
+        ok = (nullptr != reply && REDIS_REPLY_ERROR != reply->type);
+        if (ok && (REDIS_REPLY_STRING != reply->type || value != std::string(reply->str, reply->len)))
+        {
+            ++result.mismatches;
+        }
+        freeReplyObject(reply);
+        run_result_record(result, get_time_ns() - time_get, ok);
+    }
+
+    result.elapsed_ns = get_time_ns() - time_beg;
+
+    redisClusterFree(cc);
+
+    return (true);
+}
+
+/*
+ * event loop over poll(2) for the async contexts of a cluster,
+ * events are freed by the loop once hiredis cleaned them up
+ */
+struct PollEvent
+{
+    redisAsyncContext                 * context;
+    bool                                reading;
+    bool                                writing;
+};
+
+struct PollLoop
+{
+    std::list<PollEvent *>              events;
+};
+
+static void poll_add_read(void * privdata)
+{
+    reinterpret_cast<PollEvent *>(privdata)->reading = true;
+}
+
+static void poll_del_read(void * privdata)
+{
+    reinterpret_cast<PollEvent *>(privdata)->reading = false;
+}
+
+static void poll_add_write(void * privdata)
+{
+    reinterpret_cast<PollEvent *>(privdata)->writing = true;
+}
+
+static void poll_del_write(void * privdata)
+{
+    reinterpret_cast<PollEvent *>(privdata)->writing = false;
+}
+
+static void poll_cleanup(void * privdata)
+{
+    reinterpret_cast<PollEvent *>(privdata)->context = nullptr;
+}
+
+static int poll_attach(redisAsyncContext * ac, void * adapter)
+{
+    if (nullptr != ac->ev.data)
+    {
+        return (REDIS_ERR);
+    }
+
+    PollEvent * event = new PollEvent;
+    event->context = ac;
+    event->reading = false;
+    event->writing = false;
+
+    ac->ev.data = event;
+    ac->ev.addRead = poll_add_read;
+    ac->ev.delRead = poll_del_read;
+    ac->ev.addWrite = poll_add_write;
+    ac->ev.delWrite = poll_del_write;
+    ac->ev.cleanup = poll_cleanup;
+
+    reinterpret_cast<PollLoop *>(adapter)->events.push_back(event);
+
+    return (REDIS_OK);
+}
+
+static void poll_once(PollLoop & loop, int timeout_ms)
+{
+    std::vector<struct pollfd> fds;
+    std::vector<PollEvent *> events;
+    for (std::list<PollEvent *>::iterator iter = loop.events.begin(); loop.events.end() != iter; )
+    {
+        PollEvent * event = *iter;
+        if (nullptr == event->context)
+        {
+            delete event;
+            iter = loop.events.erase(iter);
+            continue;
+        }
+        if (event->reading || event->writing)
+        {
+            struct pollfd fd = { event->context->c.fd, static_cast<short>((event->reading ? POLLIN : 0) | (event->writing ? POLLOUT : 0)), 0 };
+            fds.push_back(fd);
+            events.push_back(event);
+        }
+        ++iter;
+    }
+
+    if (fds.empty())
+    {
+        poll(nullptr, 0, timeout_ms);
+        return;
+    }
+
+    if (poll(&fds[0], fds.size(), timeout_ms) <= 0)
+    {
+        return;
+    }
+
+    for (size_t index = 0; index < fds.size(); ++index)
+    {
+        PollEvent * event = events[index];
+        if (nullptr != event->context && event->reading && 0 != (fds[index].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            redisAsyncHandleRead(event->context);
+        }
+        if (nullptr != event->context && event->writing && 0 != (fds[index].revents & (POLLOUT | POLLERR)))
+        {
+            redisAsyncHandleWrite(event->context);
+        }
+    }
+}
+
+static void poll_free(PollLoop & loop)
+{
+    for (std::list<PollEvent *>::iterator iter = loop.events.begin(); loop.events.end() != iter; ++iter)
+    {
+        delete *iter;
+    }
+    loop.events.clear();
+}
+
+struct AsyncRun;
+
+struct AsyncChain
+{
+    AsyncRun                          * run;
+    uint32_t                            index;
+    uint64_t                            start;
+    std::string                         key;
+    std::string                         value;
+};
+
+struct AsyncRun
+{
+    redisClusterAsyncContext          * acc;
+    RunResult                         * result;
+    uint32_t                            next;
+    uint32_t                            ops;
+    uint32_t                            pending;
+};
+
+static void async_get_callback(redisClusterAsyncContext * acc, void * r, void * privdata);
+
+static void async_send_set(AsyncChain * chain);
+
+static void async_next(AsyncChain * chain)
+{
+    AsyncRun * run = chain->run;
+    if (run->next >= run->ops)
+    {
+        --run->pending;
+        delete chain;
+        return;
+    }
+    chain->index = run->next++;
+    async_send_set(chain);
+}
+
+static void async_set_callback(redisClusterAsyncContext * acc, void * r, void * privdata)
+{
+    AsyncChain * chain = reinterpret_cast<AsyncChain *>(privdata);
+    redisReply * reply = reinterpret_cast<redisReply *>(r);
+    bool ok = (nullptr != reply && REDIS_REPLY_STATUS == reply->type);
+    run_result_record(*chain->run->result, get_time_ns() - chain->start, ok);
+    if (!ok)
+    {
+        async_next(chain);
+        return;
+    }
+
+    const char * argv[2] = { "GET", chain->key.c_str() };
+    size_t argvlen[2] = { 3, chain->key.size() };
+    chain->start = get_time_ns();
+    if (REDIS_OK != redisClusterAsyncCommandArgv(acc, async_get_callback, chain, 2, argv, argvlen))
+    {
+        run_result_record(*chain->run->result, 0, false);
+        async_next(chain);
+    }
+}
+
+static void async_get_callback(redisClusterAsyncContext * acc, void * r, void * privdata)
+{
+    (void)acc;
+    AsyncChain * chain = reinterpret_cast<AsyncChain *>(privdata);
+    redisReply * reply = reinterpret_cast<redisReply *>(r);
+    bool ok = (nullptr != reply && REDIS_REPLY_ERROR != reply->type);
+    if (ok && (REDIS_REPLY_STRING != reply->type || chain->value != std::string(reply->str, reply->len)))
+    {
+        ++chain->run->result->mismatches;
+    }
+    run_result_record(*chain->run->result, get_time_ns() - chain->start, ok);
+    async_next(chain);
+}
+
+static void async_send_set(AsyncChain * chain)
+{
+    chain->key = test_key(chain->index);
+    chain->value = test_value(chain->index);
+
+    const char * argv[3] = { "SET", chain->key.c_str(), chain->value.c_str() };
+    size_t argvlen[3] = { 3, chain->key.size(), chain->value.size() };
+    chain->start = get_time_ns();
+    if (REDIS_OK != redisClusterAsyncCommandArgv(chain->run->acc, async_set_callback, chain, 3, argv, argvlen))
+    {
+        run_result_record(*chain->run->result, 0, false);
+        async_next(chain);
+    }
+}
+
+/*
+ * asynchronous path, ASYNC_WINDOW chains of SET then GET in flight
+ */
+static bool run_async(const std::string & address, uint32_t ops, RunResult & result)
+{
+    redisClusterAsyncContext * acc = redisClusterAsyncContextInit();
+    if (nullptr == acc)
+    {
+        return (false);
+    }
+
+    PollLoop loop;
+    acc->adapter = &loop;
+    acc->attach_fn = poll_attach;
+
+    const struct timeval timeout = { 1, 0 };
+    if (REDIS_OK != redisClusterSetOptionAddNodes(acc->cc, address.c_str()) || REDIS_OK != redisClusterSetOptionRouteUseSlots(acc->cc) ||
+        REDIS_OK != redisClusterSetOptionConnectTimeout(acc->cc, timeout) || REDIS_OK != redisClusterConnect2(acc->cc))
+    {
+        std::cout << "connect [" << address << "] failure: " << acc->cc->errstr << std::endl;
+        redisClusterAsyncFree(acc);
+        poll_free(loop);
+        return (false);
+    }
+
+    AsyncRun run;
+    run.acc = acc;
+    run.result = &result;
+    run.next = 0;
+    run.ops = ops / 2;
+    run.pending = 0;
+
+    uint64_t time_beg = get_time_ns();
+
+    for (uint32_t index = 0; index < ASYNC_WINDOW && run.next < run.ops; ++index)
+    {
+        AsyncChain * chain = new AsyncChain;
+        chain->run = &run;
+        ++run.pending;
+        chain->index = run.next++;
+        async_send_set(chain);
+    }
+
+    /* commands a failed retry drops without a callback are counted as errors */
+    const uint64_t deadline = time_beg + static_cast<uint64_t>(RUN_DEADLINE_MS) * 1000000;
+    while (run.pending > 0 && get_time_ns() < deadline)
+    {
+        /* the loop is the timer that sends commands done with their backoff */
+        int retry_ms = redisClusterAsyncHandleRetries(acc);
+        poll_once(loop, (retry_ms >= 0 && retry_ms < 10) ? retry_ms : 10);
+    }
+    result.errors += run.pending;
+    if (0 != run.pending)
+    {
+        result.tail_successes = 0;
+    }
+
+    result.elapsed_ns = get_time_ns() - time_beg;
+
+    redisClusterAsyncDisconnect(acc);
+    for (uint32_t round = 0; round < 10 && !loop.events.empty(); ++round)
+    {
+        poll_once(loop, 10);
+    }
+    redisClusterAsyncFree(acc);
+    poll_free(loop);
+
+    return (true);
+}
+
+static bool check_result(const Scenario & scenario, const RunResult & result)
+{
+    if (0 != result.mismatches)
+    {
+        return (false);
+    }
+    if (check_clean == scenario.check)
+    {
+        return (0 == result.errors);
+    }
+    return (result.tail_successes >= std::min<uint64_t>(100, result.ops / 10));
+}
+
+static void print_result(const Scenario & scenario, const char * mode, const RunResult & result, const MockNodeStats & stats, bool passed)
+{
+    double seconds = static_cast<double>(result.elapsed_ns) / 1000000000.0;
+    printf("%-12s %-6s %8llu %7llu %7llu %10.0f %9.1f %9.1f %10.1f %7llu %6llu %7llu  %s\n", scenario.name, mode,
+        static_cast<unsigned long long>(result.ops), static_cast<unsigned long long>(result.errors), static_cast<unsigned long long>(result.mismatches),
+        (seconds > 0.0 ? static_cast<double>(result.ops) / seconds : 0.0),
+        static_cast<double>(hihistogram_percentile(result.latency, 50.0)) / 1000.0,
+        static_cast<double>(hihistogram_percentile(result.latency, 99.0)) / 1000.0,
+        static_cast<double>(result.latency->max) / 1000.0,
+        static_cast<unsigned long long>(stats.moved), static_cast<unsigned long long>(stats.ask), static_cast<unsigned long long>(stats.faults),
+        (passed ? "ok" : "FAILED"));
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t ops = (argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], nullptr, 10)) : 20000);
+    uint16_t base_port = (argc > 2 ? static_cast<uint16_t>(strtoul(argv[2], nullptr, 10)) : 0);
+
+    MockCluster mock_cluster;
+    if (!mock_cluster.start(MOCK_NODES, base_port))
+    {
+        std::cout << "start mock cluster failure" << std::endl;
+        return (1);
+    }
+
+    const std::string address = mock_cluster.address();
+
+    printf("%-12s %-6s %8s %7s %7s %10s %9s %9s %10s %7s %6s %7s\n", "scenario", "mode", "ops", "errors", "wrong", "ops/s", "p50 us", "p99 us", "max us", "moved", "ask", "faults");
+
+    int failures = 0;
+    for (size_t index = 0; index < sizeof(s_scenarios) / sizeof(s_scenarios[0]); ++index)
+    {
+        const Scenario & scenario = s_scenarios[index];
+        for (int async = 0; async < 2; ++async)
+        {
+            mock_cluster.reset();
+            scenario.prepare(mock_cluster);
+
+            RunResult result;
+            run_result_init(result);
+            if (nullptr == result.latency)
+            {
+                return (1);
+            }
+
+            bool passed = (0 == async ? run_sync(address, ops, result) : run_async(address, ops, result));
+            passed = passed && check_result(scenario, result);
+            if (!passed)
+            {
+                ++failures;
+            }
+
+            MockNodeStats stats = { 0, 0, 0, 0, 0 };
+            for (uint32_t node = 0; node < MOCK_NODES; ++node)
+            {
+                MockNodeStats node_stats = mock_cluster.node_stats(node);
+                stats.moved += node_stats.moved;
+                stats.ask += node_stats.ask;
+                stats.faults += node_stats.faults;
+            }
+
+            print_result(scenario, (0 == async ? "sync" : "async"), result, stats, passed);
+
+            hihistogram_destroy(result.latency);
+        }
+    }
+
+    mock_cluster.stop();
+
+    return (0 == failures ? 0 : 2);
+}